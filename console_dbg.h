@@ -8,6 +8,9 @@
 // https://os.mbed.com/users/GlimwormBeacons/code/SEGGER_RTT/
 #include "Segger_rtt/SEGGER_RTT.h"
 #define DBG_PRINTF(f_, ...)           SEGGER_RTT_printf(0, (f_), ##__VA_ARGS__)
+#elif defined(MBR_HOST)
+#include <stdio.h>
+#define DBG_PRINTF(f_, ...)           printf((f_), ##__VA_ARGS__)
 #endif
 
 #define g_debugLevel 4
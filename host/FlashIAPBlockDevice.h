@@ -0,0 +1,70 @@
+/** @file FlashIAPBlockDevice.h
+ *  @brief FlashIAPBlockDevice of the host build, a window of the simulated
+ *         internal flash
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_FLASHIAP_BLOCK_DEVICE_H
+#define __HOST_FLASHIAP_BLOCK_DEVICE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef unsigned long long bd_addr_t;
+typedef unsigned long long bd_size_t;
+
+#define BD_ERROR_OK                 0
+#define BD_ERROR_DEVICE_ERROR       SIM_BD_ERROR_DEVICE_ERROR
+
+class FlashIAPBlockDevice
+{
+public:
+    /** @param address start of the window in the internal flash
+     *  @param size size of the window, 0: up to the end of the flash
+     */
+    FlashIAPBlockDevice(uint32_t address = 0, uint32_t size = 0)
+    : _base(address), _size(size) {}
+
+    int init(void)
+    {
+        if (_size == 0)
+        {
+            _size = sim_internal_flash.config().size - _base;
+        }
+        return (_base + (uint64_t)_size <= sim_internal_flash.config().size) ? BD_ERROR_OK : BD_ERROR_DEVICE_ERROR;
+    }
+    int deinit(void) { return BD_ERROR_OK; }
+
+    int read(void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        return valid(addr, size) ? sim_internal_flash.read(buffer, _base + addr, size) : BD_ERROR_DEVICE_ERROR;
+    }
+    int program(const void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        return valid(addr, size) ? sim_internal_flash.program(buffer, _base + addr, size) : BD_ERROR_DEVICE_ERROR;
+    }
+    int erase(bd_addr_t addr, bd_size_t size)
+    {
+        return valid(addr, size) ? sim_internal_flash.erase(_base + addr, size) : BD_ERROR_DEVICE_ERROR;
+    }
+
+    bd_size_t get_read_size() const { return sim_internal_flash.config().read_size; }
+    bd_size_t get_program_size() const { return sim_internal_flash.config().program_size; }
+    bd_size_t get_erase_size() const { return sim_internal_flash.config().erase_size; }
+    bd_size_t get_erase_size(bd_addr_t addr) const { return sim_internal_flash.config().erase_size; }
+    int get_erase_value() const { return 0xFF; }
+    bd_size_t size() const { return _size; }
+    const char *get_type() const { return "FLASHIAP"; }
+
+private:
+    bool valid(bd_addr_t addr, bd_size_t size) const
+    {
+        return addr + size <= _size && addr + size >= addr;
+    }
+
+    uint32_t _base;
+    uint32_t _size;
+};
+
+#endif /* __HOST_FLASHIAP_BLOCK_DEVICE_H */
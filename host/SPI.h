@@ -0,0 +1,12 @@
+/** @file SPI.h
+ *  @brief SPI of the host build, nothing to drive: the SPI NOR is simulated
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_SPI_H
+#define __HOST_SPI_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+#endif /* __HOST_SPI_H */
@@ -0,0 +1,58 @@
+/** @file SPIFBlockDevice.h
+ *  @brief SPIFBlockDevice of the host build, the simulated SPI NOR
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_SPIF_BLOCK_DEVICE_H
+#define __HOST_SPIF_BLOCK_DEVICE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "FlashIAPBlockDevice.h"
+
+/* Exported types ------------------------------------------------------------*/
+enum spif_bd_error {
+    SPIF_BD_ERROR_OK                    = 0,
+    SPIF_BD_ERROR_DEVICE_ERROR          = BD_ERROR_DEVICE_ERROR,
+    SPIF_BD_ERROR_PARSING_FAILED        = -4002,
+    SPIF_BD_ERROR_READY_FAILED          = -4003,
+    SPIF_BD_ERROR_WREN_FAILED           = -4004,
+    SPIF_BD_ERROR_INVALID_ERASE_PARAMS  = -4005,
+};
+
+class SPIFBlockDevice
+{
+public:
+    /** The pins and the frequency are ignored, the bus timing is the one of
+     *  sim_external_flash
+     */
+    SPIFBlockDevice(PinName mosi = NC, PinName miso = NC, PinName sclk = NC, PinName csel = NC,
+                    int freq = 40000000) {}
+
+    int init(void) { return sim_external_flash.data() ? SPIF_BD_ERROR_OK : SPIF_BD_ERROR_DEVICE_ERROR; }
+    int deinit(void) { return SPIF_BD_ERROR_OK; }
+
+    int read(void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        return sim_external_flash.read(buffer, addr, size);
+    }
+    int program(const void *buffer, bd_addr_t addr, bd_size_t size)
+    {
+        return sim_external_flash.program(buffer, addr, size);
+    }
+    int erase(bd_addr_t addr, bd_size_t size)
+    {
+        int status = sim_external_flash.erase(addr, size);
+        return (status == SPIF_BD_ERROR_OK) ? status : SPIF_BD_ERROR_INVALID_ERASE_PARAMS;
+    }
+
+    bd_size_t get_read_size() const { return sim_external_flash.config().read_size; }
+    bd_size_t get_program_size() const { return sim_external_flash.config().program_size; }
+    bd_size_t get_erase_size() const { return sim_external_flash.config().erase_size; }
+    bd_size_t get_erase_size(bd_addr_t addr) const { return sim_external_flash.config().erase_size; }
+    int get_erase_value() const { return 0xFF; }
+    bd_size_t size() const { return sim_external_flash.config().size; }
+    const char *get_type() const { return "SPIF"; }
+};
+
+#endif /* __HOST_SPIF_BLOCK_DEVICE_H */
@@ -0,0 +1,87 @@
+/** @file crc_bench.c
+ *  @brief CRC32 throughput of one engine of lib/tools/util_crc32.c, the
+ *         Makefile builds it once per CRC32_TABLE_SLICES (0 is the
+ *         bit-serial loop the table engines replace), JSON line
+ *
+ *    crc_bench_N [-s SECONDS]
+ *
+ *  The buffer is the size of the main partition, the checksum of it and
+ *  the check value of "123456789" must be the same for every engine.
+ *  Host CPU time: compare the engines against each other, not the target.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "util_crc32.h"
+
+/* Private define ------------------------------------------------------------*/
+#define CRC_BENCH_SIZE      (636U * 1024U)
+/** CRC-32/ISO-HDLC check value */
+#define CRC_BENCH_CHECK     0xCBF43926UL
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t s_buffer[CRC_BENCH_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = 0.5;
+    double start;
+    double elapsed;
+    uint64_t bytes = 0;
+    uint32_t x = 1;
+    uint32_t check;
+    uint32_t crc = 0;
+    uint32_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        if ('s' == opt)
+        {
+            seconds = atof(optarg);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-s SECONDS]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* xorshift32, the same content for every engine */
+    for (i = 0; i < CRC_BENCH_SIZE; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        s_buffer[i] = (uint8_t)x;
+    }
+
+    check = Crc32_CalculateBuffer((const uint8_t *)"123456789", 9);
+    start = now();
+    do
+    {
+        crc = Crc32_CalculateBuffer(s_buffer, CRC_BENCH_SIZE);
+        bytes += CRC_BENCH_SIZE;
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+
+    printf("{\"bench\": \"crc32\", \"slices\": %u, \"bytes\": %llu, \"mb_s\": %.1f, "
+           "\"crc\": \"0x%08X\", \"check\": \"0x%08X\", \"ok\": %s}\n",
+           (unsigned)CRC32_TABLE_SLICES, (unsigned long long)bytes,
+           (double)bytes / elapsed / 1e6, crc, check,
+           CRC_BENCH_CHECK == check ? "true" : "false");
+    return CRC_BENCH_CHECK == check ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+/** @file crypto_test.cpp
+ *  @brief Known-answer tests of lib/tools/AES and AES_CMAC, the Makefile
+ *         builds it once per AES_IMPLEMENTATION, all of them must pass the
+ *         same vectors
+ *
+ *    crypto_test_N [-p [-s SECONDS]]
+ *
+ *  -p: throughput of the rounds instead, JSON line. Host CPU time, compare
+ *  the implementations against each other, not the target.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "AES.h"
+#include "AES_CMAC.h"
+#include <chrono>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define CRYPTO_BENCH_SIZE   4096U
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    const char *name;
+    bool (*run)(void);
+} crypto_test_t;
+
+/* Private variables ---------------------------------------------------------*/
+/** FIPS-197 appendix C.1 */
+static const uint8_t s_fips_key[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+static const uint8_t s_fips_plain[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+    0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF};
+static const uint8_t s_fips_cipher[16] = {
+    0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+    0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+
+/** NIST SP 800-38A appendix F, AES-128 */
+static const uint8_t s_sp_key[16] = {
+    0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+    0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+static const uint8_t s_sp_plain[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+    0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+    0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+    0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+/** F.1.1 ECB-AES128.Encrypt */
+static const uint8_t s_sp_ecb[64] = {
+    0x3A, 0xD7, 0x7B, 0xB4, 0x0D, 0x7A, 0x36, 0x60, 0xA8, 0x9E, 0xCA, 0xF3, 0x24, 0x66, 0xEF, 0x97,
+    0xF5, 0xD3, 0xD5, 0x85, 0x03, 0xB9, 0x69, 0x9D, 0xE7, 0x85, 0x89, 0x5A, 0x96, 0xFD, 0xBA, 0xAF,
+    0x43, 0xB1, 0xCD, 0x7F, 0x59, 0x8E, 0xCE, 0x23, 0x88, 0x1B, 0x00, 0xE3, 0xED, 0x03, 0x06, 0x88,
+    0x7B, 0x0C, 0x78, 0x5E, 0x27, 0xE8, 0xAD, 0x3F, 0x82, 0x23, 0x20, 0x71, 0x04, 0x72, 0x5D, 0xD4};
+/** F.2.1 CBC-AES128.Encrypt */
+static const uint8_t s_sp_cbc_iv[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+    0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+static const uint8_t s_sp_cbc[64] = {
+    0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E, 0x9B, 0x12, 0xE9, 0x19, 0x7D,
+    0x50, 0x86, 0xCB, 0x9B, 0x50, 0x72, 0x19, 0xEE, 0x95, 0xDB, 0x11, 0x3A, 0x91, 0x76, 0x78, 0xB2,
+    0x73, 0xBE, 0xD6, 0xB8, 0xE3, 0xC1, 0x74, 0x3B, 0x71, 0x16, 0xE6, 0x9E, 0x22, 0x22, 0x95, 0x16,
+    0x3F, 0xF1, 0xCA, 0xA1, 0x68, 0x1F, 0xAC, 0x09, 0x12, 0x0E, 0xCA, 0x30, 0x75, 0x86, 0xE1, 0xA7};
+
+/** F.5.1 CTR-AES128.Encrypt */
+static const uint8_t s_sp_ctr_iv[16] = {
+    0xF0, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7,
+    0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF};
+static const uint8_t s_sp_ctr[64] = {
+    0x87, 0x4D, 0x61, 0x91, 0xB6, 0x20, 0xE3, 0x26, 0x1B, 0xEF, 0x68, 0x64, 0x99, 0x0D, 0xB6, 0xCE,
+    0x98, 0x06, 0xF6, 0x6B, 0x79, 0x70, 0xFD, 0xFF, 0x86, 0x17, 0x18, 0x7B, 0xB9, 0xFF, 0xFD, 0xFF,
+    0x5A, 0xE4, 0xDF, 0x3E, 0xDB, 0xD5, 0xD3, 0x5E, 0x5B, 0x4F, 0x09, 0x02, 0x0D, 0xB0, 0x3E, 0xAB,
+    0x1E, 0x03, 0x1D, 0xDA, 0x2F, 0xBE, 0x03, 0xD1, 0x79, 0x21, 0x70, 0xA0, 0xF3, 0x00, 0x9C, 0xEE};
+
+/** RFC 4493 section 4, the SP 800-38A key and plaintext */
+static const struct
+{
+    uint32_t length;
+    uint8_t mac[AES_CMAC_LENGTH];
+} s_rfc_cmac[] = {
+    {0,  {0xBB, 0x1D, 0x69, 0x29, 0xE9, 0x59, 0x37, 0x28, 0x7F, 0xA3, 0x7D, 0x12, 0x9B, 0x75, 0x67, 0x46}},
+    {16, {0x07, 0x0A, 0x16, 0xB4, 0x6B, 0x4D, 0x41, 0x44, 0xF7, 0x9B, 0xDD, 0x9D, 0xD0, 0x4A, 0x28, 0x7C}},
+    {40, {0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27}},
+    {64, {0x51, 0xF0, 0xBE, 0xBF, 0x7E, 0x3B, 0x9D, 0x92, 0xFC, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3C, 0xFE}},
+};
+
+static uint8_t s_buffer[CRYPTO_BENCH_SIZE];
+
+/* Private functions ---------------------------------------------------------*/
+static bool same(const void *data, const void *expected, size_t length)
+{
+    return 0 == memcmp(data, expected, length);
+}
+
+static bool testFips197(void)
+{
+    AES aes((const char *)s_fips_key, AES::KEY_128, AES::MODE_ECB);
+    uint8_t block[16];
+
+    memcpy(block, s_fips_plain, sizeof(block));
+    aes.encrypt(block, sizeof(block));
+    if (!same(block, s_fips_cipher, sizeof(block)))
+    {
+        return false;
+    }
+    aes.decrypt(block, sizeof(block));
+    return same(block, s_fips_plain, sizeof(block));
+}
+
+static bool testEcb(void)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_ECB);
+    uint8_t data[64];
+
+    memcpy(data, s_sp_plain, sizeof(data));
+    aes.encrypt(data, sizeof(data));
+    if (!same(data, s_sp_ecb, sizeof(data)))
+    {
+        return false;
+    }
+    aes.decrypt(data, sizeof(data));
+    return same(data, s_sp_plain, sizeof(data));
+}
+
+static bool testCbc(void)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_CBC, (const char *)s_sp_cbc_iv);
+    uint8_t data[64];
+
+    memcpy(data, s_sp_plain, sizeof(data));
+    aes.encrypt(data, sizeof(data));
+    if (!same(data, s_sp_cbc, sizeof(data)))
+    {
+        return false;
+    }
+    aes.setIV((const char *)s_sp_cbc_iv);
+    aes.decrypt(data, sizeof(data));
+    return same(data, s_sp_plain, sizeof(data));
+}
+
+/** @brief the copy loops decrypt an image chunk by chunk, the chain
+ *         carries over from one call to the next
+ */
+static bool testCbcChunks(void)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_CBC, (const char *)s_sp_cbc_iv);
+    uint8_t data[64];
+    char iv[16];
+    uint32_t offset;
+
+    memcpy(data, s_sp_cbc, sizeof(data));
+    for (offset = 0; offset < sizeof(data); offset += 16)
+    {
+        aes.decrypt(&data[offset], 16);
+    }
+    if (!same(data, s_sp_plain, sizeof(data)))
+    {
+        return false;
+    }
+    /* Restart at the third block from the chain vector */
+    aes.setIV((const char *)&s_sp_cbc[16]);
+    memcpy(data, &s_sp_cbc[32], 32);
+    aes.decrypt(data, 32);
+    aes.getIV(iv);
+    return same(data, &s_sp_plain[32], 32) && same(iv, &s_sp_cbc[48], 16);
+}
+
+static bool testCtr(void)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_CTR, (const char *)s_sp_ctr_iv);
+    uint8_t data[64];
+
+    memcpy(data, s_sp_plain, sizeof(data));
+    aes.encrypt(data, sizeof(data));
+    if (!same(data, s_sp_ctr, sizeof(data)))
+    {
+        return false;
+    }
+    aes.seek(0);
+    aes.decrypt(data, sizeof(data));
+    return same(data, s_sp_plain, sizeof(data));
+}
+
+/** @brief the delta base and the chunk repair decrypt at any offset */
+static bool testCtrSeek(void)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_CTR, (const char *)s_sp_ctr_iv);
+    uint8_t data[64];
+
+    memcpy(data, &s_sp_ctr[37], 20);
+    aes.seek(37);
+    aes.decrypt(data, 20);
+    if (!same(data, &s_sp_plain[37], 20))
+    {
+        return false;
+    }
+    /* Odd lengths continue the keystream */
+    memcpy(data, s_sp_ctr, sizeof(data));
+    aes.seek(0);
+    aes.decrypt(data, 5);
+    aes.decrypt(&data[5], 30);
+    aes.decrypt(&data[35], 29);
+    return same(data, s_sp_plain, sizeof(data));
+}
+
+static bool testCmac(void)
+{
+    AESCMAC cmac;
+    char mac[AES_CMAC_LENGTH];
+    uint32_t i;
+
+    cmac.setup((const char *)s_sp_key, AES::KEY_128);
+    for (i = 0; i < sizeof(s_rfc_cmac) / sizeof(s_rfc_cmac[0]); i++)
+    {
+        cmac.reset();
+        cmac.update(s_sp_plain, s_rfc_cmac[i].length);
+        cmac.finish(mac);
+        if (!same(mac, s_rfc_cmac[i].mac, AES_CMAC_LENGTH)
+        || !AESCMAC::equal(mac, s_rfc_cmac[i].mac))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @brief the image tag is updated block by block while it is read */
+static bool testCmacStream(void)
+{
+    AESCMAC cmac;
+    char mac[AES_CMAC_LENGTH];
+    uint8_t other[AES_CMAC_LENGTH];
+
+    cmac.setup((const char *)s_sp_key, AES::KEY_128);
+    cmac.update(s_sp_plain, 7);
+    cmac.update(&s_sp_plain[7], 16);
+    cmac.update(&s_sp_plain[23], 0);
+    cmac.update(&s_sp_plain[23], 17);
+    cmac.finish(mac);
+    if (!same(mac, s_rfc_cmac[2].mac, AES_CMAC_LENGTH))
+    {
+        return false;
+    }
+    memcpy(other, mac, sizeof(other));
+    other[AES_CMAC_LENGTH - 1] ^= 0x01;
+    return !AESCMAC::equal(mac, other);
+}
+
+static const crypto_test_t s_tests[] = {
+    {"aes128_fips197", testFips197},
+    {"aes128_ecb_sp800_38a", testEcb},
+    {"aes128_cbc_sp800_38a", testCbc},
+    {"aes128_cbc_chunks", testCbcChunks},
+    {"aes128_ctr_sp800_38a", testCtr},
+    {"aes128_ctr_seek", testCtrSeek},
+    {"aes128_cmac_rfc4493", testCmac},
+    {"aes128_cmac_stream", testCmacStream},
+};
+
+static double now(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** @brief MB/s of one direction of CBC over a 4K block */
+static double throughput(bool decrypt, double seconds)
+{
+    AES aes((const char *)s_sp_key, AES::KEY_128, AES::MODE_CBC, (const char *)s_sp_cbc_iv);
+    uint64_t bytes = 0;
+    double start = now();
+    double elapsed;
+
+    do
+    {
+        if (decrypt)
+        {
+            aes.decrypt(s_buffer, sizeof(s_buffer));
+        }
+        else
+        {
+            aes.encrypt(s_buffer, sizeof(s_buffer));
+        }
+        bytes += sizeof(s_buffer);
+        elapsed = now() - start;
+    } while (elapsed < seconds);
+    return (double)bytes / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    double seconds = 0.5;
+    bool perf = false;
+    uint32_t failed = 0;
+    uint32_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ps:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            perf = true;
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p [-s SECONDS]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    for (i = 0; i < sizeof(s_tests) / sizeof(s_tests[0]); i++)
+    {
+        if (!s_tests[i].run())
+        {
+            fprintf(stderr, "AES_IMPLEMENTATION %u: %s FAIL\n", (unsigned)AES_IMPLEMENTATION, s_tests[i].name);
+            failed++;
+        }
+        else if (!perf)
+        {
+            printf("AES_IMPLEMENTATION %u: %s ok\n", (unsigned)AES_IMPLEMENTATION, s_tests[i].name);
+        }
+    }
+
+    if (perf)
+    {
+        printf("{\"bench\": \"aes128\", \"implementation\": %u, \"backend\": \"%s\", "
+               "\"cbc_encrypt_mb_s\": %.1f, \"cbc_decrypt_mb_s\": %.1f, \"ok\": %s}\n",
+               (unsigned)AES_IMPLEMENTATION, CRYPTO_BACKEND_NAME,
+               throughput(false, seconds), throughput(true, seconds),
+               failed ? "false" : "true");
+    }
+    return failed ? 1 : 0;
+}
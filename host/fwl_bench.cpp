@@ -0,0 +1,280 @@
+/** @file fwl_bench.cpp
+ *  @brief Cost of FlashWearLevellingUtils::begin() against the number of
+ *         records in the region, the MBR params region (8K, 2 pages,
+ *         mbr_info_t records). JSON line per layout
+ *
+ *    fwl_bench_N [-d DATA_LENGTH]
+ *
+ *  The Makefile builds it once per FWL_SLOT_LOCATOR. "legacy" is a region
+ *  written before the page ring: with FWL_SLOT_LOCATOR 0 it is walked
+ *  record by record (scanLastHeader, the locator the ring replaced), with 1
+ *  the slots are searched (findLastSlot). "ring" is the page ring.
+ *  The reads, read bytes and CRC32 bytes are counted up to the first write
+ *  or erase: the migration of a legacy region adds the read of the last
+ *  record and of a page header to its scan.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "mbr.h"
+#include "FlashWearLevellingUtils.h"
+#include "util_crc32.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define FWL_BENCH_REGION_SIZE   MASTER_BOOT_PARAMS_REGION_SIZE
+#define FWL_BENCH_PAGE_SIZE     4096U
+#define FWL_BENCH_HEADER_LENGTH 16U
+#define FWL_BENCH_TYPE          0xAA55U
+#define FWL_BENCH_RECORDS_MAX   64U
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    uint32_t reads;
+    uint32_t read_bytes;
+    uint32_t crc_bytes;
+} fwl_cost_t;
+
+/** Region in RAM with NOR rules, counts the scan */
+class BenchFlash : public FlashWearLevellingCallbacks
+{
+public:
+    bool onRead(uint32_t addr, uint8_t *buff, uint16_t *length)
+    {
+        if (addr + *length > FWL_BENCH_REGION_SIZE)
+        {
+            return false;
+        }
+        memcpy(buff, &data[addr], *length);
+        if (counting)
+        {
+            cost.reads++;
+            cost.read_bytes += *length;
+        }
+        return true;
+    }
+    bool onWrite(uint32_t addr, uint8_t *buff, uint16_t *length)
+    {
+        uint16_t i;
+
+        if (addr + *length > FWL_BENCH_REGION_SIZE)
+        {
+            return false;
+        }
+        counting = false;
+        for (i = 0; i < *length; i++)
+        {
+            data[addr + i] &= buff[i];
+        }
+        return true;
+    }
+    bool onErase(uint32_t addr, uint16_t length)
+    {
+        if (addr + length > FWL_BENCH_REGION_SIZE)
+        {
+            return false;
+        }
+        counting = false;
+        memset(&data[addr], 0xFF, length);
+        return true;
+    }
+
+    uint8_t data[FWL_BENCH_REGION_SIZE];
+    fwl_cost_t cost;
+    bool counting;
+};
+
+/* Private variables ---------------------------------------------------------*/
+static BenchFlash s_flash;
+
+/* Private functions ---------------------------------------------------------*/
+extern "C" {
+void __real_CRC32_Update(crc32_ctx_t *ctx, const uint8_t *buffer, uint32_t length);
+
+void __wrap_CRC32_Update(crc32_ctx_t *ctx, const uint8_t *buffer, uint32_t length)
+{
+    if (s_flash.counting)
+    {
+        s_flash.cost.crc_bytes += length;
+    }
+    __real_CRC32_Update(ctx, buffer, length);
+}
+} // extern "C"
+
+/** @brief cost of begin() on the content of s_flash */
+static bool scan(uint16_t data_length, fwl_cost_t *cost)
+{
+    FlashWearLevellingUtils fwl(0, FWL_BENCH_REGION_SIZE, FWL_BENCH_PAGE_SIZE, data_length);
+    bool status_isOK;
+
+    fwl.setCallbacks(&s_flash);
+    memset(&s_flash.cost, 0, sizeof(fwl_cost_t));
+    s_flash.counting = true;
+    status_isOK = fwl.begin(false);
+    s_flash.counting = false;
+    *cost = s_flash.cost;
+    return status_isOK;
+}
+
+/** @brief record of the legacy layout in slot i */
+static void putLegacy(uint16_t data_length, uint32_t i, uint8_t fill)
+{
+    uint8_t record[FWL_BENCH_HEADER_LENGTH + FWL_DATA_LENGTH_MAX];
+    uint32_t slot_size = FWL_BENCH_HEADER_LENGTH + data_length;
+    uint32_t addr = i * slot_size;
+    uint32_t header[4];
+    crc32_ctx_t ctx;
+
+    header[1] = addr + slot_size;                           /* nextAddr */
+    header[2] = i ? addr - slot_size : 0;                   /* prevAddr */
+    header[3] = data_length | (FWL_BENCH_TYPE << 16);       /* dataLength, type */
+    memset(&record[FWL_BENCH_HEADER_LENGTH], fill, data_length);
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (const uint8_t *)&header[1], 12U);
+    CRC32_Update(&ctx, &record[FWL_BENCH_HEADER_LENGTH], data_length);
+    header[0] = CRC32_Final(&ctx);
+    memcpy(record, header, sizeof(header));
+    memcpy(&s_flash.data[addr], record, slot_size);
+}
+
+/** @brief region of the legacy layout: a full lap of records, then the
+ *         first records of the next lap, each page erased when the lap
+ *         enters it
+ */
+static void fillLegacy(uint16_t data_length, uint32_t records)
+{
+    uint32_t slot_size = FWL_BENCH_HEADER_LENGTH + data_length;
+    uint32_t slot_num = FWL_BENCH_REGION_SIZE / slot_size;
+    uint32_t erased_end = 0;
+    uint32_t end;
+    uint32_t i;
+
+    memset(s_flash.data, 0xFF, sizeof(s_flash.data));
+    for (i = 0; i < slot_num; i++)
+    {
+        putLegacy(data_length, i, (uint8_t)(0x80 | i));
+    }
+    for (i = 0; i < records; i++)
+    {
+        end = (i + 1) * slot_size;
+        while (erased_end < end)
+        {
+            memset(&s_flash.data[erased_end], 0xFF, FWL_BENCH_PAGE_SIZE);
+            erased_end += FWL_BENCH_PAGE_SIZE;
+        }
+        putLegacy(data_length, i, (uint8_t)i);
+    }
+}
+
+static void printSeries(const char *layout, const uint32_t *records, const fwl_cost_t *costs, uint32_t num, bool ok)
+{
+    uint32_t i;
+
+    printf("{\"bench\": \"fwl\", \"slot_locator\": %u, \"layout\": \"%s\", \"records\": [",
+           (unsigned)FWL_SLOT_LOCATOR, layout);
+    for (i = 0; i < num; i++)
+    {
+        printf("%s%u", i ? ", " : "", records[i]);
+    }
+    printf("], \"reads\": [");
+    for (i = 0; i < num; i++)
+    {
+        printf("%s%u", i ? ", " : "", costs[i].reads);
+    }
+    printf("], \"read_bytes\": [");
+    for (i = 0; i < num; i++)
+    {
+        printf("%s%u", i ? ", " : "", costs[i].read_bytes);
+    }
+    printf("], \"crc_bytes\": [");
+    for (i = 0; i < num; i++)
+    {
+        printf("%s%u", i ? ", " : "", costs[i].crc_bytes);
+    }
+    printf("], \"ok\": %s}\n", ok ? "true" : "false");
+}
+
+/** @brief the legacy region with 1 to all its slots of the current lap */
+static bool benchLegacy(uint16_t data_length)
+{
+    uint32_t records[FWL_BENCH_RECORDS_MAX];
+    fwl_cost_t costs[FWL_BENCH_RECORDS_MAX];
+    uint32_t slot_num = FWL_BENCH_REGION_SIZE / (FWL_BENCH_HEADER_LENGTH + data_length);
+    uint32_t num = 0;
+    uint32_t n;
+    bool status_isOK = true;
+
+    for (n = 1; n <= slot_num && num < FWL_BENCH_RECORDS_MAX; n++)
+    {
+        fillLegacy(data_length, n);
+        records[num] = n;
+        status_isOK = scan(data_length, &costs[num]) && status_isOK;
+        num++;
+    }
+    printSeries("legacy", records, costs, num, status_isOK);
+    return status_isOK;
+}
+
+#if defined(FWL_SLOT_LOCATOR) && (FWL_SLOT_LOCATOR == 1)
+/** @brief the ring filled one record after the other, over both pages */
+static bool benchRing(uint16_t data_length)
+{
+    FlashWearLevellingUtils fwl(0, FWL_BENCH_REGION_SIZE, FWL_BENCH_PAGE_SIZE, data_length);
+    uint8_t data[FWL_DATA_LENGTH_MAX];
+    uint32_t records[FWL_BENCH_RECORDS_MAX];
+    fwl_cost_t costs[FWL_BENCH_RECORDS_MAX];
+    uint32_t per_page = (FWL_BENCH_PAGE_SIZE - FWL_BENCH_HEADER_LENGTH) / (FWL_BENCH_HEADER_LENGTH + data_length);
+    uint32_t num = 0;
+    uint32_t n;
+    uint16_t length;
+    bool status_isOK;
+
+    memset(s_flash.data, 0xFF, sizeof(s_flash.data));
+    fwl.setCallbacks(&s_flash);
+    status_isOK = fwl.begin(true);
+    for (n = 1; status_isOK && n <= 2 * per_page && num < FWL_BENCH_RECORDS_MAX; n++)
+    {
+        memset(data, (uint8_t)n, data_length);
+        length = data_length;
+        status_isOK = fwl.write(data, &length);
+        records[num] = n;
+        status_isOK = scan(data_length, &costs[num]) && status_isOK;
+        num++;
+    }
+    printSeries("ring", records, costs, num, status_isOK);
+    return status_isOK;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    uint16_t data_length = sizeof(mbr_info_t);
+    bool status_isOK;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1)
+    {
+        if ('d' == opt)
+        {
+            data_length = (uint16_t)strtoul(optarg, nullptr, 0);
+        }
+        else
+        {
+            fprintf(stderr, "usage: %s [-d DATA_LENGTH]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (0 == data_length || data_length > FWL_DATA_LENGTH_MAX)
+    {
+        fprintf(stderr, "data length 1..%u\n", FWL_DATA_LENGTH_MAX);
+        return 2;
+    }
+
+    status_isOK = benchLegacy(data_length);
+#if defined(FWL_SLOT_LOCATOR) && (FWL_SLOT_LOCATOR == 1)
+    status_isOK = benchRing(data_length) && status_isOK;
+#endif
+    return status_isOK ? 0 : 1;
+}
@@ -0,0 +1,399 @@
+/** @file fwl_test.cpp
+ *  @brief Power failure tests of FlashWearLevellingUtils on the MBR params
+ *         region (8K, 2 pages, mbr_info_t records, the general headers
+ *         reserved at the end) in RAM with NOR rules. The Makefile builds it
+ *         once per FWL_SLOT_LOCATOR
+ *
+ *    fwl_test_N
+ *
+ *  A scenario runs once to count its programs and erases, then once per
+ *  operation with the power cut there, twice: the operation doesn't happen,
+ *  or it is torn (the first half of the bytes programmed or erased). The
+ *  region is begun again without a cut, it must hold the record written
+ *  before the cut or the one being written.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "mbr.h"
+#include "FlashWearLevellingUtils.h"
+#include "util_crc32.h"
+#include <stdlib.h>
+
+/* Private define ------------------------------------------------------------*/
+#define FWL_TEST_REGION_SIZE    MASTER_BOOT_PARAMS_REGION_SIZE
+#define FWL_TEST_PAGE_SIZE      4096U
+#define FWL_TEST_DATA_LENGTH    ((uint16_t)sizeof(mbr_info_t))
+#define FWL_TEST_RESERVED       MBR_PARAMS_RESERVED_LENGTH
+#define FWL_TEST_HEADER_LENGTH  16U
+#define FWL_TEST_TYPE           0xAA55U
+#define FWL_TEST_SLOT_SIZE      (FWL_TEST_HEADER_LENGTH + FWL_TEST_DATA_LENGTH)
+#define FWL_TEST_SLOT_NUM       ((FWL_TEST_REGION_SIZE - FWL_TEST_RESERVED) / FWL_TEST_SLOT_SIZE)
+#define FWL_TEST_NO_CUT         0xFFFFFFFFUL
+/* Two laps of the ring, each page erased once at least */
+#define FWL_TEST_RING_BOOTS     64U
+/* Boots after the cut */
+#define FWL_TEST_RING_RESUME    3U
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    const char *name;
+    bool (*run)(void);
+} fwl_test_t;
+
+/** Thrown by the region at the operation of the cut */
+struct fwl_power_cut
+{
+};
+
+/** Region in RAM with NOR rules, the power is cut at an operation */
+class TestFlash : public FlashWearLevellingCallbacks
+{
+public:
+    bool onRead(uint32_t addr, uint8_t *buff, uint16_t *length)
+    {
+        if (addr + *length > FWL_TEST_REGION_SIZE)
+        {
+            return false;
+        }
+        memcpy(buff, &data[addr], *length);
+        return true;
+    }
+    bool onWrite(uint32_t addr, uint8_t *buff, uint16_t *length)
+    {
+        uint16_t done;
+        uint16_t i;
+
+        if (addr + *length > FWL_TEST_REGION_SIZE)
+        {
+            return false;
+        }
+        done = power(*length);
+        for (i = 0; i < done; i++)
+        {
+            data[addr + i] &= buff[i];
+        }
+        if (done != *length)
+        {
+            throw fwl_power_cut();
+        }
+        return true;
+    }
+    bool onErase(uint32_t addr, uint16_t length)
+    {
+        uint16_t done;
+
+        if (addr + length > FWL_TEST_REGION_SIZE)
+        {
+            return false;
+        }
+        done = power(length);
+        memset(&data[addr], 0xFF, done);
+        if (done != length)
+        {
+            throw fwl_power_cut();
+        }
+        return true;
+    }
+
+    /** Cut the power at operation cut (0 is the first one), torn or not */
+    void arm(uint32_t at, bool is_torn)
+    {
+        ops = 0;
+        cut = at;
+        torn = is_torn;
+    }
+
+    uint8_t data[FWL_TEST_REGION_SIZE];
+    uint32_t ops;
+
+private:
+    /** @brief bytes of the operation done before the power fails */
+    uint16_t power(uint16_t length)
+    {
+        if (ops++ != cut)
+        {
+            return length;
+        }
+        cut = FWL_TEST_NO_CUT;
+        return torn ? length / 2 : 0;
+    }
+
+    uint32_t cut;
+    bool torn;
+};
+
+/* Private variables ---------------------------------------------------------*/
+static TestFlash s_flash;
+static uint32_t s_boot;
+
+/* Private functions ---------------------------------------------------------*/
+/** @brief record of the legacy layout in slot i */
+static void putLegacy(uint32_t i, uint8_t fill)
+{
+    uint8_t record[FWL_TEST_SLOT_SIZE];
+    uint32_t addr = i * FWL_TEST_SLOT_SIZE;
+    uint32_t header[4];
+    crc32_ctx_t ctx;
+
+    header[1] = addr + FWL_TEST_SLOT_SIZE;                      /* nextAddr */
+    header[2] = i ? addr - FWL_TEST_SLOT_SIZE : 0;              /* prevAddr */
+    header[3] = FWL_TEST_DATA_LENGTH | (FWL_TEST_TYPE << 16);   /* dataLength, type */
+    memset(&record[FWL_TEST_HEADER_LENGTH], fill, FWL_TEST_DATA_LENGTH);
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (const uint8_t *)&header[1], 12U);
+    CRC32_Update(&ctx, &record[FWL_TEST_HEADER_LENGTH], FWL_TEST_DATA_LENGTH);
+    header[0] = CRC32_Final(&ctx);
+    memcpy(record, header, sizeof(header));
+    memcpy(&s_flash.data[addr], record, FWL_TEST_SLOT_SIZE);
+}
+
+/** @brief general headers at the end of the region */
+static void putReserved(void)
+{
+    for (uint32_t i = 0; i < FWL_TEST_RESERVED; i++)
+    {
+        s_flash.data[FWL_TEST_REGION_SIZE - FWL_TEST_RESERVED + i] = (uint8_t)(0x5A ^ i);
+    }
+}
+
+static bool reservedIsKept(void)
+{
+    for (uint32_t i = 0; i < FWL_TEST_RESERVED; i++)
+    {
+        if (s_flash.data[FWL_TEST_REGION_SIZE - FWL_TEST_RESERVED + i] != (uint8_t)(0x5A ^ i))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @brief region of the legacy layout with the general headers: records
+ *         of the current lap, after a full lap when laps is 2, each page
+ *         erased when the lap enters it
+ */
+static void fillLegacy(uint32_t laps, uint32_t records)
+{
+    uint32_t erased_end = 0;
+    uint32_t end;
+    uint32_t i;
+
+    memset(s_flash.data, 0xFF, sizeof(s_flash.data));
+    for (i = 0; (laps > 1) && (i < FWL_TEST_SLOT_NUM); i++)
+    {
+        putLegacy(i, (uint8_t)(0x80 | i));
+    }
+    for (i = 0; i < records; i++)
+    {
+        end = (i + 1) * FWL_TEST_SLOT_SIZE;
+        while (erased_end < end)
+        {
+            memset(&s_flash.data[erased_end], 0xFF, FWL_TEST_PAGE_SIZE - ((erased_end + FWL_TEST_PAGE_SIZE == FWL_TEST_REGION_SIZE) ? FWL_TEST_RESERVED : 0));
+            erased_end += FWL_TEST_PAGE_SIZE;
+        }
+        putLegacy(i, (uint8_t)i);
+    }
+    putReserved();
+}
+
+/** @brief begin the region and read its newest record, no cut */
+static bool readBack(uint8_t *data)
+{
+    FlashWearLevellingUtils fwl(0, FWL_TEST_REGION_SIZE, FWL_TEST_PAGE_SIZE, FWL_TEST_DATA_LENGTH, FWL_TEST_RESERVED);
+    uint16_t length = FWL_TEST_DATA_LENGTH;
+
+    fwl.setCallbacks(&s_flash);
+    s_flash.arm(FWL_TEST_NO_CUT, false);
+    return fwl.begin(false) && fwl.read(data, &length) && (FWL_TEST_DATA_LENGTH == length);
+}
+
+static bool isFilled(const uint8_t *data, uint8_t fill)
+{
+    for (uint16_t i = 0; i < FWL_TEST_DATA_LENGTH; i++)
+    {
+        if (data[i] != fill)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** @brief the migration of every legacy region, cut at each operation:
+ *         the last legacy record is found again and moved into the ring
+ */
+static bool testMigration(void)
+{
+    uint8_t data[FWL_TEST_DATA_LENGTH];
+    uint32_t laps;
+    uint32_t records;
+    uint32_t ops;
+    uint32_t cut;
+    uint32_t torn;
+    bool status_isOK = true;
+
+    for (laps = 1; laps <= 2; laps++)
+    {
+        for (records = 1; records <= FWL_TEST_SLOT_NUM; records++)
+        {
+            fillLegacy(laps, records);
+            if (!readBack(data))
+            {
+                fprintf(stderr, "migration: lap %u, %u records: no migration\n", laps, records);
+                return false;
+            }
+            ops = s_flash.ops;
+
+            for (cut = 0; cut < ops; cut++)
+            {
+                for (torn = 0; torn < 2; torn++)
+                {
+                    fillLegacy(laps, records);
+                    s_flash.arm(cut, torn);
+                    try
+                    {
+                        FlashWearLevellingUtils fwl(0, FWL_TEST_REGION_SIZE, FWL_TEST_PAGE_SIZE, FWL_TEST_DATA_LENGTH, FWL_TEST_RESERVED);
+
+                        fwl.setCallbacks(&s_flash);
+                        fwl.begin(false);
+                    }
+                    catch (const fwl_power_cut &)
+                    {
+                    }
+
+                    if (!readBack(data) || !isFilled(data, (uint8_t)(records - 1)))
+                    {
+                        fprintf(stderr, "migration: lap %u, %u records, cut at op %u%s: record lost\n",
+                                laps, records, cut, torn ? " (torn)" : "");
+                        status_isOK = false;
+                    }
+                    if (!reservedIsKept())
+                    {
+                        fprintf(stderr, "migration: lap %u, %u records, cut at op %u%s: reserved bytes lost\n",
+                                laps, records, cut, torn ? " (torn)" : "");
+                        status_isOK = false;
+                    }
+                }
+            }
+        }
+    }
+    return status_isOK;
+}
+
+/** @brief boots from first to last, each one begins the region like the
+ *         MBR, prepares the next page every third boot and writes a record
+ *         filled with the boot number
+ */
+static void runBoots(uint32_t first, uint32_t last)
+{
+    uint8_t data[FWL_TEST_DATA_LENGTH];
+    uint16_t length;
+
+    for (s_boot = first; s_boot <= last; s_boot++)
+    {
+        FlashWearLevellingUtils fwl(0, FWL_TEST_REGION_SIZE, FWL_TEST_PAGE_SIZE, FWL_TEST_DATA_LENGTH, FWL_TEST_RESERVED);
+
+        fwl.setCallbacks(&s_flash);
+        fwl.begin(true);
+        if (0 == s_boot % 3)
+        {
+            fwl.prepare();
+        }
+        memset(data, (uint8_t)s_boot, sizeof(data));
+        length = FWL_TEST_DATA_LENGTH;
+        fwl.write(data, &length);
+    }
+}
+
+/** @brief the ring over two laps, cut at each operation: page switch,
+ *         torn record, prepare() erase, erase and write-back of the
+ *         reserved bytes of the last page. The record of the boot before
+ *         the cut or of the boot cut is read, and the ring goes on.
+ */
+static bool testRing(void)
+{
+    uint8_t data[FWL_TEST_DATA_LENGTH];
+    uint32_t ops;
+    uint32_t cut;
+    uint32_t torn;
+    uint32_t boot;
+    bool found;
+    bool status_isOK = true;
+
+    memset(s_flash.data, 0xFF, sizeof(s_flash.data));
+    putReserved();
+    s_flash.arm(FWL_TEST_NO_CUT, false);
+    runBoots(1, FWL_TEST_RING_BOOTS);
+    ops = s_flash.ops;
+    if (!readBack(data) || !isFilled(data, FWL_TEST_RING_BOOTS) || !reservedIsKept())
+    {
+        fprintf(stderr, "ring: %u boots without a cut failed\n", FWL_TEST_RING_BOOTS);
+        return false;
+    }
+
+    for (cut = 0; cut < ops; cut++)
+    {
+        for (torn = 0; torn < 2; torn++)
+        {
+            memset(s_flash.data, 0xFF, sizeof(s_flash.data));
+            putReserved();
+            s_flash.arm(cut, torn);
+            try
+            {
+                runBoots(1, FWL_TEST_RING_BOOTS);
+            }
+            catch (const fwl_power_cut &)
+            {
+            }
+            boot = s_boot;
+
+            found = readBack(data);
+            if ((found && !isFilled(data, (uint8_t)boot) && !isFilled(data, (uint8_t)(boot - 1)))
+                || (!found && (boot > 1)))
+            {
+                fprintf(stderr, "ring: boot %u, cut at op %u%s: record lost\n", boot, cut, torn ? " (torn)" : "");
+                status_isOK = false;
+            }
+
+            runBoots(boot + 1, boot + FWL_TEST_RING_RESUME);
+            if (!readBack(data) || !isFilled(data, (uint8_t)(boot + FWL_TEST_RING_RESUME)))
+            {
+                fprintf(stderr, "ring: boot %u, cut at op %u%s: no record after it\n", boot, cut, torn ? " (torn)" : "");
+                status_isOK = false;
+            }
+            if (!reservedIsKept())
+            {
+                fprintf(stderr, "ring: boot %u, cut at op %u%s: reserved bytes lost\n", boot, cut, torn ? " (torn)" : "");
+                status_isOK = false;
+            }
+        }
+    }
+    return status_isOK;
+}
+
+static const fwl_test_t s_tests[] = {
+    {"legacy_migration", testMigration},
+    {"ring", testRing},
+};
+
+int main(int argc, char *argv[])
+{
+    uint32_t failed = 0;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(s_tests) / sizeof(s_tests[0]); i++)
+    {
+        if (!s_tests[i].run())
+        {
+            fprintf(stderr, "FWL_SLOT_LOCATOR %u: %s FAIL\n", (unsigned)FWL_SLOT_LOCATOR, s_tests[i].name);
+            failed++;
+        }
+        else
+        {
+            printf("FWL_SLOT_LOCATOR %u: %s ok\n", (unsigned)FWL_SLOT_LOCATOR, s_tests[i].name);
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,20 @@
+/** @file us_ticker_api.h
+ *  @brief Microsecond ticker of the host build, the simulated time of the
+ *         flash parts so a run is repeatable
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_US_TICKER_API_H
+#define __HOST_US_TICKER_API_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include "sim_block_device.h"
+
+/* Exported functions --------------------------------------------------------*/
+inline uint32_t us_ticker_read(void)
+{
+    return (uint32_t)(SimBlockDevice::clockNs() / 1000U);
+}
+
+#endif /* __HOST_US_TICKER_API_H */
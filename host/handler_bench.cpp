@@ -0,0 +1,75 @@
+/** @file handler_bench.cpp
+ *  @brief Cost of a read call through the FlashHandler of each memory kind
+ *         against the device alone (partition_manager::benchmarkFlash) on
+ *         the simulated parts, JSON line
+ *
+ *    handler_bench [-x DEV.FIELD=N]...
+ *
+ *  The parts don't sleep their latencies: the time is the call path, the
+ *  bounds check of the handler and the copy of the simulated device.
+ *  Host CPU time: compare the paths against each other, not the target.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "partition_manager.h"
+#include "sim_flash.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Private variables ---------------------------------------------------------*/
+extern partition_manager partition_mng;
+
+/* Private functions ---------------------------------------------------------*/
+static void printCost(const char *kind, const flash_call_cost_t *cost)
+{
+    printf("\"%s\": {\"device_ns\": %u, \"handler_ns\": %u, \"create_ns\": %u}",
+           kind, cost->device, cost->handler, cost->create);
+}
+
+int main(int argc, char *argv[])
+{
+    flash_call_cost_t internal;
+    flash_call_cost_t external;
+    bool status_isOK;
+    int out;
+    int null;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "x:")) != -1)
+    {
+        if ('x' != opt || !sim_flash_option(optarg))
+        {
+            fprintf(stderr, "usage: %s [-x DEV.FIELD=N]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!sim_flash_open(nullptr, nullptr))
+    {
+        return 2;
+    }
+
+    /* The log of partition_manager goes to stdout, the JSON line too */
+    fflush(stdout);
+    out = dup(STDOUT_FILENO);
+    null = open("/dev/null", O_WRONLY);
+    if (out < 0 || null < 0 || dup2(null, STDOUT_FILENO) < 0)
+    {
+        return 2;
+    }
+    partition_mng.begin();
+    status_isOK = partition_mng.benchmarkFlash(&internal, &external);
+    partition_mng.end();
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+
+    printf("{\"bench\": \"flash_call\", \"calls\": %u, ", (unsigned)PM_BENCHMARK_CALLS);
+    printCost("internal", &internal);
+    printf(", ");
+    printCost("external", &external);
+    printf(", \"ok\": %s}\n", status_isOK ? "true" : "false");
+    fflush(stdout);
+    sim_flash_close();
+    _exit(status_isOK ? 0 : 1);
+}
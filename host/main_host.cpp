@@ -0,0 +1,173 @@
+/** @file main_host.cpp
+ *  @brief Runs one boot of the MBR (main.cpp) on the simulated flash parts
+ *
+ *    mbr_host -i int.bin -e ext.bin -l int:0x61000:app.bin -o ext.erase_ns=50000000
+ *
+ *  The files keep the flash content across runs: run again for the next
+ *  boot, after a power cut too. Exit code: 0 jump to an application, 1 no
+ *  application, 2 power cut, 3 bad arguments.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+/* Private define ------------------------------------------------------------*/
+#define HOST_EXIT_JUMP      0
+#define HOST_EXIT_IDLE      1
+#define HOST_EXIT_POWER_CUT 2
+#define HOST_EXIT_USAGE     3
+
+/* Private function prototypes -----------------------------------------------*/
+/** main() of main.cpp, renamed by the host Makefile */
+extern "C" int mbr_main(void);
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-i FILE] [-e FILE] [-l DEV:ADDR:FILE]... [-o DEV.FIELD=VALUE]... [-c N] [-r]\n"
+            "  -i FILE          internal flash content, RAM if not given\n"
+            "  -e FILE          SPI NOR content, RAM if not given\n"
+            "  -l DEV:ADDR:FILE load FILE at ADDR of int or ext before the boot\n"
+            "  -o DEV.FIELD=N   geometry or timing, e.g. ext.erase_ns=50000000\n"
+            "  -c N             power cut at the N-th program or erase\n"
+            "  -r               sleep the simulated latencies\n",
+            name);
+}
+
+/** @brief load a file like a programmer, "int:0x61000:app.bin" */
+static bool loadFile(const char *spec)
+{
+    SimBlockDevice *device;
+    std::vector<uint8_t> content;
+    const char *path;
+    char *end;
+    unsigned long addr;
+    FILE *file;
+    uint8_t chunk[4096];
+    size_t length;
+
+    if (strncmp(spec, "int:", 4) == 0)
+    {
+        device = &sim_internal_flash;
+    }
+    else if (strncmp(spec, "ext:", 4) == 0)
+    {
+        device = &sim_external_flash;
+    }
+    else
+    {
+        return false;
+    }
+    addr = strtoul(spec + 4, &end, 0);
+    if (*end != ':')
+    {
+        return false;
+    }
+    path = end + 1;
+    file = fopen(path, "rb");
+    if (file == nullptr)
+    {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+    while ((length = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        content.insert(content.end(), chunk, chunk + length);
+    }
+    fclose(file);
+    return device->load(content.data(), addr, content.size());
+} // loadFile
+
+static void printStats(SimBlockDevice *device)
+{
+    SimBlockDevice::stats_t stats = device->stats();
+
+    printf("sim %s: read %llu (%llu bytes), program %llu (%llu bytes, %llu not erased), "
+           "erase %llu commands (%llu bytes), errors %llu, busy %llu us\n",
+           device->name(),
+           (unsigned long long)stats.reads, (unsigned long long)stats.read_bytes,
+           (unsigned long long)stats.programs, (unsigned long long)stats.program_bytes,
+           (unsigned long long)stats.reprogram_bytes,
+           (unsigned long long)stats.erases, (unsigned long long)stats.erase_bytes,
+           (unsigned long long)stats.errors, (unsigned long long)(stats.busy_ns / 1000));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *internal_path = nullptr;
+    const char *external_path = nullptr;
+    std::vector<const char *> loads;
+    int status = HOST_EXIT_IDLE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:e:l:o:c:rh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            internal_path = optarg;
+            break;
+        case 'e':
+            external_path = optarg;
+            break;
+        case 'l':
+            loads.push_back(optarg);
+            break;
+        case 'o':
+            if (!sim_flash_option(optarg))
+            {
+                fprintf(stderr, "bad option %s\n", optarg);
+                return HOST_EXIT_USAGE;
+            }
+            break;
+        case 'c':
+            SimBlockDevice::powerCutAfter(strtoull(optarg, nullptr, 0));
+            break;
+        case 'r':
+            SimBlockDevice::realtime(true);
+            break;
+        default:
+            usage(argv[0]);
+            return HOST_EXIT_USAGE;
+        }
+    }
+
+    if (!sim_flash_open(internal_path, external_path))
+    {
+        return HOST_EXIT_USAGE;
+    }
+    for (const char *spec : loads)
+    {
+        if (!loadFile(spec))
+        {
+            fprintf(stderr, "bad load %s\n", spec);
+            sim_flash_close();
+            return HOST_EXIT_USAGE;
+        }
+    }
+
+    try
+    {
+        mbr_main();
+    }
+    catch (const sim_halt &halt)
+    {
+        printf("sim: %s 0x%08X\n", halt.address ? "jump" : "idle", halt.address);
+        status = halt.address ? HOST_EXIT_JUMP : HOST_EXIT_IDLE;
+    }
+    catch (const sim_power_cut &cut)
+    {
+        printf("sim: power cut, %s 0x%08llX\n", cut.device, (unsigned long long)cut.addr);
+        status = HOST_EXIT_POWER_CUT;
+    }
+
+    printStats(&sim_internal_flash);
+    printStats(&sim_external_flash);
+    fflush(stdout);
+    sim_flash_close();
+    /* The prefetch worker may still be blocked after a power cut */
+    _exit(status);
+}
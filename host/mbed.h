@@ -0,0 +1,248 @@
+/** @file mbed.h
+ *  @brief mbed-os API used by the MBR, host build: callbacks, timers, rtos
+ *         threads on std::thread, and the target hooks. Jumping to an
+ *         application or idling ends the boot with sim_halt.
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_MBED_H
+#define __HOST_MBED_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include "sim_flash.h"
+
+/* Exported macro ------------------------------------------------------------*/
+#define MBED_ALIGN(N) alignas(N)
+
+/** RAM kept across the jump to the application (boot_profile.h) */
+#define BOOT_PROFILE_PTR ((void*)sim_retained_ram)
+/** Register kept across a reset (partition_manager.h) */
+#define PM_FAST_BOOTS_REG sim_retained_reg
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+    p0 = 0, p1, p2, p3, p4, p5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15,
+    p16, p17, p18, p19, p20, p21, p22, p23, p24, p25, p26, p27, p28, p29, p30, p31,
+    NC = -1
+} PinName;
+
+typedef enum
+{
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40
+} osPriority;
+
+/** End of a boot on the host: the MBR jumped to address, 0 when it found
+ *  no application and idles
+ */
+struct sim_halt
+{
+    uint32_t address;
+};
+
+namespace mbed {
+
+template <typename F>
+class Callback;
+
+/** Stored inline like the mbed Callback, the MBR objects make no heap call */
+template <typename R, typename... ArgTs>
+class Callback<R(ArgTs...)>
+{
+public:
+    Callback() : _obj(nullptr), _thunk(nullptr) {}
+    Callback(R (*func)(ArgTs...)) : _obj(nullptr), _thunk(func ? &Callback::funcThunk : nullptr)
+    {
+        memcpy(_method, &func, sizeof(func));
+    }
+    template <typename T>
+    Callback(T *obj, R (T::*method)(ArgTs...)) : _obj(obj), _thunk(&Callback::methodThunk<T>)
+    {
+        static_assert(sizeof(method) <= sizeof(_method), "member function pointer too large");
+        memcpy(_method, &method, sizeof(method));
+    }
+
+    R operator()(ArgTs... args) const { return _thunk(this, args...); }
+    R call(ArgTs... args) const { return _thunk(this, args...); }
+    explicit operator bool() const { return _thunk != nullptr; }
+
+private:
+    static R funcThunk(const Callback *cb, ArgTs... args)
+    {
+        R (*func)(ArgTs...);
+
+        memcpy(&func, cb->_method, sizeof(func));
+        return func(args...);
+    }
+    template <typename T>
+    static R methodThunk(const Callback *cb, ArgTs... args)
+    {
+        R (T::*method)(ArgTs...);
+
+        memcpy(&method, cb->_method, sizeof(method));
+        return (static_cast<T *>(cb->_obj)->*method)(args...);
+    }
+
+    void *_obj;
+    alignas(void *) unsigned char _method[2 * sizeof(void *)];
+    R (*_thunk)(const Callback *, ArgTs...);
+};
+
+template <typename T, typename R, typename... ArgTs>
+Callback<R(ArgTs...)> callback(T *obj, R (T::*method)(ArgTs...))
+{
+    return Callback<R(ArgTs...)>(obj, method);
+}
+
+template <typename R, typename... ArgTs>
+Callback<R(ArgTs...)> callback(R (*func)(ArgTs...))
+{
+    return Callback<R(ArgTs...)>(func);
+}
+
+class Timer
+{
+public:
+    Timer() : _running(false), _elapsed(0) {}
+    void start(void)
+    {
+        if (!_running)
+        {
+            _start = std::chrono::steady_clock::now();
+            _running = true;
+        }
+    }
+    void stop(void)
+    {
+        if (_running)
+        {
+            _elapsed += std::chrono::steady_clock::now() - _start;
+            _running = false;
+        }
+    }
+    void reset(void)
+    {
+        _elapsed = std::chrono::steady_clock::duration(0);
+        _start = std::chrono::steady_clock::now();
+    }
+    std::chrono::microseconds elapsed_time(void) const
+    {
+        std::chrono::steady_clock::duration d = _elapsed;
+        if (_running)
+        {
+            d += std::chrono::steady_clock::now() - _start;
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(d);
+    }
+
+private:
+    bool _running;
+    std::chrono::steady_clock::time_point _start;
+    std::chrono::steady_clock::duration _elapsed;
+};
+
+class DigitalOut
+{
+public:
+    DigitalOut(PinName pin, int value = 0) : _pin(pin), _value(value) {}
+    DigitalOut &operator=(int value) { _value = value; return *this; }
+    operator int() const { return _value; }
+
+private:
+    PinName _pin;
+    int _value;
+};
+
+} // namespace mbed
+
+namespace rtos {
+
+class Semaphore
+{
+public:
+    Semaphore(int32_t count = 0) : _count(count) {}
+    void acquire(void)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cond.wait(lock, [this] { return _count > 0; });
+        _count--;
+    }
+    void release(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _count++;
+        }
+        _cond.notify_one();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    int32_t _count;
+};
+
+/** The stack and the priority are the host's */
+class Thread
+{
+public:
+    Thread(osPriority priority = osPriorityNormal, uint32_t stack_size = 0,
+           unsigned char *stack_mem = nullptr, const char *name = nullptr) {}
+    ~Thread()
+    {
+        /* A boot ended by a power cut leaves the worker blocked */
+        if (_thread.joinable())
+        {
+            _thread.detach();
+        }
+    }
+    /* mbed_host.cpp, std::thread allocates its state */
+    int start(mbed::Callback<void()> task);
+    int join(void)
+    {
+        if (_thread.joinable())
+        {
+            _thread.join();
+        }
+        return 0;
+    }
+
+private:
+    std::thread _thread;
+};
+
+namespace ThisThread {
+/** Idle: the host ends the boot with sim_halt{0} */
+void sleep_for(std::chrono::milliseconds rel_time);
+} // namespace ThisThread
+
+} // namespace rtos
+
+/** BOOT_PROFILE_REGION_SIZE bytes, not cleared between boots of a process */
+extern uint8_t sim_retained_ram[];
+/** GPREGRET2, not cleared between boots of a process */
+extern uint32_t sim_retained_reg;
+
+/** Jump to an application: the host ends the boot with sim_halt{address} */
+void mbed_start_application(uintptr_t address);
+
+void wait_us(int us);
+
+using namespace mbed;
+using namespace rtos;
+using namespace std::chrono_literals;
+
+#endif /* __HOST_MBED_H */
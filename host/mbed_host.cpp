@@ -0,0 +1,28 @@
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "boot_profile.h"
+
+MBED_ALIGN(8) uint8_t sim_retained_ram[BOOT_PROFILE_REGION_SIZE];
+uint32_t sim_retained_reg;
+
+void rtos::ThisThread::sleep_for(std::chrono::milliseconds rel_time)
+{
+    (void)rel_time;
+    throw sim_halt{0};
+}
+
+int rtos::Thread::start(mbed::Callback<void()> task)
+{
+    _thread = std::thread([task] { task(); });
+    return 0;
+}
+
+void mbed_start_application(uintptr_t address)
+{
+    throw sim_halt{(uint32_t)address};
+}
+
+void wait_us(int us)
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
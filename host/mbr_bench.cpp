@@ -0,0 +1,837 @@
+/** @file mbr_bench.cpp
+ *  @brief Boot latency of each startup_mode_t path of main.cpp on the
+ *         simulated flash parts, JSON report
+ *
+ *    mbr_bench [-s SCENARIO] [-x DEV.FIELD=N]... [-m FIELD=N]... [-v]
+ *
+ *  Each scenario runs in its own process on RAM flash: the images are
+ *  installed (fixed seeds), the MBR is set up through MasterBootRecord and
+ *  partition_manager, the counters are cleared and one boot (mbr_main) is
+ *  measured. The time is the flash time of the timing model of
+ *  host/sim_flash.cpp plus the CRC32 and AES work at the cycle costs of
+ *  the model below, without the overlap of the prefetch thread. LZSS and
+ *  delta decoding are not charged. The same build gives the same report.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "mbr.h"
+#include "partition_manager.h"
+#include "boot_profile.h"
+#include "scratch_arena.h"
+#include "delta_patch.h"
+#include "lzss.h"
+#include "util_crc32.h"
+#include "AES.h"
+#include <atomic>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+
+/* Private define ------------------------------------------------------------*/
+#define BENCH_MAIN_SIZE     (256U * 1024U)
+#define BENCH_BOOT_SIZE     (96U * 1024U)
+#define BENCH_VERSION_PREV  0x01000000UL
+#define BENCH_VERSION_OLD   0x01000001UL
+#define BENCH_VERSION_NEW   0x01010000UL
+/* Pages of main changed by the delta image, bytes changed in each */
+#define BENCH_DELTA_PAGES   8U
+#define BENCH_DELTA_BYTES   64U
+
+/* Private typedef -----------------------------------------------------------*/
+/** CPU cost of the checksum and cipher engines, nRF52840 at 64MHz.
+ *  Estimates of the default engines (slicing-by-8 CRC32, T-table AES-128),
+ *  calibrate with partition_manager::benchmarkCrypto() on target and -m
+ */
+typedef struct
+{
+    uint32_t cpu_hz;
+    uint32_t crc_cycles_per_byte;
+    uint32_t aes_cycles_per_block;      /* forward cipher: CTR, CBC encrypt, CMAC */
+    uint32_t aes_inv_cycles_per_block;  /* inverse cipher: CBC decrypt */
+} bench_model_t;
+
+typedef struct
+{
+    SimBlockDevice::stats_t internal;
+    SimBlockDevice::stats_t external;
+    uint64_t crc_bytes;
+    uint64_t aes_blocks;
+    uint64_t aes_inv_blocks;
+    uint32_t mbr_commits;
+    uint32_t scratch_peak;  /* bytes of the scratch arena borrowed at once */
+    uint32_t address;
+    int32_t status;         /* 0 jump, 1 idle, 2 power cut, 3 setup failed */
+    bool profile_ok;        /* the boot left its profile for the application */
+    boot_profile_t profile;
+} bench_result_t;
+
+typedef struct
+{
+    const char *name;
+    const char *startup_mode;
+    bool (*setup)(void);
+    uint32_t warm_boots;    /* boots before the measured one */
+    uint32_t expected;      /* address the boot must jump to */
+} bench_scenario_t;
+
+/* Private variables ---------------------------------------------------------*/
+static bench_model_t s_model = {64000000U, 5U, 1000U, 1100U};
+static std::atomic<uint64_t> s_crc_bytes(0);
+static std::atomic<uint64_t> s_aes_blocks(0);
+static std::atomic<uint64_t> s_aes_inv_blocks(0);
+
+/* main.cpp */
+extern partition_manager partition_mng;
+extern "C" int mbr_main(void);
+
+/* Private functions ---------------------------------------------------------*/
+/* Engine calls counted through the linker (--wrap), see the bench rule of
+ * host/Makefile. AES::encrypt/decrypt(void*, size_t) carry every block of
+ * CTR, CBC and CMAC.
+ */
+extern "C" {
+void __real_CRC32_Update(crc32_ctx_t *ctx, const uint8_t *buffer, uint32_t length);
+uint32_t __real_Crc32_CalculateBuffer(const uint8_t *buffer, uint32_t length);
+void __real__ZN3AES7encryptEPvm(AES *aes, void *data, size_t length);
+void __real__ZN3AES7decryptEPvm(AES *aes, void *data, size_t length);
+
+void __wrap_CRC32_Update(crc32_ctx_t *ctx, const uint8_t *buffer, uint32_t length)
+{
+    s_crc_bytes += length;
+    __real_CRC32_Update(ctx, buffer, length);
+}
+
+uint32_t __wrap_Crc32_CalculateBuffer(const uint8_t *buffer, uint32_t length)
+{
+    s_crc_bytes += length;
+    return __real_Crc32_CalculateBuffer(buffer, length);
+}
+
+void __wrap__ZN3AES7encryptEPvm(AES *aes, void *data, size_t length)
+{
+    s_aes_blocks += (length + 15U) / 16U;
+    __real__ZN3AES7encryptEPvm(aes, data, length);
+}
+
+void __wrap__ZN3AES7decryptEPvm(AES *aes, void *data, size_t length)
+{
+    if (AES::MODE_CTR == aes->mode())
+    {
+        s_aes_blocks += (length + 15U) / 16U;
+    }
+    else
+    {
+        s_aes_inv_blocks += (length + 15U) / 16U;
+    }
+    __real__ZN3AES7decryptEPvm(aes, data, length);
+}
+} // extern "C"
+
+/** @brief image of a partition: xorshift32 content, a vector table that
+ *         passes verifyVectorTable, its stack reserves the boot profile
+ */
+static void fillImage(std::vector<uint8_t> *image, uint32_t size, uint32_t addr, uint32_t seed)
+{
+    uint32_t x = seed ? seed : 1U;
+    uint32_t word[2] = {BOOT_PROFILE_REGION_ADDR, addr + 0x101U};
+    uint32_t i;
+
+    image->resize(size);
+    for (i = 0; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        (*image)[i] = (uint8_t)x;
+    }
+    memcpy(image->data(), word, sizeof(word));
+}
+
+/** @brief checksum of a header: size, type and version, then the image */
+static uint32_t imageChecksum(const firmwareHeader_t *header, const std::vector<uint8_t> *image)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (const uint8_t *)&header->size, 12U);
+    CRC32_Update(&ctx, image->data(), image->size());
+    return CRC32_Final(&ctx);
+}
+
+/** @brief image that compresses to about half, like code: xorshift32
+ *         bytes, one token in 16 repeats 8..39 bytes from up to 256 back
+ */
+static void fillCompressible(std::vector<uint8_t> *image, uint32_t size, uint32_t addr, uint32_t seed)
+{
+    uint32_t x = seed ? seed : 1U;
+    uint32_t word[2] = {BOOT_PROFILE_REGION_ADDR, addr + 0x101U};
+    uint32_t from;
+    uint32_t run;
+    uint32_t i = 0;
+
+    image->resize(size);
+    while (i < size)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (i >= 256U && (x & 0xFU) == 0)
+        {
+            from = i - 1U - ((x >> 8) & 0xFFU);
+            for (run = 8U + ((x >> 16) & 0x1FU); run && i < size; run--)
+            {
+                (*image)[i++] = (*image)[from++];
+            }
+        }
+        else
+        {
+            (*image)[i++] = (uint8_t)x;
+        }
+    }
+    memcpy(image->data(), word, sizeof(word));
+}
+
+static uint32_t crc32Of(const std::vector<uint8_t> *data)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, data->data(), data->size());
+    return CRC32_Final(&ctx);
+}
+
+static void putVarint(std::vector<uint8_t> *out, uint32_t value)
+{
+    while (value >= 0x80U)
+    {
+        out->push_back((uint8_t)(value | 0x80U));
+        value >>= 7;
+    }
+    out->push_back((uint8_t)value);
+}
+
+/** @brief delta image of a target of the size of the base: one record, the
+ *         whole target as diff runs (tools/mkdelta.py without the matches)
+ */
+static void makeDelta(std::vector<uint8_t> *delta, const std::vector<uint8_t> *base,
+                      const std::vector<uint8_t> *target, uint32_t base_version)
+{
+    delta_header_t header;
+    uint32_t size = target->size();
+    uint32_t pos = 0;
+    uint32_t copy;
+    uint32_t add;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = DELTA_PATCH_MAGIC;
+    header.base_size = base->size();
+    header.base_version = base_version;
+    header.base_crc = crc32Of(base);
+    header.target_size = size;
+    header.target_crc = crc32Of(target);
+    delta->assign((const uint8_t *)&header, (const uint8_t *)&header + sizeof(header));
+    putVarint(delta, size);     /* diff_len */
+    putVarint(delta, 0);        /* extra_len */
+    putVarint(delta, 0);        /* adjust */
+    while (pos < size)
+    {
+        for (copy = pos; copy < size && (*base)[copy] == (*target)[copy]; copy++)
+        {
+        }
+        for (add = copy; add < size && (*base)[add] != (*target)[add]; add++)
+        {
+        }
+        putVarint(delta, copy - pos);
+        putVarint(delta, add - copy);
+        for (; copy < add; copy++)
+        {
+            delta->push_back((uint8_t)((*target)[copy] - (*base)[copy]));
+        }
+        pos = add;
+    }
+}
+
+/** @brief LZSS image (tools/mklzss.py) with the window of the backups */
+static bool compress(std::vector<uint8_t> *packed, const std::vector<uint8_t> *image)
+{
+    static uint8_t work[LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS)] __attribute__((aligned(2)));
+    LzssEncoder encoder;
+    lzss_header_t header;
+    uint8_t out[256];
+    uint32_t length;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = LZSS_MAGIC;
+    header.raw_size = image->size();
+    header.raw_crc = crc32Of(image);
+    header.window_bits = PM_LZSS_WINDOW_BITS;
+    header.lookahead_bits = PM_LZSS_LOOKAHEAD_BITS;
+    packed->assign((const uint8_t *)&header, (const uint8_t *)&header + sizeof(header));
+    if (!encoder.begin(PM_LZSS_WINDOW_BITS, PM_LZSS_LOOKAHEAD_BITS, work))
+    {
+        return false;
+    }
+    encoder.feed(image->data(), image->size());
+    encoder.finish();
+    while (!encoder.done())
+    {
+        length = encoder.produce(out, sizeof(out));
+        packed->insert(packed->end(), out, out + length);
+    }
+    return true;
+}
+
+/** @brief store an image in the download partition and record it in the
+ *         MBR like the application after a download
+ * @param enc type.enc of the image, the image is stored as it is
+ */
+static bool download(const std::vector<uint8_t> *image, uint8_t enc, uint32_t version)
+{
+    MasterBootRecord mbr;
+    app_info_t app;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    app = mbr.getImageDownloadParams();
+    if (!sim_external_flash.load(image->data(), app.startup_addr, image->size()))
+    {
+        return false;
+    }
+    app.fw_header.size = image->size();
+    app.fw_header.type.enc = enc;
+    app.fw_header.type.app = MasterBootRecord::MAIN_APPLICATION;
+    app.fw_header.version.u32 = version;
+    app.fw_header.checksum = imageChecksum(&app.fw_header, image);
+    app.common.app_status = MasterBootRecord::APP_STATUS_OK;
+    app.common.auth = MasterBootRecord::AUTH_NONE;
+    mbr.setImageDownloadParams(&app);
+    if (mbr.commit() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    mbr.end();
+    return true;
+}
+
+/** @brief program an image into main or boot like a programmer and record
+ *         it in the MBR, status OK
+ */
+static bool install(bool main_app, uint32_t seed, uint32_t version)
+{
+    MasterBootRecord mbr;
+    std::vector<uint8_t> image;
+    app_info_t app;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    app = main_app ? mbr.getMainParams() : mbr.getBootParams();
+    fillImage(&image, main_app ? BENCH_MAIN_SIZE : BENCH_BOOT_SIZE, app.startup_addr, seed);
+    if (!sim_internal_flash.load(image.data(), app.startup_addr, image.size()))
+    {
+        return false;
+    }
+    app.fw_header.size = image.size();
+    app.fw_header.version.u32 = version;
+    app.fw_header.checksum = imageChecksum(&app.fw_header, &image);
+    app.common.app_status = MasterBootRecord::APP_STATUS_OK;
+    if (main_app)
+    {
+        mbr.setMainParams(&app);
+    }
+    else
+    {
+        mbr.setBootParams(&app);
+    }
+    if (mbr.commit() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    mbr.end();
+    return true;
+}
+
+/** @brief a device out of the factory: blank params region, main and its
+ *         general header programmed, the first boot records it in the MBR
+ */
+static bool setupFactory(void)
+{
+    std::vector<uint8_t> image;
+    firmwareHeader_t header;
+
+    fillImage(&image, BENCH_MAIN_SIZE, MAIN_APPLICATION_ADDR, 11);
+    header.size = image.size();
+    header.type.u32 = FW_APP_MAIN_TYPE;
+    header.version.u32 = BENCH_VERSION_OLD;
+    header.checksum = imageChecksum(&header, &image);
+    return sim_internal_flash.load(image.data(), MAIN_APPLICATION_ADDR, image.size())
+        && sim_internal_flash.load(&header, MAIN_APP_HEADER_GENERAL_LOCATION, sizeof(header));
+}
+
+static bool setStartUpMode(MasterBootRecord::startup_mode_t mode)
+{
+    MasterBootRecord mbr;
+    bool status;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    mbr.setStartUpMode(mode);
+    status = (mbr.commit() == MasterBootRecord::MBR_OK);
+    mbr.end();
+    return status;
+}
+
+static bool installBoth(void)
+{
+    return install(true, 11, BENCH_VERSION_OLD)
+        && install(false, 21, BENCH_VERSION_OLD);
+}
+
+static bool setupMainRun(void)
+{
+    return installBoth()
+        && setStartUpMode(MasterBootRecord::MAIN_RUN_MODE);
+}
+
+/* The download partition holds the new main (backupMain2ImageDownload), main
+ * is the old one
+ */
+static bool setupUpgradeMain(void)
+{
+    bool status;
+
+    if (!installBoth() || !install(true, 12, BENCH_VERSION_NEW))
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain2ImageDownload();
+    partition_mng.end();
+    return status
+        && install(true, 11, BENCH_VERSION_OLD)
+        && setStartUpMode(MasterBootRecord::UPGRADE_MODE);
+}
+
+/* As upgrade_main, the rollback holds the main before the old one: the
+ * backup of the upgrade overwrites it
+ */
+static bool setupUpgradeMainUsed(void)
+{
+    bool status;
+
+    if (!installBoth() || !install(true, 10, BENCH_VERSION_PREV))
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain();
+    partition_mng.end();
+    return status && setupUpgradeMain();
+}
+
+/* The rollback holds the good main, main was replaced by another image */
+static bool setupMainRollback(void)
+{
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain();
+    partition_mng.end();
+    return status
+        && install(true, 12, BENCH_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::MAIN_ROLLBACK_MODE);
+}
+
+static bool setupBootRun(void)
+{
+    return installBoth()
+        && setStartUpMode(MasterBootRecord::BOOT_RUN_MODE);
+}
+
+static bool setupBootRollback(void)
+{
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupBoot();
+    partition_mng.end();
+    return status
+        && install(false, 22, BENCH_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::BOOT_ROLLBACK_MODE);
+}
+
+/* The download partition holds a delta image against the rollback (the
+ * old main): BENCH_DELTA_PAGES pages of main change
+ */
+static bool setupUpgradeDelta(void)
+{
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> target;
+    std::vector<uint8_t> delta;
+    uint32_t page;
+    uint32_t i;
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain();
+    partition_mng.end();
+    fillImage(&base, BENCH_MAIN_SIZE, MAIN_APPLICATION_ADDR, 11);
+    target = base;
+    for (page = 0; page < BENCH_DELTA_PAGES; page++)
+    {
+        for (i = 0; i < BENCH_DELTA_BYTES; i++)
+        {
+            target[(page * 7U + 1U) * DEVICE_PAGE_ERASE_SIZE + 0x100U + i] ^= 0xA5U;
+        }
+    }
+    makeDelta(&delta, &base, &target, BENCH_VERSION_OLD);
+    return status
+        && download(&delta, MasterBootRecord::DATA_DELTA, BENCH_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::UPGRADE_MODE);
+}
+
+/* The download partition holds a new main LZSS compressed */
+static bool setupUpgradeLzss(void)
+{
+    std::vector<uint8_t> image;
+    std::vector<uint8_t> packed;
+
+    fillCompressible(&image, BENCH_MAIN_SIZE, MAIN_APPLICATION_ADDR, 12);
+    return installBoth()
+        && compress(&packed, &image)
+        && download(&packed, MasterBootRecord::DATA_RAW | MasterBootRecord::DATA_COMPRESSED, BENCH_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::UPGRADE_MODE);
+}
+
+/* The rollback holds main, one page of main rotted after the backup */
+static bool setupMainRepair(void)
+{
+    uint8_t rot[BENCH_DELTA_BYTES];
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain();
+    partition_mng.end();
+    memset(rot, 0, sizeof(rot));
+    return status
+        && sim_internal_flash.load(rot, MAIN_APPLICATION_ADDR + 37U * DEVICE_PAGE_ERASE_SIZE, sizeof(rot))
+        && setStartUpMode(MasterBootRecord::MAIN_RUN_MODE);
+}
+
+static const bench_scenario_t s_scenarios[] = {
+    {"factory_boot",    "MAIN_RUN_MODE",      setupFactory,      0, MAIN_APPLICATION_ADDR},
+    {"main_run",        "MAIN_RUN_MODE",      setupMainRun,      0, MAIN_APPLICATION_ADDR},
+    {"main_run_cached", "MAIN_RUN_MODE",      setupMainRun,      1, MAIN_APPLICATION_ADDR},
+#if (PM_VERIFY_FULL_INTERVAL > 0)
+    /* The first boot after PM_VERIFY_FULL_INTERVAL fast ones */
+    {"main_run_periodic", "MAIN_RUN_MODE",    setupMainRun,      PM_VERIFY_FULL_INTERVAL + 1, MAIN_APPLICATION_ADDR},
+#endif
+    {"upgrade_main",    "UPGRADE_MODE",       setupUpgradeMain,  0, MAIN_APPLICATION_ADDR},
+    {"upgrade_main_used", "UPGRADE_MODE",     setupUpgradeMainUsed, 0, MAIN_APPLICATION_ADDR},
+    {"upgrade_delta",   "UPGRADE_MODE",       setupUpgradeDelta, 0, MAIN_APPLICATION_ADDR},
+    {"upgrade_lzss",    "UPGRADE_MODE",       setupUpgradeLzss,  0, MAIN_APPLICATION_ADDR},
+    {"main_repair",     "MAIN_RUN_MODE",      setupMainRepair,   0, MAIN_APPLICATION_ADDR},
+    {"main_rollback",   "MAIN_ROLLBACK_MODE", setupMainRollback, 0, MAIN_APPLICATION_ADDR},
+    {"boot_run",        "BOOT_RUN_MODE",      setupBootRun,      0, BOOTLOADER_FACTORY_ADDR},
+    {"boot_rollback",   "BOOT_ROLLBACK_MODE", setupBootRollback, 0, BOOTLOADER_FACTORY_ADDR},
+};
+
+/** @brief one boot of main.cpp, the address it jumped to or 0 */
+static int32_t boot(uint32_t *address)
+{
+    *address = 0;
+    try
+    {
+        mbr_main();
+    }
+    catch (const sim_halt &halt)
+    {
+        *address = halt.address;
+        return halt.address ? 0 : 1;
+    }
+    catch (const sim_power_cut &cut)
+    {
+        return 2;
+    }
+    return 1;
+}
+
+/** @brief child process: set up, warm up, measure one boot */
+static void runScenario(const bench_scenario_t *scenario, bench_result_t *result)
+{
+    uint32_t commits;
+    uint32_t i;
+
+    memset(result, 0, sizeof(bench_result_t));
+    result->status = 3;
+    if (!sim_flash_open(nullptr, nullptr) || !scenario->setup())
+    {
+        return;
+    }
+    for (i = 0; i < scenario->warm_boots; i++)
+    {
+        if (boot(&result->address) != 0)
+        {
+            return;
+        }
+    }
+
+    sim_internal_flash.resetStats();
+    sim_external_flash.resetStats();
+    s_crc_bytes = 0;
+    s_aes_blocks = 0;
+    s_aes_inv_blocks = 0;
+    /* The MBR counts the writes since the process started */
+    commits = partition_mng.mbrWriteCount();
+    ScratchArena::resetPeak();
+    result->status = boot(&result->address);
+    result->mbr_commits = partition_mng.mbrWriteCount() - commits;
+    result->scratch_peak = ScratchArena::peak();
+    result->internal = sim_internal_flash.stats();
+    result->external = sim_external_flash.stats();
+    result->crc_bytes = s_crc_bytes;
+    result->aes_blocks = s_aes_blocks;
+    result->aes_inv_blocks = s_aes_inv_blocks;
+    result->profile_ok = BootProfile::load(&result->profile);
+}
+
+static bool runChild(const bench_scenario_t *scenario, bench_result_t *result, bool verbose)
+{
+    int fd[2];
+    pid_t pid;
+    int wstatus;
+    ssize_t length;
+
+    if (pipe(fd) != 0)
+    {
+        return false;
+    }
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fd[0]);
+        /* The MBR log goes to stderr or nowhere, stdout is the report */
+        if (!freopen(verbose ? "/dev/stderr" : "/dev/null", "w", stdout))
+        {
+            _exit(3);
+        }
+        runScenario(scenario, result);
+        fflush(stdout);
+        length = write(fd[1], result, sizeof(bench_result_t));
+        _exit(length == (ssize_t)sizeof(bench_result_t) ? 0 : 3);
+    }
+    close(fd[1]);
+    length = (pid > 0) ? read(fd[0], result, sizeof(bench_result_t)) : -1;
+    close(fd[0]);
+    if (pid > 0)
+    {
+        waitpid(pid, &wstatus, 0);
+    }
+    return length == (ssize_t)sizeof(bench_result_t);
+}
+
+static void printDevice(FILE *out, const char *name, const SimBlockDevice::stats_t *stats, bool last)
+{
+    fprintf(out,
+            "      \"%s\": {\"read_bytes\": %llu, \"program_bytes\": %llu, \"erase_bytes\": %llu, "
+            "\"reads\": %llu, \"programs\": %llu, \"erases\": %llu, \"busy_us\": %llu}%s\n",
+            name,
+            (unsigned long long)stats->read_bytes, (unsigned long long)stats->program_bytes,
+            (unsigned long long)stats->erase_bytes,
+            (unsigned long long)stats->reads, (unsigned long long)stats->programs,
+            (unsigned long long)stats->erases,
+            (unsigned long long)(stats->busy_ns / 1000U), last ? "" : ",");
+}
+
+/** Phases of the boot profile, flash time only: the host ticks are the
+ *  simulated clock of the parts
+ */
+static void printPhases(FILE *out, const bench_result_t *result)
+{
+    const boot_profile_t *profile = &result->profile;
+    bool first = true;
+    uint8_t i;
+
+    fprintf(out, "      \"phases\": {");
+    for (i = 0; result->profile_ok && i < BOOT_PHASE_NUM; i++)
+    {
+        if (profile->phases[i].calls == 0)
+        {
+            continue;
+        }
+        fprintf(out, "%s\n        \"%s\": {\"us\": %u, \"bytes\": %u, \"calls\": %u}",
+                first ? "" : ",", BootProfile::phaseName(i),
+                BootProfile::toUs(profile, profile->phases[i].ticks),
+                profile->phases[i].bytes, profile->phases[i].calls);
+        first = false;
+    }
+    fprintf(out, "%s},\n", first ? "" : "\n      ");
+}
+
+static void printConfig(FILE *out, const char *name, const SimBlockDevice::config_t *config)
+{
+    fprintf(out,
+            "    \"%s\": {\"size\": %llu, \"read_size\": %u, \"program_size\": %u, \"page_size\": %u, "
+            "\"erase_size\": %u, \"read_setup_ns\": %u, \"read_ns_per_byte\": %u, \"program_ns\": %u, "
+            "\"program_ns_per_byte\": %u, \"erase_ns\": %u, \"block32_erase_ns\": %u, \"block64_erase_ns\": %u},\n",
+            name, (unsigned long long)config->size, config->read_size, config->program_size,
+            config->page_size, config->erase_size, config->read_setup_ns, config->read_ns_per_byte,
+            config->program_ns, config->program_ns_per_byte, config->erase_ns,
+            config->block32_erase_ns, config->block64_erase_ns);
+}
+
+static bool modelOption(const char *option)
+{
+    static const struct { const char *name; uint32_t *field; } fields[] = {
+        {"cpu_hz", &s_model.cpu_hz},
+        {"crc_cycles_per_byte", &s_model.crc_cycles_per_byte},
+        {"aes_cycles_per_block", &s_model.aes_cycles_per_block},
+        {"aes_inv_cycles_per_block", &s_model.aes_inv_cycles_per_block},
+    };
+    const char *value = strchr(option, '=');
+    size_t i;
+
+    for (i = 0; value != nullptr && i < sizeof(fields) / sizeof(fields[0]); i++)
+    {
+        if (strlen(fields[i].name) == (size_t)(value - option)
+        && strncmp(fields[i].name, option, value - option) == 0)
+        {
+            *fields[i].field = (uint32_t)strtoul(value + 1, nullptr, 0);
+            return s_model.cpu_hz != 0;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *only = nullptr;
+    bool verbose = false;
+    bool first = true;
+    int failures = 0;
+    int runs = 0;
+    bench_result_t result;
+    uint64_t cycles;
+    uint64_t cpu_ns;
+    uint64_t flash_ns;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:x:m:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            only = optarg;
+            break;
+        case 'x':
+            if (!sim_flash_option(optarg))
+            {
+                fprintf(stderr, "bad flash option %s\n", optarg);
+                return 3;
+            }
+            break;
+        case 'm':
+            if (!modelOption(optarg))
+            {
+                fprintf(stderr, "bad model option %s\n", optarg);
+                return 3;
+            }
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s SCENARIO] [-x DEV.FIELD=N]... [-m FIELD=N]... [-v]\n", argv[0]);
+            return 3;
+        }
+    }
+
+    printf("{\n  \"model\": {\n");
+    printf("    \"cpu_hz\": %u, \"crc_cycles_per_byte\": %u, \"aes_cycles_per_block\": %u, "
+           "\"aes_inv_cycles_per_block\": %u,\n",
+           s_model.cpu_hz, s_model.crc_cycles_per_byte, s_model.aes_cycles_per_block,
+           s_model.aes_inv_cycles_per_block);
+    printConfig(stdout, "int", &sim_internal_flash.config());
+    printConfig(stdout, "ext", &sim_external_flash.config());
+    printf("    \"backend\": \"%s\"\n  },\n  \"scenarios\": [", CRYPTO_BACKEND_NAME);
+
+    for (i = 0; i < sizeof(s_scenarios) / sizeof(s_scenarios[0]); i++)
+    {
+        const bench_scenario_t *scenario = &s_scenarios[i];
+
+        if (only != nullptr && strcmp(only, scenario->name) != 0)
+        {
+            continue;
+        }
+        runs++;
+        if (!runChild(scenario, &result, verbose))
+        {
+            memset(&result, 0, sizeof(result));
+            result.status = 3;
+        }
+        if (result.status != 0 || result.address != scenario->expected)
+        {
+            failures++;
+        }
+        cycles = result.crc_bytes * s_model.crc_cycles_per_byte
+               + result.aes_blocks * s_model.aes_cycles_per_block
+               + result.aes_inv_blocks * s_model.aes_inv_cycles_per_block;
+        cpu_ns = cycles * 1000000000ULL / s_model.cpu_hz;
+        flash_ns = result.internal.busy_ns + result.external.busy_ns;
+
+        printf("%s\n    {\n", first ? "" : ",");
+        first = false;
+        printf("      \"name\": \"%s\", \"startup_mode\": \"%s\", \"result\": \"%s\", "
+               "\"address\": \"0x%08X\", \"ok\": %s,\n",
+               scenario->name, scenario->startup_mode,
+               result.status == 0 ? "jump" : result.status == 1 ? "idle" :
+               result.status == 2 ? "power_cut" : "setup_failed",
+               result.address,
+               (result.status == 0 && result.address == scenario->expected) ? "true" : "false");
+        printf("      \"time_us\": %llu, \"flash_us\": %llu, \"cpu_us\": %llu,\n",
+               (unsigned long long)((flash_ns + cpu_ns) / 1000U),
+               (unsigned long long)(flash_ns / 1000U),
+               (unsigned long long)(cpu_ns / 1000U));
+        printf("      \"crc_bytes\": %llu, \"aes_blocks\": %llu, \"aes_inv_blocks\": %llu, "
+               "\"cpu_cycles\": %llu, \"mbr_commits\": %u, \"scratch_peak\": %u,\n",
+               (unsigned long long)result.crc_bytes, (unsigned long long)result.aes_blocks,
+               (unsigned long long)result.aes_inv_blocks, (unsigned long long)cycles,
+               result.mbr_commits, result.scratch_peak);
+        printPhases(stdout, &result);
+        printDevice(stdout, "int", &result.internal, false);
+        printDevice(stdout, "ext", &result.external, true);
+        printf("    }");
+    }
+    printf("\n  ]\n}\n");
+    if (runs == 0)
+    {
+        fprintf(stderr, "no scenario %s\n", only ? only : "");
+        return 3;
+    }
+    return failures ? 1 : 0;
+}
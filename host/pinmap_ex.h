@@ -0,0 +1,21 @@
+/** @file pinmap_ex.h
+ *  @brief Pin map of the SPI instances, host build
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __HOST_PINMAP_EX_H
+#define __HOST_PINMAP_EX_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+/* Exported types ------------------------------------------------------------*/
+typedef struct
+{
+    PinName mosi;
+    PinName miso;
+    PinName clk;
+    int instance;
+} PinMapSPI;
+
+#endif /* __HOST_PINMAP_EX_H */
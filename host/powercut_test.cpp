@@ -0,0 +1,547 @@
+/** @file powercut_test.cpp
+ *  @brief Power failure tests of the copies of partition_manager (upgrade,
+ *         backup, restore) on the simulated flash parts: a boot of main.cpp
+ *         is cut at each program and erase, then the parts are booted again
+ *
+ *    powercut_test [-s SCENARIO] [-v]
+ *
+ *  The parts are files mapped shared and unlinked once open, every boot
+ *  runs in its own process like after a reset and sees what the previous
+ *  one left. The test keeps the content after the setup and puts it back
+ *  before each cut. A scenario boots with a cut at op 1, 2, ... until a
+ *  boot ends without reaching its cut.
+ *
+ *  After a cut, the copy in the MBR journal must resume at its block (the
+ *  "resume op" line of the partition_manager log), and the boot that jumps
+ *  must jump to the application of the scenario: its partition holds the
+ *  expected image, CRC32 and MBR header, with the expected status. The
+ *  rollback of an upgrade must hold the main it replaced.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "mbr.h"
+#include "partition_manager.h"
+#include "boot_profile.h"
+#include "sim_flash.h"
+#include "util_crc32.h"
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+
+/* Private define ------------------------------------------------------------*/
+/* 40 blocks of main, a journal checkpoint in the copy */
+#define PC_MAIN_SIZE        (160U * 1024U)
+#define PC_BOOT_SIZE        (48U * 1024U)
+#define PC_VERSION_OLD      0x01000001UL
+#define PC_VERSION_NEW      0x01010000UL
+#define PC_SEED_MAIN_OLD    11U
+#define PC_SEED_MAIN_NEW    12U
+#define PC_SEED_BOOT_OLD    21U
+#define PC_SEED_BOOT_NEW    22U
+#define PC_RESUME_LOG       "[journalBegin]\t resume op "
+
+/* Private typedef -----------------------------------------------------------*/
+typedef struct
+{
+    int32_t status;     /* 0 jump, 1 idle, 2 power cut, 3 setup failed, 4 wrong content, 5 no resume */
+    uint32_t address;
+} pc_result_t;
+
+typedef struct
+{
+    const char *name;
+    bool (*setup)(void);
+    uint32_t expected;      /* address the boot must jump to */
+    bool main_app;          /* partition the boot writes: main or boot */
+    uint32_t seed;          /* image the partition must hold */
+    uint32_t version;
+    uint8_t app_status;
+    uint32_t rollback_seed; /* image the rollback of main must hold, 0: not checked */
+} pc_scenario_t;
+
+/* Private variables ---------------------------------------------------------*/
+static bool s_verbose = false;
+
+/* main.cpp */
+extern partition_manager partition_mng;
+extern "C" int mbr_main(void);
+
+/* Private functions ---------------------------------------------------------*/
+/** @brief image of a partition: xorshift32 content, a vector table that
+ *         passes verifyVectorTable, its stack reserves the boot profile
+ */
+static void fillImage(std::vector<uint8_t> *image, uint32_t size, uint32_t addr, uint32_t seed)
+{
+    uint32_t x = seed ? seed : 1U;
+    uint32_t word[2] = {BOOT_PROFILE_REGION_ADDR, addr + 0x101U};
+    uint32_t i;
+
+    image->resize(size);
+    for (i = 0; i < size; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        (*image)[i] = (uint8_t)x;
+    }
+    memcpy(image->data(), word, sizeof(word));
+}
+
+/** @brief checksum of a header: size, type and version, then the image */
+static uint32_t imageChecksum(const firmwareHeader_t *header, const uint8_t *image, uint32_t size)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (const uint8_t *)&header->size, 12U);
+    CRC32_Update(&ctx, image, size);
+    return CRC32_Final(&ctx);
+}
+
+static uint32_t crc32Of(const uint8_t *data, uint32_t size)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, data, size);
+    return CRC32_Final(&ctx);
+}
+
+/** @brief program an image into main or boot like a programmer and record
+ *         it in the MBR, status OK
+ */
+static bool install(bool main_app, uint32_t seed, uint32_t version)
+{
+    MasterBootRecord mbr;
+    std::vector<uint8_t> image;
+    app_info_t app;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    app = main_app ? mbr.getMainParams() : mbr.getBootParams();
+    fillImage(&image, main_app ? PC_MAIN_SIZE : PC_BOOT_SIZE, app.startup_addr, seed);
+    if (!sim_internal_flash.load(image.data(), app.startup_addr, image.size()))
+    {
+        return false;
+    }
+    app.fw_header.size = image.size();
+    app.fw_header.version.u32 = version;
+    app.fw_header.checksum = imageChecksum(&app.fw_header, image.data(), image.size());
+    app.common.app_status = MasterBootRecord::APP_STATUS_OK;
+    if (main_app)
+    {
+        mbr.setMainParams(&app);
+    }
+    else
+    {
+        mbr.setBootParams(&app);
+    }
+    if (mbr.commit() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    mbr.end();
+    return true;
+}
+
+static bool setStartUpMode(MasterBootRecord::startup_mode_t mode)
+{
+    MasterBootRecord mbr;
+    bool status;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    mbr.setStartUpMode(mode);
+    status = (mbr.commit() == MasterBootRecord::MBR_OK);
+    mbr.end();
+    return status;
+}
+
+static bool installBoth(void)
+{
+    return install(true, PC_SEED_MAIN_OLD, PC_VERSION_OLD)
+        && install(false, PC_SEED_BOOT_OLD, PC_VERSION_OLD);
+}
+
+/* The download partition holds the new main, main the old one: the boot
+ * backs main up to its rollback (encrypted), then upgrades it
+ */
+static bool setupUpgradeMain(void)
+{
+    bool status;
+
+    if (!installBoth() || !install(true, PC_SEED_MAIN_NEW, PC_VERSION_NEW))
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain2ImageDownload();
+    partition_mng.end();
+    return status
+        && install(true, PC_SEED_MAIN_OLD, PC_VERSION_OLD)
+        && setStartUpMode(MasterBootRecord::UPGRADE_MODE);
+}
+
+/* The rollback holds the good main, main was replaced by another image */
+static bool setupMainRollback(void)
+{
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupMain();
+    partition_mng.end();
+    return status
+        && install(true, PC_SEED_MAIN_NEW, PC_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::MAIN_ROLLBACK_MODE);
+}
+
+static bool setupBootRollback(void)
+{
+    bool status;
+
+    if (!installBoth())
+    {
+        return false;
+    }
+    partition_mng.begin();
+    status = partition_mng.backupBoot();
+    partition_mng.end();
+    return status
+        && install(false, PC_SEED_BOOT_NEW, PC_VERSION_NEW)
+        && setStartUpMode(MasterBootRecord::BOOT_ROLLBACK_MODE);
+}
+
+static const pc_scenario_t s_scenarios[] = {
+    {"upgrade_main",  setupUpgradeMain,  MAIN_APPLICATION_ADDR,   true,  PC_SEED_MAIN_NEW, PC_VERSION_NEW,
+     MasterBootRecord::APP_STATUS_WAIT_CONFIRM, PC_SEED_MAIN_OLD},
+    {"main_rollback", setupMainRollback, MAIN_APPLICATION_ADDR,   true,  PC_SEED_MAIN_OLD, PC_VERSION_OLD,
+     MasterBootRecord::APP_STATUS_OK, 0},
+    {"boot_rollback", setupBootRollback, BOOTLOADER_FACTORY_ADDR, false, PC_SEED_BOOT_OLD, PC_VERSION_OLD,
+     MasterBootRecord::APP_STATUS_OK, 0},
+};
+
+/** @brief the partition written by the boot holds the image of the
+ *         scenario, its MBR header matches it
+ */
+static bool checkContent(const pc_scenario_t *scenario)
+{
+    MasterBootRecord mbr;
+    std::vector<uint8_t> image;
+    app_info_t app;
+    app_info_t rollback;
+    const uint8_t *content;
+    bool status;
+
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return false;
+    }
+    app = scenario->main_app ? mbr.getMainParams() : mbr.getBootParams();
+    rollback = mbr.getMainRollbackParams();
+    mbr.end();
+
+    fillImage(&image, scenario->main_app ? PC_MAIN_SIZE : PC_BOOT_SIZE, app.startup_addr, scenario->seed);
+    content = PM_INTERNAL_PTR(app.startup_addr);
+    if (app.fw_header.size != image.size()
+    || app.fw_header.version.u32 != scenario->version
+    || app.common.app_status != scenario->app_status
+    || crc32Of(content, image.size()) != crc32Of(image.data(), image.size())
+    || imageChecksum(&app.fw_header, content, image.size()) != app.fw_header.checksum)
+    {
+        fprintf(stderr, "%s: partition 0x%08X size %u version 0x%08X status %u\n", scenario->name,
+                app.startup_addr, app.fw_header.size, app.fw_header.version.u32, app.common.app_status);
+        return false;
+    }
+    if (0 == scenario->rollback_seed)
+    {
+        return true;
+    }
+
+    /* The rollback holds the main the upgrade replaced */
+    fillImage(&image, PC_MAIN_SIZE, MAIN_APPLICATION_ADDR, scenario->rollback_seed);
+    partition_mng.begin();
+    status = partition_mng.verifyMainRollback();
+    partition_mng.end();
+    if (!status
+    || MasterBootRecord::APP_STATUS_OK != rollback.common.app_status
+    || rollback.fw_header.version.u32 != PC_VERSION_OLD
+    || rollback.fw_header.size != image.size())
+    {
+        fprintf(stderr, "%s: rollback size %u version 0x%08X status %u\n", scenario->name,
+                rollback.fw_header.size, rollback.fw_header.version.u32, rollback.common.app_status);
+        return false;
+    }
+    return true;
+}
+
+static void printLog(FILE *log)
+{
+    char line[256];
+
+    rewind(log);
+    while (fgets(line, sizeof(line), log))
+    {
+        fputs(line, stderr);
+    }
+}
+
+/** @brief the log of the boot has the resume of the copy in the journal */
+static bool resumed(FILE *log, const copy_journal_t *journal)
+{
+    char line[256];
+    const char *text;
+    unsigned op;
+    unsigned block;
+
+    rewind(log);
+    while (fgets(line, sizeof(line), log))
+    {
+        text = strstr(line, PC_RESUME_LOG);
+        if (text != nullptr
+        && sscanf(text + strlen(PC_RESUME_LOG), "%u at block %u", &op, &block) == 2
+        && op == journal->common.op && block == journal->block)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** @brief child process: one boot of main.cpp, cut at the op-th program or
+ *         erase (0: no cut)
+ */
+static void bootChild(const pc_scenario_t *scenario, uint64_t cut, pc_result_t *result)
+{
+    MasterBootRecord mbr;
+    copy_journal_t journal;
+    FILE *log;
+
+    result->status = 3;
+    result->address = 0;
+    log = tmpfile();
+    if (log == nullptr || dup2(fileno(log), STDOUT_FILENO) < 0)
+    {
+        return;
+    }
+    if (mbr.begin() != MasterBootRecord::MBR_OK)
+    {
+        return;
+    }
+    journal = mbr.getJournal();
+    mbr.end();
+
+    SimBlockDevice::powerCutAfter(cut);
+    try
+    {
+        mbr_main();
+        result->status = 1;
+    }
+    catch (const sim_halt &halt)
+    {
+        result->address = halt.address;
+        result->status = halt.address ? 0 : 1;
+    }
+    catch (const sim_power_cut &power_cut)
+    {
+        result->status = 2;
+    }
+    SimBlockDevice::powerCutAfter(0);
+    fflush(stdout);
+    if (s_verbose)
+    {
+        printLog(log);
+    }
+
+    if (2 != result->status
+    && MasterBootRecord::JOURNAL_OP_NONE != journal.common.op
+    && !resumed(log, &journal))
+    {
+        fprintf(stderr, "%s: op %u at block %u not resumed\n", scenario->name, journal.common.op, journal.block);
+        result->status = 5;
+    }
+    if (0 == result->status && (result->address != scenario->expected || !checkContent(scenario)))
+    {
+        result->status = 4;
+    }
+}
+
+/** @brief set up or boot in a child process, the parts are shared with it
+ * @return false if the child didn't report
+ */
+static bool runChild(const pc_scenario_t *scenario, uint64_t cut, bool setup, pc_result_t *result)
+{
+    int fd[2];
+    pid_t pid;
+    int wstatus;
+    ssize_t length;
+
+    if (pipe(fd) != 0)
+    {
+        return false;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid == 0)
+    {
+        close(fd[0]);
+        if (setup)
+        {
+            /* The MBR log of the setup goes nowhere */
+            result->status = (freopen("/dev/null", "w", stdout) && scenario->setup()) ? 0 : 3;
+            result->address = 0;
+            fflush(stdout);
+        }
+        else
+        {
+            bootChild(scenario, cut, result);
+        }
+        length = write(fd[1], result, sizeof(pc_result_t));
+        /* The prefetch worker may still be blocked after a power cut */
+        _exit(length == (ssize_t)sizeof(pc_result_t) ? 0 : 3);
+    }
+    close(fd[1]);
+    length = (pid > 0) ? read(fd[0], result, sizeof(pc_result_t)) : -1;
+    close(fd[0]);
+    if (pid > 0)
+    {
+        waitpid(pid, &wstatus, 0);
+    }
+    return length == (ssize_t)sizeof(pc_result_t);
+}
+
+/** @brief content of both parts */
+static void snapshot(std::vector<uint8_t> *internal, std::vector<uint8_t> *external)
+{
+    internal->assign(sim_internal_flash.data(), sim_internal_flash.data() + sim_internal_flash.config().size);
+    external->assign(sim_external_flash.data(), sim_external_flash.data() + sim_external_flash.config().size);
+}
+
+static void restore(const std::vector<uint8_t> *internal, const std::vector<uint8_t> *external)
+{
+    memcpy(sim_internal_flash.data(), internal->data(), internal->size());
+    memcpy(sim_external_flash.data(), external->data(), external->size());
+}
+
+/** @brief cut the boot of a scenario at each program and erase, boot again
+ * @param cuts number of cuts done
+ */
+static bool runScenario(const pc_scenario_t *scenario, uint64_t *cuts)
+{
+    std::vector<uint8_t> internal;
+    std::vector<uint8_t> external;
+    pc_result_t result;
+    uint64_t cut;
+
+    *cuts = 0;
+    memset(sim_internal_flash.data(), 0xFF, sim_internal_flash.config().size);
+    memset(sim_external_flash.data(), 0xFF, sim_external_flash.config().size);
+    if (!runChild(scenario, 0, true, &result) || result.status != 0)
+    {
+        fprintf(stderr, "%s: setup failed\n", scenario->name);
+        return false;
+    }
+    snapshot(&internal, &external);
+
+    for (cut = 1; ; cut++)
+    {
+        restore(&internal, &external);
+        if (!runChild(scenario, cut, false, &result))
+        {
+            fprintf(stderr, "%s: cut at op %llu: no result\n", scenario->name, (unsigned long long)cut);
+            return false;
+        }
+        if (result.status != 2)
+        {
+            /* The boot ended before the cut: every op was cut */
+            if (result.status != 0)
+            {
+                fprintf(stderr, "%s: boot without a cut: status %d\n", scenario->name, result.status);
+                return false;
+            }
+            return true;
+        }
+        (*cuts)++;
+
+        /* The next boot resumes the copy and jumps */
+        if (!runChild(scenario, 0, false, &result) || result.status != 0)
+        {
+            fprintf(stderr, "%s: cut at op %llu: status %d, address 0x%08X\n", scenario->name,
+                    (unsigned long long)cut, result.status, result.address);
+            return false;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *only = nullptr;
+    char dir[] = "/tmp/powercut_XXXXXX";
+    std::string internal_path;
+    std::string external_path;
+    uint32_t failed = 0;
+    uint64_t cuts;
+    size_t i;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            only = optarg;
+            break;
+        case 'v':
+            s_verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s SCENARIO] [-v]\n", argv[0]);
+            return 3;
+        }
+    }
+
+    /* Shared with the boots, gone once the test exits */
+    if (mkdtemp(dir) == nullptr)
+    {
+        return 3;
+    }
+    internal_path = std::string(dir) + "/int.bin";
+    external_path = std::string(dir) + "/ext.bin";
+    if (!sim_flash_open(internal_path.c_str(), external_path.c_str()))
+    {
+        return 3;
+    }
+    unlink(internal_path.c_str());
+    unlink(external_path.c_str());
+    rmdir(dir);
+
+    for (i = 0; i < sizeof(s_scenarios) / sizeof(s_scenarios[0]); i++)
+    {
+        if (only != nullptr && strcmp(only, s_scenarios[i].name) != 0)
+        {
+            continue;
+        }
+        if (!runScenario(&s_scenarios[i], &cuts))
+        {
+            fprintf(stderr, "powercut: %s FAIL\n", s_scenarios[i].name);
+            failed++;
+        }
+        else
+        {
+            printf("powercut: %s ok, %llu cuts\n", s_scenarios[i].name, (unsigned long long)cuts);
+        }
+    }
+    sim_flash_close();
+    return failed ? 1 : 0;
+}
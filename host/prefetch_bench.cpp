@@ -0,0 +1,152 @@
+/** @file prefetch_bench.cpp
+ *  @brief Overlap of BlockPrefetcher: the copy loop of programApp (read the
+ *         SPI NOR, decrypt, erase and program the internal flash) run
+ *         serially, then with the next block read by the prefetch thread,
+ *         on the simulated parts sleeping their latencies. JSON line
+ *
+ *    prefetch_bench [-n BLOCKS] [-w DECRYPT_US] [-x DEV.FIELD=N]...
+ *
+ *  -w is the consumer CPU time per block (AES-CBC of 4K is some 4.4ms at
+ *  64MHz), -x the timing of the parts as mbr_host -o.
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "block_prefetcher.h"
+#include "sim_flash.h"
+#include <chrono>
+#include <stdlib.h>
+#include <thread>
+#include <unistd.h>
+
+/* Private define ------------------------------------------------------------*/
+#define PREFETCH_BENCH_BLOCK    4096U
+#define PREFETCH_BENCH_SRC      0x4B000UL   /* MAIN_APPLICATION_ROLLBACK_ADDR */
+#define PREFETCH_BENCH_DES      0x61000UL   /* MAIN_APPLICATION_ADDR */
+
+/* Private variables ---------------------------------------------------------*/
+static uint8_t s_buffer[PM_PREFETCH_BUFFER_NUM * PREFETCH_BENCH_BLOCK];
+static uint32_t s_decrypt_us = 4400;
+
+/* Private functions ---------------------------------------------------------*/
+static int readSource(void *buffer, uint32_t addr, uint32_t size)
+{
+    return sim_external_flash.read(buffer, addr, size);
+}
+
+static uint64_t nowUs(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** @brief consumer work of a block: decrypt, erase and program the des */
+static bool processBlock(const uint8_t *data, uint32_t addr, uint32_t length)
+{
+    uint32_t des = PREFETCH_BENCH_DES + (addr - PREFETCH_BENCH_SRC);
+
+    std::this_thread::sleep_for(std::chrono::microseconds(s_decrypt_us));
+    return SIM_BD_ERROR_OK == sim_internal_flash.erase(des, PREFETCH_BENCH_BLOCK)
+        && SIM_BD_ERROR_OK == sim_internal_flash.program(data, des, length);
+}
+
+static bool copySerial(uint32_t blocks)
+{
+    uint32_t addr;
+
+    for (addr = PREFETCH_BENCH_SRC; addr < PREFETCH_BENCH_SRC + blocks * PREFETCH_BENCH_BLOCK; addr += PREFETCH_BENCH_BLOCK)
+    {
+        if (SIM_BD_ERROR_OK != readSource(s_buffer, addr, PREFETCH_BENCH_BLOCK)
+        || !processBlock(s_buffer, addr, PREFETCH_BENCH_BLOCK))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool copyPrefetch(BlockPrefetcher *prefetcher, uint32_t blocks)
+{
+    uint8_t *data;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t count = 0;
+
+    prefetcher->start(callback(readSource), s_buffer, PREFETCH_BENCH_BLOCK,
+                      PREFETCH_BENCH_SRC, PREFETCH_BENCH_SRC + blocks * PREFETCH_BENCH_BLOCK);
+    while ((data = prefetcher->next(&addr, &length)) != nullptr)
+    {
+        if (!processBlock(data, addr, length))
+        {
+            break;
+        }
+        count++;
+    }
+    prefetcher->stop();
+    return count == blocks;
+}
+
+int main(int argc, char *argv[])
+{
+    BlockPrefetcher prefetcher;
+    BlockPrefetcher::stats_t stats;
+    uint32_t blocks = 16;
+    uint64_t start;
+    uint64_t serial_us;
+    uint64_t prefetch_us;
+    bool status_isOK;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            blocks = strtoul(optarg, nullptr, 0);
+            break;
+        case 'w':
+            s_decrypt_us = strtoul(optarg, nullptr, 0);
+            break;
+        case 'x':
+            if (sim_flash_option(optarg))
+            {
+                break;
+            }
+            /* fall through */
+        default:
+            fprintf(stderr, "usage: %s [-n BLOCKS] [-w DECRYPT_US] [-x DEV.FIELD=N]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!sim_flash_open(nullptr, nullptr))
+    {
+        return 2;
+    }
+    SimBlockDevice::realtime(true);
+
+    start = nowUs();
+    status_isOK = copySerial(blocks);
+    serial_us = nowUs() - start;
+
+    start = nowUs();
+    status_isOK = copyPrefetch(&prefetcher, blocks) && status_isOK;
+    prefetch_us = nowUs() - start;
+    stats = prefetcher.stats();
+    prefetcher.end();
+
+    printf("{\"bench\": \"prefetch\", \"prefetch\": %u, \"blocks\": %u, \"decrypt_us\": %u, "
+           "\"ext_read_ns_per_byte\": %u, \"int_program_ns\": %u, \"int_erase_ns\": %u, "
+           "\"serial_us\": %llu, \"prefetch_us\": %llu, \"read_us\": %u, \"wait_us\": %u, "
+           "\"overlap_pct\": %u, \"speedup\": %.2f, \"ok\": %s}\n",
+           (unsigned)PM_COPY_PREFETCH, blocks, s_decrypt_us,
+           sim_external_flash.config().read_ns_per_byte,
+           sim_internal_flash.config().program_ns,
+           sim_internal_flash.config().erase_ns,
+           (unsigned long long)serial_us, (unsigned long long)prefetch_us,
+           stats.read_us, stats.wait_us, prefetcher.overlapPercent(),
+           prefetch_us ? (double)serial_us / (double)prefetch_us : 0.0,
+           status_isOK ? "true" : "false");
+    fflush(stdout);
+    sim_flash_close();
+    _exit(status_isOK ? 0 : 1);
+}
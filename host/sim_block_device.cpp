@@ -0,0 +1,266 @@
+/* Includes ------------------------------------------------------------------*/
+#include "sim_block_device.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+/* Private variables ---------------------------------------------------------*/
+static std::atomic<uint64_t> s_cut_countdown(0);
+static std::atomic<bool> s_realtime(false);
+static std::atomic<uint64_t> s_clock_ns(0);
+
+SimBlockDevice::SimBlockDevice(const char *name, const SimBlockDevice::config_t &config)
+: _name(name),
+_config(config),
+_data(nullptr),
+_fd(-1)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+SimBlockDevice::~SimBlockDevice()
+{
+    close();
+}
+
+bool SimBlockDevice::open(const char *path)
+{
+    struct stat st;
+    void *map;
+    uint64_t old_size = 0;
+
+    close();
+    if (path == nullptr)
+    {
+        map = mmap(nullptr, _config.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            return false;
+        }
+        _data = (uint8_t *)map;
+        memset(_data, 0xFF, _config.size);
+        return true;
+    }
+
+    _fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (_fd < 0 || fstat(_fd, &st) != 0)
+    {
+        fprintf(stderr, "sim %s: can't open %s\n", _name, path);
+        close();
+        return false;
+    }
+    old_size = (uint64_t)st.st_size;
+    if (old_size != _config.size && ftruncate(_fd, _config.size) != 0)
+    {
+        close();
+        return false;
+    }
+    map = mmap(nullptr, _config.size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    _data = (uint8_t *)map;
+    /* A new file or the grown tail is erased flash */
+    if (old_size < _config.size)
+    {
+        memset(_data + old_size, 0xFF, _config.size - old_size);
+    }
+    return true;
+} // open
+
+void SimBlockDevice::close(void)
+{
+    if (_data != nullptr)
+    {
+        if (_fd >= 0)
+        {
+            msync(_data, _config.size, MS_SYNC);
+        }
+        munmap(_data, _config.size);
+        _data = nullptr;
+    }
+    if (_fd >= 0)
+    {
+        ::close(_fd);
+        _fd = -1;
+    }
+} // close
+
+void SimBlockDevice::configure(const SimBlockDevice::config_t &config)
+{
+    uint64_t size = _config.size;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _config = config;
+    if (_data != nullptr)
+    {
+        /* The mapping keeps its size */
+        _config.size = size;
+    }
+}
+
+int SimBlockDevice::read(void *buffer, uint64_t addr, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!aligned(addr, size, _config.read_size, "read"))
+    {
+        return SIM_BD_ERROR_DEVICE_ERROR;
+    }
+    memcpy(buffer, _data + addr, size);
+    _stats.reads++;
+    _stats.read_bytes += size;
+    charge(_config.read_setup_ns + size * _config.read_ns_per_byte);
+    return SIM_BD_ERROR_OK;
+} // read
+
+int SimBlockDevice::program(const void *buffer, uint64_t addr, uint64_t size)
+{
+    const uint8_t *src = (const uint8_t *)buffer;
+    uint64_t pages;
+    uint64_t i;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!aligned(addr, size, _config.program_size, "program"))
+    {
+        return SIM_BD_ERROR_DEVICE_ERROR;
+    }
+    cut(addr);
+    for (i = 0; i < size; i++)
+    {
+        if (_data[addr + i] != 0xFF)
+        {
+            _stats.reprogram_bytes++;
+        }
+        /* NOR: a program only clears bits */
+        _data[addr + i] &= src[i];
+    }
+    pages = size ? (addr + size - 1) / _config.page_size - addr / _config.page_size + 1 : 0;
+    _stats.programs++;
+    _stats.program_bytes += size;
+    charge(pages * _config.program_ns + size * _config.program_ns_per_byte);
+    return SIM_BD_ERROR_OK;
+} // program
+
+int SimBlockDevice::erase(uint64_t addr, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!aligned(addr, size, _config.erase_size, "erase"))
+    {
+        return SIM_BD_ERROR_DEVICE_ERROR;
+    }
+    /* Like SPIFBlockDevice: one command per step, the largest aligned
+     * erase of the part that fits in the range
+     */
+    while (size > 0)
+    {
+        uint64_t step = _config.erase_size;
+        uint32_t ns = _config.erase_ns;
+
+        if (_config.block64_erase_ns && addr % 0x10000U == 0 && size >= 0x10000U)
+        {
+            step = 0x10000U;
+            ns = _config.block64_erase_ns;
+        }
+        else if (_config.block32_erase_ns && addr % 0x8000U == 0 && size >= 0x8000U)
+        {
+            step = 0x8000U;
+            ns = _config.block32_erase_ns;
+        }
+        cut(addr);
+        memset(_data + addr, 0xFF, step);
+        _stats.erases++;
+        _stats.erase_bytes += step;
+        charge(ns);
+        addr += step;
+        size -= step;
+    }
+    return SIM_BD_ERROR_OK;
+} // erase
+
+bool SimBlockDevice::load(const void *buffer, uint64_t addr, uint64_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_data == nullptr || addr + size > _config.size || addr + size < addr)
+    {
+        return false;
+    }
+    memcpy(_data + addr, buffer, size);
+    return true;
+}
+
+SimBlockDevice::stats_t SimBlockDevice::stats(void)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void SimBlockDevice::resetStats(void)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void SimBlockDevice::powerCutAfter(uint64_t operations)
+{
+    s_cut_countdown = operations;
+}
+
+void SimBlockDevice::realtime(bool enable)
+{
+    s_realtime = enable;
+}
+
+/** @brief range and alignment check of an operation, a rejected one is
+ *         logged and counted like a driver error
+ */
+bool SimBlockDevice::aligned(uint64_t addr, uint64_t size, uint32_t unit, const char *op)
+{
+    if (_data != nullptr
+    && addr + size <= _config.size && addr + size >= addr
+    && addr % unit == 0 && size % unit == 0)
+    {
+        return true;
+    }
+    _stats.errors++;
+    fprintf(stderr, "sim %s: %s 0x%08llX size %llu rejected (%s, unit %u)\n",
+            _name, op, (unsigned long long)addr, (unsigned long long)size,
+            _data == nullptr ? "not open" : "range/alignment", unit);
+    return false;
+} // aligned
+
+uint64_t SimBlockDevice::clockNs(void)
+{
+    return s_clock_ns.load();
+}
+
+void SimBlockDevice::charge(uint64_t ns)
+{
+    _stats.busy_ns += ns;
+    s_clock_ns += ns;
+    if (s_realtime && ns != 0)
+    {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(ns));
+    }
+}
+
+void SimBlockDevice::cut(uint64_t addr)
+{
+    uint64_t remain = s_cut_countdown.load();
+
+    while (remain != 0 && !s_cut_countdown.compare_exchange_weak(remain, remain - 1))
+    {
+    }
+    if (remain == 1)
+    {
+        _stats.errors++;
+        throw sim_power_cut{_name, addr};
+    }
+}
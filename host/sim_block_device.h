@@ -0,0 +1,121 @@
+/** @file sim_block_device.h
+ *  @brief Simulated NOR flash of the host build: erase sets 0xFF, program
+ *         only clears bits, reads/programs/erases must be aligned to the
+ *         read/program/erase size. The content is in RAM or in a file
+ *         (mmap, kept across runs). Every operation is charged to a latency
+ *         model and counted.
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SIM_BLOCK_DEVICE_H
+#define __SIM_BLOCK_DEVICE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+/* Exported macro ------------------------------------------------------------*/
+#define SIM_BD_ERROR_OK            0
+#define SIM_BD_ERROR_DEVICE_ERROR  -4001
+
+/* Exported types ------------------------------------------------------------*/
+class SimBlockDevice
+{
+public:
+    /** Geometry and timing of the part */
+    typedef struct
+    {
+        uint64_t size;              /* bytes */
+        uint32_t read_size;         /* read alignment */
+        uint32_t program_size;      /* program alignment */
+        uint32_t page_size;         /* program page, one program latency per page touched */
+        uint32_t erase_size;        /* erase block */
+        uint32_t read_setup_ns;     /* per read command */
+        uint32_t read_ns_per_byte;
+        uint32_t program_ns;        /* per page */
+        uint32_t program_ns_per_byte;
+        uint32_t erase_ns;          /* per erase block */
+        uint32_t block32_erase_ns;  /* per aligned 32K, 0: no 32K erase */
+        uint32_t block64_erase_ns;  /* per aligned 64K, 0: no 64K erase */
+    } config_t;
+
+    typedef struct
+    {
+        uint64_t reads;
+        uint64_t read_bytes;
+        uint64_t programs;
+        uint64_t program_bytes;
+        uint64_t reprogram_bytes;   /* bytes programmed while not erased */
+        uint64_t erases;            /* erase commands */
+        uint64_t erase_bytes;
+        uint64_t errors;            /* rejected operations */
+        uint64_t busy_ns;           /* simulated time of the operations */
+    } stats_t;
+
+    SimBlockDevice(const char *name, const config_t &config);
+    ~SimBlockDevice();
+
+    /** Map the content
+     * @param path file kept across runs, created erased. nullptr: RAM only
+     * @return false if the file can't be mapped
+     */
+    bool open(const char *path);
+
+    /** Unmap the content, the file is synced */
+    void close(void);
+
+    /** Change the geometry or the timing, before open() only for the size */
+    void configure(const config_t &config);
+
+    int read(void *buffer, uint64_t addr, uint64_t size);
+    int program(const void *buffer, uint64_t addr, uint64_t size);
+    int erase(uint64_t addr, uint64_t size);
+
+    /** Write without NOR rules or stats, a programmer loading an image
+     * @return false if out of range
+     */
+    bool load(const void *buffer, uint64_t addr, uint64_t size);
+
+    /** Content, the memory map of an internal flash */
+    uint8_t *data(void) { return _data; }
+
+    const char *name(void) const { return _name; }
+    const config_t &config(void) const { return _config; }
+    stats_t stats(void);
+    void resetStats(void);
+
+    /** Power cut: the n-th program or erase of any device from now on is
+     *  not done and the process unwinds with sim_power_cut. 0: never
+     */
+    static void powerCutAfter(uint64_t operations);
+
+    /** Sleep the simulated time of each operation, so the prefetch thread
+     *  overlaps reads like on target. Off: the time is only counted
+     */
+    static void realtime(bool enable);
+
+    /** Simulated time of all the operations of all the devices, never reset */
+    static uint64_t clockNs(void);
+
+private:
+    bool aligned(uint64_t addr, uint64_t size, uint32_t unit, const char *op);
+    void charge(uint64_t ns);
+    void cut(uint64_t addr);
+
+    const char *_name;
+    config_t _config;
+    uint8_t *_data;
+    int _fd;
+    std::mutex _mutex;
+    stats_t _stats;
+};
+
+/** Thrown at a power cut, main() of the host build catches it */
+struct sim_power_cut
+{
+    const char *device;
+    uint64_t addr;
+};
+
+#endif /* __SIM_BLOCK_DEVICE_H */
@@ -0,0 +1,151 @@
+/* Includes ------------------------------------------------------------------*/
+#include "sim_flash.h"
+#include "mem_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Private define ------------------------------------------------------------*/
+/** nRF52840 product specification, NVMC maxima: tWRITE 41us per word,
+ *  tERASEPAGE 85ms. Reads are memory mapped, one word per 16ns at 64MHz
+ */
+static const SimBlockDevice::config_t s_internal_config = {
+    DEVICE_MEMORY_SIZE,     /* size */
+    1,                      /* read_size */
+    4,                      /* program_size */
+    4,                      /* page_size */
+    DEVICE_PAGE_ERASE_SIZE, /* erase_size */
+    0,                      /* read_setup_ns */
+    4,                      /* read_ns_per_byte */
+    41000,                  /* program_ns */
+    0,                      /* program_ns_per_byte */
+    85000000,               /* erase_ns */
+    0,                      /* block32_erase_ns */
+    0                       /* block64_erase_ns */
+};
+
+/** MX25R6435F (nRF52840-DK) in high performance mode, typical: page program
+ *  0.85ms, 4K sector erase 40ms. The 32K/64K block erases are taken as
+ *  120ms/150ms, common SPI NOR figures. SPIM at 8MHz: 1us per byte plus the
+ *  command and address bytes
+ */
+static const SimBlockDevice::config_t s_external_config = {
+    EX_FLASH_MEMORY_SIZE,   /* size */
+    1,                      /* read_size */
+    1,                      /* program_size */
+    256,                    /* page_size */
+    EX_FLASH_PAGE_ERASE_SIZE, /* erase_size */
+    5000,                   /* read_setup_ns */
+    1000,                   /* read_ns_per_byte */
+    850000,                 /* program_ns */
+    1000,                   /* program_ns_per_byte */
+    40000000,               /* erase_ns */
+    120000000,              /* block32_erase_ns */
+    150000000               /* block64_erase_ns */
+};
+
+typedef struct
+{
+    const char *name;
+    size_t offset;
+    size_t width;
+} sim_field_t;
+
+#define SIM_FIELD(f) {#f, offsetof(SimBlockDevice::config_t, f), sizeof(((SimBlockDevice::config_t*)0)->f)}
+
+static const sim_field_t s_fields[] = {
+    SIM_FIELD(size),
+    SIM_FIELD(read_size),
+    SIM_FIELD(program_size),
+    SIM_FIELD(page_size),
+    SIM_FIELD(erase_size),
+    SIM_FIELD(read_setup_ns),
+    SIM_FIELD(read_ns_per_byte),
+    SIM_FIELD(program_ns),
+    SIM_FIELD(program_ns_per_byte),
+    SIM_FIELD(erase_ns),
+    SIM_FIELD(block32_erase_ns),
+    SIM_FIELD(block64_erase_ns),
+};
+
+/* Exported variables --------------------------------------------------------*/
+SimBlockDevice sim_internal_flash("int", s_internal_config);
+SimBlockDevice sim_external_flash("ext", s_external_config);
+
+uint8_t *sim_internal_ptr(uint32_t addr)
+{
+    if (sim_internal_flash.data() == nullptr || addr >= sim_internal_flash.config().size)
+    {
+        fprintf(stderr, "sim int: memory map 0x%08X out of range\n", addr);
+        abort();
+    }
+    return sim_internal_flash.data() + addr;
+}
+
+bool sim_flash_option(const char *option)
+{
+    SimBlockDevice *device;
+    SimBlockDevice::config_t config;
+    const char *field;
+    const char *value;
+    unsigned long long number;
+    size_t i;
+
+    if (strncmp(option, "int.", 4) == 0)
+    {
+        device = &sim_internal_flash;
+    }
+    else if (strncmp(option, "ext.", 4) == 0)
+    {
+        device = &sim_external_flash;
+    }
+    else
+    {
+        return false;
+    }
+    field = option + 4;
+    value = strchr(field, '=');
+    if (value == nullptr)
+    {
+        return false;
+    }
+    number = strtoull(value + 1, nullptr, 0);
+
+    config = device->config();
+    for (i = 0; i < sizeof(s_fields) / sizeof(s_fields[0]); i++)
+    {
+        if (strlen(s_fields[i].name) == (size_t)(value - field)
+        && strncmp(s_fields[i].name, field, value - field) == 0)
+        {
+            if (s_fields[i].width == sizeof(uint64_t))
+            {
+                *(uint64_t *)((uint8_t *)&config + s_fields[i].offset) = number;
+            }
+            else
+            {
+                *(uint32_t *)((uint8_t *)&config + s_fields[i].offset) = (uint32_t)number;
+            }
+            /* A unit of 0 would divide by zero */
+            if (config.read_size == 0 || config.program_size == 0
+            || config.page_size == 0 || config.erase_size == 0)
+            {
+                return false;
+            }
+            device->configure(config);
+            return true;
+        }
+    }
+    return false;
+} // sim_flash_option
+
+bool sim_flash_open(const char *internal_path, const char *external_path)
+{
+    return sim_internal_flash.open(internal_path)
+        && sim_external_flash.open(external_path);
+}
+
+void sim_flash_close(void)
+{
+    sim_internal_flash.close();
+    sim_external_flash.close();
+}
@@ -0,0 +1,44 @@
+/** @file sim_flash.h
+ *  @brief Flash parts of the host build: the nRF52840 internal flash behind
+ *         FlashIAPBlockDevice and the memory map, the SPI NOR behind
+ *         SPIFBlockDevice
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SIM_FLASH_H
+#define __SIM_FLASH_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "sim_block_device.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** Internal flash reads of partition_manager go to the simulated content */
+#define PM_INTERNAL_PTR(addr) ((const uint8_t*)sim_internal_ptr((uint32_t)(addr)))
+
+/* Exported variables --------------------------------------------------------*/
+/** nRF52840 NVMC: 1M, 4K pages, word writes */
+extern SimBlockDevice sim_internal_flash;
+
+/** SPI NOR: 8M, 4K sectors, 256-byte pages */
+extern SimBlockDevice sim_external_flash;
+
+/* Exported functions --------------------------------------------------------*/
+/** Memory map of the internal flash, addr out of range aborts */
+uint8_t *sim_internal_ptr(uint32_t addr);
+
+/** Set a geometry or timing field, "int.erase_ns=85000000",
+ *  "ext.page_size=256"; devices: int, ext; fields: the ones of
+ *  SimBlockDevice::config_t
+ * @return false if the device or the field is unknown
+ */
+bool sim_flash_option(const char *option);
+
+/** Map both parts
+ * @param internal_path file of the internal flash, nullptr: RAM
+ * @param external_path file of the SPI NOR, nullptr: RAM
+ */
+bool sim_flash_open(const char *internal_path, const char *external_path);
+
+void sim_flash_close(void);
+
+#endif /* __SIM_FLASH_H */
@@ -88,6 +88,31 @@ int FlashSPIBlockDevice::erase(uint32_t addr, uint32_t size)
     return SPIF_BD_ERROR_DEVICE_ERROR;
 }
 
+/** Size of the next step of a range erase
+ *
+ *  @param spiDevice Device
+ *  @param addr     Address of the device, on a sector
+ *  @param size     Bytes left to erase, a multiple of the sector size
+ *  @return         Bytes up to the next F_SPIBLOCK_ERASE_CHUNK_SIZE boundary,
+ *                  at most size, 0 if addr or size isn't on a sector
+ */
+uint32_t FlashSPIBlockDevice::eraseStep(SPIFBlockDevice* spiDevice, uint32_t addr, uint32_t size)
+{
+    uint32_t sector = spiDevice->get_erase_size();
+    uint32_t step;
+
+    if (sector == 0 || (addr % sector) != 0 || size < sector)
+    {
+        return 0;
+    }
+    if (F_SPIBLOCK_ERASE_CHUNK_SIZE <= sector)
+    {
+        return sector;
+    }
+    step = F_SPIBLOCK_ERASE_CHUNK_SIZE - (addr % F_SPIBLOCK_ERASE_CHUNK_SIZE);
+    return (step < size) ? step : (size - (size % sector));
+} // eraseStep
+
 /** Get the size of a readable block
  *
  *  @return         Size of a readable block in bytes
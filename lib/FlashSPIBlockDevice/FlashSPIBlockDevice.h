@@ -10,6 +10,17 @@
 #define F_SPIBLOCK_PRINTF(...) CONSOLE_LOGI(__VA_ARGS__)
 #define F_SPIBLOCK_TAG_PRINTF(...) CONSOLE_TAG_LOGI("[F_SPIBLOCK]", __VA_ARGS__)
 
+/** Range erases are cut at this boundary (eraseStep), the pre-erase skips a
+ *  step already blank. SPIFBlockDevice::erase covers a step with the largest
+ *  erase types of the SFDP sector map that fit it (4K/32K/64K), the chunk
+ *  only sets the planning granularity: SPIFBlockDevice doesn't export its
+ *  erase types, 64K is the largest block erase of SPI NOR parts.
+ *  A multiple of the sector size.
+ */
+#ifndef F_SPIBLOCK_ERASE_CHUNK_SIZE
+#define F_SPIBLOCK_ERASE_CHUNK_SIZE 0x10000U
+#endif
+
 class FlashSPIBlockDevice
 {
 public:
@@ -26,6 +37,12 @@ public:
     uint32_t get_erase_size(void) const;
     uint32_t size(void) const;
 
+    /** Erase planner: the bytes from addr of the device to the next
+     *  F_SPIBLOCK_ERASE_CHUNK_SIZE boundary, at most size, 0 if addr isn't
+     *  on a sector
+     */
+    static uint32_t eraseStep(SPIFBlockDevice* spiDevice, uint32_t addr, uint32_t size);
+
 private:
     bool is_valid(uint32_t addr, uint32_t size);
     SPIFBlockDevice* _spiDevice;
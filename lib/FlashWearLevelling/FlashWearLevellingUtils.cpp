@@ -6,29 +6,101 @@
  */
 static uint32_t fwl_header_crc32(memory_cxt_t* mem)
 {
+    crc32_ctx_t ctx;
     uint32_t crc;
 
-    CRC32_Start(0);
+    CRC32_Init(&ctx);
     /* Calculator CRC 12-byte of header*/
-    CRC32_Accumulate((uint8_t *) &(mem->header.nextAddr), 12U);
-    CRC32_Accumulate((uint8_t *) mem->data.pBuffer, mem->data.length);
-    crc = CRC32_Get();
+    CRC32_Update(&ctx, (uint8_t *) &(mem->header.nextAddr), 12U);
+    CRC32_Update(&ctx, (uint8_t *) mem->data.pBuffer, mem->data.length);
+    crc = CRC32_Final(&ctx);
     
     FWL_TAG_INFO("CRC32: %08X", crc);
     return crc;
 } // fwl_header_crc32
 
+/**
+ * @brief Calculator CRC32 of a page header.
+ */
+static uint32_t fwl_page_crc32(fwl_page_header_t* page)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    /* Calculator CRC 12-byte erase_count, magic and seq */
+    CRC32_Update(&ctx, (uint8_t *) &(page->erase_count), 12U);
+    return CRC32_Final(&ctx);
+} // fwl_page_crc32
+
+/**
+ * @brief Serial number arithmetic, true if seq a is newer than seq b.
+ */
+static bool fwl_seq_after(uint32_t a, uint32_t b)
+{
+    return ((int32_t)(a - b) > 0);
+} // fwl_seq_after
+
+/**
+ * @brief Check a buffer read from flash is erased.
+ */
+static bool fwl_is_blank(const uint8_t *buff, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if (0xFF != buff[i])
+        {
+            return false;
+        }
+    }
+    return true;
+} // fwl_is_blank
+
+/**
+ * @brief Check the flash read in from can be programmed to the bytes of to,
+ *        programming only clears bits.
+ */
+static bool fwl_is_programmable(const uint8_t *from, const uint8_t *to, uint16_t length)
+{
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if ((from[i] & to[i]) != to[i])
+        {
+            return false;
+        }
+    }
+    return true;
+} // fwl_is_programmable
+
+/**
+ * @brief Calculator CRC32 of a buffer.
+ */
+static uint32_t fwl_crc32(const uint8_t *buff, uint16_t length)
+{
+    crc32_ctx_t ctx;
+
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (uint8_t *)buff, length);
+    return CRC32_Final(&ctx);
+} // fwl_crc32
+
 FlashWearLevellingUtils::
     FlashWearLevellingUtils(uint32_t start_addr,
                             size_t memory_size,
                             uint16_t page_erase_size,
-                            uint16_t data_length) : _start_addr(start_addr),
-                                                  _memory_size(memory_size),
-                                                  _page_erase_size(page_erase_size),
+                            uint16_t data_length,
+                            uint16_t reserved_length) : _data_length(data_length),
                                                   _header2data_offset_length(16U),
-                                                  _data_length(data_length)
+                                                  _memory_size(memory_size),
+                                                  _start_addr(start_addr),
+                                                  _page_erase_size(page_erase_size)
 {
     _pCallbacks = &defaultCallback;
+    _page_num = (_page_erase_size) ? (_memory_size / _page_erase_size) : 0;
+    _reserved_length = reserved_length;
+    _active_page = FWL_PAGE_NONE;
+    _active_seq = 0;
+    _write_addr = _start_addr;
+    _next_ready = false;
     headerDefault();
 } // FlashWearLevellingUtils
 
@@ -72,157 +144,964 @@ bool FlashWearLevellingUtils::begin(bool formatOnFail)
         }
     }
 
+    /* A cut during the erase of the last page leaves the reserved bytes in their copy */
+    if (_reserved_length > 0)
+    {
+        uint8_t reserved[FWL_RESERVED_LENGTH_MAX];
+
+        if (!loadReserved(reserved) || !syncReserved(reserved))
+        {
+            FWL_TAG_INFO("[begin] reserved bytes failed!");
+            return false;
+        }
+    }
+
     return true;
 } // begin
 
 /**
  * Format memory type as factory
+ * Every page is erased, the erase counters are kept. A blank page isn't
+ * erased, the reserved bytes at the end of the region are kept.
 */
 bool FlashWearLevellingUtils::format()
 {
-    bool format = true;
+    uint16_t page;
+
+    _active_page = FWL_PAGE_NONE;
+    _active_seq = 0;
+    _next_ready = false;
+    for (page = 0; page < _page_num; page++)
+    {
+        FWL_TAG_INFO("[format] page %u", page);
+        if (!preparePage(page))
+        {
+            FWL_TAG_INFO("[format] erase failed!");
+            return false;
+        }
+    }
+    return true;
+} // format
+
+/**
+ * Return memory information current
+*/
+memory_cxt_t FlashWearLevellingUtils::info()
+{
+    return _memory_cxt;
+} // info
+
+/** Write data to a region allocated
+ * 
+ *  @param buff     Buffer of data to write
+ *  @param length   Size to write in bytes
+ *  @return         True if read is succeed
+ */
+bool FlashWearLevellingUtils::write(uint8_t *buff, uint16_t *length)
+{
+    if (!verifyMemInfo())
+    {
+        FWL_TAG_INFO("[write] memory info Failed!");
+        return false;
+    }
+
+    if ((*length > MEMORY_LENGTH_MAX) || (0 == *length)
+        || ((FWL_PAGE_HEADER_LENGTH + _header2data_offset_length + *length) > (uint32_t)(_page_erase_size - mirrorLength())))
+    {
+        FWL_TAG_INFO("[write] Data length failed!");
+        return false;
+    }
+
+    memory_cxt_t w_memory = _memory_cxt;
+    w_memory.data.pBuffer = buff;
+    w_memory.data.length = *length;
+    if (appendRecord(&w_memory))
+    {
+        _memory_cxt = w_memory;
+        return true;
+    }
+    return false;
+} // write
+
+/**
+ * Erase the page following the active page while the device is idle.
+ * The newest record stays in the active page, and the next page switch of
+ * write() doesn't have to erase.
+ */
+bool FlashWearLevellingUtils::prepare()
+{
+    uint16_t next;
+
+    if ((FWL_PAGE_NONE == _active_page) || _next_ready)
+    {
+        return true;
+    }
+
+    next = (_active_page + 1) % _page_num;
+    if (!preparePage(next))
+    {
+        FWL_TAG_INFO("[prepare] page %u failed!", next);
+        return false;
+    }
+    _next_ready = true;
+    return true;
+} // prepare
+
+/**
+ * Get the erase counter of every page
+ *
+ *  @param counts   Buffer of counters, one per page
+ *  @param pages    In: buffer length, out: number of pages
+ *  @return         True if succeed
+ */
+bool FlashWearLevellingUtils::wearHistogram(uint32_t *counts, uint16_t *pages)
+{
+    fwl_page_header_t page_header;
+    uint16_t page;
+
+    if (*pages < _page_num)
+    {
+        return false;
+    }
+
+    for (page = 0; page < _page_num; page++)
+    {
+        counts[page] = 0;
+        if (loadPageHeader(page, &page_header) && (0xFFFFFFFF != page_header.erase_count))
+        {
+            counts[page] = page_header.erase_count;
+        }
+    }
+    *pages = _page_num;
+    return true;
+} // wearHistogram
+
+/** Read data from a region allocated
+ * 
+ *  @param buff     Buffer of data to read
+ *  @param length   Size to read in bytes
+ *  @return         True if read is succeed
+ */
+bool FlashWearLevellingUtils::read(uint8_t *buff, uint16_t *length)
+{
+    if (!verifyMemInfo())
+    {
+        FWL_TAG_INFO("[read] memory info Failed!");
+        return false;
+    }
+
+    if ((*length) < _memory_cxt.header.dataLength)
+    {
+        FWL_TAG_INFO("[read] length buffer is not enough!");
+        return false;
+    }
+
+    FWL_TAG_INFO("[read] load data");
+    /* Read data */
+    _memory_cxt.data.pBuffer = buff;
+    /* The data length must be equal header data length */
+    _memory_cxt.data.length = _memory_cxt.header.dataLength;
+    if (!loadData(&_memory_cxt))
+    {
+        FWL_TAG_INFO("[read] Data failed!");
+        return false;
+    }
+
+    FWL_TAG_INFO("[read] data length: %u", _memory_cxt.data.length);
+    *length = _memory_cxt.data.length;
+
+    return true;
+} // read
+
+/**
+ * @brief Set the callback handlers for this flash memory.
+ * @param [in] pCallbacks An instance of a callbacks structure used to define any callbacks for the flash memory.
+ */
+void FlashWearLevellingUtils::setCallbacks(FlashWearLevellingCallbacks *pCallbacks)
+{
+    if (pCallbacks != nullptr)
+    {
+        _pCallbacks = pCallbacks;
+    }
+    else
+    {
+        _pCallbacks = &defaultCallback;
+    }
+    FWL_TAG_INFO(">> setCallbacks: 0x%x << setCallbacks", (uint32_t)_pCallbacks);
+} // setCallbacks
+
+/**
+ * @brief Find last header information.
+ */
+bool FlashWearLevellingUtils::findLastHeader()
+{
+    if (findRingRecord())
+    {
+        return true;
+    }
 
-    /* Allocate dynamic memory */
-    uint8_t *ptr_data = new (std::nothrow) uint8_t[_page_erase_size];
-    if (ptr_data != nullptr)
+    if (FWL_PAGE_NONE == _active_page)
     {
-        uint16_t length = _page_erase_size;
-        FWL_TAG_INFO("[format] verify the first page erase");
-        if (_pCallbacks->onRead(_start_addr, ptr_data, &length))
+        /* The region may still use the legacy layout */
+#if defined(FWL_SLOT_LOCATOR) && (FWL_SLOT_LOCATOR == 1)
+        if (findLastSlot(0))
         {
-            format = false;
-            for (int i = 0; i < length; ++i)
+            return migrateLegacy();
+        }
+        FWL_TAG_INFO("[findLastHeader] slot locator failed, scan headers");
+#endif
+        if (scanLastHeader())
+        {
+            return migrateLegacy();
+        }
+        /* A migration into page 0 was interrupted, the lap is searched from page 1 */
+        if (findLastSlot((_page_erase_size + _header2data_offset_length + _data_length - 1)
+                         / (_header2data_offset_length + _data_length)))
+        {
+            return migrateLegacy();
+        }
+    }
+
+    headerDefault();
+    return false;
+} // findLastHeader
+
+/**
+ * @brief Find the newest record of the ring.
+ * The valid pages are visited from the highest sequence number, the first
+ * one holding a valid record is the active page. A newer page without any
+ * valid record was interrupted while it was activated, it is erased by the
+ * next page switch.
+ */
+bool FlashWearLevellingUtils::findRingRecord()
+{
+    fwl_page_header_t page_header;
+    uint32_t bound_seq = 0;
+    uint32_t best_seq = 0;
+    uint16_t best;
+    uint16_t page;
+    uint16_t tries;
+
+    _active_page = FWL_PAGE_NONE;
+    _next_ready = false;
+    for (tries = 0; tries < _page_num; tries++)
+    {
+        best = FWL_PAGE_NONE;
+        for (page = 0; page < _page_num; page++)
+        {
+            if (!loadPageHeader(page, &page_header) || !pageHeaderIsValid(&page_header))
+            {
+                continue;
+            }
+            if ((tries > 0) && !fwl_seq_after(bound_seq, page_header.seq))
             {
-                if (ptr_data[i] != 0xFF)
-                {
-                    format = true;
-                    break;
-                }
+                continue;
+            }
+            if ((FWL_PAGE_NONE == best) || fwl_seq_after(page_header.seq, best_seq))
+            {
+                best = page;
+                best_seq = page_header.seq;
             }
         }
-        delete[] ptr_data;
+
+        if (FWL_PAGE_NONE == best)
+        {
+            break;
+        }
+
+        if (locateInPage(best))
+        {
+            FWL_TAG_INFO("[findRingRecord] page %u, seq %u, record 0x%X", best, best_seq, _memory_cxt.header.addr);
+            _active_page = best;
+            _active_seq = best_seq;
+            return true;
+        }
+        FWL_TAG_INFO("[findRingRecord] page %u, seq %u hasn't any record", best, best_seq);
+        bound_seq = best_seq;
     }
-    
-    if (format)
+    return false;
+} // findRingRecord
+
+/**
+ * @brief Find the last valid record in a page of the ring.
+ * A page is erased before it is activated, so the slots of records with the
+ * data length given to the constructor are searched by binary search.
+ * Records of another length are walked. Only the last record is loaded and
+ * verified by CRC, a torn record is skipped through prevAddr.
+ * @param [in] page The page index.
+ */
+bool FlashWearLevellingUtils::locateInPage(uint16_t page)
+{
+    memory_cxt_t mem_cxt = {0};
+    uint32_t first = pageAddr(page) + FWL_PAGE_HEADER_LENGTH;
+    uint32_t page_end = pageEnd(page);
+    uint32_t slot_size = _header2data_offset_length + _data_length;
+    uint32_t last_addr;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t mid;
+    bool slots = false;
+    bool found = false;
+
+    if (slotIsBlank(first))
+    {
+        return false;
+    }
+
+    mem_cxt.header.addr = first;
+    if (loadHeader(&mem_cxt) && (mem_cxt.header.dataLength == _data_length))
     {
-        /* Erase first page */
-        FWL_TAG_INFO("[format] erase first page");
-        if (!_pCallbacks->onErase(_start_addr, _page_erase_size))
+        /* lo: first slot not known as written, hi: first blank slot */
+        lo = 1;
+        hi = (page_end - first) / slot_size;
+        while (lo < hi)
         {
-            FWL_TAG_INFO("[format] erase failed!");
-            return false;
+            mid = lo + (hi - lo) / 2;
+            if (slotIsBlank(first + mid * slot_size))
+            {
+                hi = mid;
+            }
+            else
+            {
+                lo = mid + 1;
+            }
         }
+        last_addr = first + (lo - 1) * slot_size;
+        _write_addr = first + lo * slot_size;
+        slots = true;
     }
     else
     {
-        FWL_TAG_INFO("[format] No");
+        /* Walk the records until the first blank header */
+        last_addr = first;
+        _write_addr = first;
+        while ((_write_addr + _header2data_offset_length <= page_end) && !slotIsBlank(_write_addr))
+        {
+            mem_cxt.header.addr = _write_addr;
+            if (!loadHeader(&mem_cxt) || (mem_cxt.header.nextAddr > page_end))
+            {
+                /* A torn header, nothing can be appended in this page */
+                _write_addr = page_end;
+                break;
+            }
+            last_addr = _write_addr;
+            _write_addr = mem_cxt.header.nextAddr;
+        }
+    }
+
+    /* Record buffer of the scratch arena */
+    ScratchBuffer scratch(MEMORY_LENGTH_MAX);
+    uint8_t *ptr_data = scratch.data();
+    if (ptr_data == NULL)
+    {
+        FWL_TAG_INFO("[locateInPage] Scratch buffer failed!");
+        return false;
     }
+
+    while ((last_addr >= first) && (last_addr < page_end))
+    {
+        mem_cxt.header.addr = last_addr;
+        if (loadHeader(&mem_cxt))
+        {
+            mem_cxt.data.pBuffer = ptr_data;
+            mem_cxt.data.length = mem_cxt.header.dataLength;
+            mem_cxt.data.addr = mem_cxt.header.addr + _header2data_offset_length;
+            if ((mem_cxt.header.nextAddr <= page_end) && loadData(&mem_cxt))
+            {
+                _memory_cxt = mem_cxt;
+                found = true;
+                break;
+            }
+        }
+        FWL_TAG_INFO("[locateInPage] record 0x%X failed!", last_addr);
+        if (last_addr == first)
+        {
+            break;
+        }
+        if (slots)
+        {
+            /* A torn header has no prevAddr */
+            last_addr -= slot_size;
+        }
+        else if (mem_cxt.header.prevAddr < last_addr)
+        {
+            last_addr = mem_cxt.header.prevAddr;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return found;
+} // locateInPage
+
+/**
+ * @brief Write a record after the last one, switch to the next page when the
+ *        active page is full. Records never straddle pages.
+ * @param [in] mem The record, data buffer and data length must be available.
+ */
+bool FlashWearLevellingUtils::appendRecord(memory_cxt_t *mem)
+{
+    uint32_t record_size = _header2data_offset_length + mem->data.length;
+    uint16_t length;
+
+    if ((FWL_PAGE_NONE == _active_page)
+        || ((_write_addr + record_size) > pageEnd(_active_page)))
+    {
+        if (!switchPage((FWL_PAGE_NONE == _active_page) ? 0 : (_active_page + 1) % _page_num))
+        {
+            FWL_TAG_INFO("[appendRecord] switch page failed!");
+            return false;
+        }
+    }
+
+    mem->header.prevAddr = _memory_cxt.header.addr;
+    mem->header.addr = _write_addr;
+    mem->header.nextAddr = _write_addr + record_size;
+    mem->header.dataLength = mem->data.length;
+    mem->header.type = MEMORY_HEADER_TYPE;
+    mem->data.addr = _write_addr + _header2data_offset_length;
+    mem->header.crc32 = fwl_header_crc32(mem);
+
+#if (1)
+    FWL_TAG_INFO("[appendRecord] header.crc32 0x%X", mem->header.crc32);
+    FWL_TAG_INFO("[appendRecord] header.addr %u(0x%X)", mem->header.addr, mem->header.addr);
+    FWL_TAG_INFO("[appendRecord] header.dataLength %u", mem->header.dataLength);
+#endif
+
+    length = _header2data_offset_length;
+    if (!_pCallbacks->onWrite(mem->header.addr, (uint8_t *)&mem->header.crc32, &length)
+        || (length != _header2data_offset_length))
+    {
+        FWL_TAG_INFO("[appendRecord] Write header failed!");
+        /* The slot is used, the next record goes after it */
+        _write_addr = mem->header.nextAddr;
+        return false;
+    }
+
+    _write_addr = mem->header.nextAddr;
+    if (!_pCallbacks->onWrite(mem->data.addr, mem->data.pBuffer, &mem->data.length)
+        || (mem->data.length != mem->header.dataLength))
+    {
+        FWL_TAG_INFO("[appendRecord] Write Data failed!");
+        _pCallbacks->onStatus(FlashWearLevellingCallbacks::status_t::ERROR_WRITE_DATA);
+        return false;
+    }
+
     return true;
-} // format
+} // appendRecord
 
 /**
- * Return memory information current
-*/
-memory_cxt_t FlashWearLevellingUtils::info()
+ * @brief Activate a page with the next sequence number.
+ * The page is erased here only if prepare() didn't run since the last switch.
+ * @param [in] page The page index.
+ */
+bool FlashWearLevellingUtils::switchPage(uint16_t page)
 {
-    return _memory_cxt;
-} // info
+    fwl_page_header_t page_header;
+    uint16_t length;
+
+    if (!_next_ready || (page != (_active_page + 1) % _page_num))
+    {
+        FWL_TAG_INFO("[switchPage] erase page %u on write", page);
+        if (!preparePage(page))
+        {
+            return false;
+        }
+    }
+
+    if (!loadPageHeader(page, &page_header))
+    {
+        return false;
+    }
+    page_header.magic = FWL_PAGE_MAGIC;
+    page_header.seq = _active_seq + 1;
+    page_header.crc32 = fwl_page_crc32(&page_header);
+
+    /* erase_count was written by preparePage() */
+    length = FWL_PAGE_HEADER_LENGTH - sizeof(page_header.erase_count);
+    if (!_pCallbacks->onWrite(pageAddr(page) + sizeof(page_header.erase_count), (uint8_t *)&page_header.magic, &length))
+    {
+        FWL_TAG_INFO("[switchPage] write page header failed!");
+        return false;
+    }
+
+    FWL_TAG_INFO("[switchPage] page %u, seq %u, erase_count %u", page, page_header.seq, page_header.erase_count);
+    _active_page = page;
+    _active_seq = page_header.seq;
+    _write_addr = pageAddr(page) + FWL_PAGE_HEADER_LENGTH;
+    _next_ready = false;
+    return true;
+} // switchPage
+
+/**
+ * @brief Erase a page and write its erase counter, a page already erased
+ *        with its counter is kept.
+ * The reserved bytes at the end of the last page aren't part of the ring:
+ * a page blank but them gets its counter without an erase. Their copy at
+ * the end of page 0 is written before the last page is erased, the bytes
+ * are written back from it after the erase or at the next begin().
+ * @param [in] page The page index.
+ */
+bool FlashWearLevellingUtils::preparePage(uint16_t page)
+{
+    fwl_page_header_t page_header;
+    uint8_t reserved[FWL_RESERVED_LENGTH_MAX];
+    uint32_t erase_count = 0;
+    uint16_t length;
+    bool keep = (_reserved_length > 0) && ((0 == page) || (_page_num - 1 == page));
+    bool erase = true;
+
+    if (keep && !loadReserved(reserved))
+    {
+        FWL_TAG_INFO("[preparePage] read reserved failed!");
+        return false;
+    }
+
+    if (loadPageHeader(page, &page_header))
+    {
+        if ((0xFFFFFFFF == page_header.magic)
+            && (0xFFFFFFFF == page_header.seq)
+            && (0xFFFFFFFF == page_header.crc32)
+            && rangeIsBlank(pageAddr(page) + FWL_PAGE_HEADER_LENGTH, pageEnd(page)))
+        {
+            /* Prepared page, or blank page the ring never erased: the counter starts from 0 */
+            erase = false;
+            erase_count = (0xFFFFFFFF != page_header.erase_count) ? page_header.erase_count : 0;
+        }
+        else if ((0xFFFFFFFF != page_header.erase_count)
+                 && ((0xFFFFFFFF == page_header.magic) || pageHeaderIsValid(&page_header)))
+        {
+            erase_count = page_header.erase_count;
+        }
+    }
+
+    if (erase)
+    {
+        if (keep && (_page_num - 1 == page) && !syncReserved(reserved))
+        {
+            return false;
+        }
+        if (!_pCallbacks->onErase(pageAddr(page), _page_erase_size))
+        {
+            FWL_TAG_INFO("[preparePage] erase failed!");
+            return false;
+        }
+        erase_count++;
+    }
+
+    if (erase || (0xFFFFFFFF == page_header.erase_count))
+    {
+        length = sizeof(erase_count);
+        if (!_pCallbacks->onWrite(pageAddr(page), (uint8_t *)&erase_count, &length))
+        {
+            FWL_TAG_INFO("[preparePage] write erase_count failed!");
+            return false;
+        }
+    }
+
+    if (keep && !syncReserved(reserved))
+    {
+        return false;
+    }
+    FWL_TAG_INFO("[preparePage] page %u, erase_count %u", page, erase_count);
+    return true;
+} // preparePage
+
+/**
+ * @brief Read the reserved bytes at the end of the region. Their copy at
+ *        the end of page 0 is taken when the end of the region is blank or
+ *        torn by a cut during the erase of the last page.
+ */
+bool FlashWearLevellingUtils::loadReserved(uint8_t *reserved)
+{
+    uint8_t mirror[FWL_RESERVED_LENGTH_MAX + sizeof(uint32_t)];
+    uint32_t crc;
+    uint16_t length = _reserved_length;
+
+    if (!_pCallbacks->onRead(_start_addr + _memory_size - _reserved_length, reserved, &length)
+        || (length != _reserved_length))
+    {
+        return false;
+    }
+    length = mirrorLength();
+    if (!_pCallbacks->onRead(mirrorAddr(), mirror, &length) || (length != mirrorLength()))
+    {
+        return false;
+    }
+    memcpy(&crc, &mirror[_reserved_length], sizeof(crc));
+    if ((fwl_crc32(mirror, _reserved_length) == crc)
+        && fwl_is_programmable(reserved, mirror, _reserved_length))
+    {
+        memcpy(reserved, mirror, _reserved_length);
+    }
+    return true;
+} // loadReserved
+
+/**
+ * @brief Write the reserved bytes and their copy at the end of page 0 where
+ *        they are blank or torn, blank reserved bytes aren't copied.
+ */
+bool FlashWearLevellingUtils::syncReserved(const uint8_t *reserved)
+{
+    uint8_t mirror[FWL_RESERVED_LENGTH_MAX + sizeof(uint32_t)];
+    uint32_t crc;
+
+    if (fwl_is_blank(reserved, _reserved_length))
+    {
+        return true;
+    }
+    crc = fwl_crc32(reserved, _reserved_length);
+    memcpy(mirror, reserved, _reserved_length);
+    memcpy(&mirror[_reserved_length], &crc, sizeof(crc));
+    return restoreRange(mirrorAddr(), mirror, mirrorLength())
+           && restoreRange(_start_addr + _memory_size - _reserved_length, mirror, _reserved_length);
+} // syncReserved
+
+/**
+ * @brief Program a range to the bytes given when it is blank or torn, a
+ *        range holding other bytes is left as it is.
+ */
+bool FlashWearLevellingUtils::restoreRange(uint32_t addr, const uint8_t *buff, uint16_t length)
+{
+    uint8_t current[FWL_RESERVED_LENGTH_MAX + sizeof(uint32_t)];
+    uint16_t read_length = length;
+
+    if (!_pCallbacks->onRead(addr, current, &read_length) || (read_length != length))
+    {
+        FWL_TAG_INFO("[restoreRange] read failed!");
+        return false;
+    }
+    if (0 == memcmp(current, buff, length))
+    {
+        return true;
+    }
+    if (!fwl_is_programmable(current, buff, length))
+    {
+        FWL_TAG_INFO("[restoreRange] 0x%x in use, not written", addr);
+        return true;
+    }
+    memcpy(current, buff, length);
+    if (!_pCallbacks->onWrite(addr, current, &length))
+    {
+        FWL_TAG_INFO("[restoreRange] write failed!");
+        return false;
+    }
+    return true;
+} // restoreRange
+
+/**
+ * @brief Check the flash from addr to end is erased.
+ */
+bool FlashWearLevellingUtils::rangeIsBlank(uint32_t addr, uint32_t end)
+{
+    uint8_t chunk[FWL_BLANK_CHECK_LENGTH];
+    uint16_t length;
+
+    for (; addr < end; addr += length)
+    {
+        length = ((end - addr) < FWL_BLANK_CHECK_LENGTH) ? (end - addr) : FWL_BLANK_CHECK_LENGTH;
+        if (!_pCallbacks->onRead(addr, chunk, &length) || (0 == length) || !fwl_is_blank(chunk, length))
+        {
+            return false;
+        }
+    }
+    return true;
+} // rangeIsBlank
+
+/**
+ * @brief Move the last record of the legacy layout into the ring.
+ * The legacy record must stay readable until the ring record is written:
+ * the page erased for the ring holds neither the record nor the first
+ * record of the lap (page 0) when there is one. Otherwise a record of the
+ * slots outside page 0 goes into page 0, a record running into page 1 is
+ * first copied into the next slot. If power fails once page 0 is erased,
+ * findLastHeader() finds the record by the slots from page 1.
+ */
+bool FlashWearLevellingUtils::migrateLegacy()
+{
+    memory_cxt_t mem_cxt = _memory_cxt;
+    uint32_t slot_size = _header2data_offset_length + _data_length;
+    uint16_t first_page = (_memory_cxt.header.addr - _start_addr) / _page_erase_size;
+    uint16_t last_page = (_memory_cxt.header.nextAddr - 1 - _start_addr) / _page_erase_size;
+    uint16_t page = FWL_PAGE_NONE;
+    uint16_t i;
+    bool slot = (_memory_cxt.header.dataLength == _data_length)
+                && (0 == (_memory_cxt.header.addr - _start_addr) % slot_size);
+    bool status_isOK = false;
+
+    /* Record buffer of the scratch arena */
+    ScratchBuffer scratch(MEMORY_LENGTH_MAX);
+    uint8_t *ptr_data = scratch.data();
+    if (ptr_data == NULL)
+    {
+        FWL_TAG_INFO("[migrateLegacy] Scratch buffer failed!");
+        return false;
+    }
+
+    mem_cxt.data.pBuffer = ptr_data;
+    mem_cxt.data.length = mem_cxt.header.dataLength;
+    if (!loadData(&mem_cxt))
+    {
+        return false;
+    }
+
+    for (i = 1; i < _page_num; i++)
+    {
+        if ((i < first_page) || (i > last_page))
+        {
+            page = i;
+            break;
+        }
+    }
+
+    if ((FWL_PAGE_NONE == page) && slot && (0 == first_page) && appendLegacy(&mem_cxt))
+    {
+        first_page = (mem_cxt.header.addr - _start_addr) / _page_erase_size;
+    }
+
+    if ((FWL_PAGE_NONE == page) && slot && (first_page > 0))
+    {
+        page = 0;
+    }
+
+    if (FWL_PAGE_NONE == page)
+    {
+        /* A record of another length isn't found without the lap, a power
+         * failure before the ring record is written loses it */
+        page = (first_page > 0) ? 0 : _page_num - 1;
+        FWL_TAG_INFO("[migrateLegacy] record 0x%X unprotected", mem_cxt.header.addr);
+    }
+    FWL_TAG_INFO("[migrateLegacy] record 0x%X into page %u", mem_cxt.header.addr, page);
+
+    _active_page = FWL_PAGE_NONE;
+    _active_seq = 0;
+    _next_ready = false;
+    if (switchPage(page) && appendRecord(&mem_cxt))
+    {
+        _memory_cxt = mem_cxt;
+        status_isOK = true;
+    }
+
+    return status_isOK;
+} // migrateLegacy
+
+/**
+ * @brief Write a copy of the last record of the legacy layout into the
+ *        next slot, if it is blank.
+ * @param [in] mem The record, the data is loaded. Out: the copy.
+ */
+bool FlashWearLevellingUtils::appendLegacy(memory_cxt_t *mem)
+{
+    memory_cxt_t copy = *mem;
+    uint32_t slot_size = _header2data_offset_length + _data_length;
+    uint16_t length;
+
+    copy.header.prevAddr = mem->header.addr;
+    copy.header.addr = mem->header.nextAddr;
+    copy.header.nextAddr = copy.header.addr + slot_size;
+    copy.data.addr = copy.header.addr + _header2data_offset_length;
+    if ((copy.header.nextAddr > _start_addr + _memory_size - _reserved_length)
+        || !rangeIsBlank(copy.header.addr, copy.header.nextAddr))
+    {
+        FWL_TAG_INFO("[appendLegacy] slot 0x%X isn't blank", copy.header.addr);
+        return false;
+    }
+    copy.header.crc32 = fwl_header_crc32(&copy);
+
+    length = _header2data_offset_length;
+    if (!_pCallbacks->onWrite(copy.header.addr, (uint8_t *)&copy.header.crc32, &length)
+        || (length != _header2data_offset_length)
+        || !_pCallbacks->onWrite(copy.data.addr, copy.data.pBuffer, &copy.data.length)
+        || (copy.data.length != copy.header.dataLength))
+    {
+        FWL_TAG_INFO("[appendLegacy] write failed!");
+        return false;
+    }
+
+    FWL_TAG_INFO("[appendLegacy] record 0x%X", copy.header.addr);
+    *mem = copy;
+    return true;
+} // appendLegacy
+
+/**
+ * @brief Read the header of a page.
+ * @param [in] page The page index.
+ * @param [out] page_header The page header.
+ */
+bool FlashWearLevellingUtils::loadPageHeader(uint16_t page, fwl_page_header_t *page_header)
+{
+    uint16_t length = FWL_PAGE_HEADER_LENGTH;
+
+    if (!_pCallbacks->onRead(pageAddr(page), (uint8_t *)page_header, &length)
+        || (length != FWL_PAGE_HEADER_LENGTH))
+    {
+        FWL_TAG_INFO("[loadPageHeader] page %u failed!", page);
+        return false;
+    }
+    return true;
+} // loadPageHeader
+
+/**
+ * @brief Check a page header was written completely by switchPage().
+ */
+bool FlashWearLevellingUtils::pageHeaderIsValid(fwl_page_header_t *page_header)
+{
+    return ((FWL_PAGE_MAGIC == page_header->magic)
+            && (fwl_page_crc32(page_header) == page_header->crc32));
+} // pageHeaderIsValid
 
-/** Write data to a region allocated
- * 
- *  @param buff     Buffer of data to write
- *  @param length   Size to write in bytes
- *  @return         True if read is succeed
+/**
+ * @brief Find last header of the legacy layout with fixed size records.
+ * A lap of records is appended from _start_addr, each record takes
+ * _header2data_offset_length + _data_length bytes, and a page is erased when
+ * the first record of the lap enters it. So every slot before the first blank
+ * slot holds a record of the current lap, the pages after it may still hold
+ * records of the previous lap. The first blank slot is found by checking the
+ * last slot of each page, then by binary search inside that page.
+ * Only the last record is loaded and verified by CRC.
+ * @param [in] first_slot The slot the search starts from, 0 but when the
+ *             first page was erased by an interrupted migration.
  */
-bool FlashWearLevellingUtils::write(uint8_t *buff, uint16_t *length)
+bool FlashWearLevellingUtils::findLastSlot(uint32_t first_slot)
 {
-    if (!verifyMemInfo())
+    memory_cxt_t mem_cxt = {0};
+    uint32_t slot_size = _header2data_offset_length + _data_length;
+    uint32_t slot_num = (_memory_size - _reserved_length) / slot_size;
+    uint32_t page_num = _memory_size / _page_erase_size;
+    uint32_t page;
+    uint32_t last;
+    uint32_t lo;
+    uint32_t hi;
+    uint32_t mid;
+    uint32_t slot;
+    bool found = false;
+
+    if (first_slot >= slot_num)
     {
-        FWL_TAG_INFO("[write] memory info Failed!");
         return false;
     }
 
-    memory_cxt_t w_memory = _memory_cxt;
-    w_memory.data.pBuffer = buff;
-    w_memory.data.length = *length;
-    if (saveData(&w_memory))
+    /* The lap must start with a record of the expected length */
+    mem_cxt.header.addr = _start_addr + first_slot * slot_size;
+    if (!loadHeader(&mem_cxt) || (mem_cxt.header.dataLength != _data_length))
     {
-        _memory_cxt = w_memory;
-        return true;
+        FWL_TAG_INFO("[findLastSlot] first record isn't a slot");
+        return false;
     }
-    return false;
-} // write
 
-/** Read data from a region allocated
- * 
- *  @param buff     Buffer of data to read
- *  @param length   Size to read in bytes
- *  @return         True if read is succeed
- */
-bool FlashWearLevellingUtils::read(uint8_t *buff, uint16_t *length)
-{
-    if (!verifyMemInfo())
+    /* lo: first slot not known as written, hi: first blank slot */
+    lo = first_slot + 1;
+    hi = slot_num;
+    for (page = 0; page < page_num; page++)
     {
-        FWL_TAG_INFO("[read] memory info Failed!");
-        return false;
+        last = (((page + 1) * _page_erase_size) - 1) / slot_size;
+        if (last >= slot_num)
+        {
+            last = slot_num - 1;
+        }
+        if (last < lo)
+        {
+            continue;
+        }
+        if (slotIsBlank(_start_addr + last * slot_size))
+        {
+            hi = last;
+            break;
+        }
+        lo = last + 1;
     }
 
-    if ((*length) < _memory_cxt.header.dataLength)
+    while (lo < hi)
     {
-        FWL_TAG_INFO("[read] length buffer is not enough!");
-        return false;
+        mid = lo + (hi - lo) / 2;
+        if (slotIsBlank(_start_addr + mid * slot_size))
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
     }
+    FWL_TAG_INFO("[findLastSlot] first blank slot %u", lo);
 
-    FWL_TAG_INFO("[read] load data");
-    /* Read data */
-    _memory_cxt.data.pBuffer = buff;
-    /* The data length must be equal header data length */
-    _memory_cxt.data.length = _memory_cxt.header.dataLength;
-    if (!loadData(&_memory_cxt))
+    /* Record buffer of the scratch arena */
+    ScratchBuffer scratch(MEMORY_LENGTH_MAX);
+    uint8_t *ptr_data = scratch.data();
+    if (ptr_data == NULL)
     {
-        FWL_TAG_INFO("[read] Data failed!");
+        FWL_TAG_INFO("[findLastSlot] Scratch buffer failed!");
         return false;
     }
 
-    FWL_TAG_INFO("[read] data length: %u", _memory_cxt.data.length);
-    *length = _memory_cxt.data.length;
+    /* Verify the last record, step back once over a torn write */
+    for (slot = lo; (slot > first_slot) && (slot + 2 > lo); slot--)
+    {
+        mem_cxt.header.addr = _start_addr + (slot - 1) * slot_size;
+        if (!loadHeader(&mem_cxt)
+        || (mem_cxt.header.dataLength != _data_length)
+        || (mem_cxt.header.nextAddr != mem_cxt.header.addr + slot_size)
+        || ((slot > first_slot + 1) && (mem_cxt.header.prevAddr != mem_cxt.header.addr - slot_size)))
+        {
+            FWL_TAG_INFO("[findLastSlot] slot %u isn't a record of the lap", slot - 1);
+            break;
+        }
+
+        mem_cxt.data.pBuffer = ptr_data;
+        mem_cxt.data.length = mem_cxt.header.dataLength;
+        mem_cxt.data.addr = mem_cxt.header.addr + _header2data_offset_length;
+        if (loadData(&mem_cxt))
+        {
+            _memory_cxt = mem_cxt;
+            found = true;
+            break;
+        }
+        FWL_TAG_INFO("[findLastSlot] slot %u data failed!", slot - 1);
+    }
 
-    return true;
-} // read
+
+    if (found)
+    {
+        FWL_TAG_INFO("[findLastSlot] Addr %u(0x%X)", _memory_cxt.header.addr, _memory_cxt.header.addr);
+    }
+    return found;
+} // findLastSlot
 
 /**
- * @brief Set the callback handlers for this flash memory.
- * @param [in] pCallbacks An instance of a callbacks structure used to define any callbacks for the flash memory.
+ * @brief Check the crc32 of a header, the unwritten flash reads 0xFF.
+ * @param [in] addr The address of the header.
  */
-void FlashWearLevellingUtils::setCallbacks(FlashWearLevellingCallbacks *pCallbacks)
+bool FlashWearLevellingUtils::slotIsBlank(uint32_t addr)
 {
-    if (pCallbacks != nullptr)
-    {
-        _pCallbacks = pCallbacks;
-    }
-    else
+    uint32_t crc32;
+    uint16_t length = sizeof(crc32);
+
+    if (!_pCallbacks->onRead(addr, (uint8_t *)&crc32, &length) || (length != sizeof(crc32)))
     {
-        _pCallbacks = &defaultCallback;
+        /* Handled as blank, the search ends before this slot */
+        return true;
     }
-    FWL_TAG_INFO(">> setCallbacks: 0x%x << setCallbacks", (uint32_t)_pCallbacks);
-} // setCallbacks
+    return (0xFFFFFFFF == crc32);
+} // slotIsBlank
 
 /**
- * @brief Find last header information.
+ * @brief Find last header of the legacy layout by walking the records from _start_addr.
  */
-bool FlashWearLevellingUtils::findLastHeader()
+bool FlashWearLevellingUtils::scanLastHeader()
 {
     memory_cxt_t mem_cxt = {0};
     uint32_t find_cnt;
 
-    /* Allocate dynamic memory */
-    uint8_t *ptr_data = new (std::nothrow) uint8_t[MEMORY_LENGTH_MAX];
+    /* Record buffer of the scratch arena */
+    ScratchBuffer scratch(MEMORY_LENGTH_MAX);
+    uint8_t *ptr_data = scratch.data();
     if (ptr_data == NULL)
     {
-        FWL_TAG_INFO("[findLastHeader] Allocate RAM failed!");
+        FWL_TAG_INFO("[scanLastHeader] Scratch buffer failed!");
         return false;
     }
-    FWL_TAG_INFO("[findLastHeader] Allocated %u byte RAM at 0x%x", MEMORY_LENGTH_MAX, (uint32_t)ptr_data);
 
     mem_cxt.header.nextAddr = _start_addr;
     find_cnt = 0;
@@ -231,7 +1110,7 @@ bool FlashWearLevellingUtils::findLastHeader()
         /* End */
         if (MEMORY_HEADER_END == mem_cxt.header.addr)
         {
-            FWL_TAG_INFO("[findLastHeader] Header Addr End!");
+            FWL_TAG_INFO("[scanLastHeader] Header Addr End!");
             break;
         }
 
@@ -239,7 +1118,7 @@ bool FlashWearLevellingUtils::findLastHeader()
         mem_cxt.header.addr = mem_cxt.header.nextAddr;
         if (!loadHeader(&mem_cxt))
         {
-            FWL_TAG_INFO("[findLastHeader] Read Header failed!");
+            FWL_TAG_INFO("[scanLastHeader] Read Header failed!");
             break;
         }
 
@@ -250,7 +1129,7 @@ bool FlashWearLevellingUtils::findLastHeader()
         mem_cxt.data.addr = mem_cxt.header.addr + _header2data_offset_length;
         if (!loadData(&mem_cxt))
         {
-            FWL_TAG_INFO("[findLastHeader] Data failed!");
+            FWL_TAG_INFO("[scanLastHeader] Data failed!");
             break;
         }
 
@@ -262,30 +1141,28 @@ bool FlashWearLevellingUtils::findLastHeader()
         _memory_cxt = mem_cxt;
     } while (1);
 
-    delete[] ptr_data; /* free memory */
-    FWL_TAG_INFO("[findLastHeader] Free %u byte RAM at 0x%x", MEMORY_LENGTH_MAX, (uint32_t)ptr_data);
 
     if (find_cnt > 0)
     {
-        FWL_TAG_INFO("[findLastHeader] Final counter: %u", find_cnt);
+        FWL_TAG_INFO("[scanLastHeader] Final counter: %u", find_cnt);
 #if (1)
-        FWL_TAG_INFO("[findLastHeader] Addr %u(0x%X)", _memory_cxt.header.addr, _memory_cxt.header.addr);
-        FWL_TAG_INFO("[findLastHeader] crc32 0x%x", _memory_cxt.header.crc32);
-        FWL_TAG_INFO("[findLastHeader] next Addr %u(0x%X)", _memory_cxt.header.nextAddr, _memory_cxt.header.nextAddr);
-        FWL_TAG_INFO("[findLastHeader] prev Addr %u(0x%X)", _memory_cxt.header.prevAddr, _memory_cxt.header.prevAddr);
-        FWL_TAG_INFO("[findLastHeader] data length %u", _memory_cxt.header.dataLength);
+        FWL_TAG_INFO("[scanLastHeader] Addr %u(0x%X)", _memory_cxt.header.addr, _memory_cxt.header.addr);
+        FWL_TAG_INFO("[scanLastHeader] crc32 0x%x", _memory_cxt.header.crc32);
+        FWL_TAG_INFO("[scanLastHeader] next Addr %u(0x%X)", _memory_cxt.header.nextAddr, _memory_cxt.header.nextAddr);
+        FWL_TAG_INFO("[scanLastHeader] prev Addr %u(0x%X)", _memory_cxt.header.prevAddr, _memory_cxt.header.prevAddr);
+        FWL_TAG_INFO("[scanLastHeader] data length %u", _memory_cxt.header.dataLength);
 #endif
         return true;
     }
     else
     {
-        FWL_TAG_INFO("[findLastHeader] Not Found header");
-        FWL_TAG_INFO("[findLastHeader] Init header default");
+        FWL_TAG_INFO("[scanLastHeader] Not Found header");
+        FWL_TAG_INFO("[scanLastHeader] Init header default");
         /* Don't have any header, this mean have not data */
         headerDefault();
     }
     return false;
-} // findLastHeader
+} // scanLastHeader
 
 void FlashWearLevellingUtils::headerDefault(void)
 {
@@ -361,136 +1238,6 @@ bool FlashWearLevellingUtils::loadHeader(memory_cxt_t *mem)
     return true;
 } // loadHeader
 
-/**
- * @brief Get data from header information.
- * @param [in] memory_cxt_t The structure content variable informations.
- */
-bool FlashWearLevellingUtils::header_isDefault(void)
-{
-    memory_cxt_t mem = {0};
-    uint16_t length;
-
-    /* Get header */
-    mem.header.addr = _start_addr;
-    length = _header2data_offset_length;
-    if (!_pCallbacks->onRead(mem.header.addr, (uint8_t *)&mem.header.crc32, &length))
-    {
-        FWL_TAG_INFO("[header_isDefault] Read Header failed!");
-        return false;
-    }
-
-    if (length != _header2data_offset_length)
-    {
-        FWL_TAG_INFO("[header_isDefault] Read length failed!");
-        return false;
-    }
-
-    if ((0xFFFFFFFF != mem.header.crc32)
-        || (_start_addr != mem.header.nextAddr)
-        || (_start_addr != mem.header.prevAddr)
-        || (0 != mem.header.dataLength)
-        || (MEMORY_HEADER_TYPE != mem.header.type))
-    {
-        FWL_TAG_INFO("[header_isDefault] false!");
-        return false;
-    }
-
-#if (1)
-    FWL_TAG_INFO("[header_isDefault] true!");
-    FWL_TAG_INFO("[header_isDefault] crc32 0x%X", mem.header.crc32);
-    FWL_TAG_INFO("[header_isDefault] header.nextAddr %u(0x%X)", mem.header.nextAddr, mem.header.nextAddr);
-    FWL_TAG_INFO("[header_isDefault] header.addr %u(0x%X)", mem.header.addr, mem.header.addr);
-    FWL_TAG_INFO("[header_isDefault] header.prevAddr %u(0x%X)", mem.header.prevAddr, mem.header.prevAddr);
-    FWL_TAG_INFO("[header_isDefault] header.dataLength %u", mem.header.dataLength);
-#endif
-
-    return true;
-} // header_isDefault
-
-/**
- * @brief set header into flash memory from header information.
- * @param [in] memory_cxt_t The structure content variable informations.
- * @Notify data buffer and data length must be available before call saveHeader()
- */
-bool FlashWearLevellingUtils::saveHeader(memory_cxt_t *mem)
-{
-    memory_cxt_t temp = *mem;
-
-    if (mem->data.pBuffer == NULL)
-    {
-        FWL_TAG_INFO("[saveHeader] Data buffer NULL");
-        return false;
-    }
-
-    if ((mem->data.length > MEMORY_LENGTH_MAX) || (0 == mem->data.length))
-    {
-        FWL_TAG_INFO("[saveHeader] Data length failed!");
-        return false;
-    }
-
-    /* Make header prev address */
-    mem->header.prevAddr = temp.header.addr;
-    /* Make header address */
-    mem->header.addr = temp.header.nextAddr;
-    /* Make header next address */
-    mem->header.nextAddr = temp.header.nextAddr;
-    mem->header.nextAddr += _header2data_offset_length;
-    mem->header.nextAddr += temp.data.length;
-    /* the space remain memory is not enough fill data */
-    if (mem->header.nextAddr > (_start_addr + _memory_size))
-    {
-        FWL_TAG_INFO("[saveHeader] Reset address");
-        /* Reset address header base equal _start_addr */
-        mem->header.addr = _start_addr;
-        /* Make header next address again */
-        mem->header.nextAddr = _start_addr;
-        mem->header.nextAddr += _header2data_offset_length;
-        mem->header.nextAddr += temp.data.length;
-
-        /* Reset temp header address */
-        temp.header.nextAddr = _start_addr;
-
-        /* Erase first page */
-        FWL_TAG_INFO("[saveHeader] erase first page");
-        if (!_pCallbacks->onErase(_start_addr, _page_erase_size))
-        {
-            FWL_TAG_INFO("[saveHeader] erase failed!");
-            return false;
-        }
-    }
-    /* Make header data length */
-    mem->header.dataLength = temp.data.length;
-    /* Make header type */
-    mem->header.type = MEMORY_HEADER_TYPE;
-    /* Make data address */
-    mem->data.addr = temp.header.nextAddr + _header2data_offset_length;
-    /* Make CRC */
-    mem->header.crc32 = fwl_header_crc32(mem);
-
-#if (1)
-    FWL_TAG_INFO("[saveHeader] header.crc32 0x%X", mem->header.crc32);
-    FWL_TAG_INFO("[saveHeader] header.nextAddr %u(0x%X)", mem->header.nextAddr, mem->header.nextAddr);
-    FWL_TAG_INFO("[saveHeader] header.addr %u(0x%X)", mem->header.addr, mem->header.addr);
-    FWL_TAG_INFO("[saveHeader] header.prevAddr %u(0x%X)", mem->header.prevAddr, mem->header.prevAddr);
-    FWL_TAG_INFO("[saveHeader] header.dataLength %u", mem->header.dataLength);
-#endif
-
-    uint16_t length = _header2data_offset_length;
-    if (!submitData(mem->header.addr, (uint8_t *)&mem->header.crc32, &length))
-    {
-        FWL_TAG_INFO("[saveHeader] Write Data failed!");
-        return false;
-    }
-
-    if (length != _header2data_offset_length)
-    {
-        FWL_TAG_INFO("[saveHeader] Write length failed!");
-        return false;
-    }
-
-    return true;
-} // saveHeader
-
 /**
  * @brief verify header header information.
  * @param [in] memory_cxt_t The structure content variable informations.
@@ -586,203 +1333,37 @@ bool FlashWearLevellingUtils::loadData(memory_cxt_t *mem)
 } // loadData
 
 /**
- * @brief set data from header information.
- * @param [in] memory_cxt_t The structure content variable informations.
- */
-bool FlashWearLevellingUtils::saveData(memory_cxt_t *mem)
-{
-    FWL_TAG_INFO("[saveData] save header");
-    if (!saveHeader(mem))
-    {
-        FWL_TAG_INFO("[saveData] header failed!");
-        return false;
-    }
-
-    /* write data */
-    FWL_TAG_INFO("[saveData] save data");
-    if (!submitData(mem->data.addr, mem->data.pBuffer, &mem->data.length))
-    {
-        FWL_TAG_INFO("[saveData] Write Data failed!");
-        return false;
-    }
-
-    if (mem->data.length != mem->header.dataLength)
-    {
-        FWL_TAG_INFO("[saveData] Write length failed!");
-        _pCallbacks->onStatus(FlashWearLevellingCallbacks::status_t::ERROR_WRITE_DATA);
-        return false;
-    }
-
-    /* Erase CRC next header */
-#if (0) /* Not need, because The flash must be erase before write anything */
-    if ((mem->header.nextAddr + 4) <= (_start_addr + _memory_size))
-    {
-        uint8_t buff[4] = {0xFF, 0xFF, 0xFF, 0xFF};
-        uint16_t length = 4;
-
-        if (!submitData(mem->header.nextAddr, buff, &length))
-        {
-            FWL_TAG_INFO("[saveData] Erase CRC failed!");
-            return false;
-        }
-        if (length != 4)
-        {
-            FWL_TAG_INFO("[saveData] Erase CRC length failed!");
-            return false;
-        }
-    }
-#endif
-
-#if (1)
-    FWL_TAG_INFO("[saveData] addr %u(0x%x)", mem->data.addr, mem->data.addr);
-    FWL_TAG_INFO("[saveData] length %u", mem->data.length);
-    FWL_TAG_INFO("[saveData] succeed");
-#endif
-
-    return true;
-} // saveData
-
-/**
- * @brief writeout data.
- * @param [in] addr The address write into flash.
- * @param [in] buff The buffer data write into flash.
- * @param [in] length The length of buffer write into flash.
- */
-bool FlashWearLevellingUtils::submitData(uint32_t addr, uint8_t *buff, uint16_t *length)
+ * verify memory information
+*/
+bool FlashWearLevellingUtils::verifyMemInfo()
 {
-    if (!eraseData(addr, *length))
+    if ((_start_addr % _page_erase_size))
     {
-        FWL_TAG_INFO("[submitData] erase failed!");
+        FWL_TAG_INFO("[verifyMemInfo][error] _start_addr must be multiples _page_erase_size");
         return false;
     }
 
-    if (!_pCallbacks->onWrite(addr, buff, length))
+    if ((0 == _memory_size) || (_memory_size % _page_erase_size))
     {
-        FWL_TAG_INFO("[submitData] write failed!");
+        FWL_TAG_INFO("[verifyMemInfo][error] _memory_size must be multiples _page_erase_size");
         return false;
     }
 
-    return true;
-} // submitData
-
-/**
- * @brief erase data from header information.
- * @param [in] memory_cxt_t The structure content variable informations.
- */
-bool FlashWearLevellingUtils::eraseData(uint32_t addr, uint16_t length)
-{
-    uint32_t offset_addr, remain_size, erase_addr, page_erase_cnt;
-    bool status_isOK = true;
-
-    offset_addr = addr % _page_erase_size;
-    remain_size = _page_erase_size - offset_addr;
-    erase_addr = addr + remain_size;
-
-    FWL_TAG_INFO("[eraseData] addr in: %u(0x%x)", addr, addr);
-    FWL_TAG_INFO("[eraseData] length in: %u", length);
-    FWL_TAG_INFO("[eraseData] remain_size: %u", remain_size);
-
-    /* Write data with write_length 
-        uint32_t write_length;
-        if (length >= remain_size)
-        {
-            write_length = remain_size;
-        }
-        else
-        {
-            write_length = length;
-        }
-        _pCallbacks->onWrite(addr, buff, write_length);
-    */
-    page_erase_cnt = 0;
-    while (length >= remain_size)
-    {
-        FWL_TAG_INFO("[eraseData] erase_addr: %u", erase_addr);
-
-        if (erase_addr == (_start_addr + _memory_size) && (length == remain_size))
-        {
-            FWL_TAG_INFO("[eraseData] last page");
-            break;
-        }
-
-        /* Assert memory size */
-        if ((erase_addr + _page_erase_size) > (_start_addr + _memory_size))
-        {
-            FWL_TAG_INFO("[eraseData] addr failed!");
-            status_isOK = false;
-            break;
-        }
-
-        /* Erase next page */
-        if (!_pCallbacks->onErase(erase_addr, _page_erase_size))
-        {
-            FWL_TAG_INFO("[eraseData] erase failed!");
-            status_isOK = false;
-            break;
-        }
-
-        ++page_erase_cnt;
-
-        /* Remain Length */
-        length -= remain_size;
-        /* Write data with write_length
-            if (length >= _page_erase_size)
-            {
-                write_length = _page_erase_size;
-            }
-            else
-            {
-                write_length = length;
-            }
-
-            if(write_length > 0)
-            {
-                _pCallbacks->onWrite(erase_addr, buff, write_length);
-            }
-        */
-
-        /* new remain size is equal page size */
-        remain_size = _page_erase_size;
-
-        /* update address to erase next page */
-        erase_addr += _page_erase_size;
-
-        FWL_TAG_INFO("[eraseData] remain length: %u", length);
-        FWL_TAG_INFO("[eraseData] remain_size: %u", remain_size);
-    } // while (length >= remain_size)
-
-    if (page_erase_cnt > 0)
-    {
-        FWL_TAG_INFO("[eraseData] page number is erased: %u", page_erase_cnt);
-    }
-    else
-    {
-        FWL_TAG_INFO("[eraseData] No");
-    }
-
-    return status_isOK;
-} // eraseData
-
-/**
- * verify memory information
-*/
-bool FlashWearLevellingUtils::verifyMemInfo()
-{
-    if ((_start_addr % _page_erase_size))
+    if (_page_num < 2)
     {
-        FWL_TAG_INFO("[verifyMemInfo][error] _start_addr must be multiples _page_erase_size");
+        FWL_TAG_INFO("[verifyMemInfo][error] the ring needs 2 pages at least");
         return false;
     }
 
-    if ((0 == _memory_size) || (_memory_size % _page_erase_size))
+    if ((_reserved_length > FWL_RESERVED_LENGTH_MAX) || (mirrorLength() >= _page_erase_size))
     {
-        FWL_TAG_INFO("[verifyMemInfo][error] _memory_size must be multiples _page_erase_size");
+        FWL_TAG_INFO("[verifyMemInfo][error] _reserved_length max = %u", FWL_RESERVED_LENGTH_MAX);
         return false;
     }
 
-    if ((_data_length + _header2data_offset_length) > _memory_size)
+    if ((_data_length + _header2data_offset_length + FWL_PAGE_HEADER_LENGTH) > (uint32_t)(_page_erase_size - mirrorLength()))
     {
-        FWL_TAG_INFO("[verifyMemInfo][error] _memory_size is not enough, min = %u", _data_length + _header2data_offset_length);
+        FWL_TAG_INFO("[verifyMemInfo][error] _page_erase_size is not enough, min = %u", _data_length + _header2data_offset_length + FWL_PAGE_HEADER_LENGTH);
         return false;
     }
 
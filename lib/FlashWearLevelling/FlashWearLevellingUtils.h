@@ -20,12 +20,30 @@
 
 #include "mbed.h"
 #include <array>
-#include <string>
+#include "scratch_arena.h"
 #include "console_dbg.h"
 
 #define MEMORY_SIZE_DEFAULT 4096U /* 4KB */
 #define PAGE_ERASE_SIZE_DEFAULT 4096U /* 4096-Byte */
 
+/** Locate the last record of the legacy layout by slots when all records
+ *  have the data length given to the constructor, instead of walking every record.
+ */
+#ifndef FWL_SLOT_LOCATOR
+#define FWL_SLOT_LOCATOR 1
+#endif
+
+/* Page header of the ring */
+#define FWL_PAGE_MAGIC 0x474E5246 /* "FRNG" */
+#define FWL_PAGE_HEADER_LENGTH 16U
+#define FWL_PAGE_NONE 0xFFFF
+/* Stack buffer used to check a prepared page is blank */
+#define FWL_BLANK_CHECK_LENGTH 64U
+/* Scratch buffer of the data of a record, the longest record read */
+#define FWL_DATA_LENGTH_MAX 256U
+/* Stack buffer of the reserved bytes kept across an erase of the last page */
+#define FWL_RESERVED_LENGTH_MAX 64U
+
 #define FWL_TAG_INFO(...) //CONSOLE_TAG_LOGI("[FWL]", __VA_ARGS__)
 #define FWL_INFO(...) //CONSOLE_LOGI(__VA_ARGS__)
 
@@ -51,10 +69,19 @@ typedef struct __attribute__((packed, aligned(4)))
     } header;
 } memory_cxt_t;
 
+/* The region is a ring of pages, every page starts with this header */
+typedef struct __attribute__((packed, aligned(4)))
+{
+    uint32_t erase_count; /* written when the page is erased */
+    uint32_t magic;       /* written when the page is activated */
+    uint32_t seq;         /* sequence number, the highest one is the newest page */
+    uint32_t crc32;       /* crc32 of erase_count, magic and seq */
+} fwl_page_header_t;
+
 class FlashWearLevellingCallbacks
 {
 private:
-    const std::array<std::string, 9> _statusStr;
+    const std::array<const char *, 9> _statusStr;
 
 public:
     typedef enum
@@ -88,7 +115,7 @@ public:
     virtual bool onErase(uint32_t addr, uint16_t length);
     virtual bool onReady();
     virtual void onStatus(status_t s);
-    std::string reportStr(status_t s)
+    const char *reportStr(status_t s)
     {
         return _statusStr[s];
     }
@@ -101,7 +128,7 @@ class FlashWearLevellingUtils
     typedef enum
     {
         MEMORY_HEADER_TYPE = 0xAA55,
-        MEMORY_LENGTH_MAX = 256,
+        MEMORY_LENGTH_MAX = FWL_DATA_LENGTH_MAX,
         MEMORY_HEADER_END = 0xFFFFFFFF
     } memoryType_t;
 
@@ -109,13 +136,16 @@ public:
     FlashWearLevellingUtils(uint32_t start_addr = 0, 
                             size_t memory_size = MEMORY_SIZE_DEFAULT, 
                             uint16_t page_erase_size = PAGE_ERASE_SIZE_DEFAULT,
-                            uint16_t data_length = 1);
+                            uint16_t data_length = 1,
+                            uint16_t reserved_length = 0);
     ~FlashWearLevellingUtils();
     void setCallbacks(FlashWearLevellingCallbacks *pCallbacks);
     bool begin(bool formatOnFail = false);
     bool format();
     bool write(uint8_t *buff, uint16_t *length);
     bool read(uint8_t *buff, uint16_t *length);
+    bool prepare();
+    bool wearHistogram(uint32_t *counts, uint16_t *pages);
     memory_cxt_t info();
 
     template <typename varType>
@@ -156,16 +186,43 @@ private:
     memory_cxt_t _memory_cxt;
     uint16_t _page_erase_size;
     FlashWearLevellingCallbacks *_pCallbacks;
+    uint16_t _page_num;
+    uint16_t _reserved_length; /* bytes at the end of the region the ring doesn't own */
+    uint16_t _active_page; /* page of the last record, FWL_PAGE_NONE if empty */
+    uint32_t _active_seq;
+    uint32_t _write_addr;  /* address of the next record */
+    bool _next_ready;      /* the page after the active one is erased */
+    uint32_t pageAddr(uint16_t page) { return _start_addr + (uint32_t)page * _page_erase_size; }
+    /* Copy of the reserved bytes and its crc32 at the end of page 0 */
+    uint16_t mirrorLength() { return (_reserved_length > 0) ? (_reserved_length + sizeof(uint32_t)) : 0; }
+    uint32_t mirrorAddr() { return pageAddr(1) - mirrorLength(); }
+    /* End of the records of a page, the last page stops before the reserved bytes, page 0 before their copy */
+    uint32_t pageEnd(uint16_t page)
+    {
+        return pageAddr(page) + _page_erase_size - ((page == _page_num - 1) ? _reserved_length : 0)
+               - ((0 == page) ? mirrorLength() : 0);
+    }
     bool findLastHeader();
-    bool header_isDefault(void);
+    bool findRingRecord();
+    bool locateInPage(uint16_t page);
+    bool appendRecord(memory_cxt_t *mem);
+    bool switchPage(uint16_t page);
+    bool preparePage(uint16_t page);
+    bool rangeIsBlank(uint32_t addr, uint32_t end);
+    bool loadReserved(uint8_t *reserved);
+    bool syncReserved(const uint8_t *reserved);
+    bool restoreRange(uint32_t addr, const uint8_t *buff, uint16_t length);
+    bool migrateLegacy();
+    bool appendLegacy(memory_cxt_t *mem);
+    bool loadPageHeader(uint16_t page, fwl_page_header_t *page_header);
+    bool pageHeaderIsValid(fwl_page_header_t *page_header);
+    bool findLastSlot(uint32_t first_slot);
+    bool slotIsBlank(uint32_t addr);
+    bool scanLastHeader();
     void headerDefault(void);
     bool loadHeader(memory_cxt_t *mem);
-    bool saveHeader(memory_cxt_t *mem);
     bool verifyHeader(memory_cxt_t *mem);
     bool loadData(memory_cxt_t *mem);
-    bool saveData(memory_cxt_t *mem);
-    bool eraseData(uint32_t addr, uint16_t length);
-    bool submitData(uint32_t addr, uint8_t *buff, uint16_t *length);
     bool verifyMemInfo();
 };
 
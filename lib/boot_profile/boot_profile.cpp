@@ -0,0 +1,203 @@
+/* Includes ------------------------------------------------------------------*/
+#include "boot_profile.h"
+#include "util_crc32.h"
+#include "hal/us_ticker_api.h"
+#include "console_dbg.h"
+#if !defined(MBR_HOST)
+#include "cmsis.h"
+#endif
+
+/* Private define ------------------------------------------------------------*/
+#define BOOT_PROFILE_TAG_PRINTF(...) CONSOLE_TAG_LOGI("[PROFILE]", __VA_ARGS__)
+
+/** Cycle counter of the Cortex-M3/M4/M7 */
+#if defined(DWT_CTRL_CYCCNTENA_Msk)
+#define BOOT_PROFILE_DWT 1
+#else
+#define BOOT_PROFILE_DWT 0
+#endif
+
+static_assert(sizeof(boot_profile_t) <= BOOT_PROFILE_REGION_SIZE, "BOOT_PROFILE_REGION_SIZE too small");
+static_assert(BOOT_PHASE_NUM <= 0xFF && BOOT_PROFILE_RING_SIZE <= 0xFF, "boot_profile_t counts are 8-bit");
+
+/* Private variables ---------------------------------------------------------*/
+static const char *const s_phase_names[BOOT_PHASE_NUM] = {
+    "boot",
+    "spi_init",
+    "mbr_begin",
+    "mbr_commit",
+    "verify_main",
+    "verify_boot",
+    "verify_download",
+    "upgrade",
+    "backup",
+    "restore",
+    "repair",
+    "end",
+};
+
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+static boot_profile_t s_profile;
+static uint32_t s_enter_tick[BOOT_PHASE_NUM];
+static uint32_t s_enter_bytes[BOOT_PHASE_NUM];
+static uint8_t s_open[BOOT_PROFILE_DEPTH];
+static uint8_t s_depth;
+#endif
+
+/* Private functions ---------------------------------------------------------*/
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+static inline uint32_t tickNow(void)
+{
+#if BOOT_PROFILE_DWT
+    return DWT->CYCCNT;
+#else
+    return us_ticker_read();
+#endif
+}
+
+static void record(uint8_t phase, uint8_t leave, uint32_t tick, uint32_t bytes)
+{
+    boot_profile_event_t *event = &s_profile.ring[s_profile.events % BOOT_PROFILE_RING_SIZE];
+
+    event->tick = tick;
+    event->bytes = bytes;
+    event->phase = phase;
+    event->leave = leave;
+    event->depth = s_depth;
+    event->reserved = 0;
+    s_profile.events++;
+}
+#endif
+
+/* Exported functions --------------------------------------------------------*/
+void BootProfile::start(void)
+{
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+    memset(&s_profile, 0, sizeof(boot_profile_t));
+    s_depth = 0;
+#if BOOT_PROFILE_DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    s_profile.tick_hz = SystemCoreClock;
+#else
+    s_profile.tick_hz = 1000000UL;
+#endif
+#endif
+}
+
+void BootProfile::enter(boot_phase_t phase)
+{
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+    uint32_t tick = tickNow();
+
+    s_enter_tick[phase] = tick;
+    s_enter_bytes[phase] = s_profile.phases[phase].bytes;
+    s_profile.phases[phase].calls++;
+    record(phase, 0, tick, 0);
+    /* Deeper phases are timed, their bytes go to the open ones */
+    if (s_depth < BOOT_PROFILE_DEPTH)
+    {
+        s_open[s_depth++] = phase;
+    }
+#else
+    (void)phase;
+#endif
+}
+
+void BootProfile::leave(boot_phase_t phase)
+{
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+    uint32_t tick = tickNow();
+    uint8_t i;
+
+    for (i = s_depth; i > 0; i--)
+    {
+        if (s_open[i - 1] == phase)
+        {
+            memmove(&s_open[i - 1], &s_open[i], s_depth - i);
+            s_depth--;
+            break;
+        }
+    }
+    s_profile.phases[phase].ticks += tick - s_enter_tick[phase];
+    record(phase, 1, tick, s_profile.phases[phase].bytes - s_enter_bytes[phase]);
+#else
+    (void)phase;
+#endif
+}
+
+void BootProfile::bytes(uint32_t length)
+{
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+    uint8_t i;
+
+    for (i = 0; i < s_depth; i++)
+    {
+        s_profile.phases[s_open[i]].bytes += length;
+    }
+#else
+    (void)length;
+#endif
+}
+
+void BootProfile::save(uint32_t jump_address)
+{
+#if defined(BOOT_PROFILE_ENABLE) && (BOOT_PROFILE_ENABLE == 1)
+    s_profile.magic = BOOT_PROFILE_MAGIC;
+    s_profile.length = sizeof(boot_profile_t);
+    s_profile.phase_num = BOOT_PHASE_NUM;
+    s_profile.ring_size = BOOT_PROFILE_RING_SIZE;
+    s_profile.jump_address = jump_address;
+    s_profile.crc = Crc32_CalculateBuffer((const uint8_t *)&s_profile, offsetof(boot_profile_t, crc));
+    memcpy(BOOT_PROFILE_PTR, &s_profile, sizeof(boot_profile_t));
+#else
+    (void)jump_address;
+#endif
+}
+
+bool BootProfile::load(boot_profile_t *profile)
+{
+    memcpy(profile, BOOT_PROFILE_PTR, sizeof(boot_profile_t));
+    /* The region holds whatever RAM had at power on */
+    return BOOT_PROFILE_MAGIC == profile->magic
+        && sizeof(boot_profile_t) == profile->length
+        && BOOT_PHASE_NUM == profile->phase_num
+        && BOOT_PROFILE_RING_SIZE == profile->ring_size
+        && profile->tick_hz != 0
+        && Crc32_CalculateBuffer((const uint8_t *)profile, offsetof(boot_profile_t, crc)) == profile->crc;
+} // load
+
+void BootProfile::print(const boot_profile_t *profile)
+{
+    uint8_t i;
+
+    BOOT_PROFILE_TAG_PRINTF("jump 0x%08X, %u events, %u ticks/s",
+                            profile->jump_address, profile->events, profile->tick_hz);
+    for (i = 0; i < BOOT_PHASE_NUM; i++)
+    {
+        if (profile->phases[i].calls == 0)
+        {
+            continue;
+        }
+        BOOT_PROFILE_TAG_PRINTF("\t %-16s %10uus %10u bytes %4u calls",
+                                phaseName(i),
+                                toUs(profile, profile->phases[i].ticks),
+                                profile->phases[i].bytes,
+                                profile->phases[i].calls);
+    }
+} // print
+
+uint32_t BootProfile::toUs(const boot_profile_t *profile, uint32_t ticks)
+{
+    if (profile->tick_hz == 0)
+    {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)ticks * 1000000ULL) / profile->tick_hz);
+}
+
+const char *BootProfile::phaseName(uint8_t phase)
+{
+    return (phase < BOOT_PHASE_NUM) ? s_phase_names[phase] : "?";
+}
@@ -0,0 +1,192 @@
+/** @file boot_profile.h
+ *  @brief Boot phase timing of the MBR: the time and the bytes of each phase
+ *         (SPI init, MBR scan, verify, copies, MBR writes) in a RAM ring,
+ *         the profile of the last boot is kept in RAM the application
+ *         doesn't use, it reads it with BootProfile::load().
+ *         Ticks are the DWT cycle counter, the microsecond ticker where
+ *         there is no DWT (host build).
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __BOOT_PROFILE_H
+#define __BOOT_PROFILE_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** Record the boot phases.
+ *  0: the hooks are compiled but folded away, start() and save() are
+ *     empty, no RAM
+ *  1: some 50 cycles per phase, the profile in .bss
+ */
+#ifndef BOOT_PROFILE_ENABLE
+#define BOOT_PROFILE_ENABLE 1
+#endif
+
+/** Events kept by the ring, an enter and a leave per phase call */
+#ifndef BOOT_PROFILE_RING_SIZE
+#define BOOT_PROFILE_RING_SIZE 32U
+#endif
+
+/** Phases open at the same time */
+#ifndef BOOT_PROFILE_DEPTH
+#define BOOT_PROFILE_DEPTH 4U
+#endif
+
+/** RAM of the last boot's profile: the top of RAM, out of the MBR's RAM
+ *  by target.mbed_ram_size (mbed_app.json). The initial stack of an mbed
+ *  application is the top of its RAM, so the application sets the same
+ *  target.mbed_ram_size. The MBR doesn't save the profile for an
+ *  application whose initial stack pointer is above the region.
+ */
+#ifndef BOOT_PROFILE_REGION_SIZE
+#define BOOT_PROFILE_REGION_SIZE 0x400U
+#endif
+#ifndef BOOT_PROFILE_REGION_ADDR
+#define BOOT_PROFILE_REGION_ADDR (0x20040000UL - BOOT_PROFILE_REGION_SIZE)
+#endif
+
+/** The host build points it at a static buffer */
+#ifndef BOOT_PROFILE_PTR
+#define BOOT_PROFILE_PTR ((void*)(uintptr_t)BOOT_PROFILE_REGION_ADDR)
+#endif
+
+/** "BPF1" */
+#define BOOT_PROFILE_MAGIC 0x31465042UL
+
+/** Scoped phase: from here to the end of the block */
+#define BOOT_PROFILE_PHASE(phase) BootPhase boot_phase_scope_(phase)
+
+/* Exported types ------------------------------------------------------------*/
+typedef enum
+{
+    BOOT_PHASE_BOOT = 0,        /* main() to the jump */
+    BOOT_PHASE_SPI_INIT,        /* SPI NOR init */
+    BOOT_PHASE_MBR_BEGIN,       /* MBR record scan (findLastHeader) */
+    BOOT_PHASE_MBR_COMMIT,      /* MBR record write */
+    BOOT_PHASE_VERIFY_MAIN,
+    BOOT_PHASE_VERIFY_BOOT,
+    BOOT_PHASE_VERIFY_DOWNLOAD,
+    BOOT_PHASE_UPGRADE,         /* image download to main/boot */
+    BOOT_PHASE_BACKUP,          /* main/boot to the rollback partition */
+    BOOT_PHASE_RESTORE,         /* rollback partition to main/boot */
+    BOOT_PHASE_REPAIR,          /* bad pages of main/boot from the rollback */
+    BOOT_PHASE_END,             /* prefetcher, MBR and SPI NOR shut down */
+    BOOT_PHASE_NUM
+} boot_phase_t;
+
+/** Totals of a phase, nested phases included */
+typedef struct
+{
+    uint32_t ticks;
+    uint32_t bytes;     /* bytes checked (CRC32) and written */
+    uint32_t calls;
+} boot_phase_stats_t;
+
+typedef struct
+{
+    uint32_t tick;      /* since BootProfile::start(), wraps at 2^32 */
+    uint32_t bytes;     /* leave: bytes of this call */
+    uint8_t phase;      /* boot_phase_t */
+    uint8_t leave;      /* 0 enter, 1 leave */
+    uint8_t depth;      /* phases open before the enter */
+    uint8_t reserved;
+} boot_profile_event_t;
+
+/** Profile of a boot, as stored in the region */
+typedef struct
+{
+    uint32_t magic;         /* BOOT_PROFILE_MAGIC */
+    uint16_t length;        /* sizeof(boot_profile_t) */
+    uint8_t phase_num;      /* BOOT_PHASE_NUM */
+    uint8_t ring_size;      /* BOOT_PROFILE_RING_SIZE */
+    uint32_t tick_hz;       /* ticks per second */
+    uint32_t jump_address;  /* 0: no application */
+    uint32_t events;        /* events recorded, the ring keeps the last ring_size */
+    boot_phase_stats_t phases[BOOT_PHASE_NUM];
+    boot_profile_event_t ring[BOOT_PROFILE_RING_SIZE];
+    uint32_t crc;           /* CRC32 of the bytes before it */
+} boot_profile_t;
+
+class BootProfile
+{
+public:
+    /** Start the tick counter and clear the ring, first thing in main() */
+    static void start(void);
+
+    static void enter(boot_phase_t phase);
+    static void leave(boot_phase_t phase);
+
+    /** Count bytes to the open phases */
+    static void bytes(uint32_t length);
+
+    /** Store the profile in the region, before the jump
+     * @param jump_address application started, 0 for none
+     */
+    static void save(uint32_t jump_address);
+
+    /** Copy the profile of the last boot out of the region
+     * @return false if the region holds no valid profile
+     */
+    static bool load(boot_profile_t *profile);
+
+    /** Log the phases of a profile */
+    static void print(const boot_profile_t *profile);
+
+    /** Microseconds of a tick count of a profile */
+    static uint32_t toUs(const boot_profile_t *profile, uint32_t ticks);
+
+    static const char *phaseName(uint8_t phase);
+};
+
+/** Enter a phase for the lifetime of the object, see BOOT_PROFILE_PHASE */
+class BootPhase
+{
+public:
+    explicit BootPhase(boot_phase_t phase) : _phase(phase)
+    {
+        if (BOOT_PROFILE_ENABLE)
+        {
+            BootProfile::enter(_phase);
+        }
+    }
+    ~BootPhase()
+    {
+        if (BOOT_PROFILE_ENABLE)
+        {
+            BootProfile::leave(_phase);
+        }
+    }
+
+private:
+    boot_phase_t _phase;
+};
+
+/* Exported functions --------------------------------------------------------*/
+/** Hooks of the instrumented code, nothing when BOOT_PROFILE_ENABLE is 0 */
+inline void bootProfileEnter(boot_phase_t phase)
+{
+    if (BOOT_PROFILE_ENABLE)
+    {
+        BootProfile::enter(phase);
+    }
+}
+
+inline void bootProfileLeave(boot_phase_t phase)
+{
+    if (BOOT_PROFILE_ENABLE)
+    {
+        BootProfile::leave(phase);
+    }
+}
+
+inline void bootProfileBytes(uint32_t length)
+{
+    if (BOOT_PROFILE_ENABLE)
+    {
+        BootProfile::bytes(length);
+    }
+}
+
+#endif /* __BOOT_PROFILE_H */
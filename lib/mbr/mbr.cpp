@@ -1,12 +1,15 @@
 /* Includes ------------------------------------------------------------------*/
 #include "mbr.h"
+#include "boot_profile.h"
+
+static_assert(MBR_PARAMS_RESERVED_LENGTH <= FWL_RESERVED_LENGTH_MAX, "the general headers don't fit FWL_RESERVED_LENGTH_MAX");
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
 /* Private macro -------------------------------------------------------------*/
 
 MasterBootRecord::MasterBootRecord() : /* Initialization FlashWearLevellingUtils object */
-                                       _flash_wear_levelling(MASTER_BOOT_PARAMS_ADDR, MASTER_BOOT_PARAMS_REGION_SIZE, DEVICE_PAGE_ERASE_SIZE, sizeof(mbr_info_t)),
+                                       _flash_wear_levelling(MASTER_BOOT_PARAMS_ADDR, MASTER_BOOT_PARAMS_REGION_SIZE, DEVICE_PAGE_ERASE_SIZE, sizeof(mbr_info_t), MBR_PARAMS_RESERVED_LENGTH),
                                        /* Initialization FlashIAPBlockDevice object */
                                        _flash_iap_block_device(MASTER_BOOT_PARAMS_ADDR, MASTER_BOOT_PARAMS_REGION_SIZE),
                                        /* Initialization flashInterface object with FlashIAPBlockDevice handler*/
@@ -15,6 +18,9 @@ MasterBootRecord::MasterBootRecord() : /* Initialization FlashWearLevellingUtils
                                        _fp_callback(&_flash_internal_handler)
 {
     _init_isOK = false;
+    _dirty = 0;
+    _tx_depth = 0;
+    _write_count = 0;
 }
 
 MasterBootRecord::~MasterBootRecord() {
@@ -25,6 +31,8 @@ void MasterBootRecord::end(void)
 {
     if (_init_isOK)
     {
+        /* Idle time, erase the next page of the params ring */
+        _flash_wear_levelling.prepare();
         _flash_internal_handler.end();
         _init_isOK = false;
     }
@@ -53,6 +61,7 @@ MasterBootRecord::mbr_status_t MasterBootRecord::begin(void)
     }
 
     this->load();
+    _flash_wear_levelling.prepare();
 
     _init_isOK = true;
     return MBR_OK;
@@ -60,24 +69,93 @@ MasterBootRecord::mbr_status_t MasterBootRecord::begin(void)
 
 MasterBootRecord::mbr_status_t MasterBootRecord::load(void)
 {
+    uint16_t length = sizeof(mbr_info_t);
+
+    /* The record in flash is the last one committed */
+    _dirty = 0;
+
     MBR_TAG_PRINTF("[_flash_wear_levelling] read");
-    if (!_flash_wear_levelling.read(&_mbr_info))
+    if (!_flash_wear_levelling.read((uint8_t *)&_mbr_info, &length)
+    || length < MBR_INFO_LEGACY_LENGTH)
     {
         return setDefault();
     }
+
+    /* The record was written by an older firmware, clear the new fields */
+    if (length < sizeof(mbr_info_t))
+    {
+        MBR_TAG_PRINTF("[load] legacy record %u byte", length);
+        memset((uint8_t *)&_mbr_info + length, 0, sizeof(mbr_info_t) - length);
+    }
     return MBR_OK;
 }
 
+/** Store the changes, it is deferred until the end of a transaction */
 MasterBootRecord::mbr_status_t MasterBootRecord::commit(void)
 {
+    if (_tx_depth > 0)
+    {
+        return MBR_OK;
+    }
+    return flush();
+}
+
+/** Store the changes now, even inside a transaction.
+ *  Used before a partition is erased, the state must be in flash first.
+ */
+MasterBootRecord::mbr_status_t MasterBootRecord::flush(void)
+{
+    if (0 == _dirty)
+    {
+        return MBR_OK;
+    }
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_MBR_COMMIT);
+    MBR_TAG_PRINTF("[flush] dirty 0x%03X", _dirty);
+    _write_count++;
     if (!_flash_wear_levelling.write(&_mbr_info))
     {
-        MBR_TAG_PRINTF("[commit] failed!");
+        MBR_TAG_PRINTF("[flush] failed!");
         return MBR_ERROR;
     }
+    bootProfileBytes(sizeof(mbr_info_t));
+    _dirty = 0;
     return MBR_OK;
 }
 
+/** Start a transaction, commit() only marks the changes until
+ *  the outermost endTransaction() stores them with one write.
+ */
+void MasterBootRecord::beginTransaction(void)
+{
+    _tx_depth++;
+}
+
+MasterBootRecord::mbr_status_t MasterBootRecord::endTransaction(void)
+{
+    if (0 == _tx_depth)
+    {
+        MBR_TAG_PRINTF("[endTransaction] no transaction");
+        return MBR_ERROR;
+    }
+
+    if (--_tx_depth > 0)
+    {
+        return MBR_OK;
+    }
+    return flush();
+}
+
+uint32_t MasterBootRecord::getWriteCount(void)
+{
+    return _write_count;
+}
+
+uint16_t MasterBootRecord::getDirty(void)
+{
+    return _dirty;
+}
+
 MasterBootRecord::mbr_status_t MasterBootRecord::setDefault(void)
 {
     mbr_info_t mbr_default = MBR_INFO_DEFAULT;
@@ -94,12 +172,14 @@ MasterBootRecord::mbr_status_t MasterBootRecord::setDefault(void)
     mbr_default.common.dfu_mode = MBR_DFU_MODE;
     
     MBR_TAG_PRINTF("[setDefault] Set");
+    _write_count++;
     if (!_flash_wear_levelling.write(&mbr_default))
     {
         MBR_TAG_PRINTF("[setDefault] write failed!");
         return MBR_ERROR;
     }
     _mbr_info = mbr_default;
+    _dirty = 0;
     return MBR_OK;
 }
 
@@ -163,82 +243,169 @@ uint16_t MasterBootRecord::getBootDfuNum(void)
     return _mbr_info.dfu_num.boot;
 }
 
-std::string MasterBootRecord::getHardwareVersion(void)
+const char *MasterBootRecord::getHardwareVersion(void)
 {
     _mbr_info.hw_version_str[HARDWARE_VERSION_LENGTH_MAX - 1] = 0;
-    return std::string((char*)_mbr_info.hw_version_str, HARDWARE_VERSION_LENGTH_MAX);
+    return (const char*)_mbr_info.hw_version_str;
+}
+
+copy_journal_t MasterBootRecord::getJournal(void)
+{
+    return _mbr_info.journal;
 }
 
 void MasterBootRecord::setMainParams(app_info_t* pParams)
 {
-    _mbr_info.main_app = *pParams;
+    setField(&_mbr_info.main_app, pParams, sizeof(app_info_t), DIRTY_MAIN_APP);
 }
 
 void MasterBootRecord::setBootParams(app_info_t* pParams)
 {
-    _mbr_info.boot_app = *pParams;
+    setField(&_mbr_info.boot_app, pParams, sizeof(app_info_t), DIRTY_BOOT_APP);
 }
 
 void MasterBootRecord::setMainRollbackParams(app_info_t* pParams)
 {
-    _mbr_info.main_rollback = *pParams;
+    setField(&_mbr_info.main_rollback, pParams, sizeof(app_info_t), DIRTY_MAIN_ROLLBACK);
 }
 
 void MasterBootRecord::setBootRollbackParams(app_info_t* pParams)
 {
-    _mbr_info.boot_rollback = *pParams;
+    setField(&_mbr_info.boot_rollback, pParams, sizeof(app_info_t), DIRTY_BOOT_ROLLBACK);
 }
 
 void MasterBootRecord::setImageDownloadParams(app_info_t* pParams)
 {
-    _mbr_info.image_download = *pParams;
+    setField(&_mbr_info.image_download, pParams, sizeof(app_info_t), DIRTY_IMAGE_DOWNLOAD);
 }
 
 void MasterBootRecord::setAes128Params(AES128_crypto_t* pParams)
 {
-    _mbr_info.aes = *pParams;
+    setField(&_mbr_info.aes, pParams, sizeof(AES128_crypto_t), DIRTY_AES);
 }
 
 void MasterBootRecord::setDfuMode(dfu_mode_t mode)
 {
-    _mbr_info.common.dfu_mode = mode;
+    if (_mbr_info.common.dfu_mode != mode)
+    {
+        _mbr_info.common.dfu_mode = mode;
+        _dirty |= DIRTY_COMMON;
+    }
 }
 
 void MasterBootRecord::setStartUpMode(startup_mode_t mode)
 {
-    _mbr_info.common.startup_mode = mode;
+    if (_mbr_info.common.startup_mode != mode)
+    {
+        _mbr_info.common.startup_mode = mode;
+        _dirty |= DIRTY_COMMON;
+    }
 }
 
 void MasterBootRecord::setMainStatus(app_status_t status)
 {
-    _mbr_info.main_app.common.app_status = status;
+    if (_mbr_info.main_app.common.app_status != status)
+    {
+        _mbr_info.main_app.common.app_status = status;
+        _dirty |= DIRTY_MAIN_APP;
+    }
 }
 
 void MasterBootRecord::setBootStatus(app_status_t status)
 {
-    _mbr_info.boot_app.common.app_status = status;
+    if (_mbr_info.boot_app.common.app_status != status)
+    {
+        _mbr_info.boot_app.common.app_status = status;
+        _dirty |= DIRTY_BOOT_APP;
+    }
 }
 
-void MasterBootRecord::setHardwareVersion(std::string const &hwName)
+void MasterBootRecord::setHardwareVersion(const char *hwName)
 {
-    memcpy(_mbr_info.hw_version_str, hwName.data(), HARDWARE_VERSION_LENGTH_MAX);
-    _mbr_info.hw_version_str[HARDWARE_VERSION_LENGTH_MAX - 1] = 0;
+    char hw_version_str[HARDWARE_VERSION_LENGTH_MAX] = {0};
+
+    strncpy(hw_version_str, hwName, HARDWARE_VERSION_LENGTH_MAX - 1);
+    setField(_mbr_info.hw_version_str, hw_version_str, HARDWARE_VERSION_LENGTH_MAX, DIRTY_HW_VERSION);
 }
 
 void MasterBootRecord::setMainDfuNum(uint16_t num)
 {
-    _mbr_info.dfu_num.main = num;
+    if (_mbr_info.dfu_num.main != num)
+    {
+        _mbr_info.dfu_num.main = num;
+        _dirty |= DIRTY_DFU_NUM;
+    }
 }
 
 void MasterBootRecord::setBootDfuNum(uint16_t num)
 {
-    _mbr_info.dfu_num.boot = num;
+    if (_mbr_info.dfu_num.boot != num)
+    {
+        _mbr_info.dfu_num.boot = num;
+        _dirty |= DIRTY_DFU_NUM;
+    }
+}
+
+void MasterBootRecord::setJournal(copy_journal_t *pJournal)
+{
+    setField(&_mbr_info.journal, pJournal, sizeof(copy_journal_t), DIRTY_JOURNAL);
+}
+
+bool MasterBootRecord::getWearHistogram(uint32_t *counts, uint16_t *pages)
+{
+    return _flash_wear_levelling.wearHistogram(counts, pages);
+}
+
+void MasterBootRecord::clearJournal(void)
+{
+    copy_journal_t journal;
+
+    memset(&journal, 0, sizeof(copy_journal_t));
+    setField(&_mbr_info.journal, &journal, sizeof(copy_journal_t), DIRTY_JOURNAL);
+}
+
+verify_cache_t MasterBootRecord::getVerifyCache(void)
+{
+    return _mbr_info.verify;
+}
+
+void MasterBootRecord::setVerifyCache(verify_cache_t *pCache)
+{
+    setField(&_mbr_info.verify, pCache, sizeof(verify_cache_t), DIRTY_VERIFY);
+}
+
+manifest_info_t MasterBootRecord::getManifest(void)
+{
+    return _mbr_info.manifest;
+}
+
+void MasterBootRecord::setManifest(manifest_info_t *pManifest)
+{
+    setField(&_mbr_info.manifest, pManifest, sizeof(manifest_info_t), DIRTY_MANIFEST);
+}
+
+/** An internal partition is going to be written, the verified entries are stale */
+void MasterBootRecord::bumpWriteGen(void)
+{
+    _mbr_info.verify.write_gen++;
+    _dirty |= DIRTY_VERIFY;
+}
+
+/** Copy a field, it is marked dirty only if the value changes */
+void MasterBootRecord::setField(void *field, const void *value, size_t length, uint16_t dirty)
+{
+    if (0 != memcmp(field, value, length))
+    {
+        memcpy(field, value, length);
+        _dirty |= dirty;
+    }
 }
 
 void MasterBootRecord::printMbrInfo(void)
 {
 #if (1)
-    if(load() == MBR_OK)
+    /* Pending changes of a transaction aren't dropped */
+    if((0 != _dirty) || (load() == MBR_OK))
     {
         MBR_TAG_PRINTF("MBR information");
         MBR_TAG_PRINTF("main_app:");
@@ -305,7 +472,23 @@ void MasterBootRecord::printMbrInfo(void)
         MBR_TAG_PRINTF("boot dfu_num: %u", _mbr_info.dfu_num.boot);
         MBR_TAG_PRINTF("hw_version_str: %16s", _mbr_info.hw_version_str);
         MBR_TAG_PRINTF("startup_mode: %u", _mbr_info.common.startup_mode);
-        MBR_TAG_PRINTF("dfu_mode: %u\n", _mbr_info.common.dfu_mode);
+        MBR_TAG_PRINTF("dfu_mode: %u", _mbr_info.common.dfu_mode);
+        MBR_TAG_PRINTF("journal: op %u, block %u", _mbr_info.journal.common.op, _mbr_info.journal.block);
+        MBR_TAG_PRINTF("verify: write_gen %u, main gen %u, boot gen %u",
+                        _mbr_info.verify.write_gen, _mbr_info.verify.main.gen, _mbr_info.verify.boot.gen);
+        MBR_TAG_PRINTF("manifest: main root 0x%08X, boot root 0x%08X",
+                        _mbr_info.manifest.main, _mbr_info.manifest.boot);
+        MBR_TAG_PRINTF("writes: %u, dirty 0x%03X", _write_count, _dirty);
+
+        uint32_t counts[MBR_PARAMS_PAGE_NUM];
+        uint16_t pages = MBR_PARAMS_PAGE_NUM;
+        if (getWearHistogram(counts, &pages))
+        {
+            for (uint16_t i = 0; i < pages; i++)
+            {
+                MBR_TAG_PRINTF("params page %u: erase_count %u", i, counts[i]);
+            }
+        }
     }
     else
     {
@@ -344,13 +527,11 @@ void MasterBootRecord::printFwHeaderInfo(firmwareHeader_t *fwHeader)
                     fwHeader->type.app ? "Main" : "Boot");
 }
 
-std::string MasterBootRecord::readableSize(float bytes) {
-    char buff[10];
-    std::string var;
+size_str_t MasterBootRecord::readableSize(float bytes) {
+    size_str_t var;
     if (bytes < 1024)
     {
-        snprintf(buff, 10, "%u", (uint32_t)bytes);
-        var = std::string(buff) + " B";
+        snprintf(var.str, sizeof(var.str), "%u B", (uint32_t)bytes);
         return var;
     }
     const char* const units[] = {" KiB", " MiB", " GiB", " TiB", "PiB"};
@@ -359,7 +540,6 @@ std::string MasterBootRecord::readableSize(float bytes) {
         bytes = bytes / 1024;
         i++;
     } while (bytes >= 1024);
-    snprintf(buff, 10, "%u.%02u", (uint32_t)bytes, (uint32_t)(bytes*100)%100);
-    var = std::string(buff) + units[i];
+    snprintf(var.str, sizeof(var.str), "%u.%02u%s", (uint32_t)bytes, (uint32_t)(bytes*100)%100, units[i]);
     return var;
 }
\ No newline at end of file
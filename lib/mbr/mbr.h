@@ -21,7 +21,6 @@
 
 /* Includes ------------------------------------------------------------------*/
 #include "mbed.h"
-#include <string>
 #include "flash_if.h"
 #include "FlashIAPBlockDevice.h"
 #include "FlashWearLevellingUtils.h"
@@ -37,6 +36,9 @@
 #define MBR_STARTUP_MODE MAIN_RUN_MODE
 #define MBR_DFU_MODE UPGRADE_MODE_ANY
 
+/* Number of pages of the params ring */
+#define MBR_PARAMS_PAGE_NUM (MASTER_BOOT_PARAMS_REGION_SIZE / DEVICE_PAGE_ERASE_SIZE)
+
 #define HARDWARE_VERSION_LENGTH_MAX 16
 #define AES128_LENGTH 16
 
@@ -63,6 +65,11 @@
 #define MAIN_APP_HEADER_GENERAL_LOCATION 0x15FE0
 #define BOOT_APP_HEADER_GENERAL_LOCATION 0x15FC0
 
+/** The general headers are in the last page of the params region, the ring
+ *  of the params log doesn't write them and keeps them when it erases the page.
+ */
+#define MBR_PARAMS_RESERVED_LENGTH (MASTER_BOOT_PARAMS_ADDR + MASTER_BOOT_PARAMS_REGION_SIZE - BOOT_APP_HEADER_GENERAL_LOCATION)
+
 #define MBR_INFO_DEFAULT                                                              \
     {                                                                                 \
         .main_app = {.startup_addr = MAIN_APPLICATION_ADDR,                           \
@@ -121,6 +128,10 @@ typedef struct __attribute__((packed, aligned(4)))
                             1. image encrypt;
                             2. Header + image raw (image download option);
                             3. (Header + image raw) encrypt (image download option);
+                            4. image encrypt AES-CTR, any block decrypts independently;
+                            5. delta image (patch of the rollback image), raw;
+                            6. delta image encrypt AES-CTR;
+                            0x80 flag or-ed with 0, 1 or 4: image compressed (LZSS);
                             */
             uint8_t app;    /* refer header_application_t 
                             0. Boot
@@ -152,7 +163,7 @@ typedef struct __attribute__((packed, aligned(4)))
         struct
         {
             uint8_t app_status; /* ref app_status_t */
-            uint8_t NI1;
+            uint8_t auth;       /* ref header_auth_t */
             uint8_t NI2;
             uint8_t NI3;
         };
@@ -165,6 +176,51 @@ typedef struct
     uint8_t iv[AES128_LENGTH];  /* AES iv encrypt */
 } AES128_crypto_t;
 
+/* Progress of a copy between partitions, the copy resumes from block after a reset */
+typedef struct __attribute__((packed, aligned(4)))
+{
+    union
+    {
+        uint32_t u32;
+        struct
+        {
+            uint8_t op; /* ref journal_op_t */
+            uint8_t NI1;
+            uint8_t NI2;
+            uint8_t NI3;
+        };
+    } common;
+    uint32_t block;        /* Number of blocks completed */
+    uint32_t src_checksum; /* Checksum of the src image being copied */
+    uint32_t src_crc;      /* Running crc32 register of src after block */
+    uint32_t des_crc;      /* Running crc32 register of des after block */
+} copy_journal_t;
+
+/* Internal partition verified in full, ref verify_cache_t */
+typedef struct __attribute__((packed, aligned(4)))
+{
+    uint32_t gen;        /* write_gen when the partition was verified */
+    uint32_t checksum;   /* fw_header.checksum verified */
+    uint32_t NI;
+} verify_entry_t;
+
+/* The CRC of an internal partition is skipped while nothing wrote it */
+typedef struct __attribute__((packed, aligned(4)))
+{
+    uint32_t write_gen; /* bumped before any internal partition is written */
+    verify_entry_t main;
+    verify_entry_t boot;
+} verify_cache_t;
+
+/* Roots of the chunk tables stored in external flash after the rollback
+ * copies, CRC32 of the table block. 0: no table
+ */
+typedef struct __attribute__((packed, aligned(4)))
+{
+    uint32_t main;
+    uint32_t boot;
+} manifest_info_t;
+
 /* Size of structure must be multiples write_size-byte for write command */
 typedef struct __attribute__((packed, aligned(4)))
 {
@@ -193,8 +249,21 @@ typedef struct __attribute__((packed, aligned(4)))
             uint8_t dfu_mode;     /* ref dfu_mode_t */
         };
     } common;
+    copy_journal_t journal; /* copy in flight */
+    verify_cache_t verify;  /* partitions verified */
+    manifest_info_t manifest; /* chunk tables of the rollback copies */
 } mbr_info_t;
 
+/* Length of a record written before the journal was added */
+#define MBR_INFO_LEGACY_LENGTH offsetof(mbr_info_t, journal)
+
+/* Text of a size for the logs, "636.00 KiB", no heap */
+typedef struct
+{
+    char str[16];
+    const char *c_str(void) const { return str; }
+} size_str_t;
+
 class MasterBootRecord
 {
 public:
@@ -228,9 +297,23 @@ public:
         DATA_RAW = 0,
         DATA_ENC,
         DATA_HEADER_AND_RAW, /* reserve */
-        DATA_HEADER_AND_ENC  /* reserve */
+        DATA_HEADER_AND_ENC, /* reserve */
+        DATA_ENC_CTR,
+        DATA_DELTA,
+        DATA_DELTA_ENC_CTR,
+        DATA_COMPRESSED = 0x80 /* flag, lzss_header_t + heatshrink stream, encrypted after compression */
     } header_encrypt_t;
 
+    /** Image authentication. AUTH_CMAC: a 16-byte AES-CMAC tag is stored
+     *  right after the image (startup_addr + size), computed over size,
+     *  version and the image bytes as stored, with a key derived from aes.key
+     */
+    typedef enum
+    {
+        AUTH_NONE = 0,
+        AUTH_CMAC
+    } header_auth_t;
+
     typedef enum
     {
         APP_STATUS_NONE = 0,
@@ -239,6 +322,17 @@ public:
         APP_STATUS_ERROR
     } app_status_t;
 
+    typedef enum
+    {
+        JOURNAL_OP_NONE = 0,
+        JOURNAL_OP_UPGRADE_MAIN,
+        JOURNAL_OP_UPGRADE_BOOT,
+        JOURNAL_OP_RESTORE_MAIN,
+        JOURNAL_OP_RESTORE_BOOT,
+        JOURNAL_OP_BACKUP_MAIN,
+        JOURNAL_OP_BACKUP_BOOT
+    } journal_op_t;
+
     /**
      * @brief  Comm status structures definition
      */
@@ -252,6 +346,23 @@ public:
         NO_APP_MODE         /* 5. App None */
     } startup_mode_t;
 
+    /* Fields changed since the last record was written */
+    typedef enum
+    {
+        DIRTY_MAIN_APP = 0x0001,
+        DIRTY_MAIN_ROLLBACK = 0x0002,
+        DIRTY_BOOT_APP = 0x0004,
+        DIRTY_BOOT_ROLLBACK = 0x0008,
+        DIRTY_IMAGE_DOWNLOAD = 0x0010,
+        DIRTY_DFU_NUM = 0x0020,
+        DIRTY_HW_VERSION = 0x0040,
+        DIRTY_AES = 0x0080,
+        DIRTY_COMMON = 0x0100,
+        DIRTY_JOURNAL = 0x0200,
+        DIRTY_VERIFY = 0x0400,
+        DIRTY_MANIFEST = 0x0800
+    } dirty_field_t;
+
 public:
     MasterBootRecord();
     ~MasterBootRecord();
@@ -260,6 +371,9 @@ public:
     mbr_status_t load(void);
     mbr_status_t setDefault(void);
     mbr_status_t commit(void);
+    mbr_status_t flush(void);
+    void beginTransaction(void);
+    mbr_status_t endTransaction(void);
     void end(void);
     void printMbrInfo(void);
     void printAppInfo(app_info_t *pParams);
@@ -277,7 +391,13 @@ public:
     app_status_t getBootStatus(void);
     uint16_t getMainDfuNum(void);
     uint16_t getBootDfuNum(void);
-    std::string getHardwareVersion(void);
+    const char *getHardwareVersion(void);
+    copy_journal_t getJournal(void);
+    bool getWearHistogram(uint32_t *counts, uint16_t *pages);
+    uint32_t getWriteCount(void);
+    uint16_t getDirty(void);
+    verify_cache_t getVerifyCache(void);
+    manifest_info_t getManifest(void);
 
     void setMainParams(app_info_t *pParams);
     void setBootParams(app_info_t *pParams);
@@ -289,9 +409,14 @@ public:
     void setStartUpMode(startup_mode_t mode);
     void setMainStatus(app_status_t status);
     void setBootStatus(app_status_t status);
-    void setHardwareVersion(std::string const &hwName);
+    void setHardwareVersion(const char *hwName);
     void setMainDfuNum(uint16_t num);
     void setBootDfuNum(uint16_t num);
+    void setJournal(copy_journal_t *pJournal);
+    void clearJournal(void);
+    void setVerifyCache(verify_cache_t *pCache);
+    void bumpWriteGen(void);
+    void setManifest(manifest_info_t *pManifest);
 
 private:
     /* Register callback handler flash memory */
@@ -330,7 +455,7 @@ private:
         void onStatus(FlashWearLevellingCallbacks::status_t err_code)
         {
             MBR_TAG_PRINTF("[flashIFCallback][onStatus] %s",
-                           reportStr(err_code).c_str());
+                           reportStr(err_code));
         }
 
     private:
@@ -338,14 +463,19 @@ private:
     };
 
 private:
-    flashInterface<FlashIAPBlockDevice> _flash_internal_handler;
     FlashWearLevellingUtils _flash_wear_levelling;
     FlashIAPBlockDevice _flash_iap_block_device;
+    flashInterface<FlashIAPBlockDevice> _flash_internal_handler;
     flashIFCallback _fp_callback;
     mbr_info_t _mbr_info;
     bool _init_isOK;
+    uint16_t _dirty;        /* ref dirty_field_t, fields changed since the last write */
+    uint8_t _tx_depth;      /* nesting level of transactions */
+    uint32_t _write_count;  /* records written since reset */
+
+    void setField(void *field, const void *value, size_t length, uint16_t dirty);
 
-    std::string readableSize(float bytes);
+    size_str_t readableSize(float bytes);
 };
 
 #endif /* __MBR_H */
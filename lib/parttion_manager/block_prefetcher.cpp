@@ -0,0 +1,184 @@
+/** @file block_prefetcher.cpp
+ *  @brief Double buffered (ping-pong) block reader for the partition copy loops
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "block_prefetcher.h"
+
+/* Private typedef -----------------------------------------------------------*/
+/* Private define ------------------------------------------------------------*/
+/* Private macro -------------------------------------------------------------*/
+
+BlockPrefetcher::BlockPrefetcher() :
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+_thread(osPriorityAboveNormal, PM_PREFETCH_STACK_SIZE, _stack, "prefetch"),
+_request(0),
+_done(0),
+_thread_started(false),
+_exit(false),
+_in_flight(false),
+#endif
+_buffer(nullptr),
+_block_size(0),
+_next_addr(0),
+_end_addr(0),
+_index(0),
+_pending(false),
+_slot_data(nullptr),
+_slot_addr(0),
+_slot_length(0),
+_slot_result(0)
+{
+    memset(&_stats, 0, sizeof(stats_t));
+}
+
+BlockPrefetcher::~BlockPrefetcher()
+{
+    this->end();
+}
+
+void BlockPrefetcher::start(read_cb_t read, uint8_t *buffer, uint32_t block_size, uint32_t start_addr, uint32_t end_addr)
+{
+    this->stop();
+    _read = read;
+    _buffer = buffer;
+    _block_size = block_size;
+    _next_addr = start_addr;
+    _end_addr = end_addr;
+    _index = 0;
+    memset(&_stats, 0, sizeof(stats_t));
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    if (!_thread_started)
+    {
+        _exit = false;
+        _thread.start(callback(this, &BlockPrefetcher::worker));
+        _thread_started = true;
+    }
+#endif
+    this->request();
+}
+
+uint8_t *BlockPrefetcher::next(uint32_t *addr, uint32_t *length)
+{
+    uint8_t *data;
+
+    if (!_pending)
+    {
+        return nullptr;
+    }
+
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    Timer t;
+    t.start();
+    _done.acquire();
+    t.stop();
+    _in_flight = false;
+    _stats.wait_us += std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+#else
+    /* Serial mode, the consumer waits for the whole read */
+    readSlot();
+    _stats.wait_us = _stats.read_us;
+#endif
+
+    _pending = false;
+    if (_slot_result != 0)
+    {
+        return nullptr;
+    }
+
+    data = _slot_data;
+    *addr = _slot_addr;
+    *length = _slot_length;
+    _stats.blocks++;
+
+    /* The other buffer is free now, start reading the following block */
+    _next_addr += _slot_length;
+    _index = (_index + 1) % PM_PREFETCH_BUFFER_NUM;
+    this->request();
+
+    return data;
+}
+
+void BlockPrefetcher::stop(void)
+{
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    if (_in_flight)
+    {
+        /* The buffer may be released by the caller, wait for the worker */
+        _done.acquire();
+        _in_flight = false;
+    }
+#endif
+    _pending = false;
+}
+
+void BlockPrefetcher::end(void)
+{
+    this->stop();
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    if (_thread_started)
+    {
+        _exit = true;
+        _request.release();
+        _thread.join();
+        _thread_started = false;
+    }
+#endif
+}
+
+uint32_t BlockPrefetcher::overlapPercent(void) const
+{
+    if (_stats.read_us == 0 || _stats.wait_us >= _stats.read_us)
+    {
+        return 0;
+    }
+    return (uint32_t)(((uint64_t)(_stats.read_us - _stats.wait_us) * 100) / _stats.read_us);
+}
+
+void BlockPrefetcher::request(void)
+{
+    if (_next_addr >= _end_addr)
+    {
+        return;
+    }
+
+    _slot_data = _buffer + _index * _block_size;
+    _slot_addr = _next_addr;
+    _slot_length = _end_addr - _next_addr;
+    if (_slot_length > _block_size)
+    {
+        _slot_length = _block_size;
+    }
+    _slot_result = 0;
+    _pending = true;
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    _in_flight = true;
+    _request.release();
+#endif
+}
+
+int BlockPrefetcher::readSlot(void)
+{
+    Timer t;
+    t.start();
+    _slot_result = _read(_slot_data, _slot_addr, _slot_length);
+    t.stop();
+    _stats.read_us += std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    return _slot_result;
+}
+
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+void BlockPrefetcher::worker(void)
+{
+    while (true)
+    {
+        _request.acquire();
+        if (_exit)
+        {
+            break;
+        }
+        readSlot();
+        _done.release();
+    }
+}
+#endif
@@ -0,0 +1,117 @@
+/** @file block_prefetcher.h
+ *  @brief Double buffered (ping-pong) block reader for the partition copy loops.
+ *         While the consumer decrypts and programs block N, block N+1 is read
+ *         from the source device by a worker thread into the other buffer.
+ *         The overlap needs a read that leaves the CPU to the consumer. On the
+ *         nRF52840 it doesn't: the blocking SPI transfer of SPIFBlockDevice
+ *         busy-waits on the SPIM end event, and the NVMC stalls the CPU for
+ *         an internal erase or program. The gain measured by prefetch_bench
+ *         on the host is an upper bound, the target one is to be measured on
+ *         the board (boot profile of the upgrade phase).
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __BLOCK_PREFETCHER_H
+#define __BLOCK_PREFETCHER_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "console_dbg.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** Read the next source block by a worker thread.
+ *  0: the block is read when it is requested, the copy loop runs serially
+ *  1: ping-pong buffers, the next block is read while the current one is
+ *     processed, a gain only where the SPI read doesn't busy-wait the CPU
+ */
+#ifndef PM_COPY_PREFETCH
+#define PM_COPY_PREFETCH 1
+#endif
+
+/** Number of block buffers the caller has to provide */
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+#define PM_PREFETCH_BUFFER_NUM 2
+#else
+#define PM_PREFETCH_BUFFER_NUM 1
+#endif
+
+/** Stack size of the prefetch worker thread */
+#ifndef PM_PREFETCH_STACK_SIZE
+#define PM_PREFETCH_STACK_SIZE 1024
+#endif
+
+/* Exported types ------------------------------------------------------------*/
+class BlockPrefetcher
+{
+public:
+    /** Read callback, same signature as BlockDevice::read */
+    typedef mbed::Callback<int(void *, uint32_t, uint32_t)> read_cb_t;
+
+    typedef struct
+    {
+        uint32_t blocks;   /* number of blocks handed to the consumer */
+        uint32_t read_us;  /* time spent reading the source device */
+        uint32_t wait_us;  /* time the consumer was blocked waiting for a block */
+    } stats_t;
+
+    BlockPrefetcher();
+    ~BlockPrefetcher();
+
+    /** Start reading the source, the first block is requested immediately
+     * @param read source read callback
+     * @param buffer buffer of PM_PREFETCH_BUFFER_NUM * block_size bytes
+     * @param block_size size of one block
+     * @param start_addr first address to read
+     * @param end_addr address after the last byte to read
+     */
+    void start(read_cb_t read, uint8_t *buffer, uint32_t block_size, uint32_t start_addr, uint32_t end_addr);
+
+    /** Get the next block and request the block after it
+     * @param addr address of the block
+     * @param length length of the block
+     * @return pointer to the block data, nullptr at end of data or on read error.
+     *         The data is valid until the following call of next() or stop().
+     */
+    uint8_t *next(uint32_t *addr, uint32_t *length);
+
+    /** Stop reading, waits for a block still being read */
+    void stop(void);
+
+    /** Terminate the worker thread, it can't be started again */
+    void end(void);
+
+    /** Statistics of the last transfer */
+    stats_t stats(void) const { return _stats; }
+
+    /** Percentage of the read time hidden behind the consumer work */
+    uint32_t overlapPercent(void) const;
+
+private:
+    void request(void);
+    int readSlot(void);
+#if defined(PM_COPY_PREFETCH) && (PM_COPY_PREFETCH == 1)
+    void worker(void);
+    rtos::Thread _thread;
+    rtos::Semaphore _request;
+    rtos::Semaphore _done;
+    MBED_ALIGN(8) unsigned char _stack[PM_PREFETCH_STACK_SIZE];
+    bool _thread_started;
+    volatile bool _exit;
+    bool _in_flight;
+#endif
+    read_cb_t _read;
+    uint8_t *_buffer;
+    uint32_t _block_size;
+    uint32_t _next_addr;
+    uint32_t _end_addr;
+    uint8_t _index;
+    bool _pending;
+    /* block requested from the source */
+    uint8_t *_slot_data;
+    uint32_t _slot_addr;
+    uint32_t _slot_length;
+    int _slot_result;
+    stats_t _stats;
+};
+
+#endif /* __BLOCK_PREFETCHER_H */
@@ -0,0 +1,240 @@
+/** @file delta_patch.cpp
+ *  @brief Streaming decoder of the sequential delta image
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "delta_patch.h"
+
+DeltaPatcher::DeltaPatcher()
+{
+    _in = nullptr;
+    _in_len = 0;
+    _base_size = 0;
+    _target_remain = 0;
+    _error = false;
+}
+
+void DeltaPatcher::begin(const delta_header_t *header, read_cb_t base)
+{
+    _base = base;
+    _base_size = header->base_size;
+    _target_remain = header->target_size;
+    _in = nullptr;
+    _in_len = 0;
+    _state = STATE_CONTROL;
+    memset(_fields, 0, sizeof(_fields));
+    _field = 0;
+    _shift = 0;
+    _diff_remain = 0;
+    _copy_remain = 0;
+    _add_remain = 0;
+    _extra_remain = 0;
+    _adjust = 0;
+    _from = 0;
+    _error = false;
+}
+
+void DeltaPatcher::feed(const uint8_t *data, uint32_t length)
+{
+    _in = data;
+    _in_len = length;
+}
+
+/** @brief read count varints, a field may be split over two feeds
+ * @return true when all the fields are read
+*/
+bool DeltaPatcher::readFields(uint32_t *fields, uint8_t count)
+{
+    uint8_t byte;
+
+    while (_field < count && _in_len)
+    {
+        byte = *_in++;
+        _in_len--;
+        if (_shift >= 7 * DELTA_VARINT_MAX_LENGTH)
+        {
+            _error = true;
+            return false;
+        }
+        fields[_field] |= (uint32_t)(byte & 0x7F) << _shift;
+        _shift += 7;
+        if ((byte & 0x80) == 0)
+        {
+            _field++;
+            _shift = 0;
+        }
+    }
+    if (_field < count)
+    {
+        return false;
+    }
+    _field = 0;
+    return true;
+}
+
+/** @brief the lengths can't go past the target */
+bool DeltaPatcher::parseControl(void)
+{
+    _diff_remain = _fields[0];
+    _extra_remain = _fields[1];
+    _adjust = (int32_t)((_fields[2] >> 1) ^ (0U - (_fields[2] & 1U)));
+    memset(_fields, 0, sizeof(_fields));
+    return (_diff_remain <= _target_remain
+         && _extra_remain <= _target_remain - _diff_remain);
+}
+
+/** @brief the run can't go past the diff or read past the base */
+bool DeltaPatcher::parseRun(void)
+{
+    _copy_remain = _fields[0];
+    _add_remain = _fields[1];
+    memset(_fields, 0, sizeof(_fields));
+    return (_copy_remain <= _diff_remain
+         && _add_remain <= _diff_remain - _copy_remain
+         && (_copy_remain + _add_remain) != 0
+         && _from <= _base_size
+         && (_copy_remain + _add_remain) <= _base_size - _from);
+}
+
+/** @brief read n base bytes to out, the add bytes are added in place */
+uint32_t DeltaPatcher::fromBase(uint8_t *out, uint32_t n, bool add)
+{
+    uint32_t i;
+
+    if (n > DELTA_BASE_READ_SIZE)
+    {
+        n = DELTA_BASE_READ_SIZE;
+    }
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (_base(out, _from, n) != 0)
+    {
+        _error = true;
+        return 0;
+    }
+    if (add)
+    {
+        for (i = 0; i < n; i++)
+        {
+            out[i] += _in[i];
+        }
+        _in += n;
+        _in_len -= n;
+    }
+    _from += n;
+    _target_remain -= n;
+    return n;
+}
+
+uint32_t DeltaPatcher::produce(uint8_t *out, uint32_t size)
+{
+    uint32_t written = 0;
+    uint32_t n;
+
+    while (written < size && !done() && !_error)
+    {
+        switch (_state)
+        {
+        case STATE_CONTROL:
+            if (!readFields(_fields, 3))
+            {
+                return written;
+            }
+            if (!parseControl())
+            {
+                _error = true;
+                return written;
+            }
+            _state = _diff_remain ? STATE_RUN : STATE_EXTRA;
+            break;
+
+        case STATE_RUN:
+            if (!readFields(_fields, 2))
+            {
+                return written;
+            }
+            if (!parseRun())
+            {
+                _error = true;
+                return written;
+            }
+            _diff_remain -= _copy_remain + _add_remain;
+            _state = STATE_COPY;
+            break;
+
+        case STATE_COPY:
+            /* Unchanged bytes, no patch input */
+            n = _copy_remain;
+            if (n > size - written)
+            {
+                n = size - written;
+            }
+            n = fromBase(&out[written], n, false);
+            _copy_remain -= n;
+            written += n;
+            if (_copy_remain == 0)
+            {
+                _state = STATE_ADD;
+            }
+            break;
+
+        case STATE_ADD:
+            n = _add_remain;
+            if (n > size - written)
+            {
+                n = size - written;
+            }
+            if (n > _in_len)
+            {
+                n = _in_len;
+            }
+            if (n == 0 && _add_remain)
+            {
+                return written;
+            }
+            n = fromBase(&out[written], n, true);
+            _add_remain -= n;
+            written += n;
+            if (_add_remain == 0)
+            {
+                _state = _diff_remain ? STATE_RUN : STATE_EXTRA;
+            }
+            break;
+
+        case STATE_EXTRA:
+            n = _extra_remain;
+            if (n > size - written)
+            {
+                n = size - written;
+            }
+            if (n > _in_len)
+            {
+                n = _in_len;
+            }
+            if (n == 0 && _extra_remain)
+            {
+                return written;
+            }
+            memcpy(&out[written], _in, n);
+            _in += n;
+            _in_len -= n;
+            _extra_remain -= n;
+            _target_remain -= n;
+            written += n;
+            if (_extra_remain == 0)
+            {
+                /* Record complete */
+                _from += _adjust;
+                _state = STATE_CONTROL;
+            }
+            break;
+
+        default:
+            _error = true;
+            break;
+        }
+    }
+    return written;
+} // produce
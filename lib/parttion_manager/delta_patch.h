@@ -0,0 +1,129 @@
+/** @file delta_patch.h
+ *  @brief Streaming decoder of the sequential delta image (bsdiff control
+ *         triples). The target image is rebuilt from a base image and the
+ *         patch, both read once in increasing order of the patch.
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __DELTA_PATCH_H
+#define __DELTA_PATCH_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** "DLT1" */
+#define DELTA_PATCH_MAGIC 0x31544C44UL
+
+/** Size of the delta image header */
+#define DELTA_HEADER_LENGTH 32U
+
+/** Longest varint of a 32-bit field */
+#define DELTA_VARINT_MAX_LENGTH 5U
+
+/** Largest base read of the decoder, the target buffer is used for it */
+#ifndef DELTA_BASE_READ_SIZE
+#define DELTA_BASE_READ_SIZE 512U
+#endif
+
+/* Exported types ------------------------------------------------------------*/
+/** Delta image:
+ *  delta_header_t, little-endian
+ *  records until target_size bytes are produced, fields are LEB128 varints:
+ *      diff_len, extra_len, adjust (zigzag)
+ *      diff_len bytes of target from base[from..], as runs until diff_len:
+ *          copy_len, add_len, add_len bytes
+ *          copy_len bytes: target = base[from]
+ *          add_len bytes: target = base[from] + add (mod 256)
+ *      extra_len bytes copied to target
+ *      from += adjust
+ *  Generated by tools/mkdelta.py
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;         /* DELTA_PATCH_MAGIC */
+    uint32_t base_size;     /* size of the base image */
+    uint32_t base_version;  /* version of the base image */
+    uint32_t base_crc;      /* CRC32 of the base image */
+    uint32_t target_size;   /* size of the rebuilt image */
+    uint32_t target_crc;    /* CRC32 of the rebuilt image */
+    uint32_t reserved[2];
+} delta_header_t;
+
+class DeltaPatcher
+{
+public:
+    /** Read callback of the base image, same signature as BlockDevice::read */
+    typedef mbed::Callback<int(void *, uint32_t, uint32_t)> read_cb_t;
+
+    DeltaPatcher();
+
+    /** Start a patch, the header was read and checked by the caller
+     * @param header delta image header
+     * @param base read callback of the base image (plain data)
+     */
+    void begin(const delta_header_t *header, read_cb_t base);
+
+    /** Give the next bytes of the patch, they are kept until consumed by produce()
+     * @param data patch bytes after the header
+     * @param length number of bytes
+     */
+    void feed(const uint8_t *data, uint32_t length);
+
+    /** The fed bytes are consumed, feed() the next ones.
+     *  A copy run goes on without input.
+     */
+    bool needInput(void) const { return _in_len == 0 && !done() && !_error && _state != STATE_COPY; }
+
+    /** Rebuild the next target bytes
+     * @param out target buffer
+     * @param size space in the target buffer
+     * @return number of bytes written to out, less than size when the input
+     *         runs out, the target is complete or on error
+     */
+    uint32_t produce(uint8_t *out, uint32_t size);
+
+    /** Target image complete */
+    bool done(void) const { return _target_remain == 0; }
+
+    /** Patch format or base read error */
+    bool error(void) const { return _error; }
+
+    /** Fed bytes not consumed */
+    uint32_t pending(void) const { return _in_len; }
+
+private:
+    typedef enum
+    {
+        STATE_CONTROL = 0,
+        STATE_RUN,
+        STATE_COPY,
+        STATE_ADD,
+        STATE_EXTRA
+    } state_t;
+
+    bool readFields(uint32_t *fields, uint8_t count);
+    bool parseControl(void);
+    bool parseRun(void);
+    uint32_t fromBase(uint8_t *out, uint32_t n, bool add);
+
+    read_cb_t _base;
+    uint32_t _base_size;
+    const uint8_t *_in;
+    uint32_t _in_len;
+    state_t _state;
+    /* varint fields of the record or run being read */
+    uint32_t _fields[3];
+    uint8_t _field;
+    uint8_t _shift;
+    uint32_t _diff_remain;
+    uint32_t _copy_remain;
+    uint32_t _add_remain;
+    uint32_t _extra_remain;
+    int32_t _adjust;
+    uint32_t _from;
+    uint32_t _target_remain;
+    bool _error;
+};
+
+#endif /* __DELTA_PATCH_H */
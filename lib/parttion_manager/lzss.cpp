@@ -0,0 +1,381 @@
+/** @file lzss.cpp
+ *  @brief Streaming LZSS encoder and decoder of the compressed images
+ */
+
+/* Includes ------------------------------------------------------------------*/
+#include "lzss.h"
+
+/* Private define ------------------------------------------------------------*/
+/* Empty hash head or chain link */
+#define LZSS_NIL 0xFFFFU
+
+/* Shortest match found by the 3-byte hash */
+#define LZSS_MATCH_MIN 3U
+
+static bool lzssParamsValid(uint8_t window_bits, uint8_t lookahead_bits)
+{
+    return (window_bits >= LZSS_WINDOW_BITS_MIN
+         && window_bits <= LZSS_WINDOW_BITS_MAX
+         && lookahead_bits >= LZSS_LOOKAHEAD_BITS_MIN
+         && lookahead_bits < window_bits);
+}
+
+LzssDecoder::LzssDecoder()
+{
+    _window = nullptr;
+    _in = nullptr;
+    _in_len = 0;
+    _out_remain = 0;
+    _error = false;
+}
+
+bool LzssDecoder::begin(const lzss_header_t *header, uint8_t *window)
+{
+    if (!lzssParamsValid(header->window_bits, header->lookahead_bits))
+    {
+        return false;
+    }
+    _window = window;
+    _window_bits = header->window_bits;
+    _lookahead_bits = header->lookahead_bits;
+    _mask = LZSS_WINDOW_SIZE(_window_bits) - 1;
+    /* A reference before the first byte reads 0, as heatshrink does */
+    memset(_window, 0, LZSS_WINDOW_SIZE(_window_bits));
+    _head = 0;
+    _in = nullptr;
+    _in_len = 0;
+    _acc = 0;
+    _acc_bits = 0;
+    _state = STATE_TAG;
+    _offset = 0;
+    _count = 0;
+    _out_remain = header->raw_size;
+    _error = false;
+    return true;
+}
+
+void LzssDecoder::feed(const uint8_t *data, uint32_t length)
+{
+    _in = data;
+    _in_len = length;
+}
+
+/** @brief read count bits MSB first, a field may be split over two feeds
+ * @return true when the field is read
+*/
+bool LzssDecoder::getBits(uint8_t count, uint32_t *value)
+{
+    while (_acc_bits < count)
+    {
+        if (_in_len == 0)
+        {
+            return false;
+        }
+        _acc = (_acc << 8) | *_in++;
+        _in_len--;
+        _acc_bits += 8;
+    }
+    _acc_bits -= count;
+    *value = (_acc >> _acc_bits) & ((1UL << count) - 1);
+    return true;
+}
+
+uint32_t LzssDecoder::produce(uint8_t *out, uint32_t size)
+{
+    uint32_t written = 0;
+    uint32_t value;
+
+    while (written < size && !done() && !_error)
+    {
+        switch (_state)
+        {
+        case STATE_TAG:
+            if (!getBits(1, &value))
+            {
+                return written;
+            }
+            _state = value ? STATE_LITERAL : STATE_INDEX;
+            break;
+
+        case STATE_LITERAL:
+            if (!getBits(8, &value))
+            {
+                return written;
+            }
+            emit((uint8_t)value);
+            out[written++] = (uint8_t)value;
+            _state = STATE_TAG;
+            break;
+
+        case STATE_INDEX:
+            if (!getBits(_window_bits, &value))
+            {
+                return written;
+            }
+            _offset = value + 1;
+            _state = STATE_COUNT;
+            break;
+
+        case STATE_COUNT:
+            if (!getBits(_lookahead_bits, &value))
+            {
+                return written;
+            }
+            _count = value + 1;
+            if (_count > _out_remain)
+            {
+                _error = true;
+                return written;
+            }
+            _state = STATE_COPY;
+            break;
+
+        case STATE_COPY:
+            /* The source may overlap the bytes being copied (runs) */
+            while (_count && written < size)
+            {
+                value = _window[(_head - _offset) & _mask];
+                emit((uint8_t)value);
+                out[written++] = (uint8_t)value;
+                _count--;
+            }
+            if (_count == 0)
+            {
+                _state = STATE_TAG;
+            }
+            break;
+
+        default:
+            _error = true;
+            break;
+        }
+    }
+    return written;
+} // produce
+
+LzssEncoder::LzssEncoder()
+{
+    _buf = nullptr;
+    _in = nullptr;
+    _in_len = 0;
+    _finished = false;
+    _done = false;
+}
+
+bool LzssEncoder::begin(uint8_t window_bits, uint8_t lookahead_bits, uint8_t *work)
+{
+    uint32_t i;
+
+    if (!lzssParamsValid(window_bits, lookahead_bits))
+    {
+        return false;
+    }
+    _window_bits = window_bits;
+    _lookahead_bits = lookahead_bits;
+    _window = LZSS_WINDOW_SIZE(window_bits);
+    _lookahead = 1UL << lookahead_bits;
+    _buf = work;
+    _prev = (uint16_t*)(work + 2 * _window);
+    _heads = _prev + 2 * _window;
+    for (i = 0; i < (1UL << LZSS_HASH_BITS); i++)
+    {
+        _heads[i] = LZSS_NIL;
+    }
+    _pos = 0;
+    _end = 0;
+    _hashed = 0;
+    _in = nullptr;
+    _in_len = 0;
+    _acc = 0;
+    _acc_bits = 0;
+    _finished = false;
+    _done = false;
+    return true;
+}
+
+void LzssEncoder::feed(const uint8_t *data, uint32_t length)
+{
+    _in = data;
+    _in_len = length;
+}
+
+/** @brief move the fed bytes to the buffer, the oldest bytes are dropped
+ * when the lookahead reaches the end of the buffer
+*/
+void LzssEncoder::fill(void)
+{
+    uint32_t n;
+
+    while (_in_len)
+    {
+        if (_end == 2 * _window)
+        {
+            if (_end - _pos >= _lookahead)
+            {
+                return;
+            }
+            /* Keep one window of history before _pos */
+            slide(_pos - _window);
+        }
+        n = 2 * _window - _end;
+        if (n > _in_len)
+        {
+            n = _in_len;
+        }
+        memcpy(&_buf[_end], _in, n);
+        _in += n;
+        _in_len -= n;
+        _end += n;
+    }
+}
+
+void LzssEncoder::slide(uint32_t shift)
+{
+    uint32_t i;
+
+    memmove(_buf, &_buf[shift], _end - shift);
+    memmove(_prev, &_prev[shift], (_end - shift) * sizeof(uint16_t));
+    for (i = 0; i < _end - shift; i++)
+    {
+        _prev[i] = (_prev[i] == LZSS_NIL || _prev[i] < shift) ? LZSS_NIL : _prev[i] - shift;
+    }
+    for (i = 0; i < (1UL << LZSS_HASH_BITS); i++)
+    {
+        _heads[i] = (_heads[i] == LZSS_NIL || _heads[i] < shift) ? LZSS_NIL : _heads[i] - shift;
+    }
+    _pos -= shift;
+    _end -= shift;
+    _hashed -= shift;
+}
+
+/** @brief multiplicative hash of the 3 bytes at pos */
+uint32_t LzssEncoder::hash(uint32_t pos) const
+{
+    uint32_t key = ((uint32_t)_buf[pos] << 16) | ((uint32_t)_buf[pos + 1] << 8) | _buf[pos + 2];
+
+    return (uint32_t)(key * 0x9E3779B1U) >> (32 - LZSS_HASH_BITS);
+}
+
+void LzssEncoder::insert(uint32_t pos)
+{
+    uint32_t h = hash(pos);
+
+    _prev[pos] = _heads[h];
+    _heads[h] = (uint16_t)pos;
+}
+
+/** @brief longest match of the bytes at _pos in the window
+ * @param offset distance back to the match
+ * @return match length, 0 if there is none
+*/
+uint32_t LzssEncoder::findMatch(uint32_t *offset)
+{
+    uint32_t max_len = _end - _pos;
+    uint32_t depth = LZSS_CHAIN_DEPTH;
+    uint32_t best = 0;
+    uint32_t cand;
+    uint32_t len;
+
+    if (max_len > _lookahead)
+    {
+        max_len = _lookahead;
+    }
+    if (max_len < LZSS_MATCH_MIN)
+    {
+        return 0;
+    }
+    cand = _heads[hash(_pos)];
+    while (cand != LZSS_NIL && depth--)
+    {
+        /* The links only go back, the next ones are further */
+        if (_pos - cand > _window)
+        {
+            break;
+        }
+        for (len = 0; len < max_len && _buf[cand + len] == _buf[_pos + len]; len++)
+        {
+        }
+        if (len > best)
+        {
+            best = len;
+            *offset = _pos - cand;
+            if (best == max_len)
+            {
+                break;
+            }
+        }
+        cand = _prev[cand];
+    }
+    return best;
+}
+
+void LzssEncoder::putBits(uint32_t value, uint8_t count)
+{
+    _acc = (_acc << count) | (value & ((1UL << count) - 1));
+    _acc_bits += count;
+}
+
+uint32_t LzssEncoder::produce(uint8_t *out, uint32_t size)
+{
+    uint32_t written = 0;
+    uint32_t offset = 0;
+    uint32_t len;
+
+    while (true)
+    {
+        while (_acc_bits >= 8)
+        {
+            if (written == size)
+            {
+                return written;
+            }
+            _acc_bits -= 8;
+            out[written++] = (uint8_t)(_acc >> _acc_bits);
+        }
+        if (_done)
+        {
+            return written;
+        }
+
+        fill();
+        if (_end - _pos < _lookahead && !_finished)
+        {
+            /* A match could go on in the next bytes */
+            return written;
+        }
+        if (_pos == _end)
+        {
+            if (_in_len)
+            {
+                continue;
+            }
+            if (_acc_bits)
+            {
+                putBits(0, 8 - _acc_bits);
+                continue;
+            }
+            _done = true;
+            return written;
+        }
+
+        while (_hashed < _pos && _hashed + LZSS_MATCH_MIN <= _end)
+        {
+            insert(_hashed++);
+        }
+        len = findMatch(&offset);
+        /* A reference costs 1 + window_bits + lookahead_bits, a literal 9 bits */
+        if (len * 9 > 1U + _window_bits + _lookahead_bits)
+        {
+            putBits(0, 1);
+            putBits(offset - 1, _window_bits);
+            putBits(len - 1, _lookahead_bits);
+            _pos += len;
+        }
+        else
+        {
+            putBits(1, 1);
+            putBits(_buf[_pos], 8);
+            _pos++;
+        }
+    }
+} // produce
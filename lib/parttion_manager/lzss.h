@@ -0,0 +1,187 @@
+/** @file lzss.h
+ *  @brief Streaming LZSS encoder and decoder of the compressed images, the
+ *         bit stream is the one of heatshrink: a flag bit, then an 8-bit
+ *         literal (1) or a back-reference (0) of window_bits offset - 1 and
+ *         lookahead_bits length - 1, MSB first, the last byte padded by 0.
+ *         RAM is fixed: the decoder keeps the window (4K or less), the
+ *         encoder two windows and its hash chains.
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __LZSS_H
+#define __LZSS_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** "LZS1" */
+#define LZSS_MAGIC 0x31535A4CUL
+
+/** Size of the compressed image header */
+#define LZSS_HEADER_LENGTH 16U
+
+/** Window limits, the decoder window is 1 << window_bits bytes */
+#define LZSS_WINDOW_BITS_MIN 4U
+#define LZSS_WINDOW_BITS_MAX 12U
+#define LZSS_LOOKAHEAD_BITS_MIN 3U
+#define LZSS_WINDOW_SIZE(bits) (1U << (bits))
+
+/** Hash table of the encoder, 1 << LZSS_HASH_BITS heads */
+#ifndef LZSS_HASH_BITS
+#define LZSS_HASH_BITS 9U
+#endif
+
+/** Candidates compared by the encoder for one match */
+#ifndef LZSS_CHAIN_DEPTH
+#define LZSS_CHAIN_DEPTH 32U
+#endif
+
+/** Work buffer of the encoder: 2 windows of data and 16-bit chain links,
+ *  16-bit hash heads
+ */
+#define LZSS_ENCODER_WORK_SIZE(bits) ((2U << (bits)) * 3U + (1U << LZSS_HASH_BITS) * 2U)
+
+/* Exported types ------------------------------------------------------------*/
+/** Compressed image:
+ *  lzss_header_t, little-endian
+ *  bit stream until raw_size bytes are produced, the bytes after it are
+ *  ignored (padding of a CBC encrypted image)
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;         /* LZSS_MAGIC */
+    uint32_t raw_size;      /* size of the uncompressed image */
+    uint32_t raw_crc;       /* CRC32 of the uncompressed image */
+    uint8_t window_bits;
+    uint8_t lookahead_bits;
+    uint16_t reserved;
+} lzss_header_t;
+
+class LzssDecoder
+{
+public:
+    LzssDecoder();
+
+    /** Start a stream, the header was read by the caller
+     * @param header compressed image header
+     * @param window buffer of LZSS_WINDOW_SIZE(header->window_bits) bytes
+     * @return false if the window or lookahead size isn't supported
+     */
+    bool begin(const lzss_header_t *header, uint8_t *window);
+
+    /** Give the next bytes of the stream, they are kept until consumed by produce()
+     * @param data stream bytes after the header
+     * @param length number of bytes
+     */
+    void feed(const uint8_t *data, uint32_t length);
+
+    /** Decode the next bytes
+     * @param out output buffer
+     * @param size space in the output buffer
+     * @return number of bytes written to out, less than size when the fed
+     *         bytes run out, the image is complete or on error
+     */
+    uint32_t produce(uint8_t *out, uint32_t size);
+
+    /** Image complete */
+    bool done(void) const { return _out_remain == 0; }
+
+    /** A back-reference goes past the image size */
+    bool error(void) const { return _error; }
+
+    /** Fed bytes not consumed */
+    uint32_t pending(void) const { return _in_len; }
+
+private:
+    typedef enum
+    {
+        STATE_TAG = 0,
+        STATE_LITERAL,
+        STATE_INDEX,
+        STATE_COUNT,
+        STATE_COPY
+    } state_t;
+
+    bool getBits(uint8_t count, uint32_t *value);
+    void emit(uint8_t data) { _window[_head++ & _mask] = data; _out_remain--; }
+
+    uint8_t *_window;
+    uint32_t _mask;
+    uint32_t _head;
+    uint8_t _window_bits;
+    uint8_t _lookahead_bits;
+    const uint8_t *_in;
+    uint32_t _in_len;
+    uint32_t _acc;
+    uint8_t _acc_bits;
+    state_t _state;
+    uint32_t _offset;
+    uint32_t _count;
+    uint32_t _out_remain;
+    bool _error;
+};
+
+class LzssEncoder
+{
+public:
+    LzssEncoder();
+
+    /** Start a stream, greedy parsing over hash chains
+     * @param window_bits offset bits, LZSS_WINDOW_BITS_MIN..LZSS_WINDOW_BITS_MAX
+     * @param lookahead_bits length bits, LZSS_LOOKAHEAD_BITS_MIN..window_bits - 1
+     * @param work buffer of LZSS_ENCODER_WORK_SIZE(window_bits) bytes, 2-byte aligned
+     * @return false if the window or lookahead size isn't supported
+     */
+    bool begin(uint8_t window_bits, uint8_t lookahead_bits, uint8_t *work);
+
+    /** Give the next bytes of the image, they are kept until consumed by produce()
+     * @param data image bytes
+     * @param length number of bytes
+     */
+    void feed(const uint8_t *data, uint32_t length);
+
+    /** No more bytes, the last ones are encoded and the stream is padded */
+    void finish(void) { _finished = true; }
+
+    /** Encode the next bytes
+     * @param out output buffer
+     * @param size space in the output buffer
+     * @return number of bytes written to out, less than size when the fed
+     *         bytes run out or the stream is complete
+     */
+    uint32_t produce(uint8_t *out, uint32_t size);
+
+    /** Stream complete, finish() was called and everything is produced */
+    bool done(void) const { return _done; }
+
+    /** Fed bytes not consumed */
+    uint32_t pending(void) const { return _in_len; }
+
+private:
+    void fill(void);
+    void slide(uint32_t shift);
+    uint32_t hash(uint32_t pos) const;
+    void insert(uint32_t pos);
+    uint32_t findMatch(uint32_t *offset);
+    void putBits(uint32_t value, uint8_t count);
+
+    uint8_t *_buf;
+    uint16_t *_prev;
+    uint16_t *_heads;
+    uint32_t _window;
+    uint32_t _lookahead;
+    uint8_t _window_bits;
+    uint8_t _lookahead_bits;
+    uint32_t _pos;
+    uint32_t _end;
+    uint32_t _hashed;
+    const uint8_t *_in;
+    uint32_t _in_len;
+    uint32_t _acc;
+    uint8_t _acc_bits;
+    bool _finished;
+    bool _done;
+};
+
+#endif /* __LZSS_H */
@@ -1,30 +1,70 @@
 /* Includes ------------------------------------------------------------------*/
 #include "partition_manager.h"
 #include "util_crc32.h"
+#include "boot_profile.h"
+#include "hal/us_ticker_api.h"
+#if DEVICE_TRNG
+#include "hal/trng_api.h"
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/** Most scratch borrowed at once: the block buffers and the LZSS work of
+ *  packApp/unpackApp, with a MBR record written by a journal checkpoint
+ */
+#define PM_SCRATCH_LZSS_SIZE ((LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS) > LZSS_WINDOW_SIZE(LZSS_WINDOW_BITS_MAX)) \
+                              ? LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS) : LZSS_WINDOW_SIZE(LZSS_WINDOW_BITS_MAX))
+#define PM_SCRATCH_WORST_SIZE (SCRATCH_ROUND((PM_PREFETCH_BUFFER_NUM + 1U) * SCRATCH_BLOCK_SIZE + PM_SCRATCH_LZSS_SIZE) \
+                               + SCRATCH_ROUND(FWL_DATA_LENGTH_MAX))
+
+static_assert(PM_SCRATCH_WORST_SIZE <= SCRATCH_ARENA_SIZE, "SCRATCH_ARENA_SIZE too small for the copy paths");
+
+/* Nibbles of PM_FAST_BOOTS_REG */
+#define PM_FAST_BOOTS_MAIN_SHIFT 0U
+#define PM_FAST_BOOTS_BOOT_SHIFT 4U
+#define PM_FAST_BOOTS_MASK 0x0FU
+
+static_assert(PM_VERIFY_FULL_INTERVAL <= PM_FAST_BOOTS_MASK, "PM_VERIFY_FULL_INTERVAL doesn't fit a nibble of PM_FAST_BOOTS_REG");
+
 /* Private macro -------------------------------------------------------------*/
 
-static void printData(const void* data, size_t length)
+static void printPrefetchStats(const char* tag, const BlockPrefetcher* prefetcher)
 {
-    const char* dataBytes = (const char*)data;
-    for (size_t i = 0; i < length; i++) {
-        if ((i % 16) == 0)
-            PARTITION_MNG_PRINTF("\t");
-        PARTITION_MNG_PRINTF("%02X ", dataBytes[i]);
-    }
-    PARTITION_MNG_PRINTF("\n");
+    BlockPrefetcher::stats_t stats = prefetcher->stats();
+    PARTITION_MNG_TAG_PRINTF("%s\t blocks=%u, read=%uus, wait=%uus, overlap=%u%%",
+                            tag,
+                            stats.blocks,
+                            stats.read_us,
+                            stats.wait_us,
+                            prefetcher->overlapPercent());
+}
+
+#if (PM_VERIFY_FULL_INTERVAL > 0)
+/** @brief fast boots left before the full verify of a partition */
+static uint8_t fastBootsLeft(uint8_t shift)
+{
+    return (uint8_t)((PM_FAST_BOOTS_REG >> shift) & PM_FAST_BOOTS_MASK);
+}
+
+static void setFastBootsLeft(uint8_t shift, uint8_t left)
+{
+    PM_FAST_BOOTS_REG = (PM_FAST_BOOTS_REG & ~((uint32_t)PM_FAST_BOOTS_MASK << shift)) | ((uint32_t)left << shift);
 }
+#endif
 
 SPIFBlockDevice* partition_manager::_spiDevice = nullptr;
+FlashIAPBlockDevice partition_manager::_iapDevice(DEVICE_BASE_ADDR, DEVICE_MEMORY_SIZE);
 
 partition_manager::partition_manager(SPIFBlockDevice* spiDevice) :
 _mbr(),
-aes128()
+aes128(),
+_cmac(),
+_prefetcher()
 {
     _spiDevice = spiDevice;
     _init_isOK = false;
+    _deltaBase = nullptr;
+    _deltaBaseDecrypt = false;
 }
 
 partition_manager::~partition_manager()
@@ -43,13 +83,20 @@ void partition_manager::begin(void)
         return;
     }
 
-    _spiDevice->init();  
-    _mbr.begin();
+    {
+        BOOT_PROFILE_PHASE(BOOT_PHASE_SPI_INIT);
+        _spiDevice->init();
+    }
+    _iapDevice.init();
+    {
+        BOOT_PROFILE_PHASE(BOOT_PHASE_MBR_BEGIN);
+        _mbr.begin();
+    }
     
     app = _mbr.getMainParams();
     if (MBR_CRC_APP_FACTORY == app.fw_header.checksum)
     {
-        memcpy(&fw_header, (uint8_t*)MAIN_APP_HEADER_GENERAL_LOCATION, sizeof(firmwareHeader_t));
+        memcpy(&fw_header, PM_INTERNAL_PTR(MAIN_APP_HEADER_GENERAL_LOCATION), sizeof(firmwareHeader_t));
         PARTITION_MNG_TAG_PRINTF("[begin] Main firmware header at 0x%08X", MAIN_APP_HEADER_GENERAL_LOCATION);
         PARTITION_MNG_TAG_PRINTF("\t checksum: 0x%08X", fw_header.checksum);
         PARTITION_MNG_TAG_PRINTF("\t size: %u(%s)", fw_header.size, readableSize(fw_header.size).c_str());
@@ -81,7 +128,7 @@ void partition_manager::begin(void)
     app = _mbr.getBootParams();
     if (MBR_CRC_APP_FACTORY == app.fw_header.checksum)
     {
-        memcpy(&fw_header, (uint8_t*)BOOT_APP_HEADER_GENERAL_LOCATION, sizeof(firmwareHeader_t));
+        memcpy(&fw_header, PM_INTERNAL_PTR(BOOT_APP_HEADER_GENERAL_LOCATION), sizeof(firmwareHeader_t));
         PARTITION_MNG_TAG_PRINTF("[begin] Boot firmware header at 0x%08X", BOOT_APP_HEADER_GENERAL_LOCATION);
         PARTITION_MNG_TAG_PRINTF("\t checksum: 0x%08X", fw_header.checksum);
         PARTITION_MNG_TAG_PRINTF("\t size: %u(%s)", fw_header.size, readableSize(fw_header.size).c_str());
@@ -130,8 +177,41 @@ void partition_manager::begin(void)
 
 void partition_manager::end(void)
 {
+    BOOT_PROFILE_PHASE(BOOT_PHASE_END);
+
+    _prefetcher.end();
     _mbr.end();
+    _iapDevice.deinit();
     _spiDevice->deinit();
+    if (_init_isOK)
+    {
+        PARTITION_MNG_TAG_PRINTF("[end] scratch peak %u of %u bytes", (uint32_t)ScratchArena::peak(), (uint32_t)ScratchArena::capacity());
+    }
+    /* begin() loads the MBR again */
+    _init_isOK = false;
+}
+
+/** @brief group the MBR changes of a boot sequence into one record write
+ * The journal of a copy is still stored before the partition is erased.
+*/
+void partition_manager::beginTransaction(void)
+{
+    _mbr.beginTransaction();
+}
+
+/* return true if succeed */
+bool partition_manager::endTransaction(void)
+{
+    bool status_isOK = (_mbr.endTransaction() == MasterBootRecord::MBR_OK);
+
+    PARTITION_MNG_TAG_PRINTF("[endTransaction] MBR writes %u", _mbr.getWriteCount());
+    return status_isOK;
+}
+
+/* Number of MBR records written since reset */
+uint32_t partition_manager::mbrWriteCount(void)
+{
+    return _mbr.getWriteCount();
 }
 
 MasterBootRecord::startup_mode_t partition_manager::getStartUpModeFromMBR(void)
@@ -287,9 +367,20 @@ bool partition_manager::verifyMain(void)
 {
     app_info_t app;
     bool status;
+    app_info_t store;
+    verify_cache_t cache;
+    manifest_info_t manifest;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_VERIFY_MAIN);
+
     PARTITION_MNG_TAG_PRINTF("[verifyMain]>> start");
     app = _mbr.getMainParams();
-    status = this->verify(&app);
+    store = _mbr.getMainRollbackParams();
+    cache = _mbr.getVerifyCache();
+    manifest = _mbr.getManifest();
+    status = this->verifyCached(&app, &cache.main, &store, manifest.main, PM_FAST_BOOTS_MAIN_SHIFT);
+    _mbr.setVerifyCache(&cache);
+    _mbr.commit();
     PARTITION_MNG_TAG_PRINTF("[verifyMain]<< finish, status %s", status ? "OK":"Fail");
     return status;
 }
@@ -298,9 +389,20 @@ bool partition_manager::verifyBoot(void)
 {
     app_info_t app;
     bool status;
+    app_info_t store;
+    verify_cache_t cache;
+    manifest_info_t manifest;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_VERIFY_BOOT);
+
     PARTITION_MNG_TAG_PRINTF("[verifyBoot]>> start");
     app = _mbr.getBootParams();
-    status = this->verify(&app);
+    store = _mbr.getBootRollbackParams();
+    cache = _mbr.getVerifyCache();
+    manifest = _mbr.getManifest();
+    status = this->verifyCached(&app, &cache.boot, &store, manifest.boot, PM_FAST_BOOTS_BOOT_SHIFT);
+    _mbr.setVerifyCache(&cache);
+    _mbr.commit();
     PARTITION_MNG_TAG_PRINTF("[verifyBoot]<< finish, status %s", status ? "OK":"Fail");
     return status;
 }
@@ -331,6 +433,9 @@ bool partition_manager::verifyImageDownload(void)
 {
     app_info_t app;
     bool status;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_VERIFY_DOWNLOAD);
+
     PARTITION_MNG_TAG_PRINTF("[verifyImageDownload]>> start");
     app = _mbr.getImageDownloadParams();
     status = this->verify(&app);
@@ -338,6 +443,52 @@ bool partition_manager::verifyImageDownload(void)
     return status;
 }
 
+/** @brief the next verifyMain/verifyBoot check the CRC of the whole image */
+void partition_manager::invalidateVerifyCache(void)
+{
+    verify_cache_t cache;
+
+    PARTITION_MNG_TAG_PRINTF("[invalidateVerifyCache]");
+    cache = _mbr.getVerifyCache();
+    memset(&cache.main, 0, sizeof(verify_entry_t));
+    memset(&cache.boot, 0, sizeof(verify_entry_t));
+    _mbr.setVerifyCache(&cache);
+    _mbr.commit();
+}
+
+/** @brief check main chunk by chunk against the table of its rollback copy
+ * @return number of bad chunks, PM_MANIFEST_NONE if main has no table
+*/
+uint32_t partition_manager::verifyMainChunks(void)
+{
+    app_info_t app;
+    app_info_t store;
+    manifest_info_t manifest;
+    uint32_t bad;
+    PARTITION_MNG_TAG_PRINTF("[verifyMainChunks]>> start");
+    app = _mbr.getMainParams();
+    store = _mbr.getMainRollbackParams();
+    manifest = _mbr.getManifest();
+    bad = this->verifyChunks(&app, &store, manifest.main);
+    PARTITION_MNG_TAG_PRINTF("[verifyMainChunks]<< finish, bad chunks %d", (int)bad);
+    return bad;
+}
+
+uint32_t partition_manager::verifyBootChunks(void)
+{
+    app_info_t app;
+    app_info_t store;
+    manifest_info_t manifest;
+    uint32_t bad;
+    PARTITION_MNG_TAG_PRINTF("[verifyBootChunks]>> start");
+    app = _mbr.getBootParams();
+    store = _mbr.getBootRollbackParams();
+    manifest = _mbr.getManifest();
+    bad = this->verifyChunks(&app, &store, manifest.boot);
+    PARTITION_MNG_TAG_PRINTF("[verifyBootChunks]<< finish, bad chunks %d", (int)bad);
+    return bad;
+}
+
 uint8_t partition_manager::appUpgrade(void)
 {
     app_info_t app;
@@ -352,8 +503,14 @@ bool partition_manager::upgradeMain(void)
 {
     app_info_t des;
     app_info_t src;
+    app_info_t base;
+    uint32_t des_size;
+    uint32_t des_crc;
     MasterBootRecord::dfu_mode_t dfu_mode;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_UPGRADE);
+
     PARTITION_MNG_TAG_PRINTF("[upgradeMain]>> start");
     des = _mbr.getMainParams();
     src = _mbr.getImageDownloadParams();
@@ -370,13 +527,14 @@ bool partition_manager::upgradeMain(void)
         }
     }
 
-    if (programApp(&des, &src))
+    base = _mbr.getMainRollbackParams();
+    if (installApp(&des, &src, &base, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_UPGRADE_MAIN))
     {
-        des.fw_header.size = src.fw_header.size;
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = MasterBootRecord::APP_STATUS_WAIT_CONFIRM;
-        PARTITION_MNG_TAG_PRINTF("[upgradeMain] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[upgradeMain] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[upgradeMain] update des into MBR");
         _mbr.setMainParams(&des);
         _mbr.setMainDfuNum(_mbr.getMainDfuNum() + 1);
@@ -404,8 +562,14 @@ bool partition_manager::upgradeBoot(void)
 {
     app_info_t des;
     app_info_t src;
+    app_info_t base;
+    uint32_t des_size;
+    uint32_t des_crc;
     MasterBootRecord::dfu_mode_t dfu_mode;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_UPGRADE);
+
     PARTITION_MNG_TAG_PRINTF("[upgradeBoot]>> start");
     des = _mbr.getBootParams();
     src = _mbr.getImageDownloadParams();
@@ -422,13 +586,14 @@ bool partition_manager::upgradeBoot(void)
         }
     }
 
-    if (programApp(&des, &src))
+    base = _mbr.getBootRollbackParams();
+    if (installApp(&des, &src, &base, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_UPGRADE_BOOT))
     {
-        des.fw_header.size = src.fw_header.size;
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = MasterBootRecord::APP_STATUS_WAIT_CONFIRM;
-        PARTITION_MNG_TAG_PRINTF("[upgradeBoot] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[upgradeBoot] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[upgradeBoot] update des into MBR");
         _mbr.setBootParams(&des);
         _mbr.setBootDfuNum(_mbr.getBootDfuNum() + 1);
@@ -455,7 +620,13 @@ bool partition_manager::restoreMain(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_size;
+    uint32_t des_crc;
+    copy_journal_t journal;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_RESTORE);
+
     PARTITION_MNG_TAG_PRINTF("[restoreMain]>> start");
     des = _mbr.getMainParams();
     src = _mbr.getMainRollbackParams();
@@ -466,13 +637,29 @@ bool partition_manager::restoreMain(void)
         return false;
     }
 
-    if (programApp(&des, &src))
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_BACKUP_MAIN == journal.common.op)
     {
-        des.fw_header.size = src.fw_header.size;
+        PARTITION_MNG_TAG_PRINTF("[restoreMain]\t rollback partition is being written");
+        return false;
+    }
+
+    /* The copy checks the src CRC at its end, a rollback without tag is
+     * verified before main is erased
+     */
+    if (MasterBootRecord::AUTH_CMAC != src.common.auth && !verify(&src))
+    {
+        PARTITION_MNG_TAG_PRINTF("[restoreMain]\t rollback application ERROR");
+        return false;
+    }
+
+    if (installApp(&des, &src, nullptr, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_RESTORE_MAIN))
+    {
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[restoreMain] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[restoreMain] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[restoreMain] update des into MBR");
         _mbr.setMainParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -498,7 +685,13 @@ bool partition_manager::restoreBoot(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_size;
+    uint32_t des_crc;
+    copy_journal_t journal;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_RESTORE);
+
     PARTITION_MNG_TAG_PRINTF("[restoreBoot]>> start");
     des = _mbr.getBootParams();
     src = _mbr.getBootRollbackParams();
@@ -509,13 +702,29 @@ bool partition_manager::restoreBoot(void)
         return false;
     }
 
-    if (programApp(&des, &src))
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_BACKUP_BOOT == journal.common.op)
     {
-        des.fw_header.size = src.fw_header.size;
+        PARTITION_MNG_TAG_PRINTF("[restoreBoot]\t rollback partition is being written");
+        return false;
+    }
+
+    /* The copy checks the src CRC at its end, a rollback without tag is
+     * verified before boot is erased
+     */
+    if (MasterBootRecord::AUTH_CMAC != src.common.auth && !verify(&src))
+    {
+        PARTITION_MNG_TAG_PRINTF("[restoreBoot]\t rollback application ERROR");
+        return false;
+    }
+
+    if (installApp(&des, &src, nullptr, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_RESTORE_BOOT))
+    {
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[restoreBoot] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[restoreBoot] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[restoreBoot] update des into MBR");
         _mbr.setBootParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -537,11 +746,108 @@ bool partition_manager::restoreBoot(void)
     return status_isOK;
 }
 
+/** @brief rewrite the bad pages of main from the rollback partition when it
+ * holds the same image, by its chunk table or page by page. Only the damaged
+ * pages are erased and programmed. restoreMain is the fallback when it fails.
+*/
+bool partition_manager::repairMain(void)
+{
+    app_info_t des;
+    app_info_t src;
+    verify_cache_t cache;
+    manifest_info_t manifest;
+    copy_journal_t journal;
+    bool status_isOK;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_REPAIR);
+
+    PARTITION_MNG_TAG_PRINTF("[repairMain]>> start");
+    des = _mbr.getMainParams();
+    src = _mbr.getMainRollbackParams();
+
+    if (MasterBootRecord::APP_STATUS_OK != src.common.app_status)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairMain]\t app status Failure!");
+        return false;
+    }
+
+    /* A copy in flight resumes from its journal, its blocks aren't touched */
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_UPGRADE_MAIN == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_RESTORE_MAIN == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_BACKUP_MAIN == journal.common.op)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairMain]\t op %u in progress", journal.common.op);
+        return false;
+    }
+
+    manifest = _mbr.getManifest();
+    status_isOK = repairApp(&des, &src, manifest.main);
+    if (status_isOK)
+    {
+        cache = _mbr.getVerifyCache();
+        status_isOK = verifyCached(&des, &cache.main, &src, manifest.main, PM_FAST_BOOTS_MAIN_SHIFT);
+        _mbr.setVerifyCache(&cache);
+        _mbr.commit();
+    }
+    PARTITION_MNG_TAG_PRINTF("[repairMain]<< finish, status %s", status_isOK ? "OK":"Fail");
+    return status_isOK;
+}
+
+bool partition_manager::repairBoot(void)
+{
+    app_info_t des;
+    app_info_t src;
+    verify_cache_t cache;
+    manifest_info_t manifest;
+    copy_journal_t journal;
+    bool status_isOK;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_REPAIR);
+
+    PARTITION_MNG_TAG_PRINTF("[repairBoot]>> start");
+    des = _mbr.getBootParams();
+    src = _mbr.getBootRollbackParams();
+
+    if (MasterBootRecord::APP_STATUS_OK != src.common.app_status)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairBoot]\t app status Failure!");
+        return false;
+    }
+
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_UPGRADE_BOOT == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_RESTORE_BOOT == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_BACKUP_BOOT == journal.common.op)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairBoot]\t op %u in progress", journal.common.op);
+        return false;
+    }
+
+    manifest = _mbr.getManifest();
+    status_isOK = repairApp(&des, &src, manifest.boot);
+    if (status_isOK)
+    {
+        cache = _mbr.getVerifyCache();
+        status_isOK = verifyCached(&des, &cache.boot, &src, manifest.boot, PM_FAST_BOOTS_BOOT_SHIFT);
+        _mbr.setVerifyCache(&cache);
+        _mbr.commit();
+    }
+    PARTITION_MNG_TAG_PRINTF("[repairBoot]<< finish, status %s", status_isOK ? "OK":"Fail");
+    return status_isOK;
+}
+
 bool partition_manager::backupMain(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_size;
+    uint32_t des_crc;
+    copy_journal_t journal;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_BACKUP);
+
     PARTITION_MNG_TAG_PRINTF("[backupMain]>> start");
     des = _mbr.getMainRollbackParams();
     src = _mbr.getMainParams();
@@ -552,13 +858,21 @@ bool partition_manager::backupMain(void)
         return false;
     }
 
-    if (backupApp(&des, &src))
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_UPGRADE_MAIN == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_RESTORE_MAIN == journal.common.op)
     {
-        des.fw_header.size = src.fw_header.size;
+        PARTITION_MNG_TAG_PRINTF("[backupMain]\t main partition is being written");
+        return false;
+    }
+
+    if (storeApp(&des, &src, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_BACKUP_MAIN))
+    {
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[backupMain] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[backupMain] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[backupMain] update MBR");
         _mbr.setMainRollbackParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -584,17 +898,19 @@ bool partition_manager::backupMain2ImageDownload(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_size;
+    uint32_t des_crc;
     bool status_isOK = true;
     PARTITION_MNG_TAG_PRINTF("[backupMain2ImageDownload]>> start");
     des = _mbr.getImageDownloadParams();
     src = _mbr.getMainParams();
-    if (backupApp(&des, &src))
+    if (storeApp(&des, &src, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_NONE))
     {
-        des.fw_header.size = src.fw_header.size;
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[backupMain2ImageDownload] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[backupMain2ImageDownload] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[backupMain2ImageDownload] update MBR");
         _mbr.setImageDownloadParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -620,17 +936,21 @@ bool partition_manager::cloneMain2ImageDownload(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_crc;
     bool status_isOK = true;
     PARTITION_MNG_TAG_PRINTF("[cloneMain2ImageDownload]>> start");
     des = _mbr.getImageDownloadParams();
     src = _mbr.getMainParams();
-    if (cloneApp(&des, &src))
+    /* The clone is a plain copy, the type is covered by the des CRC */
+    des.fw_header.type.enc &= ~MasterBootRecord::DATA_COMPRESSED;
+    if (cloneApp(&des, &src, &des_crc))
     {
+        des.common.auth = MasterBootRecord::AUTH_NONE;
         des.fw_header.size = src.fw_header.size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[cloneMain2ImageDownload] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[cloneMain2ImageDownload] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[cloneMain2ImageDownload] update MBR");
         _mbr.setImageDownloadParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -656,7 +976,13 @@ bool partition_manager::backupBoot(void)
 {
     app_info_t des;
     app_info_t src;
+    uint32_t des_size;
+    uint32_t des_crc;
+    copy_journal_t journal;
     bool status_isOK = true;
+
+    BOOT_PROFILE_PHASE(BOOT_PHASE_BACKUP);
+
     PARTITION_MNG_TAG_PRINTF("[backupBoot]>> start");
     des = _mbr.getBootRollbackParams();
     src = _mbr.getBootParams();
@@ -667,13 +993,21 @@ bool partition_manager::backupBoot(void)
         return false;
     }
 
-    if (backupApp(&des, &src))
+    journal = _mbr.getJournal();
+    if (MasterBootRecord::JOURNAL_OP_UPGRADE_BOOT == journal.common.op
+    || MasterBootRecord::JOURNAL_OP_RESTORE_BOOT == journal.common.op)
     {
-        des.fw_header.size = src.fw_header.size;
+        PARTITION_MNG_TAG_PRINTF("[backupBoot]\t boot partition is being written");
+        return false;
+    }
+
+    if (storeApp(&des, &src, &des_size, &des_crc, MasterBootRecord::JOURNAL_OP_BACKUP_BOOT))
+    {
+        des.fw_header.size = des_size;
         des.fw_header.version.u32 = src.fw_header.version.u32;
         des.common.app_status = src.common.app_status;
-        PARTITION_MNG_TAG_PRINTF("[backupBoot] update des crc32");
-        des.fw_header.checksum = CRC32(&des);
+        des.fw_header.checksum = des_crc;
+        PARTITION_MNG_TAG_PRINTF("[backupBoot] des crc32=0x%08X", des_crc);
         PARTITION_MNG_TAG_PRINTF("[backupBoot] update MBR");
         _mbr.setBootRollbackParams(&des);
         if(_mbr.commit() == MasterBootRecord::MBR_OK)
@@ -695,18 +1029,25 @@ bool partition_manager::backupBoot(void)
     return status_isOK;
 }
 
-bool partition_manager::programApp(app_info_t* des, app_info_t* src)
+bool partition_manager::programApp(app_info_t* des, app_info_t* src, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
 {
-    FlashHandler* desFlash;
-    FlashHandler* srcFlash;
+    InternalHandler desFlash(des);
+    ExternalHandler srcFlash(src);
     uint32_t addr;
+    uint32_t start_addr;
     uint32_t remain_size;
     uint32_t read_size;
     uint32_t block_size;
-    uint32_t crc;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
     uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    crc32_ctx_t src_ctx;
+    firmwareHeader_t des_header;
     bool status_isOK = true;
     bool decrypt_image = true;
+    uint8_t chain[AES128_LENGTH];
 
     PARTITION_MNG_TAG_PRINTF("[programApp]>> start");
     PARTITION_MNG_TAG_PRINTF("[programApp]\t Src external: addr=0x%08X; size=%u",
@@ -723,10 +1064,14 @@ bool partition_manager::programApp(app_info_t* des, app_info_t* src)
         return false;
     }
 
-    PARTITION_MNG_TAG_PRINTF("[programApp] verify source");
-    if (!verify(src))
+    /* The source CRC is verified while copying, only check the header here.
+     * An untagged src is verified by the caller before: main.cpp verifies the
+     * image download, restoreMain/restoreBoot the rollback.
+     */
+    if (FIRMWARE_TYPE_SIGNAL != src->fw_header.type.signal
+    || src->fw_header.size > src->max_size)
     {
-        PARTITION_MNG_TAG_PRINTF("[programApp]\t application source ERROR");
+        PARTITION_MNG_TAG_PRINTF("[programApp]\t application source header ERROR");
         return false;
     }
 
@@ -736,26 +1081,51 @@ bool partition_manager::programApp(app_info_t* des, app_info_t* src)
         return false;
     }
 
-    desFlash = new FlashHandler(des);
-    srcFlash = new FlashHandler(src);
+    block_size = desFlash.get_erase_size();
+    /* Block buffers of the scratch arena */
+    ScratchBuffer scratch(PM_PREFETCH_BUFFER_NUM * block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[programApp]\t allocate %u memory failed!", PM_PREFETCH_BUFFER_NUM * block_size);
+        return false;
+    }
+
+    /* A forged or corrupted image is rejected before the first erase of des */
+    if (!authenticate(&srcFlash, src, ptr_buffer, block_size))
+    {
+        PARTITION_MNG_TAG_PRINTF("[programApp]\t application source authentication ERROR");
+        return false;
+    }
 
-    block_size = desFlash->get_erase_size();
-    /* Allocate dynamic memory */
-    ptr_data = new (std::nothrow) uint8_t[block_size];
-    if (ptr_data == nullptr)
+    /* Running CRC of the des image, the des header takes src size and version */
+    des_header = des->fw_header;
+    des_header.size = src->fw_header.size;
+    des_header.version.u32 = src->fw_header.version.u32;
+    CRC32_Init(&image_ctx);
+    CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+    /* Running CRC of the src image, check against src checksum at the end */
+    CRC32_Init(&src_ctx);
+    CRC32_Update(&src_ctx, (uint8_t *) &(src->fw_header.size), 12U);
+    /* The des partition isn't verified anymore, stored by journalBegin */
+    _mbr.bumpWriteGen();
+    /* Resume an interrupted copy, the crc registers are loaded from the journal */
+    if (!journalBegin(op, src, block_size, &src_ctx, &image_ctx, &start_addr))
     {
-        PARTITION_MNG_TAG_PRINTF("[programApp]\t allocate %u memory failed!", block_size);
-        delete desFlash;
-        delete srcFlash;
         return false;
     }
 
-    if (MasterBootRecord::DATA_ENC == src->fw_header.type.enc)
+    if (isEncrypted(src->fw_header.type.enc))
     {
-        PARTITION_MNG_TAG_PRINTF("[programApp]\t processing decrypt image");
+        PARTITION_MNG_TAG_PRINTF("[programApp]\t processing decrypt image, enc=%u", src->fw_header.type.enc);
         decrypt_image = true;
-        AES128_crypto_t mbr_aes = _mbr.getAes128Params();
-        aes128.setup((const char*)mbr_aes.key, AES::KEY_128, AES::MODE_CBC, (const char*)mbr_aes.iv);
+        cipherBegin(src->fw_header.type.enc, nullptr);
+        aes128.getIV((char*)chain);
+        if (start_addr && AES::MODE_CBC == aes128.mode())
+        {
+            /* CBC chain, the IV of a block is the last cipher block before it */
+            srcFlash.read(chain, start_addr - AES128_LENGTH, AES128_LENGTH);
+        }
     }
     else
     {
@@ -763,307 +1133,2249 @@ bool partition_manager::programApp(app_info_t* des, app_info_t* src)
         decrypt_image = false;
     }
 
-    remain_size = src->fw_header.size;
-    addr = 0;
+    remain_size = src->fw_header.size - start_addr;
+    addr = start_addr;
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+    /* Block N+1 is read from src while block N is processed and programmed */
+    _prefetcher.start(callback(&srcFlash, &ExternalHandler::read), ptr_buffer, block_size, start_addr, src->fw_header.size);
     while (remain_size)
     {
-        if (remain_size > block_size)
-        {
-            read_size = block_size;
-        }
-        else
+        ptr_data = _prefetcher.next(&addr, &read_size);
+        if (ptr_data == nullptr)
         {
-            read_size = remain_size;
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[programApp]\t read src fail!");
+            break;
         }
-        desFlash->erase(addr, block_size);
-        srcFlash->read(ptr_data, addr, read_size);
+        CRC32_Update(&src_ctx, ptr_data, read_size);
         if (decrypt_image)
         {
             /* Decrypt data before write to des partition */
-            aes128.decrypt(ptr_data, read_size);
+            aesDecrypt(ptr_data, read_size, addr, chain);
         }
-        desFlash->program(ptr_data, addr, read_size);
-#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
-        crc = Crc32_CalculateBuffer(ptr_data, read_size);
-        desFlash->read(ptr_data, addr, read_size);
-        if (crc != Crc32_CalculateBuffer(ptr_data, read_size))
+        write_status = writeBlock(&desFlash, ptr_data, addr, read_size, block_size);
+        if (WRITE_ERROR == write_status)
         {
             status_isOK = false;
-            PARTITION_MNG_TAG_PRINTF("[programApp]\t crc32=0x%08X fail!", crc);
+            PARTITION_MNG_TAG_PRINTF("[programApp]\t write 0x%08X fail!", addr);
             break;
         }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+        if (WRITE_OK == write_status)
+        {
+            crc = Crc32_CalculateBuffer(ptr_data, read_size);
+            desFlash.read(ptr_data, addr, read_size);
+            if (crc != Crc32_CalculateBuffer(ptr_data, read_size))
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[programApp]\t crc32=0x%08X fail!", crc);
+                break;
+            }
+        }
 #endif
-        addr += read_size;
+        /* ptr_data holds the data read back from des partition */
+        CRC32_Update(&image_ctx, ptr_data, read_size);
         remain_size -= read_size;
-        PARTITION_MNG_TAG_PRINTF("[programApp]\t %u, %08X, %u%%", read_size, crc, addr * 100 / src->fw_header.size);
+        if (remain_size && !journalCheckpoint(op, (addr + read_size) / block_size, &src_ctx, &image_ctx))
+        {
+            status_isOK = false;
+            break;
+        }
+        PARTITION_MNG_TAG_PRINTF("[programApp]\t %u, %08X, %u%%", read_size, crc, (addr + read_size) * 100 / src->fw_header.size);
     }
+    _prefetcher.stop();
+    printPrefetchStats("[programApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[programApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
 
     if (decrypt_image)
     {
-        aes128.clear();
+        cipherEnd();
     }
-    delete[] ptr_data;
-    delete desFlash;
-    delete srcFlash;
-    aes128.clear();
+    *des_crc = CRC32_Final(&image_ctx);
+    if (status_isOK)
+    {
+        crc = CRC32_Final(&src_ctx);
+        if (crc != src->fw_header.checksum)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[programApp]\t src crc=0x%08X, expected crc=0x%08X", crc, src->fw_header.checksum);
+        }
+    }
+    journalEnd(op, status_isOK);
 
     PARTITION_MNG_TAG_PRINTF("[programApp]<< finish");
 
     return status_isOK;
 } // programApp
 
-/** @brief copy application image from internal to external
+/** @brief write an image from external to internal: a full image is copied,
+ * a compressed image is decompressed, a delta image is applied to the
+ * rollback image
  * @param des information des application
  * @param src information src application
+ * @param base rollback of des, base of a delta image, nullptr if src can't be a delta image
+ * @param des_size size of the image written to des
+*/
+bool partition_manager::installApp(app_info_t* des, app_info_t* src, app_info_t* base, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
+{
+    uint8_t enc = src->fw_header.type.enc & ~MasterBootRecord::DATA_COMPRESSED;
+
+    if (MasterBootRecord::DATA_DELTA == enc
+    || MasterBootRecord::DATA_DELTA_ENC_CTR == enc)
+    {
+        if (base == nullptr
+        || (src->fw_header.type.enc & MasterBootRecord::DATA_COMPRESSED))
+        {
+            PARTITION_MNG_TAG_PRINTF("[installApp]\t delta image enc=0x%02X isn't supported", src->fw_header.type.enc);
+            return false;
+        }
+        return patchApp(des, src, base, des_size, des_crc, op);
+    }
+    if (src->fw_header.type.enc & MasterBootRecord::DATA_COMPRESSED)
+    {
+        return unpackApp(des, src, des_size, des_crc, op);
+    }
+    *des_size = src->fw_header.size;
+    return programApp(des, src, des_crc, op);
+}
+
+/** @brief rebuild an application image from a delta image and the rollback
+ * image (base), streaming: the delta image and the base are read once, only
+ * the des blocks that change are erased and programmed.
+ * An interrupted patch starts again from the first block, the base isn't
+ * written and the blocks already written are skipped by writeBlock.
+ * @param des information des application
+ * @param src information delta image
+ * @param base information base application, raw or AES-CTR
+ * @param des_size size of the rebuilt image
 */
-bool partition_manager::backupApp(app_info_t* des, app_info_t* src)
+bool partition_manager::patchApp(app_info_t* des, app_info_t* src, app_info_t* base, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
 {
-    FlashHandler* desFlash;
-    FlashHandler* srcFlash;
+    InternalHandler desFlash(des);
+    ExternalHandler srcFlash(src);
+    ExternalHandler baseFlash(base);
+    DeltaPatcher patcher;
+    delta_header_t header;
     uint32_t addr;
-    uint32_t remain_size;
+    uint32_t src_addr;
     uint32_t read_size;
     uint32_t block_size;
-    uint32_t crc;
+    uint32_t out_len;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
+    uint8_t *ptr_out;
     uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    crc32_ctx_t src_ctx;
+    crc32_ctx_t target_ctx;
+    firmwareHeader_t des_header;
     bool status_isOK = true;
-    bool encrypt_image = true;
+    bool decrypt_patch;
+    bool cipher_open;
+    uint8_t chain[AES128_LENGTH];
 
-    PARTITION_MNG_TAG_PRINTF("[backupApp]>> start");
-    PARTITION_MNG_TAG_PRINTF("[backupApp]\t Src internal: addr=0x%08X; size=%u",
+    PARTITION_MNG_TAG_PRINTF("[patchApp]>> start");
+    PARTITION_MNG_TAG_PRINTF("[patchApp]\t Delta external: addr=0x%08X; size=%u",
                             src->startup_addr,
                             src->fw_header.size);
-    PARTITION_MNG_TAG_PRINTF("[backupApp]\t Des external: addr=0x%08X; max_size=%u",
-                            des->startup_addr,
-                            des->max_size);
+    PARTITION_MNG_TAG_PRINTF("[patchApp]\t Base external: addr=0x%08X; size=%u; version=0x%08X",
+                            base->startup_addr,
+                            base->fw_header.size,
+                            base->fw_header.version.u32);
 
-    if (des->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
-    || src->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    if (src->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || base->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || des->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t type memory des/src ERROR");
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t type memory des/src/base ERROR");
         return false;
     }
 
-    PARTITION_MNG_TAG_PRINTF("[programApp] verify source");
-    if (!verify(src))
+    if (FIRMWARE_TYPE_SIGNAL != src->fw_header.type.signal
+    || src->fw_header.size < DELTA_HEADER_LENGTH
+    || src->fw_header.size > src->max_size)
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t application source ERROR");
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t delta image header ERROR");
         return false;
     }
 
-    if (src->fw_header.size > des->max_size)
+    /* The base is read at any offset, CBC would need the block before each read */
+    if (MasterBootRecord::APP_STATUS_OK != base->common.app_status
+    || (MasterBootRecord::DATA_RAW != base->fw_header.type.enc
+    && MasterBootRecord::DATA_ENC_CTR != base->fw_header.type.enc))
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t Des partition size isn't enough to store source image");
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t base status %u, enc %u isn't supported",
+                                base->common.app_status,
+                                base->fw_header.type.enc);
         return false;
     }
 
-    desFlash = new FlashHandler(des);
-    srcFlash = new FlashHandler(src);
-
-    block_size = desFlash->get_erase_size();
-    /* Allocate dynamic memory */
-    ptr_data = new (std::nothrow) uint8_t[block_size];
-    if (ptr_data == nullptr)
+    block_size = desFlash.get_erase_size();
+    /* Prefetch buffers of the delta image and one des block */
+    ScratchBuffer scratch((PM_PREFETCH_BUFFER_NUM + 1) * block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t allocate %u memory failed!", block_size);
-        delete desFlash;
-        delete srcFlash;
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t allocate %u memory failed!", (PM_PREFETCH_BUFFER_NUM + 1) * block_size);
         return false;
     }
+    ptr_out = ptr_buffer + PM_PREFETCH_BUFFER_NUM * block_size;
 
-    if (MasterBootRecord::DATA_ENC == des->fw_header.type.enc)
+    /* Everything is checked before the first erase of des */
+    if (!authenticate(&srcFlash, src, ptr_buffer, block_size))
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t processing encrypt image");
-        encrypt_image = true;
-        AES128_crypto_t mbr_aes = _mbr.getAes128Params();
-        aes128.setup((const char*)mbr_aes.key, AES::KEY_128, AES::MODE_CBC, (const char*)mbr_aes.iv);
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t delta image authentication ERROR");
+        status_isOK = false;
     }
-    else
+
+    decrypt_patch = (MasterBootRecord::DATA_DELTA_ENC_CTR == src->fw_header.type.enc);
+    /* baseFlash lives on this stack, every exit below clears _deltaBase */
+    _deltaBase = &baseFlash;
+    _deltaBaseDecrypt = (MasterBootRecord::DATA_ENC_CTR == base->fw_header.type.enc);
+    cipher_open = decrypt_patch || _deltaBaseDecrypt;
+    if (cipher_open)
     {
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t processing image");
-        encrypt_image = false;
+        /* Delta image and base share the MBR key and iv, the CTR offset selects the keystream */
+        cipherBegin(MasterBootRecord::DATA_ENC_CTR, nullptr);
     }
 
-    remain_size = src->fw_header.size;
-    addr = 0;
-    while (remain_size)
+    CRC32_Init(&src_ctx);
+    CRC32_Update(&src_ctx, (uint8_t *) &(src->fw_header.size), 12U);
+    if (status_isOK && srcFlash.read(&header, 0, DELTA_HEADER_LENGTH) == 0)
     {
-        if (remain_size > block_size)
+        CRC32_Update(&src_ctx, (uint8_t *) &header, DELTA_HEADER_LENGTH);
+        if (decrypt_patch)
         {
-            read_size = block_size;
+            aesDecrypt(&header, DELTA_HEADER_LENGTH, 0, chain);
         }
-        else
+        if (DELTA_PATCH_MAGIC != header.magic
+        || header.base_size != base->fw_header.size
+        || header.base_version != base->fw_header.version.u32
+        || header.target_size > des->max_size)
         {
-            read_size = remain_size;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t delta for base size=%u; version=0x%08X, target size=%u ERROR",
+                                    header.base_size,
+                                    header.base_version,
+                                    header.target_size);
+            status_isOK = false;
         }
-        desFlash->erase(addr, block_size);
-        srcFlash->read(ptr_data, addr, read_size);
-        if (encrypt_image)
+    }
+    else
+    {
+        status_isOK = false;
+    }
+
+    if (status_isOK)
+    {
+        /* The rollback must be the image the delta was made from */
+        CRC32_Init(&target_ctx);
+        for (addr = 0; addr < header.base_size && status_isOK; addr += read_size)
         {
-            /* Encrypt data before write to des partition */
-            aes128.encrypt(ptr_data, read_size);
+            read_size = header.base_size - addr;
+            if (read_size > block_size)
+            {
+                read_size = block_size;
+            }
+            status_isOK = (readBase(ptr_out, addr, read_size) == 0);
+            CRC32_Update(&target_ctx, ptr_out, read_size);
         }
-        desFlash->program(ptr_data, addr, read_size);
-#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
-        crc = Crc32_CalculateBuffer(ptr_data, read_size);
-        desFlash->read(ptr_data, addr, read_size);
-        if (crc != Crc32_CalculateBuffer(ptr_data, read_size))
+        crc = CRC32_Final(&target_ctx);
+        if (!status_isOK || crc != header.base_crc)
         {
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t base crc32=0x%08X, expected crc32=0x%08X", crc, header.base_crc);
             status_isOK = false;
-            PARTITION_MNG_TAG_PRINTF("[backupApp]\t crc32=0x%08X fail!", crc);
-            break;
         }
-#endif
-        addr += read_size;
-        remain_size -= read_size;
-        PARTITION_MNG_TAG_PRINTF("[backupApp]\t %u, %08X, %u%%", read_size, crc, addr * 100 / src->fw_header.size);
     }
 
-    if (encrypt_image)
+    if (!status_isOK)
     {
-        aes128.clear();
+        patchEnd(cipher_open);
+        return false;
     }
-    delete[] ptr_data;
-    delete desFlash;
-    delete srcFlash;
-
-    PARTITION_MNG_TAG_PRINTF("[backupApp]<< finish");
 
-    return status_isOK;
-} // backupApp
+    /* Running CRC of the des image, the des header takes target size and src version */
+    des_header = des->fw_header;
+    des_header.size = header.target_size;
+    des_header.version.u32 = src->fw_header.version.u32;
+    CRC32_Init(&image_ctx);
+    CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+    CRC32_Init(&target_ctx);
+    _mbr.bumpWriteGen();
+    /* No checkpoint, the patch is applied again from the first block */
+    if (!journalBegin(op, src, block_size, &src_ctx, &image_ctx, nullptr))
+    {
+        patchEnd(cipher_open);
+        return false;
+    }
 
-bool partition_manager::cloneApp(app_info_t* des, app_info_t* src)
-{
-    FlashHandler* desFlash;
-    FlashHandler* srcFlash;
-    uint32_t addr;
-    uint32_t remain_size;
-    uint32_t read_size;
-    uint32_t block_size;
-    uint32_t crc;
+    patcher.begin(&header, callback(this, &partition_manager::readBase));
+    addr = 0;
+    out_len = 0;
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+    _prefetcher.start(callback(&srcFlash, &ExternalHandler::read), ptr_buffer, block_size, DELTA_HEADER_LENGTH, src->fw_header.size);
+    while (!patcher.done())
+    {
+        if (patcher.needInput())
+        {
+            ptr_data = _prefetcher.next(&src_addr, &read_size);
+            if (ptr_data == nullptr)
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[patchApp]\t read delta fail!");
+                break;
+            }
+            CRC32_Update(&src_ctx, ptr_data, read_size);
+            if (decrypt_patch)
+            {
+                aesDecrypt(ptr_data, read_size, src_addr, chain);
+            }
+            patcher.feed(ptr_data, read_size);
+        }
+        out_len += patcher.produce(ptr_out + out_len, block_size - out_len);
+        if (patcher.error())
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t delta format or base read ERROR at 0x%08X", addr + out_len);
+            break;
+        }
+        if (out_len < block_size && !patcher.done())
+        {
+            continue;
+        }
+
+        CRC32_Update(&target_ctx, ptr_out, out_len);
+        write_status = writeBlock(&desFlash, ptr_out, addr, out_len, block_size);
+        if (WRITE_ERROR == write_status)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t write 0x%08X fail!", addr);
+            break;
+        }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+        if (WRITE_OK == write_status)
+        {
+            crc = Crc32_CalculateBuffer(ptr_out, out_len);
+            desFlash.read(ptr_out, addr, out_len);
+            if (crc != Crc32_CalculateBuffer(ptr_out, out_len))
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[patchApp]\t crc32=0x%08X fail!", crc);
+                break;
+            }
+        }
+#endif
+        /* ptr_out holds the data read back from des partition */
+        CRC32_Update(&image_ctx, ptr_out, out_len);
+        addr += out_len;
+        out_len = 0;
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t %u%%", addr * 100 / header.target_size);
+    }
+    /* The rest of the delta image is read for the src crc */
+    while (status_isOK && (ptr_data = _prefetcher.next(&src_addr, &read_size)) != nullptr)
+    {
+        CRC32_Update(&src_ctx, ptr_data, read_size);
+        if (read_size)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t %u bytes after the last record", read_size);
+        }
+    }
+    if (status_isOK && patcher.pending())
+    {
+        status_isOK = false;
+        PARTITION_MNG_TAG_PRINTF("[patchApp]\t %u bytes after the last record", patcher.pending());
+    }
+    _prefetcher.stop();
+    printPrefetchStats("[patchApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[patchApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+    patchEnd(cipher_open);
+
+    *des_size = header.target_size;
+    *des_crc = CRC32_Final(&image_ctx);
+    if (status_isOK)
+    {
+        crc = CRC32_Final(&target_ctx);
+        if (crc != header.target_crc)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t target crc=0x%08X, expected crc=0x%08X", crc, header.target_crc);
+        }
+        crc = CRC32_Final(&src_ctx);
+        if (crc != src->fw_header.checksum)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[patchApp]\t src crc=0x%08X, expected crc=0x%08X", crc, src->fw_header.checksum);
+        }
+    }
+    journalEnd(op, status_isOK);
+
+    PARTITION_MNG_TAG_PRINTF("[patchApp]<< finish");
+
+    return status_isOK;
+} // patchApp
+
+/** @brief release the base image and the CTR context of patchApp */
+void partition_manager::patchEnd(bool cipher_open)
+{
+    if (cipher_open)
+    {
+        cipherEnd();
+    }
+    _deltaBase = nullptr;
+    _deltaBaseDecrypt = false;
+} // patchEnd
+
+/** @brief read the plain base image of patchApp */
+int partition_manager::readBase(void *buffer, uint32_t addr, uint32_t size)
+{
+    if (_deltaBase == nullptr || _deltaBase->read(buffer, addr, size) != 0)
+    {
+        return -1;
+    }
+    if (_deltaBaseDecrypt)
+    {
+        aes128.seek(addr);
+        aes128.decrypt(buffer, size);
+    }
+    return 0;
+}
+
+/** @brief decompress an image from external to internal, streaming: the
+ * compressed image is read once, only the des blocks that change are erased
+ * and programmed.
+ * The decoder state isn't in the journal, an interrupted copy starts again
+ * from the first block and the blocks already written are skipped by writeBlock.
+ * @param des information des application
+ * @param src information compressed image, raw or encrypted after compression
+ * @param des_size size of the decompressed image
+*/
+bool partition_manager::unpackApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
+{
+    InternalHandler desFlash(des);
+    ExternalHandler srcFlash(src);
+    LzssDecoder decoder;
+    lzss_header_t header;
+    uint32_t addr;
+    uint32_t src_addr;
+    uint32_t read_size;
+    uint32_t block_size;
+    uint32_t out_len;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
+    uint8_t *ptr_out;
+    uint8_t *ptr_window;
+    uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    crc32_ctx_t src_ctx;
+    crc32_ctx_t raw_ctx;
+    firmwareHeader_t des_header;
+    bool status_isOK = true;
+    bool decrypt_image;
+    uint8_t chain[AES128_LENGTH];
+
+    PARTITION_MNG_TAG_PRINTF("[unpackApp]>> start");
+    PARTITION_MNG_TAG_PRINTF("[unpackApp]\t Src external: addr=0x%08X; size=%u; enc=0x%02X",
+                            src->startup_addr,
+                            src->fw_header.size,
+                            src->fw_header.type.enc);
+    PARTITION_MNG_TAG_PRINTF("[unpackApp]\t Des internal: addr=0x%08X; max_size=%u",
+                            des->startup_addr,
+                            des->max_size);
+
+    if (src->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || des->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    {
+        PARTITION_MNG_TAG_PRINTF("[unpackApp]\t type memory des/src ERROR");
+        return false;
+    }
+
+    if (FIRMWARE_TYPE_SIGNAL != src->fw_header.type.signal
+    || src->fw_header.size < LZSS_HEADER_LENGTH
+    || src->fw_header.size > src->max_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[unpackApp]\t compressed image header ERROR");
+        return false;
+    }
+
+    block_size = desFlash.get_erase_size();
+    /* Prefetch buffers of the compressed image, one des block and the largest window */
+    ScratchBuffer scratch((PM_PREFETCH_BUFFER_NUM + 1) * block_size + LZSS_WINDOW_SIZE(LZSS_WINDOW_BITS_MAX));
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[unpackApp]\t allocate %u memory failed!",
+                                (PM_PREFETCH_BUFFER_NUM + 1) * block_size + LZSS_WINDOW_SIZE(LZSS_WINDOW_BITS_MAX));
+        return false;
+    }
+    ptr_out = ptr_buffer + PM_PREFETCH_BUFFER_NUM * block_size;
+    ptr_window = ptr_out + block_size;
+
+    /* Everything is checked before the first erase of des */
+    if (!authenticate(&srcFlash, src, ptr_buffer, block_size))
+    {
+        PARTITION_MNG_TAG_PRINTF("[unpackApp]\t compressed image authentication ERROR");
+        status_isOK = false;
+    }
+
+    decrypt_image = isEncrypted(src->fw_header.type.enc);
+    if (decrypt_image)
+    {
+        /* Any mode, the image is read in order from the first byte */
+        cipherBegin(src->fw_header.type.enc, nullptr);
+        aes128.getIV((char*)chain);
+    }
+
+    CRC32_Init(&src_ctx);
+    CRC32_Update(&src_ctx, (uint8_t *) &(src->fw_header.size), 12U);
+    if (status_isOK && srcFlash.read(&header, 0, LZSS_HEADER_LENGTH) == 0)
+    {
+        CRC32_Update(&src_ctx, (uint8_t *) &header, LZSS_HEADER_LENGTH);
+        if (decrypt_image)
+        {
+            aesDecrypt(&header, LZSS_HEADER_LENGTH, 0, chain);
+        }
+        if (LZSS_MAGIC != header.magic
+        || header.raw_size > des->max_size
+        || !decoder.begin(&header, ptr_window))
+        {
+            PARTITION_MNG_TAG_PRINTF("[unpackApp]\t image size=%u; window=%u; lookahead=%u ERROR",
+                                    header.raw_size,
+                                    header.window_bits,
+                                    header.lookahead_bits);
+            status_isOK = false;
+        }
+    }
+    else
+    {
+        status_isOK = false;
+    }
+
+    if (!status_isOK)
+    {
+        if (decrypt_image)
+        {
+            cipherEnd();
+        }
+        return false;
+    }
+
+    /* Running CRC of the des image, the des header takes raw size and src version */
+    des_header = des->fw_header;
+    des_header.size = header.raw_size;
+    des_header.version.u32 = src->fw_header.version.u32;
+    CRC32_Init(&image_ctx);
+    CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+    CRC32_Init(&raw_ctx);
+    _mbr.bumpWriteGen();
+    /* No checkpoint, the image is decompressed again from the first block */
+    if (!journalBegin(op, src, block_size, &src_ctx, &image_ctx, nullptr))
+    {
+        if (decrypt_image)
+        {
+            cipherEnd();
+        }
+        return false;
+    }
+
+    addr = 0;
+    out_len = 0;
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+    _prefetcher.start(callback(&srcFlash, &ExternalHandler::read), ptr_buffer, block_size, LZSS_HEADER_LENGTH, src->fw_header.size);
+    while (!decoder.done())
+    {
+        out_len += decoder.produce(ptr_out + out_len, block_size - out_len);
+        if (decoder.error())
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[unpackApp]\t compressed stream ERROR at 0x%08X", addr + out_len);
+            break;
+        }
+        if (out_len < block_size && !decoder.done())
+        {
+            ptr_data = _prefetcher.next(&src_addr, &read_size);
+            if (ptr_data == nullptr)
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[unpackApp]\t read src fail!");
+                break;
+            }
+            CRC32_Update(&src_ctx, ptr_data, read_size);
+            if (decrypt_image)
+            {
+                aesDecrypt(ptr_data, read_size, src_addr, chain);
+            }
+            decoder.feed(ptr_data, read_size);
+            continue;
+        }
+
+        CRC32_Update(&raw_ctx, ptr_out, out_len);
+        write_status = writeBlock(&desFlash, ptr_out, addr, out_len, block_size);
+        if (WRITE_ERROR == write_status)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[unpackApp]\t write 0x%08X fail!", addr);
+            break;
+        }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+        if (WRITE_OK == write_status)
+        {
+            crc = Crc32_CalculateBuffer(ptr_out, out_len);
+            desFlash.read(ptr_out, addr, out_len);
+            if (crc != Crc32_CalculateBuffer(ptr_out, out_len))
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[unpackApp]\t crc32=0x%08X fail!", crc);
+                break;
+            }
+        }
+#endif
+        /* ptr_out holds the data read back from des partition */
+        CRC32_Update(&image_ctx, ptr_out, out_len);
+        addr += out_len;
+        out_len = 0;
+        PARTITION_MNG_TAG_PRINTF("[unpackApp]\t %u%%", addr * 100 / header.raw_size);
+    }
+    /* The rest of the compressed image (padding) is read for the src crc */
+    while (status_isOK && (ptr_data = _prefetcher.next(&src_addr, &read_size)) != nullptr)
+    {
+        CRC32_Update(&src_ctx, ptr_data, read_size);
+    }
+    _prefetcher.stop();
+    printPrefetchStats("[unpackApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[unpackApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+    if (decrypt_image)
+    {
+        cipherEnd();
+    }
+
+    *des_size = header.raw_size;
+    *des_crc = CRC32_Final(&image_ctx);
+    if (status_isOK)
+    {
+        crc = CRC32_Final(&raw_ctx);
+        if (crc != header.raw_crc)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[unpackApp]\t image crc=0x%08X, expected crc=0x%08X", crc, header.raw_crc);
+        }
+        crc = CRC32_Final(&src_ctx);
+        if (crc != src->fw_header.checksum)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[unpackApp]\t src crc=0x%08X, expected crc=0x%08X", crc, src->fw_header.checksum);
+        }
+    }
+    journalEnd(op, status_isOK);
+
+    PARTITION_MNG_TAG_PRINTF("[unpackApp]<< finish");
+
+    return status_isOK;
+} // unpackApp
+
+/** @brief write an image from internal to external: LZSS compressed when
+ * PM_BACKUP_COMPRESS, copied as it is otherwise
+ * @param des information des application
+ * @param src information src application
+ * @param des_size size of the image stored in des
+*/
+bool partition_manager::storeApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
+{
+#if defined(PM_BACKUP_COMPRESS) && (PM_BACKUP_COMPRESS == 1)
+    return packApp(des, src, des_size, des_crc, op);
+#else
+    return backupApp(des, src, des_size, des_crc, op);
+#endif
+}
+
+/** @brief copy application image from internal to external
+ * @param des information des application
+ * @param src information src application
+ * @param des_size size of the image stored in des
+*/
+bool partition_manager::backupApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
+{
+    ExternalHandler desFlash(des);
+    InternalHandler srcFlash(src);
+    uint32_t addr;
+    uint32_t start_addr;
+    uint32_t remain_size;
+    uint32_t read_size;
+    uint32_t block_size;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
     uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    firmwareHeader_t des_header;
     bool status_isOK = true;
+    bool encrypt_image = true;
+    uint8_t chain[AES128_LENGTH];
+    uint8_t mac[AES_CMAC_LENGTH];
+    uint32_t tag_size;
+    uint32_t tag_head = 0;
+    uint32_t write_size;
+    uint32_t erase_end;
+    bool pre_erased = false;
+
+    PARTITION_MNG_TAG_PRINTF("[backupApp]>> start");
+    PARTITION_MNG_TAG_PRINTF("[backupApp]\t Src internal: addr=0x%08X; size=%u",
+                            src->startup_addr,
+                            src->fw_header.size);
+    PARTITION_MNG_TAG_PRINTF("[backupApp]\t Des external: addr=0x%08X; max_size=%u",
+                            des->startup_addr,
+                            des->max_size);
+
+    if (des->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || src->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t type memory des/src ERROR");
+        return false;
+    }
+
+    PARTITION_MNG_TAG_PRINTF("[programApp] verify source");
+    if (!verify(src))
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t application source ERROR");
+        return false;
+    }
+
+#if defined(PM_BACKUP_AUTH) && (PM_BACKUP_AUTH == 1)
+    des->common.auth = MasterBootRecord::AUTH_CMAC;
+#else
+    des->common.auth = MasterBootRecord::AUTH_NONE;
+#endif
+    tag_size = (MasterBootRecord::AUTH_CMAC == des->common.auth) ? AES_CMAC_LENGTH : 0;
+    if (src->fw_header.size + tag_size > des->max_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t Des partition size isn't enough to store source image");
+        return false;
+    }
+
+    block_size = desFlash.get_erase_size();
+    /* Block buffers of the scratch arena */
+    ScratchBuffer scratch(PM_PREFETCH_BUFFER_NUM * block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t allocate %u memory failed!", PM_PREFETCH_BUFFER_NUM * block_size);
+        return false;
+    }
+
+    if (isEncrypted(des->fw_header.type.enc))
+    {
+        /* The caller stores des header, restore decrypts by this mode */
+        des->fw_header.type.enc = PM_BACKUP_ENC;
+    }
+    des->fw_header.type.enc &= ~MasterBootRecord::DATA_COMPRESSED;
+    /* Running CRC of the des image, the des header takes src size and version */
+    des_header = des->fw_header;
+    des_header.size = src->fw_header.size;
+    des_header.version.u32 = src->fw_header.version.u32;
+    CRC32_Init(&image_ctx);
+    CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+    /* The chunk table of the old copy goes with it, stored by journalBegin */
+    manifestClear(op);
+    /* Resume an interrupted copy, the crc register is loaded from the journal */
+    if (!journalBegin(op, src, block_size, nullptr, &image_ctx, &start_addr))
+    {
+        return false;
+    }
+
+    if (tag_size)
+    {
+        macBegin(&des_header);
+        if (start_addr)
+        {
+            /* The tag covers the blocks already copied, read them back from des */
+            _prefetcher.start(callback(&desFlash, &ExternalHandler::read), ptr_buffer, block_size, 0, start_addr);
+            while ((ptr_data = _prefetcher.next(&addr, &read_size)) != nullptr)
+            {
+                _cmac.update(ptr_data, read_size);
+            }
+            _prefetcher.stop();
+        }
+    }
+
+    if (isEncrypted(des->fw_header.type.enc))
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t processing encrypt image, enc=%u", des->fw_header.type.enc);
+        encrypt_image = true;
+        cipherBegin(des->fw_header.type.enc, nullptr);
+        aes128.getIV((char*)chain);
+        if (start_addr && AES::MODE_CBC == aes128.mode())
+        {
+            /* CBC chain, the IV of a block is the last cipher block before it */
+            desFlash.read(chain, start_addr - AES128_LENGTH, AES128_LENGTH);
+        }
+    }
+    else
+    {
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t processing image");
+        encrypt_image = false;
+    }
+
+    remain_size = src->fw_header.size - start_addr;
+    addr = start_addr;
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+#if defined(PM_BACKUP_PRE_ERASE) && (PM_BACKUP_PRE_ERASE == 1)
+    /* des holding the same image keeps the blocks the differential write skips */
+    if (des->fw_header.size != src->fw_header.size
+    || des->fw_header.version.u32 != src->fw_header.version.u32)
+    {
+        /* The image and its tag, the blocks from a resumed copy are kept */
+        erase_end = ((src->fw_header.size + tag_size + block_size - 1) / block_size) * block_size;
+        pre_erased = preErase(&desFlash, start_addr, erase_end - start_addr);
+    }
+#endif
+    /* Block N+1 is read from src while block N is processed and programmed */
+    _prefetcher.start(callback(&srcFlash, &InternalHandler::read), ptr_buffer, block_size, start_addr, src->fw_header.size);
+    while (remain_size)
+    {
+        ptr_data = _prefetcher.next(&addr, &read_size);
+        if (ptr_data == nullptr)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[backupApp]\t read src fail!");
+            break;
+        }
+        if (encrypt_image)
+        {
+            /* Encrypt data before write to des partition */
+            aesEncrypt(ptr_data, read_size, addr, chain);
+        }
+        write_size = read_size;
+        if (tag_size)
+        {
+            _cmac.update(ptr_data, read_size);
+            if (read_size == remain_size)
+            {
+                _cmac.finish((char*)mac);
+                /* The tag goes in the tail of the last block, the rest starts the next one */
+                tag_head = (read_size + tag_size <= block_size) ? tag_size : (block_size - read_size);
+                memcpy(ptr_data + read_size, mac, tag_head);
+                write_size += tag_head;
+                tag_size -= tag_head;
+            }
+        }
+        write_status = writeBlock(&desFlash, ptr_data, addr, write_size, block_size, pre_erased);
+        if (WRITE_ERROR == write_status)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[backupApp]\t write 0x%08X fail!", addr);
+            break;
+        }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+        if (WRITE_OK == write_status)
+        {
+            crc = Crc32_CalculateBuffer(ptr_data, write_size);
+            desFlash.read(ptr_data, addr, write_size);
+            if (crc != Crc32_CalculateBuffer(ptr_data, write_size))
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[backupApp]\t crc32=0x%08X fail!", crc);
+                break;
+            }
+        }
+#endif
+        /* ptr_data holds the data read back from des partition */
+        CRC32_Update(&image_ctx, ptr_data, read_size);
+        remain_size -= read_size;
+        if (remain_size && !journalCheckpoint(op, (addr + read_size) / block_size, nullptr, &image_ctx))
+        {
+            status_isOK = false;
+            break;
+        }
+        PARTITION_MNG_TAG_PRINTF("[backupApp]\t %u, %08X, %u%%", read_size, crc, (addr + read_size) * 100 / src->fw_header.size);
+    }
+    _prefetcher.stop();
+    printPrefetchStats("[backupApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[backupApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+
+    if (status_isOK && tag_size)
+    {
+        /* The rest of the tag starts the next block */
+        if ((WRITE_ERROR == writeBlock(&desFlash, mac + tag_head, src->fw_header.size + tag_head, tag_size, block_size, pre_erased))
+        || (desFlash.read(chain, src->fw_header.size, AES_CMAC_LENGTH) != 0)
+        || !AESCMAC::equal(chain, mac))
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[backupApp]\t write tag fail!");
+        }
+    }
+    if (status_isOK)
+    {
+        manifestWrite(&desFlash, des, src->fw_header.size, src, ptr_buffer, block_size, op);
+    }
+    _cmac.clear();
+    if (encrypt_image)
+    {
+        cipherEnd();
+    }
+    *des_size = src->fw_header.size;
+    *des_crc = CRC32_Final(&image_ctx);
+    journalEnd(op, status_isOK);
+
+    PARTITION_MNG_TAG_PRINTF("[backupApp]<< finish");
+
+    return status_isOK;
+} // backupApp
+
+/** @brief copy application image from internal to external, LZSS compressed
+ * then encrypted when des is an encrypted partition.
+ * The image is compressed twice: the first pass gives the stored size and the
+ * CRC of the image, the header, the des CRC and the tag start with them. The
+ * second pass writes. The encoder state isn't in the journal, an interrupted
+ * backup starts again from the first block.
+ * @param des information des application
+ * @param src information src application
+ * @param des_size size of the compressed image stored in des
+*/
+bool partition_manager::packApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op)
+{
+    ExternalHandler desFlash(des);
+    InternalHandler srcFlash(src);
+    LzssEncoder encoder;
+    lzss_header_t header;
+    uint32_t addr;
+    uint32_t src_addr;
+    uint32_t read_size;
+    uint32_t in_size;
+    uint32_t block_size;
+    uint32_t out_len;
+    uint32_t stored_size;
+    uint32_t write_size;
+    uint32_t tag_size;
+    uint32_t tag_head = 0;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
+    uint8_t *ptr_out;
+    uint8_t *ptr_work;
+    uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    crc32_ctx_t raw_ctx;
+    firmwareHeader_t des_header;
+    bool status_isOK = true;
+    bool encrypt_image;
+    bool cbc_padding;
+    bool journal_open = false;
+    uint8_t pass;
+    uint8_t chain[AES128_LENGTH];
+    uint8_t mac[AES_CMAC_LENGTH];
+
+    PARTITION_MNG_TAG_PRINTF("[packApp]>> start");
+    PARTITION_MNG_TAG_PRINTF("[packApp]\t Src internal: addr=0x%08X; size=%u",
+                            src->startup_addr,
+                            src->fw_header.size);
+    PARTITION_MNG_TAG_PRINTF("[packApp]\t Des external: addr=0x%08X; max_size=%u",
+                            des->startup_addr,
+                            des->max_size);
+
+    if (des->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || src->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    {
+        PARTITION_MNG_TAG_PRINTF("[packApp]\t type memory des/src ERROR");
+        return false;
+    }
+
+    PARTITION_MNG_TAG_PRINTF("[packApp] verify source");
+    if (!verify(src))
+    {
+        PARTITION_MNG_TAG_PRINTF("[packApp]\t application source ERROR");
+        return false;
+    }
+
+#if defined(PM_BACKUP_AUTH) && (PM_BACKUP_AUTH == 1)
+    des->common.auth = MasterBootRecord::AUTH_CMAC;
+#else
+    des->common.auth = MasterBootRecord::AUTH_NONE;
+#endif
+    tag_size = (MasterBootRecord::AUTH_CMAC == des->common.auth) ? AES_CMAC_LENGTH : 0;
+
+    block_size = desFlash.get_erase_size();
+    /* Prefetch buffers of src, one des block and the encoder work */
+    ScratchBuffer scratch((PM_PREFETCH_BUFFER_NUM + 1) * block_size + LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS));
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[packApp]\t allocate %u memory failed!",
+                                (PM_PREFETCH_BUFFER_NUM + 1) * block_size + LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS));
+        return false;
+    }
+    ptr_out = ptr_buffer + PM_PREFETCH_BUFFER_NUM * block_size;
+    ptr_work = ptr_out + block_size;
+
+    encrypt_image = isEncrypted(des->fw_header.type.enc);
+    if (encrypt_image)
+    {
+        /* The caller stores des header, restore decrypts by this mode */
+        des->fw_header.type.enc = PM_BACKUP_ENC;
+    }
+    des->fw_header.type.enc |= MasterBootRecord::DATA_COMPRESSED;
+    /* A CBC image is a multiple of the cipher block, the stream is padded by 0 */
+    cbc_padding = encrypt_image && (MasterBootRecord::DATA_ENC == PM_BACKUP_ENC);
+
+    header.magic = LZSS_MAGIC;
+    header.raw_size = src->fw_header.size;
+    header.raw_crc = 0;
+    header.window_bits = PM_LZSS_WINDOW_BITS;
+    header.lookahead_bits = PM_LZSS_LOOKAHEAD_BITS;
+    header.reserved = 0;
+    stored_size = 0;
+    addr = 0;
+
+    /* Pass 0 sizes the compressed image, pass 1 writes it */
+    for (pass = 0; pass < 2 && status_isOK; pass++)
+    {
+        if (!encoder.begin(PM_LZSS_WINDOW_BITS, PM_LZSS_LOOKAHEAD_BITS, ptr_work))
+        {
+            PARTITION_MNG_TAG_PRINTF("[packApp]\t window=%u; lookahead=%u ERROR", PM_LZSS_WINDOW_BITS, PM_LZSS_LOOKAHEAD_BITS);
+            status_isOK = false;
+            break;
+        }
+        if (pass == 0)
+        {
+            CRC32_Init(&raw_ctx);
+        }
+        else
+        {
+            /* Running CRC of the des image, the des header takes stored size and src version */
+            des_header = des->fw_header;
+            des_header.size = stored_size;
+            des_header.version.u32 = src->fw_header.version.u32;
+            CRC32_Init(&image_ctx);
+            CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+            manifestClear(op);
+            /* No checkpoint, the backup is written again from the first block */
+            if (!journalBegin(op, src, block_size, nullptr, &image_ctx, nullptr))
+            {
+                status_isOK = false;
+                break;
+            }
+            journal_open = true;
+            if (tag_size)
+            {
+                macBegin(&des_header);
+            }
+            if (encrypt_image)
+            {
+                PARTITION_MNG_TAG_PRINTF("[packApp]\t processing encrypt image, enc=0x%02X", des->fw_header.type.enc);
+                cipherBegin(des->fw_header.type.enc, nullptr);
+                aes128.getIV((char*)chain);
+            }
+            memset(&_write_stats, 0, sizeof(write_stats_t));
+        }
+        memcpy(ptr_out, &header, LZSS_HEADER_LENGTH);
+        out_len = LZSS_HEADER_LENGTH;
+        addr = 0;
+        in_size = 0;
+        /* Block N+1 is read from src while block N is compressed */
+        _prefetcher.start(callback(&srcFlash, &InternalHandler::read), ptr_buffer, block_size, 0, src->fw_header.size);
+        while (!encoder.done())
+        {
+            out_len += encoder.produce(ptr_out + out_len, block_size - out_len);
+            if (out_len < block_size && !encoder.done())
+            {
+                ptr_data = _prefetcher.next(&src_addr, &read_size);
+                if (ptr_data == nullptr)
+                {
+                    if (in_size != src->fw_header.size)
+                    {
+                        status_isOK = false;
+                        PARTITION_MNG_TAG_PRINTF("[packApp]\t read src fail!");
+                        break;
+                    }
+                    encoder.finish();
+                    continue;
+                }
+                if (pass == 0)
+                {
+                    CRC32_Update(&raw_ctx, ptr_data, read_size);
+                }
+                in_size += read_size;
+                encoder.feed(ptr_data, read_size);
+                continue;
+            }
+            while (cbc_padding && encoder.done() && (out_len % AES128_LENGTH))
+            {
+                ptr_out[out_len++] = 0;
+            }
+            if (pass == 0 || out_len == 0)
+            {
+                addr += out_len;
+                out_len = 0;
+                continue;
+            }
+
+            if (encrypt_image)
+            {
+                /* Encrypt data before write to des partition */
+                aesEncrypt(ptr_out, out_len, addr, chain);
+            }
+            write_size = out_len;
+            if (tag_size)
+            {
+                _cmac.update(ptr_out, out_len);
+                if (addr + out_len == stored_size)
+                {
+                    /* The tag goes in the tail of the last block, the rest starts the next one */
+                    _cmac.finish((char*)mac);
+                    tag_head = (out_len + tag_size <= block_size) ? tag_size : (block_size - out_len);
+                    memcpy(ptr_out + out_len, mac, tag_head);
+                    write_size += tag_head;
+                    tag_size -= tag_head;
+                }
+            }
+            write_status = writeBlock(&desFlash, ptr_out, addr, write_size, block_size);
+            if (WRITE_ERROR == write_status)
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[packApp]\t write 0x%08X fail!", addr);
+                break;
+            }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+            if (WRITE_OK == write_status)
+            {
+                crc = Crc32_CalculateBuffer(ptr_out, write_size);
+                desFlash.read(ptr_out, addr, write_size);
+                if (crc != Crc32_CalculateBuffer(ptr_out, write_size))
+                {
+                    status_isOK = false;
+                    PARTITION_MNG_TAG_PRINTF("[packApp]\t crc32=0x%08X fail!", crc);
+                    break;
+                }
+            }
+#endif
+            /* ptr_out holds the data read back from des partition */
+            CRC32_Update(&image_ctx, ptr_out, out_len);
+            addr += out_len;
+            out_len = 0;
+            PARTITION_MNG_TAG_PRINTF("[packApp]\t %u%%", in_size * 100 / src->fw_header.size);
+        }
+        _prefetcher.stop();
+
+        if (pass == 0 && status_isOK)
+        {
+            stored_size = addr;
+            header.raw_crc = CRC32_Final(&raw_ctx);
+            PARTITION_MNG_TAG_PRINTF("[packApp]\t compressed size=%u(%u%%)",
+                                    stored_size,
+                                    stored_size * 100 / (src->fw_header.size ? src->fw_header.size : 1));
+            if (stored_size + tag_size > des->max_size)
+            {
+                PARTITION_MNG_TAG_PRINTF("[packApp]\t Des partition size isn't enough to store source image");
+                status_isOK = false;
+            }
+        }
+    }
+    printPrefetchStats("[packApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[packApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+
+    if (status_isOK && addr != stored_size)
+    {
+        status_isOK = false;
+        PARTITION_MNG_TAG_PRINTF("[packApp]\t stored size=%u, expected size=%u", addr, stored_size);
+    }
+    if (status_isOK && tag_size)
+    {
+        /* The rest of the tag starts the next block */
+        if ((WRITE_ERROR == writeBlock(&desFlash, mac + tag_head, stored_size + tag_head, tag_size, block_size))
+        || (desFlash.read(chain, stored_size, AES_CMAC_LENGTH) != 0)
+        || !AESCMAC::equal(chain, mac))
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[packApp]\t write tag fail!");
+        }
+    }
+    if (status_isOK)
+    {
+        manifestWrite(&desFlash, des, stored_size, src, ptr_buffer, block_size, op);
+    }
+    _cmac.clear();
+    if (encrypt_image && journal_open)
+    {
+        cipherEnd();
+    }
+    *des_size = stored_size;
+    *des_crc = journal_open ? CRC32_Final(&image_ctx) : 0;
+    if (journal_open)
+    {
+        journalEnd(op, status_isOK);
+    }
+
+    PARTITION_MNG_TAG_PRINTF("[packApp]<< finish");
+
+    return status_isOK;
+} // packApp
+
+bool partition_manager::cloneApp(app_info_t* des, app_info_t* src, uint32_t* des_crc)
+{
+    ExternalHandler desFlash(des);
+    InternalHandler srcFlash(src);
+    uint32_t addr;
+    uint32_t remain_size;
+    uint32_t read_size;
+    uint32_t block_size;
+    uint32_t crc = 0;
+    write_status_t write_status;
+    uint8_t *ptr_buffer;
+    uint8_t *ptr_data;
+    crc32_ctx_t image_ctx;
+    firmwareHeader_t des_header;
+    bool status_isOK = true;
+
+    PARTITION_MNG_TAG_PRINTF("[cloneApp]>> start");
+    PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Src internal: addr=0x%08X; size=%u",
+                            src->startup_addr,
+                            src->fw_header.size);
+    PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Des external: addr=0x%08X; max_size=%u",
+                            des->startup_addr,
+                            des->max_size);
+
+    if (des->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || src->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    {
+        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t type memory des/src ERROR");
+        return false;
+    }
+
+    PARTITION_MNG_TAG_PRINTF("[programApp] verify source");
+    if (!verify(src))
+    {
+        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t application source ERROR");
+        return false;
+    }
+
+    if (src->fw_header.size > des->max_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Des partition size isn't enough to store source image");
+        return false;
+    }
+
+    block_size = desFlash.get_erase_size();
+    /* Block buffers of the scratch arena */
+    ScratchBuffer scratch(PM_PREFETCH_BUFFER_NUM * block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t allocate %u memory failed!", PM_PREFETCH_BUFFER_NUM * block_size);
+        return false;
+    }
+
+    /* Running CRC of the des image, the des header takes src size and version */
+    des_header = des->fw_header;
+    des_header.size = src->fw_header.size;
+    des_header.version.u32 = src->fw_header.version.u32;
+    CRC32_Init(&image_ctx);
+    CRC32_Update(&image_ctx, (uint8_t *) &(des_header.size), 12U);
+
+    remain_size = src->fw_header.size;
+    addr = 0;
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+    /* Block N+1 is read from src while block N is processed and programmed */
+    _prefetcher.start(callback(&srcFlash, &InternalHandler::read), ptr_buffer, block_size, 0, src->fw_header.size);
+    while (remain_size)
+    {
+        ptr_data = _prefetcher.next(&addr, &read_size);
+        if (ptr_data == nullptr)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[cloneApp]\t read src fail!");
+            break;
+        }
+        write_status = writeBlock(&desFlash, ptr_data, addr, read_size, block_size);
+        if (WRITE_ERROR == write_status)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[cloneApp]\t write 0x%08X fail!", addr);
+            break;
+        }
+#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
+        if (WRITE_OK == write_status)
+        {
+            crc = Crc32_CalculateBuffer(ptr_data, read_size);
+            desFlash.read(ptr_data, addr, read_size);
+            if (crc != Crc32_CalculateBuffer(ptr_data, read_size))
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[cloneApp]\t crc32=0x%08X fail!", crc);
+                break;
+            }
+        }
+#endif
+        /* ptr_data holds the data read back from des partition */
+        CRC32_Update(&image_ctx, ptr_data, read_size);
+        remain_size -= read_size;
+        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t %u, %08X, %u%%", read_size, crc, (addr + read_size) * 100 / src->fw_header.size);
+    }
+    _prefetcher.stop();
+    printPrefetchStats("[cloneApp]", &_prefetcher);
+    PARTITION_MNG_TAG_PRINTF("[cloneApp]\t pages skipped=%u, erased=%u, programmed=%u",
+                            _write_stats.skipped,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+
+    *des_crc = CRC32_Final(&image_ctx);
+
+    PARTITION_MNG_TAG_PRINTF("[cloneApp]<< finish");
+
+    return status_isOK;
+} // cloneApp
+
+/** @brief start or resume the journal of a copy
+ * @param op journal operation, JOURNAL_OP_NONE copies without journal
+ * @param src information src application
+ * @param block_size copy block size
+ * @param src_ctx running crc of src, nullptr if it isn't used
+ * @param des_ctx running crc of des
+ * @param start_addr address to start the copy from, nullptr if the copy
+ *        always starts from the first block
+ * @return false if the journal isn't stored, des must not be written
+*/
+bool partition_manager::journalBegin(MasterBootRecord::journal_op_t op, app_info_t* src, uint32_t block_size, crc32_ctx_t* src_ctx, crc32_ctx_t* des_ctx, uint32_t* start_addr)
+{
+    copy_journal_t journal;
+
+    if (start_addr)
+    {
+        *start_addr = 0;
+    }
+    if (MasterBootRecord::JOURNAL_OP_NONE == op)
+    {
+        return true;
+    }
+
+    journal = _mbr.getJournal();
+    if (op == journal.common.op
+    && src->fw_header.checksum == journal.src_checksum
+    && (journal.block * block_size) < src->fw_header.size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[journalBegin]\t resume op %u at block %u", op, journal.block);
+        if (src_ctx)
+        {
+            src_ctx->crc = journal.src_crc;
+        }
+        des_ctx->crc = journal.des_crc;
+        if (start_addr)
+        {
+            *start_addr = journal.block * block_size;
+        }
+        return true;
+    }
+
+    if (MasterBootRecord::JOURNAL_OP_NONE != journal.common.op)
+    {
+        PARTITION_MNG_TAG_PRINTF("[journalBegin]\t drop op %u at block %u", journal.common.op, journal.block);
+        journalInvalidate((MasterBootRecord::journal_op_t)journal.common.op);
+    }
+
+    /* Record the copy before the first block is erased */
+    journal.common.u32 = 0;
+    journal.common.op = op;
+    journal.block = 0;
+    journal.src_checksum = src->fw_header.checksum;
+    journal.src_crc = src_ctx ? src_ctx->crc : 0;
+    journal.des_crc = des_ctx->crc;
+    _mbr.setJournal(&journal);
+    if (_mbr.flush() != MasterBootRecord::MBR_OK)
+    {
+        PARTITION_MNG_TAG_PRINTF("[journalBegin]\t store MBR failure!");
+        return false;
+    }
+    return true;
+} // journalBegin
+
+/** @brief store the progress of a copy every PM_JOURNAL_INTERVAL_BLOCKS blocks
+ * @param op journal operation
+ * @param block number of blocks completed
+ * @param src_ctx running crc of src, nullptr if it isn't used
+ * @param des_ctx running crc of des
+ * @return false if the checkpoint isn't stored, the copy stops
+*/
+bool partition_manager::journalCheckpoint(MasterBootRecord::journal_op_t op, uint32_t block, crc32_ctx_t* src_ctx, crc32_ctx_t* des_ctx)
+{
+    copy_journal_t journal;
+
+    if (MasterBootRecord::JOURNAL_OP_NONE == op
+    || (block % PM_JOURNAL_INTERVAL_BLOCKS) != 0)
+    {
+        return true;
+    }
+
+    journal = _mbr.getJournal();
+    journal.block = block;
+    journal.src_crc = src_ctx ? src_ctx->crc : 0;
+    journal.des_crc = des_ctx->crc;
+    _mbr.setJournal(&journal);
+    if (_mbr.flush() != MasterBootRecord::MBR_OK)
+    {
+        PARTITION_MNG_TAG_PRINTF("[journalCheckpoint]\t store MBR failure!");
+        return false;
+    }
+    return true;
+} // journalCheckpoint
+
+/** @brief close the journal of a copy
+ * On success the journal is only cleared in RAM, the caller commits it
+ * together with the new partition information. On failure it is flushed
+ * even inside a transaction, the des partition can't be trusted.
+ * @param op journal operation
+ * @param status_isOK result of the copy
+*/
+void partition_manager::journalEnd(MasterBootRecord::journal_op_t op, bool status_isOK)
+{
+    if (MasterBootRecord::JOURNAL_OP_NONE == op)
+    {
+        return;
+    }
+
+    _mbr.clearJournal();
+    if (!status_isOK)
+    {
+        journalInvalidate(op);
+        if (_mbr.flush() != MasterBootRecord::MBR_OK)
+        {
+            PARTITION_MNG_TAG_PRINTF("[journalEnd]\t store MBR failure!");
+        }
+    }
+} // journalEnd
+
+/** @brief a copy is abandoned, the des partition holds a part of the image
+ * The internal partitions are verified by CRC before they run. The rollback
+ * partitions are trusted by their status, so it is cleared.
+ * @param op journal operation
+*/
+void partition_manager::journalInvalidate(MasterBootRecord::journal_op_t op)
+{
+    app_info_t app;
+
+    if (MasterBootRecord::JOURNAL_OP_BACKUP_MAIN == op)
+    {
+        app = _mbr.getMainRollbackParams();
+        app.common.app_status = MasterBootRecord::APP_STATUS_NONE;
+        _mbr.setMainRollbackParams(&app);
+    }
+    else if (MasterBootRecord::JOURNAL_OP_BACKUP_BOOT == op)
+    {
+        app = _mbr.getBootRollbackParams();
+        app.common.app_status = MasterBootRecord::APP_STATUS_NONE;
+        _mbr.setBootRollbackParams(&app);
+    }
+} // journalInvalidate
+
+/** @brief erase and program one des block, skip the work the block doesn't need
+ * @param flash des partition
+ * @param data data going to be programmed
+ * @param addr block address
+ * @param size data length
+ * @param block_size erase size of the des partition
+ * @param erased the block was erased by preErase, it is only programmed
+ * @return WRITE_OK if the block was programmed, WRITE_SKIPPED if it already
+ *         held the data, WRITE_ERROR if the erase or the program failed
+*/
+template <class Flash>
+partition_manager::write_status_t partition_manager::writeBlock(FlashHandler<Flash>* flash, const uint8_t* data, uint32_t addr, uint32_t size, uint32_t block_size, bool erased)
+{
+    if (erased)
+    {
+        if (flash->program(data, addr, size) != 0)
+        {
+            PARTITION_MNG_TAG_PRINTF("[writeBlock]\t program 0x%08X fail!", addr);
+            return WRITE_ERROR;
+        }
+        _write_stats.programmed++;
+        bootProfileBytes(size);
+        return WRITE_OK;
+    }
+#if defined(PM_DIFFERENTIAL_WRITE) && (PM_DIFFERENTIAL_WRITE == 1)
+    uint8_t chunk[PM_DIFFERENTIAL_CHUNK_SIZE];
+    uint32_t offset;
+    uint32_t length;
+    uint32_t i;
+    uint8_t expected;
+    bool identical = true;
+    bool blank = true;
+
+    /* The block tail after the data must be blank as if it was erased */
+    offset = 0;
+    while (offset < block_size && (identical || blank))
+    {
+        length = block_size - offset;
+        if (length > PM_DIFFERENTIAL_CHUNK_SIZE)
+        {
+            length = PM_DIFFERENTIAL_CHUNK_SIZE;
+        }
+        if (flash->read(chunk, addr + offset, length) != 0)
+        {
+            identical = false;
+            blank = false;
+            break;
+        }
+        for (i = 0; i < length; i++)
+        {
+            expected = (offset + i < size) ? data[offset + i] : PM_ERASED_VALUE;
+            if (chunk[i] != expected)
+            {
+                identical = false;
+            }
+            if (chunk[i] != PM_ERASED_VALUE)
+            {
+                blank = false;
+            }
+        }
+        offset += length;
+    }
+
+    if (identical)
+    {
+        _write_stats.skipped++;
+        return WRITE_SKIPPED;
+    }
+
+    if (!blank)
+#endif
+    {
+        if (flash->erase(addr, block_size) != 0)
+        {
+            PARTITION_MNG_TAG_PRINTF("[writeBlock]\t erase 0x%08X fail!", addr);
+            return WRITE_ERROR;
+        }
+        _write_stats.erased++;
+    }
+    if (flash->program(data, addr, size) != 0)
+    {
+        PARTITION_MNG_TAG_PRINTF("[writeBlock]\t program 0x%08X fail!", addr);
+        return WRITE_ERROR;
+    }
+    _write_stats.programmed++;
+    bootProfileBytes(size);
+
+    return WRITE_OK;
+} // writeBlock
+
+/** @brief erase a des range before a copy, one eraseStep() at a time: a
+ * step of the SPI NOR is a chunk, erased by its 32K/64K block erases where
+ * it is aligned. A step already blank is only read.
+ * @param flash des partition
+ * @param addr start of the range, on an erase block
+ * @param size length of the range, a multiple of the erase block
+ * @return true if the whole range is blank
+*/
+template <class Flash>
+bool partition_manager::preErase(FlashHandler<Flash>* flash, uint32_t addr, uint32_t size)
+{
+    uint8_t chunk[PM_DIFFERENTIAL_CHUNK_SIZE];
+    uint32_t step;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t i;
+    uint32_t erases = 0;
+    uint32_t blanks = 0;
+    bool blank;
+
+    PARTITION_MNG_TAG_PRINTF("[preErase] 0x%08X, %u bytes", addr, size);
+    while (size > 0)
+    {
+        step = flash->eraseStep(addr, size);
+        if (step == 0)
+        {
+            PARTITION_MNG_TAG_PRINTF("[preErase]\t 0x%08X unaligned", addr);
+            return false;
+        }
+        /* Reading a step costs less than erasing it */
+        blank = true;
+        for (offset = 0; offset < step && blank; offset += length)
+        {
+            length = step - offset;
+            if (length > PM_DIFFERENTIAL_CHUNK_SIZE)
+            {
+                length = PM_DIFFERENTIAL_CHUNK_SIZE;
+            }
+            if (flash->read(chunk, addr + offset, length) != 0)
+            {
+                blank = false;
+                break;
+            }
+            for (i = 0; i < length; i++)
+            {
+                if (chunk[i] != PM_ERASED_VALUE)
+                {
+                    blank = false;
+                    break;
+                }
+            }
+        }
+        if (blank)
+        {
+            blanks++;
+        }
+        else
+        {
+            if (flash->erase(addr, step) != 0)
+            {
+                PARTITION_MNG_TAG_PRINTF("[preErase]\t erase 0x%08X, %u bytes fail!", addr, step);
+                return false;
+            }
+            erases++;
+        }
+        addr += step;
+        size -= step;
+    }
+    PARTITION_MNG_TAG_PRINTF("[preErase]\t erases=%u, blank=%u", erases, blanks);
+    return true;
+} // preErase
+
+/** @brief check the AES-CMAC tag stored after the image, one streaming pass
+ *  over the image as stored (cipher text for an encrypted image)
+ *
+ *  @param flash    flash of the image
+ *  @param app      app information
+ *  @param buffer   PM_PREFETCH_BUFFER_NUM * block_size bytes
+ *  @param block_size read size
+ *  @return         True if the tag is valid, or the image has no tag and
+ *                  PM_IMAGE_AUTH_REQUIRED is 0
+ */
+bool partition_manager::authenticate(ExternalHandler* flash, app_info_t* app, uint8_t* buffer, uint32_t block_size)
+{
+    uint8_t mac[AES_CMAC_LENGTH];
+    uint8_t tag[AES_CMAC_LENGTH];
+    uint8_t* ptr_data;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t remain_size;
+    bool status_isOK = true;
+
+    if (MasterBootRecord::AUTH_CMAC != app->common.auth)
+    {
+#if defined(PM_IMAGE_AUTH_REQUIRED) && (PM_IMAGE_AUTH_REQUIRED == 1)
+        PARTITION_MNG_TAG_PRINTF("[authenticate]\t image without tag rejected");
+        return false;
+#else
+        return true;
+#endif
+    }
+
+    PARTITION_MNG_TAG_PRINTF("[authenticate]>> start");
+    if (app->fw_header.size + AES_CMAC_LENGTH > app->max_size
+    || flash->read(tag, app->fw_header.size, AES_CMAC_LENGTH) != 0)
+    {
+        PARTITION_MNG_TAG_PRINTF("[authenticate]\t read tag fail!");
+        return false;
+    }
+
+    macBegin(&app->fw_header);
+    remain_size = app->fw_header.size;
+    _prefetcher.start(callback(flash, &ExternalHandler::read), buffer, block_size, 0, app->fw_header.size);
+    while (remain_size)
+    {
+        ptr_data = _prefetcher.next(&addr, &length);
+        if (ptr_data == nullptr)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[authenticate]\t read fail!");
+            break;
+        }
+        _cmac.update(ptr_data, length);
+        remain_size -= length;
+    }
+    _prefetcher.stop();
+    _cmac.finish((char*)mac);
+    _cmac.clear();
+
+    if (status_isOK && !AESCMAC::equal(mac, tag))
+    {
+        status_isOK = false;
+        PARTITION_MNG_TAG_PRINTF("[authenticate]\t tag mismatch!");
+    }
+    PARTITION_MNG_TAG_PRINTF("[authenticate]<< %s", status_isOK ? "succeed" : "failure");
+    return status_isOK;
+} // authenticate
+
+/** Convenience function for checking partition region validity
+ *
+ *  @param app      app information
+ *  @return         True if verify crc32 is valid for partition region
+ */
+bool partition_manager::verify(app_info_t* app)
+{
+  uint32_t crc;
+  bool result = false;
+  PARTITION_MNG_TAG_PRINTF("[verify]>> start");
+
+  if (FIRMWARE_TYPE_SIGNAL != app->fw_header.type.signal)
+  {
+      PARTITION_MNG_TAG_PRINTF("[verify]\t app header signal error");
+      return false;
+  }
+
+  PARTITION_MNG_TAG_PRINTF("[verify]\t check CRC32");
+  crc = this->CRC32(app);
+  if(crc == app->fw_header.checksum)
+  {
+    result = true;
+    PARTITION_MNG_TAG_PRINTF("[verify]\t crc=0x%08X App OK", crc);
+  }
+  else
+  {
+    result = false;
+    PARTITION_MNG_TAG_PRINTF("[verify]\t error crc=0x%08X, expected crc=0x%08X", crc, app->fw_header.checksum);
+    PARTITION_MNG_TAG_PRINTF("[verify]\t App Fail");
+  }
+  PARTITION_MNG_TAG_PRINTF("[verify]<< finish");
+  return result;
+}
+
+/** @brief verify an internal partition, the CRC is skipped if the partition
+ * wasn't written since it was verified in full
+ * @param app internal partition
+ * @param entry verified entry of the partition, updated by the result
+ * @param store rollback partition holding the chunk table
+ * @param root root of the chunk table, sampled on the fast path
+ * @param fast_shift nibble of the partition in PM_FAST_BOOTS_REG
+*/
+bool partition_manager::verifyCached(app_info_t* app, verify_entry_t* entry, app_info_t* store, uint32_t root, uint8_t fast_shift)
+{
+    uint32_t write_gen = _mbr.getVerifyCache().write_gen;
+
+#if defined(PM_VERIFY_CACHE_ENABLE) && (PM_VERIFY_CACHE_ENABLE == 1)
+    if (entry->gen == write_gen
+    && entry->checksum == app->fw_header.checksum
+    && MBR_CRC_APP_FACTORY != app->fw_header.checksum
+    && MBR_CRC_APP_NONE != app->fw_header.checksum
+#if (PM_VERIFY_FULL_INTERVAL > 0)
+    && fastBootsLeft(fast_shift) > 0
+#endif
+    )
+    {
+        if (FIRMWARE_TYPE_SIGNAL == app->fw_header.type.signal
+        && app->fw_header.size <= app->max_size
+        && verifyVectorTable(app)
+        && manifestSample(app, store, root))
+        {
+#if (PM_VERIFY_FULL_INTERVAL > 0)
+            setFastBootsLeft(fast_shift, fastBootsLeft(fast_shift) - 1);
+#endif
+            PARTITION_MNG_TAG_PRINTF("[verifyCached]\t gen %u verified, skip CRC", write_gen);
+            return true;
+        }
+        PARTITION_MNG_TAG_PRINTF("[verifyCached]\t fast check fail");
+    }
+#endif
+
+    memset(entry, 0, sizeof(verify_entry_t));
+    if (!verify(app))
+    {
+        return false;
+    }
+    entry->gen = write_gen;
+    entry->checksum = app->fw_header.checksum;
+#if (PM_VERIFY_FULL_INTERVAL > 0)
+    setFastBootsLeft(fast_shift, PM_VERIFY_FULL_INTERVAL);
+#endif
+    return true;
+}
+
+/** @brief sanity check of the vector table of an internal partition
+ * @param app internal partition
+*/
+bool partition_manager::verifyVectorTable(app_info_t* app)
+{
+    const uint32_t* vector_table;
+    uint32_t stack_ptr;
+    uint32_t reset_handler;
+
+    if (app->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL)
+    {
+        return false;
+    }
+
+    vector_table = (const uint32_t*)PM_INTERNAL_PTR(app->startup_addr);
+    stack_ptr = vector_table[0];
+    reset_handler = vector_table[1];
+    if (stack_ptr < PM_RAM_START || stack_ptr > PM_RAM_END)
+    {
+        PARTITION_MNG_TAG_PRINTF("[verifyVectorTable]\t stack pointer 0x%08X error", stack_ptr);
+        return false;
+    }
+
+    /* Thumb code inside the image */
+    if ((reset_handler & 1U) == 0
+    || reset_handler < app->startup_addr
+    || reset_handler >= app->startup_addr + app->fw_header.size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[verifyVectorTable]\t reset handler 0x%08X error", reset_handler);
+        return false;
+    }
+    return true;
+}
+
+/** @brief first erase block after the image and its tag in a rollback partition
+ * @param store rollback partition, common.auth gives the tag
+ * @param stored_size size of the image as stored
+ * @param block_size erase size of the rollback partition
+*/
+uint32_t partition_manager::manifestAddr(const app_info_t* store, uint32_t stored_size, uint32_t block_size)
+{
+    if (MasterBootRecord::AUTH_CMAC == store->common.auth)
+    {
+        stored_size += AES_CMAC_LENGTH;
+    }
+    return ((stored_size + block_size - 1) / block_size) * block_size;
+}
+
+/** @brief drop the chunk table of a rollback partition going to be written,
+ * the caller stores the MBR
+ * @param op journal operation of the backup
+*/
+void partition_manager::manifestClear(MasterBootRecord::journal_op_t op)
+{
+    manifest_info_t manifest = _mbr.getManifest();
+
+    if (MasterBootRecord::JOURNAL_OP_BACKUP_MAIN == op)
+    {
+        manifest.main = 0;
+    }
+    else if (MasterBootRecord::JOURNAL_OP_BACKUP_BOOT == op)
+    {
+        manifest.boot = 0;
+    }
+    _mbr.setManifest(&manifest);
+}
+
+/** @brief store the chunk table of src after its copy, the root goes to the
+ * MBR with the backup. A backup without table is still valid, only the
+ * partial verify and repair are lost.
+ * @param flash rollback partition
+ * @param store rollback partition information, common.auth is set
+ * @param stored_size size of the copy as stored
+ * @param src internal image, read memory mapped
+ * @param buffer block_size bytes
+ * @param block_size erase size of the rollback partition
+ * @param op journal operation of the backup, JOURNAL_OP_NONE: no table
+*/
+void partition_manager::manifestWrite(ExternalHandler* flash, app_info_t* store, uint32_t stored_size, app_info_t* src, uint8_t* buffer, uint32_t block_size, MasterBootRecord::journal_op_t op)
+{
+#if defined(PM_MANIFEST_ENABLE) && (PM_MANIFEST_ENABLE == 1)
+    manifest_header_t header;
+    manifest_info_t manifest;
+    uint32_t* entry;
+    uint32_t* table;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t offset;
+    uint32_t i;
+    uint32_t root;
+
+    manifest = _mbr.getManifest();
+    if (MasterBootRecord::JOURNAL_OP_BACKUP_MAIN == op)
+    {
+        entry = &manifest.main;
+    }
+    else if (MasterBootRecord::JOURNAL_OP_BACKUP_BOOT == op)
+    {
+        entry = &manifest.boot;
+    }
+    else
+    {
+        return;
+    }
+
+    header.magic = PM_MANIFEST_MAGIC;
+    header.checksum = src->fw_header.checksum;
+    header.size = src->fw_header.size;
+    header.chunk_size = PM_MANIFEST_CHUNK_SIZE;
+    header.count = (src->fw_header.size + PM_MANIFEST_CHUNK_SIZE - 1) / PM_MANIFEST_CHUNK_SIZE;
+    length = sizeof(manifest_header_t) + header.count * sizeof(uint32_t);
+    addr = manifestAddr(store, stored_size, block_size);
+    if (length > block_size || addr + block_size > store->max_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[manifestWrite]\t no room for %u chunks", header.count);
+        return;
+    }
 
-    PARTITION_MNG_TAG_PRINTF("[cloneApp]>> start");
-    PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Src internal: addr=0x%08X; size=%u",
-                            src->startup_addr,
-                            src->fw_header.size);
-    PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Des external: addr=0x%08X; max_size=%u",
-                            des->startup_addr,
-                            des->max_size);
+    memcpy(buffer, &header, sizeof(manifest_header_t));
+    table = (uint32_t*)(buffer + sizeof(manifest_header_t));
+    for (i = 0; i < header.count; i++)
+    {
+        offset = i * PM_MANIFEST_CHUNK_SIZE;
+        table[i] = Crc32_CalculateBuffer(PM_INTERNAL_PTR(src->startup_addr + offset),
+                                        (header.size - offset < PM_MANIFEST_CHUNK_SIZE) ? header.size - offset : PM_MANIFEST_CHUNK_SIZE);
+    }
+    root = Crc32_CalculateBuffer(buffer, length);
+    if (WRITE_ERROR == writeBlock(flash, buffer, addr, length, block_size)
+    || flash->read(buffer, addr, length) != 0
+    || root != Crc32_CalculateBuffer(buffer, length))
+    {
+        PARTITION_MNG_TAG_PRINTF("[manifestWrite]\t write table fail!");
+        return;
+    }
+    *entry = root;
+    _mbr.setManifest(&manifest);
+    PARTITION_MNG_TAG_PRINTF("[manifestWrite]\t %u chunks at 0x%08X, root 0x%08X", header.count, addr, root);
+#endif
+} // manifestWrite
+
+/** @brief read the chunk table of app from its rollback partition
+ * @param app internal image
+ * @param store rollback partition
+ * @param root root of the chunk table, ref manifest_info_t
+ * @param table CRC32 of the chunks, capacity entries
+ * @param count number of chunks
+ * @return false if app has no valid table
+*/
+bool partition_manager::manifestLoad(app_info_t* app, app_info_t* store, uint32_t root, uint32_t* table, uint32_t capacity, uint32_t* count)
+{
+    ExternalHandler flash(store);
+    manifest_header_t header;
+    uint32_t addr;
+    uint32_t length;
+    crc32_ctx_t ctx;
 
-    PARTITION_MNG_TAG_PRINTF("[programApp] verify source");
-    if (!verify(src))
+    if (0 == root
+    || MBR_CRC_APP_FACTORY == app->fw_header.checksum
+    || MBR_CRC_APP_NONE == app->fw_header.checksum)
     {
-        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t application source ERROR");
         return false;
     }
 
-    if (src->fw_header.size > des->max_size)
+    addr = manifestAddr(store, store->fw_header.size, flash.get_erase_size());
+    if (addr + sizeof(manifest_header_t) > store->max_size
+    || flash.read(&header, addr, sizeof(manifest_header_t)) != 0
+    || PM_MANIFEST_MAGIC != header.magic
+    || header.checksum != app->fw_header.checksum
+    || header.size != app->fw_header.size
+    || header.chunk_size == 0
+    || header.count != (header.size + header.chunk_size - 1) / header.chunk_size
+    || sizeof(manifest_header_t) + header.count * sizeof(uint32_t) > flash.get_erase_size())
     {
-        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t Des partition size isn't enough to store source image");
+        PARTITION_MNG_TAG_PRINTF("[manifestLoad]\t table header ERROR");
+        return false;
+    }
+    if (header.count > capacity)
+    {
+        PARTITION_MNG_TAG_PRINTF("[manifestLoad]\t %u chunks, room for %u", header.count, capacity);
+        return false;
+    }
+
+    length = header.count * sizeof(uint32_t);
+    CRC32_Init(&ctx);
+    CRC32_Update(&ctx, (uint8_t*)&header, sizeof(manifest_header_t));
+    if (flash.read(table, addr + sizeof(manifest_header_t), length) != 0)
+    {
+        length = 0;
+    }
+    CRC32_Update(&ctx, (uint8_t*)table, length);
+    if (length == 0 || CRC32_Final(&ctx) != root)
+    {
+        PARTITION_MNG_TAG_PRINTF("[manifestLoad]\t root ERROR");
+        return false;
+    }
+    *count = header.count;
+    return true;
+} // manifestLoad
+
+/** @brief CRC32 of one chunk of an internal image */
+static uint32_t chunkCrc(app_info_t* app, uint32_t index)
+{
+    uint32_t offset = index * PM_MANIFEST_CHUNK_SIZE;
+    uint32_t length = app->fw_header.size - offset;
+
+    if (length > PM_MANIFEST_CHUNK_SIZE)
+    {
+        length = PM_MANIFEST_CHUNK_SIZE;
+    }
+    return Crc32_CalculateBuffer(PM_INTERNAL_PTR(app->startup_addr + offset), length);
+}
+
+/** @brief random chunks of the sample, a new set each boot */
+static uint32_t sampleSeed(void)
+{
+    uint32_t seed = 0;
+#if DEVICE_TRNG
+    trng_t trng;
+    size_t length = 0;
+
+    trng_init(&trng);
+    trng_get_bytes(&trng, (uint8_t*)&seed, sizeof(seed), &length);
+    trng_free(&trng);
+#endif
+    seed ^= us_ticker_read();
+    return seed ? seed : 0x2545F491UL;
+}
+
+/** @brief check PM_MANIFEST_SAMPLE_CHUNKS random chunks of app
+ * @return false only if a chunk doesn't match its table, an image without
+ *         table passes
+*/
+bool partition_manager::manifestSample(app_info_t* app, app_info_t* store, uint32_t root)
+{
+#if (PM_MANIFEST_SAMPLE_CHUNKS > 0)
+    uint32_t* table;
+    uint32_t count;
+    uint32_t seed;
+    uint32_t index;
+    uint32_t n;
+    bool status_isOK = true;
+    ScratchBuffer scratch(PM_MANIFEST_TABLE_SIZE);
+
+    table = scratch.as<uint32_t>();
+    if (table == nullptr
+    || !manifestLoad(app, store, root, table, PM_MANIFEST_TABLE_SIZE / sizeof(uint32_t), &count))
+    {
+        return true;
+    }
+    seed = sampleSeed();
+    for (n = 0; n < PM_MANIFEST_SAMPLE_CHUNKS && n < count; n++)
+    {
+        /* xorshift32 */
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        index = seed % count;
+        if (chunkCrc(app, index) != table[index])
+        {
+            PARTITION_MNG_TAG_PRINTF("[manifestSample]\t chunk %u ERROR", index);
+            status_isOK = false;
+            break;
+        }
+    }
+    return status_isOK;
+#else
+    return true;
+#endif
+} // manifestSample
+
+/** @brief check every chunk of app against its table
+ * @return number of bad chunks, PM_MANIFEST_NONE if app has no table
+*/
+uint32_t partition_manager::verifyChunks(app_info_t* app, app_info_t* store, uint32_t root)
+{
+    uint32_t* table;
+    uint32_t count;
+    uint32_t bad = 0;
+    uint32_t i;
+    ScratchBuffer scratch(PM_MANIFEST_TABLE_SIZE);
+
+    if (app->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL
+    || app->fw_header.size > app->max_size)
+    {
+        return PM_MANIFEST_NONE;
+    }
+    table = scratch.as<uint32_t>();
+    if (table == nullptr
+    || !manifestLoad(app, store, root, table, PM_MANIFEST_TABLE_SIZE / sizeof(uint32_t), &count))
+    {
+        PARTITION_MNG_TAG_PRINTF("[verifyChunks]\t no chunk table");
+        return PM_MANIFEST_NONE;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (chunkCrc(app, i) != table[i])
+        {
+            PARTITION_MNG_TAG_PRINTF("[verifyChunks]\t chunk %u at 0x%08X ERROR", i, app->startup_addr + i * PM_MANIFEST_CHUNK_SIZE);
+            bad++;
+        }
+    }
+    return bad;
+} // verifyChunks
+
+/** @brief rewrite the pages of des that are bad from the copy in src. The
+ * copy is read at the offset of the page: raw, AES-CTR from the offset,
+ * AES-CBC from the cipher block before it. A compressed copy has no random
+ * access.
+ * With a chunk table, a page is bad when it doesn't match the table, and
+ * the page of src is checked by the table before it is written.
+ * Without, the copy must be the same image (size and version), every page
+ * is compared with the copy and the one that differ are written. The CRC
+ * of des checked by the caller tells if the copy was the same image.
+ * No journal: an interrupted repair leaves bad pages, repaired again.
+ * @param des internal image
+ * @param src rollback partition
+ * @param root root of the chunk table, ref manifest_info_t
+*/
+bool partition_manager::repairApp(app_info_t* des, app_info_t* src, uint32_t root)
+{
+    InternalHandler desFlash(des);
+    ExternalHandler srcFlash(src);
+    uint32_t* table;
+    uint32_t count;
+    uint32_t block_size;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t crc;
+    uint32_t repaired = 0;
+    uint32_t i;
+    uint8_t* ptr_buffer;
+    uint8_t chain[AES128_LENGTH];
+    bool decrypt_image;
+    bool status_isOK = true;
+    ScratchBuffer tableScratch(PM_MANIFEST_TABLE_SIZE);
+
+    PARTITION_MNG_TAG_PRINTF("[repairApp]>> start");
+    if (des->fw_header.type.mem != MasterBootRecord::MEMORY_INTERNAL
+    || src->fw_header.type.mem != MasterBootRecord::MEMORY_EXTERNAL
+    || des->fw_header.size > des->max_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t type memory des/src ERROR");
+        return false;
+    }
+    if (MBR_CRC_APP_FACTORY == des->fw_header.checksum
+    || MBR_CRC_APP_NONE == des->fw_header.checksum)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t des checksum unknown");
+        return false;
+    }
+    if (src->fw_header.type.enc & MasterBootRecord::DATA_COMPRESSED)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t compressed copy, no random access");
+        return false;
+    }
+    if (src->fw_header.size < des->fw_header.size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t src size ERROR");
         return false;
     }
 
-    desFlash = new FlashHandler(des);
-    srcFlash = new FlashHandler(src);
+    table = tableScratch.as<uint32_t>();
+    if (table == nullptr
+    || !manifestLoad(des, src, root, table, PM_MANIFEST_TABLE_SIZE / sizeof(uint32_t), &count))
+    {
+        table = nullptr;
+        if (src->fw_header.size != des->fw_header.size
+        || src->fw_header.version.u32 != des->fw_header.version.u32)
+        {
+            PARTITION_MNG_TAG_PRINTF("[repairApp]\t src isn't a copy of des");
+            return false;
+        }
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t no chunk table, compare every page");
+        count = (des->fw_header.size + PM_MANIFEST_CHUNK_SIZE - 1) / PM_MANIFEST_CHUNK_SIZE;
+    }
 
-    block_size = desFlash->get_erase_size();
-    /* Allocate dynamic memory */
-    ptr_data = new (std::nothrow) uint8_t[block_size];
-    if (ptr_data == nullptr)
+    block_size = desFlash.get_erase_size();
+    if (PM_MANIFEST_CHUNK_SIZE != block_size)
+    {
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t chunk %u isn't a des block %u", PM_MANIFEST_CHUNK_SIZE, block_size);
+        return false;
+    }
+    ScratchBuffer scratch(block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
     {
-        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t allocate %u memory failed!", block_size);
-        delete desFlash;
-        delete srcFlash;
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t allocate %u memory failed!", block_size);
         return false;
     }
 
-    remain_size = src->fw_header.size;
-    addr = 0;
-    while (remain_size)
+    decrypt_image = isEncrypted(src->fw_header.type.enc);
+    if (decrypt_image)
+    {
+        cipherBegin(src->fw_header.type.enc, nullptr);
+    }
+    memset(&_write_stats, 0, sizeof(write_stats_t));
+    for (i = 0; i < count && status_isOK; i++)
     {
-        if (remain_size > block_size)
+        if (table && chunkCrc(des, i) == table[i])
         {
-            read_size = block_size;
+            continue;
         }
-        else
+        offset = i * PM_MANIFEST_CHUNK_SIZE;
+        length = des->fw_header.size - offset;
+        if (length > PM_MANIFEST_CHUNK_SIZE)
         {
-            read_size = remain_size;
+            length = PM_MANIFEST_CHUNK_SIZE;
         }
-        desFlash->erase(addr, block_size);
-        srcFlash->read(ptr_data, addr, read_size);
-        desFlash->program(ptr_data, addr, read_size);
-#if defined(PM_VERIFY_DATA_BY_CRC32) && (PM_VERIFY_DATA_BY_CRC32 == 1)
-        crc = Crc32_CalculateBuffer(ptr_data, read_size);
-        desFlash->read(ptr_data, addr, read_size);
-        if (crc != Crc32_CalculateBuffer(ptr_data, read_size))
+        if (decrypt_image)
+        {
+            aes128.getIV((char*)chain);
+            if (offset && AES::MODE_CBC == aes128.mode()
+            && srcFlash.read(chain, offset - AES128_LENGTH, AES128_LENGTH) != 0)
+            {
+                status_isOK = false;
+                PARTITION_MNG_TAG_PRINTF("[repairApp]\t read src fail!");
+                break;
+            }
+        }
+        if (srcFlash.read(ptr_buffer, offset, length) != 0)
         {
             status_isOK = false;
-            PARTITION_MNG_TAG_PRINTF("[cloneApp]\t crc32=0x%08X fail!", crc);
+            PARTITION_MNG_TAG_PRINTF("[repairApp]\t read src fail!");
             break;
         }
-#endif
-        addr += read_size;
-        remain_size -= read_size;
-        PARTITION_MNG_TAG_PRINTF("[cloneApp]\t %u, %08X, %u%%", read_size, crc, addr * 100 / src->fw_header.size);
+        if (decrypt_image)
+        {
+            aesDecrypt(ptr_buffer, length, offset, chain);
+        }
+        if (table == nullptr
+        && 0 == memcmp(ptr_buffer, PM_INTERNAL_PTR(des->startup_addr + offset), length))
+        {
+            continue;
+        }
+        crc = Crc32_CalculateBuffer(ptr_buffer, length);
+        if (table && crc != table[i])
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[repairApp]\t src chunk %u ERROR", i);
+            break;
+        }
+        PARTITION_MNG_TAG_PRINTF("[repairApp]\t page %u at 0x%08X", i, des->startup_addr + offset);
+        if (repaired == 0)
+        {
+            /* The des partition isn't verified anymore */
+            _mbr.bumpWriteGen();
+            _mbr.flush();
+        }
+        if (WRITE_ERROR == writeBlock(&desFlash, ptr_buffer, offset, length, block_size)
+        || desFlash.read(ptr_buffer, offset, length) != 0
+        || Crc32_CalculateBuffer(ptr_buffer, length) != crc)
+        {
+            status_isOK = false;
+            PARTITION_MNG_TAG_PRINTF("[repairApp]\t write page %u fail!", i);
+            break;
+        }
+        repaired++;
     }
-
-    delete[] ptr_data;
-    delete desFlash;
-    delete srcFlash;
-
-    PARTITION_MNG_TAG_PRINTF("[cloneApp]<< finish");
-
+    if (decrypt_image)
+    {
+        cipherEnd();
+    }
+    PARTITION_MNG_TAG_PRINTF("[repairApp]\t pages %u, repaired %u, erased=%u, programmed=%u",
+                            count,
+                            repaired,
+                            _write_stats.erased,
+                            _write_stats.programmed);
+    PARTITION_MNG_TAG_PRINTF("[repairApp]<< %s", status_isOK ? "succeed" : "failure");
     return status_isOK;
-} // cloneApp
-
-/** Convenience function for checking partition region validity
- *
- *  @param app      app information
- *  @return         True if verify crc32 is valid for partition region
- */
-bool partition_manager::verify(app_info_t* app)
-{
-  uint32_t crc;
-  bool result = false;
-  PARTITION_MNG_TAG_PRINTF("[verify]>> start");
-
-  if (FIRMWARE_TYPE_SIGNAL != app->fw_header.type.signal)
-  {
-      PARTITION_MNG_TAG_PRINTF("[verify]\t app header signal error");
-      return false;
-  }
-
-  PARTITION_MNG_TAG_PRINTF("[verify]\t check CRC32");
-  crc = this->CRC32(app);
-  if(crc == app->fw_header.checksum)
-  {
-    result = true;
-    PARTITION_MNG_TAG_PRINTF("[verify]\t crc=0x%08X App OK", crc);
-  }
-  else
-  {
-    result = false;
-    PARTITION_MNG_TAG_PRINTF("[verify]\t error crc=0x%08X, expected crc=0x%08X", crc, app->fw_header.checksum);
-    PARTITION_MNG_TAG_PRINTF("[verify]\t App Fail");
-  }
-  PARTITION_MNG_TAG_PRINTF("[verify]<< finish");
-  return result;
-}
+} // repairApp
 
 /**
  * @brief Calculator CRC32 partition.
  */
 uint32_t partition_manager::CRC32(app_info_t* app)
 {
+    crc32_ctx_t ctx;
     uint32_t crc;
 
     PARTITION_MNG_TAG_PRINTF("[CRC32]>> start");
     PARTITION_MNG_TAG_PRINTF("[CRC32]\t addr=0x%08X, size=%u", app->startup_addr, app->fw_header.size);
-    CRC32_Start(0);
+    CRC32_Init(&ctx);
     /* Calculator CRC 12-byte of fw_header*/
-    CRC32_Accumulate((uint8_t *) &(app->fw_header.size), 12U);
+    CRC32_Update(&ctx, (uint8_t *) &(app->fw_header.size), 12U);
     if (app->fw_header.type.mem == MasterBootRecord::MEMORY_INTERNAL)
     {
         if (app->fw_header.size > app->max_size)
@@ -1072,25 +3384,24 @@ uint32_t partition_manager::CRC32(app_info_t* app)
             return 0;
         }
         PARTITION_MNG_TAG_PRINTF("[CRC32]\t internal memory");
-        CRC32_Accumulate((uint8_t *) app->startup_addr, app->fw_header.size);
+        CRC32_Update(&ctx, PM_INTERNAL_PTR(app->startup_addr), app->fw_header.size);
     }
     else
     {
-        FlashSPIBlockDevice* spiFlash;
+        ExternalHandler spiFlash(app);
         uint32_t addr;
         uint32_t remain_size;
         uint32_t read_size;
         uint32_t block_size;
 
         PARTITION_MNG_TAG_PRINTF("[CRC32]\t external memory");
-        spiFlash = new FlashSPIBlockDevice(_spiDevice, app->startup_addr, app->max_size);
-        block_size = spiFlash->get_erase_size();
-        /* Allocate dynamic memory */
-        uint8_t *ptr_data = new (std::nothrow) uint8_t[block_size];
+        block_size = spiFlash.get_erase_size();
+        /* Block buffer of the scratch arena */
+        ScratchBuffer scratch(block_size);
+        uint8_t *ptr_data = scratch.data();
         if (ptr_data == nullptr)
         {
             PARTITION_MNG_TAG_PRINTF("[CRC32]\t allocate %u memory failed!", block_size);
-            delete spiFlash;
             return 0;
         }
 
@@ -1114,65 +3425,302 @@ uint32_t partition_manager::CRC32(app_info_t* app)
                 read_size = remain_size;
             }
 
-            spiFlash->read(ptr_data, addr, read_size);
-            CRC32_Accumulate((uint8_t *) ptr_data, read_size);
+            spiFlash.read(ptr_data, addr, read_size);
+            CRC32_Update(&ctx, (uint8_t *) ptr_data, read_size);
             addr += read_size;
             remain_size -= read_size;
             PARTITION_MNG_TAG_PRINTF("[CRC32]\t %u%%", addr * 100 / app->fw_header.size);
         }
-
-        delete[] ptr_data;
-        delete spiFlash;
     }
-    crc = CRC32_Get();
+    crc = CRC32_Final(&ctx);
+    bootProfileBytes(app->fw_header.size);
     
     PARTITION_MNG_TAG_PRINTF("[CRC32]\t 0x%08X", crc);
     PARTITION_MNG_TAG_PRINTF("[CRC32]<< finish");
     return crc;
 } // fwl_header_crc32
 
-void partition_manager::aesEncrypt(void *data, size_t length)
+/** @brief image encrypted by AES-CBC or AES-CTR
+ * @param enc refer header_encrypt_t, with or without DATA_COMPRESSED
+*/
+bool partition_manager::isEncrypted(uint8_t enc)
+{
+    enc &= ~MasterBootRecord::DATA_COMPRESSED;
+    return (MasterBootRecord::DATA_ENC == enc || MasterBootRecord::DATA_ENC_CTR == enc);
+}
+
+/** @brief expand the MBR key once for a whole image
+ * @param enc refer header_encrypt_t, DATA_ENC_CTR selects the CTR mode
+ * @param iv chain of the first chunk, nullptr to start with the MBR iv
+*/
+void partition_manager::cipherBegin(uint8_t enc, const uint8_t* iv)
 {
     AES128_crypto_t mbr_aes = _mbr.getAes128Params();
-#if (0)
-    //Encrypt the message in-place
-    PARTITION_MNG_TAG_PRINTF("[aesEncrypt]>> start");
-    PARTITION_MNG_TAG_PRINTF("[aesEncrypt]\t Key");
-    printData(mbr_aes.key, AES128_LENGTH);
-    PARTITION_MNG_TAG_PRINTF("[aesEncrypt]\t Iv");
-    printData(mbr_aes.iv, AES128_LENGTH);
-    PARTITION_MNG_TAG_PRINTF("[aesEncrypt]\t Data length %u", length);
-#endif
-    aes128.setup((const char*)mbr_aes.key, AES::KEY_128, AES::MODE_CBC, (const char*)mbr_aes.iv);
-    aes128.encrypt(data, length);
+
+    aes128.setup((const char*)mbr_aes.key, AES::KEY_128,
+                 (MasterBootRecord::DATA_ENC_CTR == (enc & ~MasterBootRecord::DATA_COMPRESSED)) ? AES::MODE_CTR : AES::MODE_CBC,
+                 (const char*)(iv ? iv : mbr_aes.iv));
+    memset(&mbr_aes, 0, sizeof(AES128_crypto_t));
+}
+
+void partition_manager::cipherEnd(void)
+{
     aes128.clear();
-    // PARTITION_MNG_TAG_PRINTF("[aesEncrypt]>> finish");
 }
 
-void partition_manager::aesDecrypt(void *data, size_t length)
+/** @brief time the block cipher and checksum engines of the copy and verify
+ * paths on DEVICE_PAGE_ERASE_SIZE blocks. The engines are selected at compile
+ * time (CRYPTO_BACKEND, AES_IMPLEMENTATION, CRC32_TABLE_SLICES), build once
+ * per engine to compare them.
+*/
+void partition_manager::benchmarkCrypto(void)
+{
+    static const char* const names[] = {"aes-ctr", "aes-cbc enc", "aes-cbc dec", "aes-cmac", "crc32"};
+    const uint32_t block_size = DEVICE_PAGE_ERASE_SIZE;
+    uint32_t us[sizeof(names) / sizeof(names[0])];
+    uint8_t chain[AES128_LENGTH];
+    uint8_t mac[AES_CMAC_LENGTH];
+    firmwareHeader_t header;
+    crc32_ctx_t ctx;
+    uint8_t *ptr_buffer;
+    uint32_t i;
+    uint32_t n;
+    Timer t;
+
+    ScratchBuffer scratch(block_size);
+    ptr_buffer = scratch.data();
+    if (ptr_buffer == nullptr)
+    {
+        PARTITION_MNG_TAG_PRINTF("[benchmarkCrypto]\t allocate %u memory failed!", block_size);
+        return;
+    }
+    memset(ptr_buffer, 0x5A, block_size);
+    memset(&header, 0, sizeof(firmwareHeader_t));
+    PARTITION_MNG_TAG_PRINTF("[benchmarkCrypto]>> start, backend %s, %u x %u bytes",
+                            CRYPTO_BACKEND_NAME, PM_BENCHMARK_BLOCKS, block_size);
+
+    t.start();
+    cipherBegin(MasterBootRecord::DATA_ENC_CTR, nullptr);
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_BLOCKS; i++)
+    {
+        aesEncrypt(ptr_buffer, block_size, i * block_size, chain);
+    }
+    us[0] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    cipherEnd();
+
+    cipherBegin(MasterBootRecord::DATA_ENC, nullptr);
+    aes128.getIV((char*)chain);
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_BLOCKS; i++)
+    {
+        aesEncrypt(ptr_buffer, block_size, i * block_size, chain);
+    }
+    us[1] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_BLOCKS; i++)
+    {
+        aesDecrypt(ptr_buffer, block_size, i * block_size, chain);
+    }
+    us[2] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    cipherEnd();
+
+    macBegin(&header);
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_BLOCKS; i++)
+    {
+        _cmac.update(ptr_buffer, block_size);
+    }
+    _cmac.finish((char*)mac);
+    us[3] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    _cmac.clear();
+
+    CRC32_Init(&ctx);
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_BLOCKS; i++)
+    {
+        CRC32_Update(&ctx, ptr_buffer, block_size);
+    }
+    us[4] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    t.stop();
+
+    for (n = 0; n < sizeof(names) / sizeof(names[0]); n++)
+    {
+        PARTITION_MNG_TAG_PRINTF("[benchmarkCrypto]\t %s: %u us/block, %u KB/s",
+                                names[n],
+                                us[n] / PM_BENCHMARK_BLOCKS,
+                                (uint32_t)((uint64_t)PM_BENCHMARK_BLOCKS * block_size * 1000000U / 1024U / (us[n] ? us[n] : 1)));
+    }
+    PARTITION_MNG_TAG_PRINTF("[benchmarkCrypto]<< finish");
+} // benchmarkCrypto
+
+/** @brief time PM_BENCHMARK_CALLS reads of 4 bytes in app, straight to the
+ * device of Flash, through one FlashHandler and through a FlashHandler made
+ * for each read
+ * @return false if a read failed
+*/
+template <class Flash>
+bool partition_manager::timeFlashCalls(app_info_t* app, flash_call_cost_t* cost)
+{
+    FlashHandler<Flash> flash(app);
+    uint32_t data;
+    uint32_t us[3];
+    uint32_t i;
+    int err = 0;
+    Timer t;
+
+    t.start();
+    for (i = 0; i < PM_BENCHMARK_CALLS; i++)
+    {
+        err |= Flash::read(&data, app->startup_addr + (i & 0xFFU) * sizeof(data), sizeof(data));
+    }
+    us[0] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_CALLS; i++)
+    {
+        err |= flash.read(&data, (i & 0xFFU) * sizeof(data), sizeof(data));
+    }
+    us[1] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    t.reset();
+    for (i = 0; i < PM_BENCHMARK_CALLS; i++)
+    {
+        FlashHandler<Flash> handler(app);
+        err |= handler.read(&data, (i & 0xFFU) * sizeof(data), sizeof(data));
+    }
+    us[2] = std::chrono::duration_cast<std::chrono::microseconds>(t.elapsed_time()).count();
+    t.stop();
+
+    cost->device = (uint32_t)((uint64_t)us[0] * 1000U / PM_BENCHMARK_CALLS);
+    cost->handler = (uint32_t)((uint64_t)us[1] * 1000U / PM_BENCHMARK_CALLS);
+    cost->create = (uint32_t)((uint64_t)us[2] * 1000U / PM_BENCHMARK_CALLS);
+    return 0 == err;
+}
+
+/** @brief cost of a read call through the FlashHandler of each memory kind
+ * against the device alone, on the main partition and its rollback. Call it
+ * between begin() and end().
+ * @param internal, external the costs, may be nullptr
+ * @return false if not initialized or a read failed
+*/
+bool partition_manager::benchmarkFlash(flash_call_cost_t* internal, flash_call_cost_t* external)
+{
+    flash_call_cost_t cost[2];
+    app_info_t app;
+    bool status_isOK;
+    uint32_t n;
+
+    if (!_init_isOK)
+    {
+        PARTITION_MNG_TAG_PRINTF("[benchmarkFlash]\t not initialized!");
+        return false;
+    }
+    PARTITION_MNG_TAG_PRINTF("[benchmarkFlash]>> start, %u reads of 4 bytes", PM_BENCHMARK_CALLS);
+    app = _mbr.getMainParams();
+    status_isOK = timeFlashCalls<InternalFlash>(&app, &cost[0]);
+    app = _mbr.getMainRollbackParams();
+    status_isOK = timeFlashCalls<ExternalFlash>(&app, &cost[1]) && status_isOK;
+
+    for (n = 0; n < 2; n++)
+    {
+        PARTITION_MNG_TAG_PRINTF("[benchmarkFlash]\t %s: device %u, handler %u, create + read %u ns/call",
+                                n ? "external" : "internal",
+                                cost[n].device, cost[n].handler, cost[n].create);
+    }
+    if (internal != nullptr)
+    {
+        *internal = cost[0];
+    }
+    if (external != nullptr)
+    {
+        *external = cost[1];
+    }
+    PARTITION_MNG_TAG_PRINTF("[benchmarkFlash]<< finish %s", status_isOK ? "OK" : "FAIL");
+    return status_isOK;
+} // benchmarkFlash
+
+/** @brief start the tag of an image, the CMAC key is derived from the MBR key
+ * (SP 800-108 counter mode: [1] || label || 0x00 || [128]) so the cipher key
+ * isn't used for two purposes
+ * @param header size and version are the first 8 bytes of the message
+*/
+void partition_manager::macBegin(const firmwareHeader_t* header)
 {
     AES128_crypto_t mbr_aes = _mbr.getAes128Params();
-#if (0)
-    PARTITION_MNG_TAG_PRINTF("[aesDecrypt]>> start");
-    PARTITION_MNG_TAG_PRINTF("[aesDecrypt]\t Key");
-    printData(mbr_aes.key, AES128_LENGTH);
-    PARTITION_MNG_TAG_PRINTF("[aesDecrypt]\t Iv");
-    printData(mbr_aes.iv, AES128_LENGTH);
-    PARTITION_MNG_TAG_PRINTF("[aesDecrypt]\t Data length %u", length);
-#endif
-    aes128.setup((const char*)mbr_aes.key, AES::KEY_128, AES::MODE_CBC, (const char*)mbr_aes.iv);
+    static const char label[] = PM_MAC_KDF_LABEL;
+    const uint8_t counter = 0x01;
+    const uint8_t length[3] = {0x00, 0x00, 0x80};
+    char key[AES_CMAC_LENGTH];
+
+    _cmac.setup((const char*)mbr_aes.key, AES::KEY_128);
+    _cmac.update(&counter, 1);
+    _cmac.update(label, sizeof(label) - 1);
+    _cmac.update(length, sizeof(length));
+    _cmac.finish(key);
+    _cmac.setup(key, AES::KEY_128);
+    memset(key, 0, sizeof(key));
+    memset(&mbr_aes, 0, sizeof(AES128_crypto_t));
+
+    _cmac.update(&header->size, sizeof(header->size));
+    _cmac.update(&header->version.u32, sizeof(header->version.u32));
+}
+
+/** @brief encrypt a chunk in-place, any chunk can be processed again:
+ * CBC from its own chain, CTR from its address
+ * @param data chunk
+ * @param length chunk length
+ * @param addr offset of the chunk in the image (CTR)
+ * @param chain in: iv of the chunk, out: iv of the next chunk (CBC)
+*/
+void partition_manager::aesEncrypt(void *data, size_t length, uint32_t addr, uint8_t* chain)
+{
+    if (AES::MODE_CTR == aes128.mode())
+    {
+        aes128.seek(addr);
+        aes128.encrypt(data, length);
+        return;
+    }
+    aes128.setIV((const char*)chain);
+    aes128.encrypt(data, length);
+    if (length >= AES128_LENGTH)
+    {
+        memcpy(chain, (uint8_t*)data + length - AES128_LENGTH, AES128_LENGTH);
+    }
+}
+
+/** @brief decrypt a chunk in-place, see aesEncrypt
+ * @param data chunk
+ * @param length chunk length
+ * @param addr offset of the chunk in the image (CTR)
+ * @param chain in: iv of the chunk, out: iv of the next chunk (CBC)
+*/
+void partition_manager::aesDecrypt(void *data, size_t length, uint32_t addr, uint8_t* chain)
+{
+    uint8_t next[AES128_LENGTH];
+
+    if (AES::MODE_CTR == aes128.mode())
+    {
+        aes128.seek(addr);
+        aes128.decrypt(data, length);
+        return;
+    }
+    if (length >= AES128_LENGTH)
+    {
+        /* The last cipher block is overwritten by the decryption */
+        memcpy(next, (uint8_t*)data + length - AES128_LENGTH, AES128_LENGTH);
+    }
+    aes128.setIV((const char*)chain);
     aes128.decrypt(data, length);
-    aes128.clear();
-    // PARTITION_MNG_TAG_PRINTF("[aesDecrypt]>> finish");
+    if (length >= AES128_LENGTH)
+    {
+        memcpy(chain, next, AES128_LENGTH);
+    }
 }
 
-std::string partition_manager::readableSize(float bytes) {
-    char buff[10];
-    std::string var;
+size_str_t partition_manager::readableSize(float bytes) {
+    size_str_t var;
     if (bytes < 1024)
     {
-        snprintf(buff, 10, "%u", (uint32_t)bytes);
-        var = std::string(buff) + " B";
+        snprintf(var.str, sizeof(var.str), "%u B", (uint32_t)bytes);
         return var;
     }
     const char* const units[] = {" KiB", " MiB", " GiB", " TiB", "PiB"};
@@ -1181,7 +3729,6 @@ std::string partition_manager::readableSize(float bytes) {
         bytes = bytes / 1024;
         i++;
     } while (bytes >= 1024);
-    snprintf(buff, 10, "%u.%02u", (uint32_t)bytes, (uint32_t)(bytes*100)%100);
-    var = std::string(buff) + units[i];
+    snprintf(var.str, sizeof(var.str), "%u.%02u%s", (uint32_t)bytes, (uint32_t)(bytes*100)%100, units[i]);
     return var;
 } // readableSize
\ No newline at end of file
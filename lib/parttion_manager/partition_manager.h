@@ -21,10 +21,15 @@
 /* Includes ------------------------------------------------------------------*/
 #include "mbed.h"
 #include "AES.h"
-#include <string>
+#include "AES_CMAC.h"
 #include "FlashIAPBlockDevice.h"
 #include "FlashSPIBlockDevice.h"
 #include "mbr.h"
+#include "block_prefetcher.h"
+#include "delta_patch.h"
+#include "lzss.h"
+#include "util_crc32.h"
+#include "scratch_arena.h"
 #include "console_dbg.h"
 
 /* Exported macro ------------------------------------------------------------*/
@@ -34,6 +39,196 @@
 /* Private defines -----------------------------------------------------------*/
 #define PM_VERIFY_DATA_BY_CRC32 1
 
+/** Read the des block before writing it.
+ *  Identical block: erase and program are skipped
+ *  Blank block: erase is skipped
+ */
+#ifndef PM_DIFFERENTIAL_WRITE
+#define PM_DIFFERENTIAL_WRITE 1
+#endif
+
+/** Stack buffer used to compare the des block */
+#ifndef PM_DIFFERENTIAL_CHUNK_SIZE
+#define PM_DIFFERENTIAL_CHUNK_SIZE 128
+#endif
+
+/** Number of blocks copied between two journal checkpoints.
+ *  An interrupted upgrade, restore or backup resumes from the last checkpoint.
+ *  Each checkpoint is one MBR record, 15 fit in a params page: at 32 a 256K
+ *  upgrade stores about 5 records and doesn't wrap the params ring. A resume
+ *  needs power for one interval (32 erases, about 3 s) to make progress.
+ */
+#ifndef PM_JOURNAL_INTERVAL_BLOCKS
+#define PM_JOURNAL_INTERVAL_BLOCKS 32
+#endif
+
+/** Skip the CRC of main/boot when the partition wasn't written since its
+ *  last full verify, the header and the vector table are still checked.
+ *  0: every boot verifies the CRC of the whole image, for builds that must
+ *  not boot an image modified in place
+ */
+#ifndef PM_VERIFY_CACHE_ENABLE
+#define PM_VERIFY_CACHE_ENABLE 1
+#endif
+
+/** Number of boots by the fast path before a full verify, so a flipped bit
+ *  outside the sampled chunks is found within this many boots, up to 15.
+ *  0: full verify only after a write or invalidateVerifyCache().
+ *  The boots left are counted in PM_FAST_BOOTS_REG, a fast boot writes no
+ *  MBR record. A power-on reset clears the register: the first boot after
+ *  it runs a full verify.
+ */
+#ifndef PM_VERIFY_FULL_INTERVAL
+#define PM_VERIFY_FULL_INTERVAL 0
+#endif
+
+/** Register kept across a system reset, a nibble per internal partition.
+ *  GPREGRET2 of the nRF52, the host build points it at a variable.
+ */
+#ifndef PM_FAST_BOOTS_REG
+#define PM_FAST_BOOTS_REG (NRF_POWER->GPREGRET2)
+#endif
+
+/** RAM range the initial stack pointer of an application must be in */
+#ifndef PM_RAM_START
+#define PM_RAM_START 0x20000000UL
+#endif
+#ifndef PM_RAM_END
+#define PM_RAM_END 0x20040000UL
+#endif
+
+/** Internal flash read through the memory map, the host build points it at
+ *  the simulated device
+ */
+#ifndef PM_INTERNAL_PTR
+#define PM_INTERNAL_PTR(addr) ((const uint8_t*)(uintptr_t)(addr))
+#endif
+
+/** Encryption of the images written by backupApp to an encrypted partition.
+ *  MasterBootRecord::DATA_ENC_CTR: any 4K block decrypts from its address
+ *  MasterBootRecord::DATA_ENC: CBC, a block needs the cipher block before it
+ *  The mode is stored in the des header, restore reads it from there.
+ */
+#ifndef PM_BACKUP_ENC
+#define PM_BACKUP_ENC MasterBootRecord::DATA_ENC_CTR
+#endif
+
+/** backupMain, backupBoot and backupMain2ImageDownload store the image LZSS
+ *  compressed (packApp, DATA_COMPRESSED flag) instead of backupApp.
+ *  The image is compressed twice: once to size it, once to write it.
+ *  A compressed rollback can't be the base of a delta image.
+ */
+#ifndef PM_BACKUP_COMPRESS
+#define PM_BACKUP_COMPRESS 0
+#endif
+
+/** backupApp erases the des range up front, F_SPIBLOCK_ERASE_CHUNK_SIZE at
+ *  a time (SPIFBlockDevice uses its 32K/64K block erases), then programs
+ *  the blocks without reading them. Ranges already blank are read, not
+ *  erased. Skipped when
+ *  des holds the same image (size, version), the differential write keeps
+ *  its blocks.
+ */
+#ifndef PM_BACKUP_PRE_ERASE
+#define PM_BACKUP_PRE_ERASE 1
+#endif
+
+/** Window and match length bits of the backup compression, the encoder
+ *  needs LZSS_ENCODER_WORK_SIZE(PM_LZSS_WINDOW_BITS) bytes of RAM
+ */
+#ifndef PM_LZSS_WINDOW_BITS
+#define PM_LZSS_WINDOW_BITS 10
+#endif
+#ifndef PM_LZSS_LOOKAHEAD_BITS
+#define PM_LZSS_LOOKAHEAD_BITS 4
+#endif
+
+/** backupMain/backupBoot store a chunk table (manifest) of the image in the
+ *  erase block after the rollback copy and its tag: the CRC32 of every
+ *  PM_MANIFEST_CHUNK_SIZE bytes of the internal image. Its root is in the MBR.
+ *  A bad page of main/boot is found and rewritten alone from the rollback.
+ *  The table is skipped when the rollback partition has no block left.
+ */
+#ifndef PM_MANIFEST_ENABLE
+#define PM_MANIFEST_ENABLE 1
+#endif
+
+/** Chunk of the table, an internal page so a bad chunk is one page to rewrite */
+#ifndef PM_MANIFEST_CHUNK_SIZE
+#define PM_MANIFEST_CHUNK_SIZE DEVICE_PAGE_ERASE_SIZE
+#endif
+
+/** Chunks checked at random by the fast path of verifyMain/verifyBoot, a bad
+ *  one falls back to the CRC of the whole image. 0: no sampling
+ */
+#ifndef PM_MANIFEST_SAMPLE_CHUNKS
+#define PM_MANIFEST_SAMPLE_CHUNKS 4
+#endif
+
+/** Scratch RAM of a loaded table, the table and its header fit in one
+ *  erase block of the rollback partition
+ */
+#define PM_MANIFEST_TABLE_SIZE EX_FLASH_PAGE_ERASE_SIZE
+
+/** "MFT1" */
+#define PM_MANIFEST_MAGIC 0x3154464DUL
+
+/** verifyMainChunks/verifyBootChunks: the image has no chunk table */
+#define PM_MANIFEST_NONE 0xFFFFFFFFUL
+
+/** Reject an image without an AES-CMAC tag (upgrade and restore).
+ *  0: an image with common.auth == AUTH_NONE is checked by CRC32 only
+ */
+#ifndef PM_IMAGE_AUTH_REQUIRED
+#define PM_IMAGE_AUTH_REQUIRED 0
+#endif
+
+/** backupApp stores an AES-CMAC tag after the image in the des partition */
+#ifndef PM_BACKUP_AUTH
+#define PM_BACKUP_AUTH 1
+#endif
+
+/** Label of the CMAC key derivation (SP 800-108 counter mode) */
+#ifndef PM_MAC_KDF_LABEL
+#define PM_MAC_KDF_LABEL "IMAGE-CMAC"
+#endif
+
+/** Blocks of DEVICE_PAGE_ERASE_SIZE processed by benchmarkCrypto per engine */
+#ifndef PM_BENCHMARK_BLOCKS
+#define PM_BENCHMARK_BLOCKS 16
+#endif
+
+/** Reads of 4 bytes timed by benchmarkFlash per path */
+#ifndef PM_BENCHMARK_CALLS
+#define PM_BENCHMARK_CALLS 10000
+#endif
+
+/** Value of an erased flash byte, internal and external */
+#define PM_ERASED_VALUE 0xFF
+
+/** FlashHandler access out of the partition */
+#define PM_FLASH_ERROR (-1)
+
+/** Chunk table block: manifest_header_t, then count CRC32, little-endian.
+ *  The root in the MBR is the CRC32 of the header and the table.
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;      /* PM_MANIFEST_MAGIC */
+    uint32_t checksum;   /* fw_header.checksum of the image described */
+    uint32_t size;       /* image size */
+    uint32_t chunk_size; /* PM_MANIFEST_CHUNK_SIZE */
+    uint32_t count;      /* number of chunks, the last one may be short */
+} manifest_header_t;
+
+/** Cost of a 4-byte read per call, ns, measured by benchmarkFlash */
+typedef struct
+{
+    uint32_t device;   /* the device of the memory kind */
+    uint32_t handler;  /* a FlashHandler of the partition */
+    uint32_t create;   /* a FlashHandler made for the read */
+} flash_call_cost_t;
+
 class partition_manager
 {
 public:
@@ -41,17 +236,25 @@ public:
     ~partition_manager();
     void begin(void);
     void end(void);
+    void beginTransaction(void);
+    bool endTransaction(void);
+    uint32_t mbrWriteCount(void);
     void printPartition(void);
     bool verifyMain(void);
     bool verifyBoot(void);
     bool verifyMainRollback(void);
     bool verifyBootRollback(void);
     bool verifyImageDownload(void);
+    void invalidateVerifyCache(void);
+    uint32_t verifyMainChunks(void);
+    uint32_t verifyBootChunks(void);
     uint8_t appUpgrade(void);
     bool upgradeMain(void);
     bool upgradeBoot(void);
     bool restoreMain(void);
     bool restoreBoot(void);
+    bool repairMain(void);
+    bool repairBoot(void);
     bool backupMain(void);
     bool backupBoot(void);
     bool backupMain2ImageDownload(void);
@@ -64,99 +267,139 @@ public:
     bool setBootStatusToMBR(MasterBootRecord::app_status_t status);
     uint32_t mainAddress(void);
     uint32_t bootAddress(void);
+    void benchmarkCrypto(void);
+    bool benchmarkFlash(flash_call_cost_t* internal = nullptr, flash_call_cost_t* external = nullptr);
 
 private:
     static SPIFBlockDevice* _spiDevice;
     MasterBootRecord _mbr;
     AES aes128;
+    AESCMAC _cmac;
+    BlockPrefetcher _prefetcher;
     bool _init_isOK;
-    std::string readableSize(float bytes);
-    bool programApp(app_info_t* des, app_info_t* src);
-    bool backupApp(app_info_t* des, app_info_t* src);
-    bool cloneApp(app_info_t* des, app_info_t* src);
+
+    typedef struct
+    {
+        uint32_t skipped;    /* des block already held the data */
+        uint32_t erased;
+        uint32_t programmed;
+    } write_stats_t;
+    write_stats_t _write_stats;
+    typedef enum
+    {
+        WRITE_OK = 0,       /* des block erased if needed and programmed */
+        WRITE_SKIPPED,      /* des block already held the data */
+        WRITE_ERROR         /* erase or program failed */
+    } write_status_t;
+    size_str_t readableSize(float bytes);
+    bool programApp(app_info_t* des, app_info_t* src, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool patchApp(app_info_t* des, app_info_t* src, app_info_t* base, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool unpackApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool installApp(app_info_t* des, app_info_t* src, app_info_t* base, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool storeApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool backupApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool packApp(app_info_t* des, app_info_t* src, uint32_t* des_size, uint32_t* des_crc, MasterBootRecord::journal_op_t op);
+    bool cloneApp(app_info_t* des, app_info_t* src, uint32_t* des_crc);
     bool verify(app_info_t* app);
+    bool verifyCached(app_info_t* app, verify_entry_t* entry, app_info_t* store, uint32_t root, uint8_t fast_shift);
+    bool verifyVectorTable(app_info_t* app);
     uint32_t CRC32(app_info_t* app);
-    void aesEncrypt(void *data, size_t length);
-    void aesDecrypt(void *data, size_t length);
+    bool journalBegin(MasterBootRecord::journal_op_t op, app_info_t* src, uint32_t block_size, crc32_ctx_t* src_ctx, crc32_ctx_t* des_ctx, uint32_t* start_addr);
+    bool journalCheckpoint(MasterBootRecord::journal_op_t op, uint32_t block, crc32_ctx_t* src_ctx, crc32_ctx_t* des_ctx);
+    void journalEnd(MasterBootRecord::journal_op_t op, bool status_isOK);
+    void journalInvalidate(MasterBootRecord::journal_op_t op);
+    static bool isEncrypted(uint8_t enc);
+    void cipherBegin(uint8_t enc, const uint8_t* iv);
+    void cipherEnd(void);
+    void macBegin(const firmwareHeader_t* header);
+    void aesEncrypt(void *data, size_t length, uint32_t addr, uint8_t* chain);
+    void aesDecrypt(void *data, size_t length, uint32_t addr, uint8_t* chain);
 
-    class FlashHandler
+    /** Memory kinds of the partitions, the devices are in static storage.
+     *  addr is the address in the memory.
+     */
+    class InternalFlash
     {
-    private:
-        FlashSPIBlockDevice* spiFlash;
-        FlashIAPBlockDevice* iapFlash;
-        bool _external;
     public:
-        FlashHandler(app_info_t* app)
-        {
-            if (app->fw_header.type.mem == MasterBootRecord::MEMORY_EXTERNAL)
-            {
-                _external = true;
-                spiFlash = new FlashSPIBlockDevice(_spiDevice, app->startup_addr, app->max_size);
-                spiFlash->init();
-            }
-            else
-            {
-                _external = false;
-                iapFlash = new FlashIAPBlockDevice(app->startup_addr, app->max_size);
-                iapFlash->init();
-            }
-        }
+        static int read(void *buffer, uint32_t addr, uint32_t size) { return _iapDevice.read(buffer, addr, size); }
+        static int program(const void *buffer, uint32_t addr, uint32_t size) { return _iapDevice.program(buffer, addr, size); }
+        static int erase(uint32_t addr, uint32_t size) { return _iapDevice.erase(addr, size); }
+        static uint32_t get_erase_size(void) { return _iapDevice.get_erase_size(); }
+        static uint32_t eraseStep(uint32_t, uint32_t) { return _iapDevice.get_erase_size(); }
+    };
+
+    class ExternalFlash
+    {
+    public:
+        static int read(void *buffer, uint32_t addr, uint32_t size) { return _spiDevice->read(buffer, addr, size); }
+        static int program(const void *buffer, uint32_t addr, uint32_t size) { return _spiDevice->program(buffer, addr, size); }
+        static int erase(uint32_t addr, uint32_t size) { return _spiDevice->erase(addr, size); }
+        static uint32_t get_erase_size(void) { return _spiDevice->get_erase_size(); }
+        static uint32_t eraseStep(uint32_t addr, uint32_t size) { return FlashSPIBlockDevice::eraseStep(_spiDevice, addr, size); }
+    };
 
-        ~FlashHandler(){
-            if (_external)
-            {
-                delete spiFlash;
-            }
-            else
-            {
-                delete iapFlash;
-            }
+    /** Partition of an application on a memory kind, addr is the offset in
+     *  the partition. The calls go straight to the device of Flash.
+     */
+    template <class Flash>
+    class FlashHandler
+    {
+    private:
+        uint32_t _base;
+        uint32_t _size;
+        bool is_valid(uint32_t addr, uint32_t size) const {
+            return (addr + size) <= _size && (addr + size) >= addr;
         }
+    public:
+        FlashHandler(const app_info_t* app) : _base(app->startup_addr), _size(app->max_size) {}
 
         int read(void *buffer, uint32_t addr, uint32_t size) {
-            if (_external)
-            {
-                return spiFlash->read(buffer, addr, size);
-            }
-            else
-            {
-                return iapFlash->read(buffer, addr, size);
-            }
+            return is_valid(addr, size) ? Flash::read(buffer, _base + addr, size) : PM_FLASH_ERROR;
         }
 
         int program(const void *buffer, uint32_t addr, uint32_t size) {
-            if (_external)
-            {
-                return spiFlash->program(buffer, addr, size);
-            }
-            else
-            {
-                return iapFlash->program(buffer, addr, size);
-            }
+            return is_valid(addr, size) ? Flash::program(buffer, _base + addr, size) : PM_FLASH_ERROR;
         }
 
         int erase(uint32_t addr, uint32_t size) {
-            if (_external)
-            {
-                return spiFlash->erase(addr, size);
-            }
-            else
-            {
-                return iapFlash->erase(addr, size);
-            }
+            return is_valid(addr, size) ? Flash::erase(_base + addr, size) : PM_FLASH_ERROR;
         }
 
         uint32_t get_erase_size(void) const {
-            if (_external)
-            {
-                return spiFlash->get_erase_size();
-            }
-            else
-            {
-                return iapFlash->get_erase_size();
-            }
+            return Flash::get_erase_size();
+        }
+
+        /* Size of the largest erase at addr within size bytes */
+        uint32_t eraseStep(uint32_t addr, uint32_t size) const {
+            return Flash::eraseStep(_base + addr, size);
         }
     };
+    typedef FlashHandler<InternalFlash> InternalHandler;
+    typedef FlashHandler<ExternalFlash> ExternalHandler;
+    /* The whole internal flash */
+    static FlashIAPBlockDevice _iapDevice;
+
+    bool authenticate(ExternalHandler* flash, app_info_t* app, uint8_t* buffer, uint32_t block_size);
+    /* Chunk table of the image copied to a rollback partition */
+    static uint32_t manifestAddr(const app_info_t* store, uint32_t stored_size, uint32_t block_size);
+    void manifestClear(MasterBootRecord::journal_op_t op);
+    void manifestWrite(ExternalHandler* flash, app_info_t* store, uint32_t stored_size, app_info_t* src, uint8_t* buffer, uint32_t block_size, MasterBootRecord::journal_op_t op);
+    bool manifestLoad(app_info_t* app, app_info_t* store, uint32_t root, uint32_t* table, uint32_t capacity, uint32_t* count);
+    bool manifestSample(app_info_t* app, app_info_t* store, uint32_t root);
+    uint32_t verifyChunks(app_info_t* app, app_info_t* store, uint32_t root);
+    bool repairApp(app_info_t* des, app_info_t* src, uint32_t root);
+    /* Base image of patchApp */
+    ExternalHandler* _deltaBase;
+    bool _deltaBaseDecrypt;
+    int readBase(void *buffer, uint32_t addr, uint32_t size);
+    void patchEnd(bool cipher_open);
+
+    template <class Flash>
+    write_status_t writeBlock(FlashHandler<Flash>* flash, const uint8_t* data, uint32_t addr, uint32_t size, uint32_t block_size, bool erased = false);
+    template <class Flash>
+    bool preErase(FlashHandler<Flash>* flash, uint32_t addr, uint32_t size);
+    template <class Flash>
+    bool timeFlashCalls(app_info_t* app, flash_call_cost_t* cost);
 };
 
 #endif /* __PARTITON_MANAGER_H */
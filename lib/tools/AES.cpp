@@ -16,74 +16,147 @@
 
 #include "AES.h"
 
+/* Forward S-box, F is applied to every entry */
+#define AES_FSB(F) \
+    F(0x63) F(0x7C) F(0x77) F(0x7B) F(0xF2) F(0x6B) F(0x6F) F(0xC5) \
+    F(0x30) F(0x01) F(0x67) F(0x2B) F(0xFE) F(0xD7) F(0xAB) F(0x76) \
+    F(0xCA) F(0x82) F(0xC9) F(0x7D) F(0xFA) F(0x59) F(0x47) F(0xF0) \
+    F(0xAD) F(0xD4) F(0xA2) F(0xAF) F(0x9C) F(0xA4) F(0x72) F(0xC0) \
+    F(0xB7) F(0xFD) F(0x93) F(0x26) F(0x36) F(0x3F) F(0xF7) F(0xCC) \
+    F(0x34) F(0xA5) F(0xE5) F(0xF1) F(0x71) F(0xD8) F(0x31) F(0x15) \
+    F(0x04) F(0xC7) F(0x23) F(0xC3) F(0x18) F(0x96) F(0x05) F(0x9A) \
+    F(0x07) F(0x12) F(0x80) F(0xE2) F(0xEB) F(0x27) F(0xB2) F(0x75) \
+    F(0x09) F(0x83) F(0x2C) F(0x1A) F(0x1B) F(0x6E) F(0x5A) F(0xA0) \
+    F(0x52) F(0x3B) F(0xD6) F(0xB3) F(0x29) F(0xE3) F(0x2F) F(0x84) \
+    F(0x53) F(0xD1) F(0x00) F(0xED) F(0x20) F(0xFC) F(0xB1) F(0x5B) \
+    F(0x6A) F(0xCB) F(0xBE) F(0x39) F(0x4A) F(0x4C) F(0x58) F(0xCF) \
+    F(0xD0) F(0xEF) F(0xAA) F(0xFB) F(0x43) F(0x4D) F(0x33) F(0x85) \
+    F(0x45) F(0xF9) F(0x02) F(0x7F) F(0x50) F(0x3C) F(0x9F) F(0xA8) \
+    F(0x51) F(0xA3) F(0x40) F(0x8F) F(0x92) F(0x9D) F(0x38) F(0xF5) \
+    F(0xBC) F(0xB6) F(0xDA) F(0x21) F(0x10) F(0xFF) F(0xF3) F(0xD2) \
+    F(0xCD) F(0x0C) F(0x13) F(0xEC) F(0x5F) F(0x97) F(0x44) F(0x17) \
+    F(0xC4) F(0xA7) F(0x7E) F(0x3D) F(0x64) F(0x5D) F(0x19) F(0x73) \
+    F(0x60) F(0x81) F(0x4F) F(0xDC) F(0x22) F(0x2A) F(0x90) F(0x88) \
+    F(0x46) F(0xEE) F(0xB8) F(0x14) F(0xDE) F(0x5E) F(0x0B) F(0xDB) \
+    F(0xE0) F(0x32) F(0x3A) F(0x0A) F(0x49) F(0x06) F(0x24) F(0x5C) \
+    F(0xC2) F(0xD3) F(0xAC) F(0x62) F(0x91) F(0x95) F(0xE4) F(0x79) \
+    F(0xE7) F(0xC8) F(0x37) F(0x6D) F(0x8D) F(0xD5) F(0x4E) F(0xA9) \
+    F(0x6C) F(0x56) F(0xF4) F(0xEA) F(0x65) F(0x7A) F(0xAE) F(0x08) \
+    F(0xBA) F(0x78) F(0x25) F(0x2E) F(0x1C) F(0xA6) F(0xB4) F(0xC6) \
+    F(0xE8) F(0xDD) F(0x74) F(0x1F) F(0x4B) F(0xBD) F(0x8B) F(0x8A) \
+    F(0x70) F(0x3E) F(0xB5) F(0x66) F(0x48) F(0x03) F(0xF6) F(0x0E) \
+    F(0x61) F(0x35) F(0x57) F(0xB9) F(0x86) F(0xC1) F(0x1D) F(0x9E) \
+    F(0xE1) F(0xF8) F(0x98) F(0x11) F(0x69) F(0xD9) F(0x8E) F(0x94) \
+    F(0x9B) F(0x1E) F(0x87) F(0xE9) F(0xCE) F(0x55) F(0x28) F(0xDF) \
+    F(0x8C) F(0xA1) F(0x89) F(0x0D) F(0xBF) F(0xE6) F(0x42) F(0x68) \
+    F(0x41) F(0x99) F(0x2D) F(0x0F) F(0xB0) F(0x54) F(0xBB) F(0x16)
+
+/* Inverse S-box, F is applied to every entry */
+#define AES_RSB(F) \
+    F(0x52) F(0x09) F(0x6A) F(0xD5) F(0x30) F(0x36) F(0xA5) F(0x38) \
+    F(0xBF) F(0x40) F(0xA3) F(0x9E) F(0x81) F(0xF3) F(0xD7) F(0xFB) \
+    F(0x7C) F(0xE3) F(0x39) F(0x82) F(0x9B) F(0x2F) F(0xFF) F(0x87) \
+    F(0x34) F(0x8E) F(0x43) F(0x44) F(0xC4) F(0xDE) F(0xE9) F(0xCB) \
+    F(0x54) F(0x7B) F(0x94) F(0x32) F(0xA6) F(0xC2) F(0x23) F(0x3D) \
+    F(0xEE) F(0x4C) F(0x95) F(0x0B) F(0x42) F(0xFA) F(0xC3) F(0x4E) \
+    F(0x08) F(0x2E) F(0xA1) F(0x66) F(0x28) F(0xD9) F(0x24) F(0xB2) \
+    F(0x76) F(0x5B) F(0xA2) F(0x49) F(0x6D) F(0x8B) F(0xD1) F(0x25) \
+    F(0x72) F(0xF8) F(0xF6) F(0x64) F(0x86) F(0x68) F(0x98) F(0x16) \
+    F(0xD4) F(0xA4) F(0x5C) F(0xCC) F(0x5D) F(0x65) F(0xB6) F(0x92) \
+    F(0x6C) F(0x70) F(0x48) F(0x50) F(0xFD) F(0xED) F(0xB9) F(0xDA) \
+    F(0x5E) F(0x15) F(0x46) F(0x57) F(0xA7) F(0x8D) F(0x9D) F(0x84) \
+    F(0x90) F(0xD8) F(0xAB) F(0x00) F(0x8C) F(0xBC) F(0xD3) F(0x0A) \
+    F(0xF7) F(0xE4) F(0x58) F(0x05) F(0xB8) F(0xB3) F(0x45) F(0x06) \
+    F(0xD0) F(0x2C) F(0x1E) F(0x8F) F(0xCA) F(0x3F) F(0x0F) F(0x02) \
+    F(0xC1) F(0xAF) F(0xBD) F(0x03) F(0x01) F(0x13) F(0x8A) F(0x6B) \
+    F(0x3A) F(0x91) F(0x11) F(0x41) F(0x4F) F(0x67) F(0xDC) F(0xEA) \
+    F(0x97) F(0xF2) F(0xCF) F(0xCE) F(0xF0) F(0xB4) F(0xE6) F(0x73) \
+    F(0x96) F(0xAC) F(0x74) F(0x22) F(0xE7) F(0xAD) F(0x35) F(0x85) \
+    F(0xE2) F(0xF9) F(0x37) F(0xE8) F(0x1C) F(0x75) F(0xDF) F(0x6E) \
+    F(0x47) F(0xF1) F(0x1A) F(0x71) F(0x1D) F(0x29) F(0xC5) F(0x89) \
+    F(0x6F) F(0xB7) F(0x62) F(0x0E) F(0xAA) F(0x18) F(0xBE) F(0x1B) \
+    F(0xFC) F(0x56) F(0x3E) F(0x4B) F(0xC6) F(0xD2) F(0x79) F(0x20) \
+    F(0x9A) F(0xDB) F(0xC0) F(0xFE) F(0x78) F(0xCD) F(0x5A) F(0xF4) \
+    F(0x1F) F(0xDD) F(0xA8) F(0x33) F(0x88) F(0x07) F(0xC7) F(0x31) \
+    F(0xB1) F(0x12) F(0x10) F(0x59) F(0x27) F(0x80) F(0xEC) F(0x5F) \
+    F(0x60) F(0x51) F(0x7F) F(0xA9) F(0x19) F(0xB5) F(0x4A) F(0x0D) \
+    F(0x2D) F(0xE5) F(0x7A) F(0x9F) F(0x93) F(0xC9) F(0x9C) F(0xEF) \
+    F(0xA0) F(0xE0) F(0x3B) F(0x4D) F(0xAE) F(0x2A) F(0xF5) F(0xB0) \
+    F(0xC8) F(0xEB) F(0xBB) F(0x3C) F(0x83) F(0x53) F(0x99) F(0x61) \
+    F(0x17) F(0x2B) F(0x04) F(0x7E) F(0xBA) F(0x77) F(0xD6) F(0x26) \
+    F(0xE1) F(0x69) F(0x14) F(0x63) F(0x55) F(0x21) F(0x0C) F(0x7D)
+
+#define AES_BYTE(s) (char)(s),
+
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+/* Multiplication in GF(2^8) by constants, evaluated by the compiler */
+#define AES_XT(x) (((((x) << 1) ^ (((x) & 0x80) ? 0x1B : 0x00))) & 0xFF)
+#define AES_M2(x) AES_XT(x)
+#define AES_M3(x) (AES_XT(x) ^ (x))
+#define AES_M4(x) AES_XT(AES_XT(x))
+#define AES_M8(x) AES_XT(AES_M4(x))
+#define AES_M9(x) (AES_M8(x) ^ (x))
+#define AES_M11(x) (AES_M8(x) ^ AES_XT(x) ^ (x))
+#define AES_M13(x) (AES_M8(x) ^ AES_M4(x) ^ (x))
+#define AES_M14(x) (AES_M8(x) ^ AES_M4(x) ^ AES_XT(x))
+#define AES_WORD(b0, b1, b2, b3) (((uint32_t)(b0) << 24) | ((uint32_t)(b1) << 16) | ((uint32_t)(b2) << 8) | (uint32_t)(b3))
+
+/* Round tables, SubBytes and MixColumns of one byte of a column */
+#define AES_TE0_ENTRY(s) AES_WORD(AES_M2(s), (s), (s), AES_M3(s)),
+#define AES_TD0_ENTRY(s) AES_WORD(AES_M14(s), AES_M9(s), AES_M13(s), AES_M11(s)),
+static const uint32_t s_Te0[256] = {
+    AES_FSB(AES_TE0_ENTRY)
+};
+static const uint32_t s_Td0[256] = {
+    AES_RSB(AES_TD0_ENTRY)
+};
+
+#if (AES_IMPLEMENTATION == AES_IMPL_TTABLE_FULL)
+#define AES_TE1_ENTRY(s) AES_WORD(AES_M3(s), AES_M2(s), (s), (s)),
+#define AES_TE2_ENTRY(s) AES_WORD((s), AES_M3(s), AES_M2(s), (s)),
+#define AES_TE3_ENTRY(s) AES_WORD((s), (s), AES_M3(s), AES_M2(s)),
+#define AES_TD1_ENTRY(s) AES_WORD(AES_M11(s), AES_M14(s), AES_M9(s), AES_M13(s)),
+#define AES_TD2_ENTRY(s) AES_WORD(AES_M13(s), AES_M11(s), AES_M14(s), AES_M9(s)),
+#define AES_TD3_ENTRY(s) AES_WORD(AES_M9(s), AES_M13(s), AES_M11(s), AES_M14(s)),
+static const uint32_t s_Te1[256] = { AES_FSB(AES_TE1_ENTRY) };
+static const uint32_t s_Te2[256] = { AES_FSB(AES_TE2_ENTRY) };
+static const uint32_t s_Te3[256] = { AES_FSB(AES_TE3_ENTRY) };
+static const uint32_t s_Td1[256] = { AES_RSB(AES_TD1_ENTRY) };
+static const uint32_t s_Td2[256] = { AES_RSB(AES_TD2_ENTRY) };
+static const uint32_t s_Td3[256] = { AES_RSB(AES_TD3_ENTRY) };
+#define AES_TE0(x) s_Te0[(x) & 0xFF]
+#define AES_TE1(x) s_Te1[(x) & 0xFF]
+#define AES_TE2(x) s_Te2[(x) & 0xFF]
+#define AES_TE3(x) s_Te3[(x) & 0xFF]
+#define AES_TD0(x) s_Td0[(x) & 0xFF]
+#define AES_TD1(x) s_Td1[(x) & 0xFF]
+#define AES_TD2(x) s_Td2[(x) & 0xFF]
+#define AES_TD3(x) s_Td3[(x) & 0xFF]
+#else
+/* The other tables are rotations of the first one */
+#define AES_ROR(w, n) (((w) >> (n)) | ((w) << (32 - (n))))
+#define AES_TE0(x) s_Te0[(x) & 0xFF]
+#define AES_TE1(x) AES_ROR(s_Te0[(x) & 0xFF], 8)
+#define AES_TE2(x) AES_ROR(s_Te0[(x) & 0xFF], 16)
+#define AES_TE3(x) AES_ROR(s_Te0[(x) & 0xFF], 24)
+#define AES_TD0(x) s_Td0[(x) & 0xFF]
+#define AES_TD1(x) AES_ROR(s_Td0[(x) & 0xFF], 8)
+#define AES_TD2(x) AES_ROR(s_Td0[(x) & 0xFF], 16)
+#define AES_TD3(x) AES_ROR(s_Td0[(x) & 0xFF], 24)
+#endif
+
+#define AES_GETU32(p) AES_WORD((uint8_t)(p)[0], (uint8_t)(p)[1], (uint8_t)(p)[2], (uint8_t)(p)[3])
+#define AES_PUTU32(p, w) { (p)[0] = (char)((w) >> 24); (p)[1] = (char)((w) >> 16); (p)[2] = (char)((w) >> 8); (p)[3] = (char)(w); }
+#define AES_SBOX(x) ((uint32_t)(uint8_t)m_Sbox[(x) & 0xFF])
+#define AES_INV_SBOX(x) ((uint32_t)(uint8_t)m_InvSbox[(x) & 0xFF])
+#endif
+
 const char AES::m_Sbox[256] = {
-    0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5,
-    0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
-    0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0,
-    0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
-    0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC,
-    0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
-    0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A,
-    0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
-    0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0,
-    0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
-    0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B,
-    0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
-    0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85,
-    0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
-    0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5,
-    0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
-    0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17,
-    0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
-    0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88,
-    0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
-    0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C,
-    0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
-    0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9,
-    0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
-    0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6,
-    0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
-    0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E,
-    0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
-    0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94,
-    0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
-    0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68,
-    0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16
+    AES_FSB(AES_BYTE)
 };
 
 const char AES::m_InvSbox[256] = {
-    0x52, 0x09, 0x6A, 0xD5, 0x30, 0x36, 0xA5, 0x38,
-    0xBF, 0x40, 0xA3, 0x9E, 0x81, 0xF3, 0xD7, 0xFB,
-    0x7C, 0xE3, 0x39, 0x82, 0x9B, 0x2F, 0xFF, 0x87,
-    0x34, 0x8E, 0x43, 0x44, 0xC4, 0xDE, 0xE9, 0xCB,
-    0x54, 0x7B, 0x94, 0x32, 0xA6, 0xC2, 0x23, 0x3D,
-    0xEE, 0x4C, 0x95, 0x0B, 0x42, 0xFA, 0xC3, 0x4E,
-    0x08, 0x2E, 0xA1, 0x66, 0x28, 0xD9, 0x24, 0xB2,
-    0x76, 0x5B, 0xA2, 0x49, 0x6D, 0x8B, 0xD1, 0x25,
-    0x72, 0xF8, 0xF6, 0x64, 0x86, 0x68, 0x98, 0x16,
-    0xD4, 0xA4, 0x5C, 0xCC, 0x5D, 0x65, 0xB6, 0x92,
-    0x6C, 0x70, 0x48, 0x50, 0xFD, 0xED, 0xB9, 0xDA,
-    0x5E, 0x15, 0x46, 0x57, 0xA7, 0x8D, 0x9D, 0x84,
-    0x90, 0xD8, 0xAB, 0x00, 0x8C, 0xBC, 0xD3, 0x0A,
-    0xF7, 0xE4, 0x58, 0x05, 0xB8, 0xB3, 0x45, 0x06,
-    0xD0, 0x2C, 0x1E, 0x8F, 0xCA, 0x3F, 0x0F, 0x02,
-    0xC1, 0xAF, 0xBD, 0x03, 0x01, 0x13, 0x8A, 0x6B,
-    0x3A, 0x91, 0x11, 0x41, 0x4F, 0x67, 0xDC, 0xEA,
-    0x97, 0xF2, 0xCF, 0xCE, 0xF0, 0xB4, 0xE6, 0x73,
-    0x96, 0xAC, 0x74, 0x22, 0xE7, 0xAD, 0x35, 0x85,
-    0xE2, 0xF9, 0x37, 0xE8, 0x1C, 0x75, 0xDF, 0x6E,
-    0x47, 0xF1, 0x1A, 0x71, 0x1D, 0x29, 0xC5, 0x89,
-    0x6F, 0xB7, 0x62, 0x0E, 0xAA, 0x18, 0xBE, 0x1B,
-    0xFC, 0x56, 0x3E, 0x4B, 0xC6, 0xD2, 0x79, 0x20,
-    0x9A, 0xDB, 0xC0, 0xFE, 0x78, 0xCD, 0x5A, 0xF4,
-    0x1F, 0xDD, 0xA8, 0x33, 0x88, 0x07, 0xC7, 0x31,
-    0xB1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xEC, 0x5F,
-    0x60, 0x51, 0x7F, 0xA9, 0x19, 0xB5, 0x4A, 0x0D,
-    0x2D, 0xE5, 0x7A, 0x9F, 0x93, 0xC9, 0x9C, 0xEF,
-    0xA0, 0xE0, 0x3B, 0x4D, 0xAE, 0x2A, 0xF5, 0xB0,
-    0xC8, 0xEB, 0xBB, 0x3C, 0x83, 0x53, 0x99, 0x61,
-    0x17, 0x2B, 0x04, 0x7E, 0xBA, 0x77, 0xD6, 0x26,
-    0xE1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0C, 0x7D
+    AES_RSB(AES_BYTE)
 };
 
 const unsigned int AES::m_Rcon[10] = {
@@ -129,6 +202,19 @@ void AES::setup(const char* key, KeySize keySize, CipherMode mode, const char* i
         expandKey(key, keySize);
     }
 
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+    //The peripheral takes the raw AES-128 key
+    memset(m_Ecb.key, 0, 16);
+    if (key != NULL && keySize == KEY_128) {
+        memcpy(m_Ecb.key, key, 16);
+    }
+#endif
+
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+    //Derive the round keys of the equivalent inverse cipher
+    expandDecKey();
+#endif
+
     //Check if the initialization vector pointer is NULL
     if (iv == NULL) {
         //Set a blank initialization vector
@@ -137,6 +223,52 @@ void AES::setup(const char* key, KeySize keySize, CipherMode mode, const char* i
         //Copy the initialization vector to the carry vector
         memcpy(m_CarryVector, iv, 16);
     }
+
+    //Start the CTR keystream at the iv
+    memcpy(m_Counter, m_CarryVector, 16);
+    m_StreamPos = 16;
+}
+
+void AES::seek(uint32_t offset)
+{
+    uint32_t carry = offset >> 4;
+
+    //Counter block = iv + offset / 16, big-endian 128-bit addition
+    for (int i = 15; i >= 0; i--) {
+        carry += (uint8_t)m_CarryVector[i];
+        m_Counter[i] = (char)carry;
+        carry >>= 8;
+    }
+    m_StreamPos = 16;
+
+    //Skip the leading bytes of a partial block
+    if (offset & 0x0F) {
+        char temp[16];
+        memset(temp, 0, sizeof(temp));
+        ctr(temp, temp, offset & 0x0F);
+    }
+}
+
+void AES::ctr(const char* src, char* dest, size_t length)
+{
+    while (length > 0) {
+        //Generate the next keystream block
+        if (m_StreamPos == 16) {
+            memcpy(m_State, m_Counter, 16);
+            encryptBlock();
+            for (int i = 15; i >= 0; i--) {
+                if (++m_Counter[i] != 0)
+                    break;
+            }
+            m_StreamPos = 0;
+        }
+
+        //XOR the data with the keystream
+        while (m_StreamPos < 16 && length > 0) {
+            *dest++ = *src++ ^ m_State[m_StreamPos++];
+            length--;
+        }
+    }
 }
 
 void AES::encrypt(void* data, size_t length)
@@ -150,6 +282,12 @@ void AES::encrypt(const void* src, char* dest, size_t length)
     //Convert the source pointer for byte access
     const char* srcBytes = (const char*)src;
 
+    //CTR is a stream, no padding
+    if (m_CipherMode == MODE_CTR) {
+        ctr(srcBytes, dest, length);
+        return;
+    }
+
     //Check if the length is less than 1 block
     if (length > 0 && length < 16) {
         //Copy the partial source block to the state array
@@ -167,7 +305,7 @@ void AES::encrypt(const void* src, char* dest, size_t length)
         }
 
         //Encrypt the state array
-        aesEncrypt();
+        encryptBlock();
 
         //Perform CBC post-processing if necessary
         if (m_CipherMode == MODE_CBC) {
@@ -196,7 +334,7 @@ void AES::encrypt(const void* src, char* dest, size_t length)
         }
 
         //Encrypt the state array
-        aesEncrypt();
+        encryptBlock();
 
         //Perform CBC post-processing if necessary
         if (m_CipherMode == MODE_CBC) {
@@ -228,7 +366,7 @@ void AES::encrypt(const void* src, char* dest, size_t length)
             }
 
             //Encrypt the state array
-            aesEncrypt();
+            encryptBlock();
             length = 0;
         }
 
@@ -249,6 +387,12 @@ void AES::decrypt(const char* src, void* dest, size_t length)
     //Convert the destination pointer for byte access
     char* destBytes = (char*)dest;
 
+    //CTR is a stream, no padding
+    if (m_CipherMode == MODE_CTR) {
+        ctr(src, destBytes, length);
+        return;
+    }
+
     //Check if the length is less than 1 block
     if (length > 0 && length < 16) {
         //Copy the complete source block to the state array
@@ -288,7 +432,7 @@ void AES::decrypt(const char* src, void* dest, size_t length)
             //Perform CBC processing if necessary
             if (m_CipherMode == MODE_CBC) {
                 //XOR the state array with the last partial source block
-                for (int i = 0; i < length; i++) {
+                for (size_t i = 0; i < length; i++) {
                     m_State[i] = m_State[i] ^ src[i];
                 }
             }
@@ -325,14 +469,139 @@ void AES::decrypt(const char* src, void* dest, size_t length)
     }
 }
 
+void AES::setIV(const char* iv)
+{
+    //Restart the chain without expanding the key again
+    if (iv == NULL) {
+        memset(m_CarryVector, 0, 16);
+    } else {
+        memcpy(m_CarryVector, iv, 16);
+    }
+
+    //CTR restarts at the new iv
+    memcpy(m_Counter, m_CarryVector, 16);
+    m_StreamPos = 16;
+}
+
+void AES::getIV(char* iv) const
+{
+    memcpy(iv, m_CarryVector, 16);
+}
+
 void AES::clear()
 {
     //Erase the key, state array, and carry vector
     memset(m_Key, 0, sizeof(m_Key));
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+    memset(m_DecKey, 0, sizeof(m_DecKey));
+#endif
     memset(m_State, 0, sizeof(m_State));
     memset(m_CarryVector, 0, sizeof(m_CarryVector));
+    memset(m_Counter, 0, sizeof(m_Counter));
+    m_StreamPos = 16;
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+    memset(&m_Ecb, 0, sizeof(m_Ecb));
+#endif
 }
 
+void AES::encryptBlock()
+{
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+    //AES-128 by the peripheral, software if the block was aborted
+    if (m_Rounds == 10) {
+        memcpy(m_Ecb.cleartext, m_State, 16);
+        if (CRYPTO_EcbEncrypt(&m_Ecb) == 0) {
+            memcpy(m_State, m_Ecb.ciphertext, 16);
+            return;
+        }
+    }
+#endif
+    aesEncrypt();
+}
+
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+void AES::aesEncrypt()
+{
+    const unsigned int* rk = m_Key;
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+
+    s0 = AES_GETU32(m_State) ^ rk[0];
+    s1 = AES_GETU32(m_State + 4) ^ rk[1];
+    s2 = AES_GETU32(m_State + 8) ^ rk[2];
+    s3 = AES_GETU32(m_State + 12) ^ rk[3];
+    for (int r = 1; r < m_Rounds; r++) {
+        rk += 4;
+        t0 = AES_TE0(s0 >> 24) ^ AES_TE1(s1 >> 16) ^ AES_TE2(s2 >> 8) ^ AES_TE3(s3) ^ rk[0];
+        t1 = AES_TE0(s1 >> 24) ^ AES_TE1(s2 >> 16) ^ AES_TE2(s3 >> 8) ^ AES_TE3(s0) ^ rk[1];
+        t2 = AES_TE0(s2 >> 24) ^ AES_TE1(s3 >> 16) ^ AES_TE2(s0 >> 8) ^ AES_TE3(s1) ^ rk[2];
+        t3 = AES_TE0(s3 >> 24) ^ AES_TE1(s0 >> 16) ^ AES_TE2(s1 >> 8) ^ AES_TE3(s2) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    //Last round without MixColumns
+    rk += 4;
+    t0 = (AES_SBOX(s0 >> 24) << 24) ^ (AES_SBOX(s1 >> 16) << 16) ^ (AES_SBOX(s2 >> 8) << 8) ^ AES_SBOX(s3) ^ rk[0];
+    t1 = (AES_SBOX(s1 >> 24) << 24) ^ (AES_SBOX(s2 >> 16) << 16) ^ (AES_SBOX(s3 >> 8) << 8) ^ AES_SBOX(s0) ^ rk[1];
+    t2 = (AES_SBOX(s2 >> 24) << 24) ^ (AES_SBOX(s3 >> 16) << 16) ^ (AES_SBOX(s0 >> 8) << 8) ^ AES_SBOX(s1) ^ rk[2];
+    t3 = (AES_SBOX(s3 >> 24) << 24) ^ (AES_SBOX(s0 >> 16) << 16) ^ (AES_SBOX(s1 >> 8) << 8) ^ AES_SBOX(s2) ^ rk[3];
+    AES_PUTU32(m_State, t0);
+    AES_PUTU32(m_State + 4, t1);
+    AES_PUTU32(m_State + 8, t2);
+    AES_PUTU32(m_State + 12, t3);
+}
+
+void AES::aesDecrypt()
+{
+    const unsigned int* rk = m_DecKey;
+    uint32_t s0, s1, s2, s3;
+    uint32_t t0, t1, t2, t3;
+
+    s0 = AES_GETU32(m_State) ^ rk[0];
+    s1 = AES_GETU32(m_State + 4) ^ rk[1];
+    s2 = AES_GETU32(m_State + 8) ^ rk[2];
+    s3 = AES_GETU32(m_State + 12) ^ rk[3];
+    for (int r = 1; r < m_Rounds; r++) {
+        rk += 4;
+        t0 = AES_TD0(s0 >> 24) ^ AES_TD1(s3 >> 16) ^ AES_TD2(s2 >> 8) ^ AES_TD3(s1) ^ rk[0];
+        t1 = AES_TD0(s1 >> 24) ^ AES_TD1(s0 >> 16) ^ AES_TD2(s3 >> 8) ^ AES_TD3(s2) ^ rk[1];
+        t2 = AES_TD0(s2 >> 24) ^ AES_TD1(s1 >> 16) ^ AES_TD2(s0 >> 8) ^ AES_TD3(s3) ^ rk[2];
+        t3 = AES_TD0(s3 >> 24) ^ AES_TD1(s2 >> 16) ^ AES_TD2(s1 >> 8) ^ AES_TD3(s0) ^ rk[3];
+        s0 = t0;
+        s1 = t1;
+        s2 = t2;
+        s3 = t3;
+    }
+
+    //Last round without InvMixColumns
+    rk += 4;
+    t0 = (AES_INV_SBOX(s0 >> 24) << 24) ^ (AES_INV_SBOX(s3 >> 16) << 16) ^ (AES_INV_SBOX(s2 >> 8) << 8) ^ AES_INV_SBOX(s1) ^ rk[0];
+    t1 = (AES_INV_SBOX(s1 >> 24) << 24) ^ (AES_INV_SBOX(s0 >> 16) << 16) ^ (AES_INV_SBOX(s3 >> 8) << 8) ^ AES_INV_SBOX(s2) ^ rk[1];
+    t2 = (AES_INV_SBOX(s2 >> 24) << 24) ^ (AES_INV_SBOX(s1 >> 16) << 16) ^ (AES_INV_SBOX(s0 >> 8) << 8) ^ AES_INV_SBOX(s3) ^ rk[2];
+    t3 = (AES_INV_SBOX(s3 >> 24) << 24) ^ (AES_INV_SBOX(s2 >> 16) << 16) ^ (AES_INV_SBOX(s1 >> 8) << 8) ^ AES_INV_SBOX(s0) ^ rk[3];
+    AES_PUTU32(m_State, t0);
+    AES_PUTU32(m_State + 4, t1);
+    AES_PUTU32(m_State + 8, t2);
+    AES_PUTU32(m_State + 12, t3);
+}
+
+void AES::expandDecKey()
+{
+    //The round keys in reverse order, InvMixColumns applied to the inner ones
+    for (int r = 0; r <= m_Rounds; r++) {
+        for (int c = 0; c < 4; c++) {
+            uint32_t w = m_Key[(m_Rounds - r) * 4 + c];
+            if (r > 0 && r < m_Rounds) {
+                w = AES_TD0(AES_SBOX(w >> 24)) ^ AES_TD1(AES_SBOX(w >> 16)) ^ AES_TD2(AES_SBOX(w >> 8)) ^ AES_TD3(AES_SBOX(w));
+            }
+            m_DecKey[r * 4 + c] = w;
+        }
+    }
+}
+#else
 void AES::aesEncrypt()
 {
     addRoundKey(0);
@@ -360,6 +629,7 @@ void AES::aesDecrypt()
     invSubBytes();
     addRoundKey(0);
 }
+#endif
 
 void AES::expandKey(const char* key, int nk)
 {
@@ -396,7 +666,7 @@ unsigned int AES::subWord(unsigned int w)
 {
     unsigned int out = 0;
     for(int i = 0; i < 4; ++i) {
-        char temp = (w & 0xFF);
+        unsigned char temp = (w & 0xFF);
         out |= (m_Sbox[temp] << (8*i));
         w = (w >> 8);
     }
@@ -406,13 +676,13 @@ unsigned int AES::subWord(unsigned int w)
 void AES::subBytes()
 {
     for(int i = 0; i < 16; ++i)
-        m_State[i] = m_Sbox[m_State[i]];
+        m_State[i] = m_Sbox[(unsigned char)m_State[i]];
 }
 
 void AES::invSubBytes()
 {
     for(int i = 0; i < 16; ++i)
-        m_State[i] = m_InvSbox[m_State[i]];
+        m_State[i] = m_InvSbox[(unsigned char)m_State[i]];
 }
 
 void AES::shiftRows()
@@ -18,6 +18,19 @@
 #define AES_H
 
 #include "mbed.h"
+#include "crypto_backend.h"
+
+/** AES round implementations
+ */
+#define AES_IMPL_BYTE 0         /**< Byte oriented rounds, S-boxes only */
+#define AES_IMPL_TTABLE 1       /**< 32-bit rounds, one 1K table per direction (2K flash) */
+#define AES_IMPL_TTABLE_FULL 2  /**< 32-bit rounds, four 1K tables per direction (8K flash) */
+
+/** Select flash size vs. speed, all produce the same output
+ */
+#ifndef AES_IMPLEMENTATION
+#define AES_IMPLEMENTATION AES_IMPL_TTABLE
+#endif
 
 /** AES class.
  *  Used for encrypting/decrypting data using the AES block cipher.
@@ -97,7 +110,8 @@ public:
      */
     enum CipherMode {
         MODE_ECB,   /**< Electronic codebook */
-        MODE_CBC    /**< Cipher block chaining */
+        MODE_CBC,   /**< Cipher block chaining */
+        MODE_CTR    /**< Counter, the iv is the initial 128-bit big-endian counter block */
     };
 
     /** Create a blank AES object
@@ -126,6 +140,13 @@ public:
      */
     void setup(const char* key, KeySize keySize, CipherMode mode = MODE_ECB, const char* iv = NULL);
 
+    /** Move the CTR keystream to a byte offset from the iv, any block can be
+     *  processed independently (MODE_CTR only)
+     *
+     * @param offset Byte offset of the next data in the stream.
+     */
+    void seek(uint32_t offset);
+
     /** Encrypt the specified data in-place, using CTS or zero-padding if necessary
      *
      * @param data Pointer to the data to encrypt (minimum 16B for output).
@@ -156,6 +177,22 @@ public:
      */
     void decrypt(const char* src, void* dest, size_t length);
 
+    /** Set the chaining vector, the expanded key is kept
+     *
+     * @param iv Pointer to the 16B vector, the last cipher block before the next data in CBC mode.
+     */
+    void setIV(const char* iv);
+
+    /** Get the chaining vector, a stream can be restarted from it by setIV()
+     *
+     * @param iv Pointer to an array in which to store the 16B vector.
+     */
+    void getIV(char* iv) const;
+
+    /** Get the cipher mode
+     */
+    CipherMode mode() const { return m_CipherMode; }
+
     /** Erase any sensitive information in this AES object
      */
     void clear();
@@ -168,13 +205,26 @@ private:
     AES::CipherMode m_CipherMode;
     int m_Rounds;
     unsigned int m_Key[60];
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+    unsigned int m_DecKey[60];
+#endif
     char m_State[16];
     char m_CarryVector[16];
+    char m_Counter[16];
+    int m_StreamPos;
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+    MBED_ALIGN(4) crypto_ecb_data_t m_Ecb;
+#endif
 
     //Internal methods
+    void ctr(const char* src, char* dest, size_t length);
+    void encryptBlock();
     void aesEncrypt();
     void aesDecrypt();
     void expandKey(const char* key, int nk);
+#if (AES_IMPLEMENTATION != AES_IMPL_BYTE)
+    void expandDecKey();
+#endif
     unsigned int rotWord(unsigned int w);
     unsigned int invRotWord(unsigned int w);
     unsigned int subWord(unsigned int w);
@@ -0,0 +1,140 @@
+/** @file AES_CMAC.cpp
+ *  @brief AES-CMAC (NIST SP 800-38B, RFC 4493) over the AES block primitive
+ */
+
+#include "AES_CMAC.h"
+
+AESCMAC::AESCMAC()
+{
+    //Blank object, setup() is required
+    m_BlockLength = 0;
+}
+
+AESCMAC::~AESCMAC()
+{
+    //Erase any sensitive information
+    clear();
+}
+
+void AESCMAC::setup(const char* key, AES::KeySize keySize)
+{
+    char l[16];
+
+    //The block chain is ECB on the running state
+    m_Aes.setup(key, keySize, AES::MODE_ECB);
+
+    //L = AES(K, 0^128), the subkeys are L << 1 and L << 2 with the Rb fix-up
+    memset(l, 0, 16);
+    m_Aes.encrypt(l, 16);
+    leftShift(l, m_K1);
+    if (l[0] & 0x80) {
+        m_K1[15] ^= 0x87;
+    }
+    leftShift(m_K1, m_K2);
+    if (m_K1[0] & 0x80) {
+        m_K2[15] ^= 0x87;
+    }
+    memset(l, 0, 16);
+
+    reset();
+}
+
+void AESCMAC::reset()
+{
+    memset(m_X, 0, 16);
+    m_BlockLength = 0;
+}
+
+void AESCMAC::update(const void* data, size_t length)
+{
+    const char* bytes = (const char*)data;
+    size_t n;
+
+    //The last block is held back, finish() masks it with a subkey
+    if (m_BlockLength < 16) {
+        n = 16 - m_BlockLength;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(m_Block + m_BlockLength, bytes, n);
+        m_BlockLength += n;
+        bytes += n;
+        length -= n;
+    }
+    if (length == 0) {
+        return;
+    }
+
+    //More data follows, so the buffered block is not the last one
+    process(m_Block);
+    while (length > 16) {
+        process(bytes);
+        bytes += 16;
+        length -= 16;
+    }
+    memcpy(m_Block, bytes, length);
+    m_BlockLength = length;
+}
+
+void AESCMAC::finish(char* mac)
+{
+    int i;
+
+    if (m_BlockLength == 16) {
+        //Complete last block
+        for (i = 0; i < 16; i++) {
+            m_Block[i] ^= m_K1[i];
+        }
+    } else {
+        //Padded last block, 10* padding
+        m_Block[m_BlockLength] = 0x80;
+        memset(m_Block + m_BlockLength + 1, 0, 15 - m_BlockLength);
+        for (i = 0; i < 16; i++) {
+            m_Block[i] ^= m_K2[i];
+        }
+    }
+    process(m_Block);
+    memcpy(mac, m_X, 16);
+    memset(m_Block, 0, 16);
+    m_BlockLength = 0;
+}
+
+bool AESCMAC::equal(const void* mac1, const void* mac2)
+{
+    const unsigned char* a = (const unsigned char*)mac1;
+    const unsigned char* b = (const unsigned char*)mac2;
+    unsigned char diff = 0;
+
+    //No early exit, the time doesn't depend on the position of a mismatch
+    for (int i = 0; i < AES_CMAC_LENGTH; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+void AESCMAC::clear()
+{
+    m_Aes.clear();
+    memset(m_K1, 0, 16);
+    memset(m_K2, 0, 16);
+    memset(m_X, 0, 16);
+    memset(m_Block, 0, 16);
+    m_BlockLength = 0;
+}
+
+void AESCMAC::process(const char* block)
+{
+    //X = AES(K, X ^ M)
+    for (int i = 0; i < 16; i++) {
+        m_X[i] ^= block[i];
+    }
+    m_Aes.encrypt(m_X, 16);
+}
+
+void AESCMAC::leftShift(const char* src, char* dest)
+{
+    for (int i = 0; i < 15; i++) {
+        dest[i] = (char)((src[i] << 1) | ((src[i + 1] >> 7) & 0x01));
+    }
+    dest[15] = (char)(src[15] << 1);
+}
@@ -0,0 +1,87 @@
+/** @file AES_CMAC.h
+ *  @brief AES-CMAC (NIST SP 800-38B, RFC 4493) over the AES block primitive
+ */
+
+#ifndef AES_CMAC_H
+#define AES_CMAC_H
+
+#include "AES.h"
+
+/** Length of a CMAC tag */
+#define AES_CMAC_LENGTH 16
+
+/** AES-CMAC class.
+ *  Streaming message authentication code, the data may be passed in chunks
+ *  of any length.
+ *
+ * Example:
+ * @code
+ * AESCMAC cmac;
+ * char tag[AES_CMAC_LENGTH];
+ *
+ * cmac.setup(key, AES::KEY_128);
+ * cmac.update(header, sizeof(header));
+ * cmac.update(image, image_size);
+ * cmac.finish(tag);
+ * @endcode
+ */
+class AESCMAC
+{
+public:
+    /** Create a blank AES-CMAC object
+     */
+    AESCMAC();
+
+    /** Destroy this AES-CMAC object and clear sensitive information
+     */
+    ~AESCMAC();
+
+    /** Set up this object with the specified key and start a new message
+     *
+     * @param key Pointer to the key array.
+     * @param keySize The size of the key.
+     */
+    void setup(const char* key, AES::KeySize keySize);
+
+    /** Start a new message with the current key
+     */
+    void reset();
+
+    /** Add data to the message
+     *
+     * @param data Pointer to the data.
+     * @param length Length of the data in bytes.
+     */
+    void update(const void* data, size_t length);
+
+    /** Finish the message, reset() is required before the next one
+     *
+     * @param mac Pointer to the tag output (AES_CMAC_LENGTH bytes).
+     */
+    void finish(char* mac);
+
+    /** Compare two tags in constant time
+     *
+     * @return True if the tags are equal.
+     */
+    static bool equal(const void* mac1, const void* mac2);
+
+    /** Erase any sensitive information in this AES-CMAC object
+     */
+    void clear();
+
+private:
+    //Member variables
+    AES m_Aes;
+    char m_K1[16];
+    char m_K2[16];
+    char m_X[16];
+    char m_Block[16];
+    size_t m_BlockLength;
+
+    //Internal methods
+    void process(const char* block);
+    static void leftShift(const char* src, char* dest);
+};
+
+#endif
@@ -0,0 +1,33 @@
+/** @file crypto_backend.c
+ */
+
+/******************************************************************************/
+//  INCLUDE HEADER
+/******************************************************************************/
+#include "crypto_backend.h"
+
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+#include "nrf.h"
+
+/******************************************************************************/
+//  FUNCTIONS
+/******************************************************************************/
+int CRYPTO_EcbEncrypt(crypto_ecb_data_t * data)
+{
+    NRF_ECB->ECBDATAPTR = (uintptr_t)data;
+    NRF_ECB->EVENTS_ENDECB = 0;
+    NRF_ECB->EVENTS_ERRORECB = 0;
+    NRF_ECB->TASKS_STARTECB = 1;
+    /* 128-bit block, about 7 us */
+    while ((NRF_ECB->EVENTS_ENDECB == 0) && (NRF_ECB->EVENTS_ERRORECB == 0))
+    {
+    }
+    if (NRF_ECB->EVENTS_ERRORECB != 0)
+    {
+        NRF_ECB->EVENTS_ERRORECB = 0;
+        return -1;
+    }
+    NRF_ECB->EVENTS_ENDECB = 0;
+    return 0;
+}
+#endif
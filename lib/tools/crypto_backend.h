@@ -0,0 +1,67 @@
+/** @file crypto_backend.h
+ *  @brief Compile-time selection of the crypto and checksum engines
+ */
+#ifndef __CRYPTO_BACKEND_H
+#define __CRYPTO_BACKEND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/******************************************************************************/
+//  INCLUDE HEADER
+/******************************************************************************/
+#include <stdint.h>
+
+/******************************************************************************/
+//  MACRO. DEFINE
+/******************************************************************************/
+/** Block cipher engines of the AES class */
+#define CRYPTO_BACKEND_SOFTWARE             (0)
+#define CRYPTO_BACKEND_NRF_ECB              (1)
+
+/** Engine of the AES-128 forward cipher (CTR, CMAC, CBC/ECB encrypt)
+ *  CRYPTO_BACKEND_SOFTWARE: AES_IMPLEMENTATION rounds, portable (host tests)
+ *  CRYPTO_BACKEND_NRF_ECB: nRF52 ECB peripheral. The inverse cipher and the
+ *  AES-192/256 keys stay in software, a block aborted by the peripheral is
+ *  done again in software.
+ *  The checksum engine is the CRC32 table engine (CRC32_TABLE_SLICES) for both,
+ *  the nRF52840 has no CRC peripheral for memory.
+ */
+#ifndef CRYPTO_BACKEND
+#define CRYPTO_BACKEND                      CRYPTO_BACKEND_SOFTWARE
+#endif
+
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+#define CRYPTO_BACKEND_NAME                 "nrf-ecb"
+#else
+#define CRYPTO_BACKEND_NAME                 "software"
+#endif
+
+/******************************************************************************/
+//  TYPEDEF
+/******************************************************************************/
+/** ECB data structure, layout of the peripheral ECBDATAPTR (RAM only) */
+typedef struct
+{
+    uint8_t key[16];
+    uint8_t cleartext[16];
+    uint8_t ciphertext[16];
+} crypto_ecb_data_t;
+
+/******************************************************************************/
+//  FUNCTIONS
+/******************************************************************************/
+#if (CRYPTO_BACKEND == CRYPTO_BACKEND_NRF_ECB)
+/**
+ * Encrypt data->cleartext to data->ciphertext with data->key (AES-128)
+ * @return 0 on success, -1 if the peripheral aborted the block
+ */
+int CRYPTO_EcbEncrypt(crypto_ecb_data_t * data);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRYPTO_BACKEND_H */
@@ -0,0 +1,56 @@
+/* Includes ------------------------------------------------------------------*/
+#include "scratch_arena.h"
+
+static_assert((SCRATCH_ARENA_SIZE % SCRATCH_ALIGN) == 0, "SCRATCH_ARENA_SIZE must be a multiple of SCRATCH_ALIGN");
+
+/* Private variables ---------------------------------------------------------*/
+MBED_ALIGN(8) static uint8_t s_arena[SCRATCH_ARENA_SIZE];
+static size_t s_top;
+static size_t s_peak;
+
+/* Exported functions --------------------------------------------------------*/
+uint8_t *ScratchArena::borrow(size_t size)
+{
+    uint8_t *ptr;
+
+    if (size > SCRATCH_ARENA_SIZE - s_top)
+    {
+        return nullptr;
+    }
+    ptr = &s_arena[s_top];
+    /* The arena size is aligned, the rounded size still fits */
+    s_top += SCRATCH_ROUND(size);
+    if (s_top > s_peak)
+    {
+        s_peak = s_top;
+    }
+    return ptr;
+} // borrow
+
+void ScratchArena::release(const uint8_t *ptr)
+{
+    if ((ptr >= s_arena) && (ptr < &s_arena[s_top]))
+    {
+        s_top = (size_t)(ptr - s_arena);
+    }
+} // release
+
+size_t ScratchArena::used(void)
+{
+    return s_top;
+}
+
+size_t ScratchArena::peak(void)
+{
+    return s_peak;
+}
+
+size_t ScratchArena::capacity(void)
+{
+    return SCRATCH_ARENA_SIZE;
+}
+
+void ScratchArena::resetPeak(void)
+{
+    s_peak = s_top;
+}
@@ -0,0 +1,86 @@
+/** @file scratch_arena.h
+ *  @brief Static scratch RAM of the MBR: the block buffers of the copy paths,
+ *         the CRC32 reads and the MBR records are borrowed from one arena,
+ *         last borrowed first released, instead of the heap.
+ *
+ *    ScratchBuffer buffer(2 * block_size);
+ *    if (!buffer.ok()) { ... }
+ *
+ *  The arena isn't thread safe, only the boot thread borrows from it.
+ */
+
+/* Define to prevent recursive inclusion -------------------------------------*/
+#ifndef __SCRATCH_ARENA_H
+#define __SCRATCH_ARENA_H
+
+/* Includes ------------------------------------------------------------------*/
+#include "mbed.h"
+#include "mem_layout.h"
+
+/* Exported macro ------------------------------------------------------------*/
+/** Largest erase block of the two flash parts, the copies work in blocks */
+#define SCRATCH_BLOCK_SIZE ((DEVICE_PAGE_ERASE_SIZE > EX_FLASH_PAGE_ERASE_SIZE) \
+                            ? DEVICE_PAGE_ERASE_SIZE : EX_FLASH_PAGE_ERASE_SIZE)
+
+/** Size of the arena. The worst borrower is the backup compression: three
+ *  blocks and the LZSS encoder, with a MBR record written by a journal
+ *  checkpoint on top (partition_manager.cpp checks it).
+ */
+#ifndef SCRATCH_ARENA_SIZE
+#define SCRATCH_ARENA_SIZE (5U * SCRATCH_BLOCK_SIZE)
+#endif
+
+/** Alignment of each borrowed buffer */
+#define SCRATCH_ALIGN 8U
+
+/** Bytes a buffer of size takes in the arena */
+#define SCRATCH_ROUND(size) (((size) + SCRATCH_ALIGN - 1U) & ~(SCRATCH_ALIGN - 1U))
+
+/* Exported types ------------------------------------------------------------*/
+class ScratchArena
+{
+public:
+    /** Take size bytes on top of the arena
+     * @return nullptr if the arena has less than size bytes left
+     */
+    static uint8_t *borrow(size_t size);
+
+    /** Give back ptr and everything borrowed after it */
+    static void release(const uint8_t *ptr);
+
+    /** Bytes borrowed now, the most borrowed at once, the arena size */
+    static size_t used(void);
+    static size_t peak(void);
+    static size_t capacity(void);
+
+    /** Start a new peak from the bytes borrowed now */
+    static void resetPeak(void);
+};
+
+/** A buffer of the arena for the lifetime of the object */
+class ScratchBuffer
+{
+public:
+    explicit ScratchBuffer(size_t size) : _ptr(ScratchArena::borrow(size)) {}
+    ~ScratchBuffer()
+    {
+        if (_ptr != nullptr)
+        {
+            ScratchArena::release(_ptr);
+        }
+    }
+
+    bool ok(void) const { return _ptr != nullptr; }
+    uint8_t *data(void) const { return _ptr; }
+
+    template <typename T>
+    T *as(void) const { return reinterpret_cast<T *>(_ptr); }
+
+private:
+    ScratchBuffer(const ScratchBuffer &);
+    ScratchBuffer &operator=(const ScratchBuffer &);
+
+    uint8_t *_ptr;
+};
+
+#endif /* __SCRATCH_ARENA_H */
@@ -36,16 +36,52 @@ extern "C" {
 #define CRC32_ENABLE_REFLECT_BIT_ORDER      (1)
 /* CRC32_POLY */
 #define CRC32_POLY                          (0x04C11DB7)
+/* CRC32_POLY in reflected bit order, using by the table engine */
+#define CRC32_POLY_REFLECTED                (0xEDB88320)
+
+/** Table engine, trade table size (const flash) for speed
+ *  0: bit-serial, no table
+ *  1: byte-wise, 1KB table
+ *  4: slicing-by-4, 4KB table
+ *  8: slicing-by-8, 8KB table
+ *  The table engine requires CRC32_ENABLE_REFLECT_BIT_ORDER,
+ *  otherwise the bit-serial loop is used.
+ */
+#ifndef CRC32_TABLE_SLICES
+#define CRC32_TABLE_SLICES                  (8)
+#endif
 
 /******************************************************************************/
 //  TYPEDEF
 /******************************************************************************/
+/** CRC32 context, one per running computation */
+typedef struct
+{
+    uint32_t crc;   /* CRC register (engine domain), use CRC32_Final to get value */
+} crc32_ctx_t;
 
 /******************************************************************************/
 //  FUNCTIONS
 /******************************************************************************/
+/**
+ * Start a CRC computation on a context
+ */
+void CRC32_Init(crc32_ctx_t * ctx);
+
+/**
+ * Accumulate buffer into a context
+ */
+void CRC32_Update(crc32_ctx_t * ctx, const uint8_t * buffer, uint32_t length);
+
+/**
+ * Get CRC of a context, the context can still be updated after
+ */
+uint32_t CRC32_Final(const crc32_ctx_t * ctx);
+
 /**
  * Start to calculator CRC
+ * @note Legacy API on a single shared context, not re-entrant.
+ *       Use CRC32_Init/CRC32_Update/CRC32_Final instead.
  */
 void CRC32_Start(uint32_t seek);
 
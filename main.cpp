@@ -5,6 +5,7 @@
 #include "mem_layout.h"
 #include "mbr.h"
 #include "partition_manager.h"
+#include "boot_profile.h"
 #include "console_dbg.h"
 
 /* Private define ------------------------------------------------------------*/
@@ -29,9 +30,14 @@ partition_manager partition_mng(&spiFlashDevice);
 DigitalOut kx022_cs(KX022_CS_PIN);
 
 static uint32_t startup_application(void);
+static bool profileReserved(uint32_t jump_address);
 
 int main()
 {
+    boot_profile_t profile;
+
+    BootProfile::start();
+    bootProfileEnter(BOOT_PHASE_BOOT);
     MAIN_CONSOLE("\r\n\r\n");
     MAIN_TAG_CONSOLE("======================MBR======================");
     kx022_cs = 1; /* unselect spi bus kx022 */
@@ -43,10 +49,21 @@ int main()
     // partition_mng.cloneMain2ImageDownload();
     // partition_mng.verifyMainRollback();
     // partition_mng.restoreMain();
+    // partition_mng.benchmarkCrypto();
     // partition_mng.end();
     // while(1) {};
 
     uint32_t jump_address = startup_application();
+    bootProfileLeave(BOOT_PHASE_BOOT);
+    /* The application reads it from the reserved RAM */
+    if (profileReserved(jump_address))
+    {
+        BootProfile::save(jump_address);
+    }
+    if (BootProfile::load(&profile))
+    {
+        BootProfile::print(&profile);
+    }
     if (jump_address != 0)
     {
         MAIN_TAG_CONSOLE("Starting application 0x%0X", jump_address);
@@ -68,6 +85,8 @@ static uint32_t startup_application(void)
     uint32_t jump_address;
 
     partition_mng.begin();
+    /* One MBR record write for the whole boot sequence */
+    partition_mng.beginTransaction();
 
     startupMode = partition_mng.getStartUpModeFromMBR();
     MAIN_TAG_CONSOLE("Startup Mode %u", startupMode);
@@ -132,6 +151,7 @@ static uint32_t startup_application(void)
         }
         // break;
         /* if the upgrade failure, then main run */
+        /* fall through */
     case MasterBootRecord::MAIN_RUN_MODE:
         MAIN_TAG_CONSOLE("===================== MAIN_RUN_MODE =====================");
         if (partition_mng.verifyMain())
@@ -146,12 +166,21 @@ static uint32_t startup_application(void)
                 MAIN_TAG_CONSOLE("MAIN_RUN_MODE status Error");
             }
         }
+        else if (partition_mng.repairMain()
+        && partition_mng.getMainStatusFromMBR() == MasterBootRecord::APP_STATUS_OK)
+        {
+            /* Bad pages rewritten from the rollback partition */
+            jump_address = partition_mng.mainAddress();
+            MAIN_TAG_CONSOLE("MAIN_RUN_MODE repaired");
+            break;
+        }
         else
         {
             MAIN_TAG_CONSOLE("MAIN_RUN_MODE ERROR");
         }
         // break;
         /* if the main application failure, then rollback main application */
+        /* fall through */
     case MasterBootRecord::MAIN_ROLLBACK_MODE:
         MAIN_TAG_CONSOLE("=================== MAIN_ROLLBACK_MODE ==================");
         if (partition_mng.restoreMain())
@@ -166,6 +195,7 @@ static uint32_t startup_application(void)
         }
         // break;
         /* if the main rollback failure, then bootloader run */
+        /* fall through */
     case MasterBootRecord::BOOT_RUN_MODE:
         MAIN_TAG_CONSOLE("===================== BOOT_RUN_MODE =====================");
         if (partition_mng.verifyBoot())
@@ -180,12 +210,20 @@ static uint32_t startup_application(void)
                 MAIN_TAG_CONSOLE("BOOT_RUN_MODE status Error");
             }
         }
+        else if (partition_mng.repairBoot()
+        && partition_mng.getBootStatusFromMBR() == MasterBootRecord::APP_STATUS_OK)
+        {
+            jump_address = partition_mng.bootAddress();
+            MAIN_TAG_CONSOLE("BOOT_RUN_MODE repaired");
+            break;
+        }
         else
         {
             MAIN_TAG_CONSOLE("BOOT_RUN_MODE ERROR");
         }
         // break;
         /* if the boot application failure, then rollback boot application */
+        /* fall through */
     case MasterBootRecord::BOOT_ROLLBACK_MODE:
         MAIN_TAG_CONSOLE("=================== BOOT_ROLLBACK_MODE ==================");
         if (partition_mng.restoreBoot())
@@ -199,7 +237,7 @@ static uint32_t startup_application(void)
             MAIN_TAG_CONSOLE("BOOT_ROLLBACK_MODE ERROR");
         }
         // break;
-    
+        /* fall through */
     default:
         jump_address = 0;
         break;
@@ -237,7 +275,32 @@ static uint32_t startup_application(void)
         MAIN_TAG_CONSOLE("Bootloader application 0x%0X", jump_address);
     }
 
+    if (!partition_mng.endTransaction())
+    {
+        MAIN_TAG_CONSOLE("[endTransaction] store MBR failure!");
+    }
     partition_mng.end();
 
     return jump_address;
-}
\ No newline at end of file
+}
+
+/** @brief the boot profile is only left for an application that reserves
+ * its region: the initial stack pointer is at or below the region, as set by
+ * the same target.mbed_ram_size as the MBR (mbed_app.json)
+ */
+static bool profileReserved(uint32_t jump_address)
+{
+    uint32_t stack_ptr;
+
+    if (jump_address == 0)
+    {
+        return true;
+    }
+    stack_ptr = *(const uint32_t*)PM_INTERNAL_PTR(jump_address);
+    if (stack_ptr > BOOT_PROFILE_REGION_ADDR)
+    {
+        MAIN_TAG_CONSOLE("stack 0x%08X over the boot profile, not saved", stack_ptr);
+        return false;
+    }
+    return true;
+}
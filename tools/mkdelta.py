@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+"""Create a delta image (lib/parttion_manager/delta_patch.h) of a target
+firmware against the base firmware stored in the rollback partition.
+
+    mkdelta.py base.bin target.bin delta.bin --base-version 0x01020003
+
+The delta image is stored in the image download partition with
+type.enc = DATA_DELTA (5), or DATA_DELTA_ENC_CTR (6) once encrypted, and
+the MBR params size/checksum of the delta image itself.
+"""
+import argparse
+import struct
+import zlib
+
+MAGIC = 0x31544C44
+KEY_LEN = 8          # bytes hashed to find a match in the base
+MIN_MATCH = 16       # shorter exact matches are stored as extra bytes
+CANDIDATES = 8       # base positions kept per key
+GIVE_UP = 64         # a diff region ends after this many bytes without gain
+ZERO_RUN = 4         # zero diff bytes that end an add run
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def zigzag(value):
+    return ((value << 1) ^ (value >> 31)) & 0xFFFFFFFF
+
+
+def encode_diff(diff):
+    """Runs of copy_len, add_len, add bytes"""
+    out = bytearray()
+    pos = 0
+    while pos < len(diff):
+        copy = pos
+        while copy < len(diff) and diff[copy] == 0:
+            copy += 1
+        add = copy
+        zeros = 0
+        while add < len(diff) and zeros < ZERO_RUN:
+            zeros = zeros + 1 if diff[add] == 0 else 0
+            add += 1
+        if zeros:
+            add -= zeros
+        out += varint(copy - pos) + varint(add - copy) + diff[copy:add]
+        pos = add
+    return bytes(out)
+
+
+def record(diff, extra, adjust):
+    return varint(len(diff)) + varint(len(extra)) + varint(zigzag(adjust)) + encode_diff(diff) + bytes(extra)
+
+
+def build_index(base):
+    index = {}
+    for pos in range(0, len(base) - KEY_LEN + 1):
+        positions = index.setdefault(base[pos:pos + KEY_LEN], [])
+        if len(positions) < CANDIDATES:
+            positions.append(pos)
+    return index
+
+
+def exact_length(base, bpos, target, tpos):
+    n = 0
+    limit = min(len(base) - bpos, len(target) - tpos)
+    while n + 64 <= limit and base[bpos + n:bpos + n + 64] == target[tpos + n:tpos + n + 64]:
+        n += 64
+    while n < limit and base[bpos + n] == target[tpos + n]:
+        n += 1
+    return n
+
+
+def diff_length(base, bpos, target, tpos):
+    """Length of the diff region: maximise 2 * equal bytes - length"""
+    limit = min(len(base) - bpos, len(target) - tpos)
+    score = best_score = best_len = 0
+    n = 0
+    while n < limit and n - best_len < GIVE_UP:
+        run = exact_length(base, bpos + n, target, tpos + n)
+        if run:
+            n += run
+            score += run
+        else:
+            n += 1
+            score -= 1
+        if score > best_score:
+            best_score, best_len = score, n
+    return best_len
+
+
+def find_match(index, base, target, tpos, expected):
+    best_pos, best_len = -1, 0
+    candidates = list(index.get(target[tpos:tpos + KEY_LEN], ()))
+    if 0 <= expected < len(base):
+        candidates.append(expected)
+    for bpos in candidates:
+        n = exact_length(base, bpos, target, tpos)
+        if n > best_len:
+            best_pos, best_len = bpos, n
+    return best_pos, best_len
+
+
+def make_delta(base, target):
+    index = build_index(base)
+    out = bytearray()
+    diff_from, diff = 0, b""     # open record: diff region at diff_from
+    extra = bytearray()
+    tpos = 0
+    while tpos < len(target):
+        expected = diff_from + len(diff) + len(extra)
+        bpos, n = find_match(index, base, target, tpos, expected)
+        if n < MIN_MATCH:
+            extra.append(target[tpos])
+            tpos += 1
+            continue
+        n = diff_length(base, bpos, target, tpos)
+        adjust = bpos - (diff_from + len(diff))
+        out += record(diff, extra, adjust)
+        diff = bytes((target[tpos + i] - base[bpos + i]) & 0xFF for i in range(n))
+        diff_from, extra = bpos, bytearray()
+        tpos += n
+    out += record(diff, extra, 0)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("base")
+    parser.add_argument("target")
+    parser.add_argument("delta")
+    parser.add_argument("--base-version", type=lambda v: int(v, 0), required=True,
+                        help="version of the base in the MBR params (u32)")
+    args = parser.parse_args()
+
+    base = open(args.base, "rb").read()
+    target = open(args.target, "rb").read()
+    body = make_delta(base, target)
+    header = struct.pack("<IIIIII8x", MAGIC, len(base), args.base_version,
+                         zlib.crc32(base), len(target), zlib.crc32(target))
+    with open(args.delta, "wb") as f:
+        f.write(header + body)
+    print("base %u, target %u, delta %u (%.1f%% of target)"
+          % (len(base), len(target), len(header) + len(body),
+             100.0 * (len(header) + len(body)) / max(len(target), 1)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Compress a firmware image (lib/parttion_manager/lzss.h), heatshrink bit
+stream behind a 16-byte header.
+
+    mklzss.py app.bin app.lz --window-bits 11 --lookahead-bits 4
+
+The compressed image is stored in the image download partition with the
+DATA_COMPRESSED flag (0x80) or-ed into type.enc, and the MBR params
+size/checksum of the compressed image itself. Encrypt it after compression,
+use --align 16 for AES-CBC.
+"""
+import argparse
+import struct
+import zlib
+
+MAGIC = 0x31535A4C
+MATCH_MIN = 3        # shortest match found by the 3-byte key
+CHAIN_DEPTH = 32     # candidates compared for one match
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.bits = 0
+
+    def put(self, value, count):
+        self.acc = (self.acc << count) | (value & ((1 << count) - 1))
+        self.bits += count
+        while self.bits >= 8:
+            self.bits -= 8
+            self.out.append((self.acc >> self.bits) & 0xFF)
+        self.acc &= (1 << self.bits) - 1
+
+    def flush(self):
+        if self.bits:
+            self.put(0, 8 - self.bits)
+        return bytes(self.out)
+
+
+def compress(data, window_bits, lookahead_bits):
+    window = 1 << window_bits
+    lookahead = 1 << lookahead_bits
+    chains = {}
+    writer = BitWriter()
+    pos = 0
+    hashed = 0
+    while pos < len(data):
+        while hashed < pos and hashed + MATCH_MIN <= len(data):
+            chains.setdefault(data[hashed:hashed + MATCH_MIN], []).append(hashed)
+            hashed += 1
+        max_len = min(lookahead, len(data) - pos)
+        best, offset = 0, 0
+        if max_len >= MATCH_MIN:
+            candidates = chains.get(data[pos:pos + MATCH_MIN], [])
+            for cand in reversed(candidates[-CHAIN_DEPTH:]):
+                if pos - cand > window:
+                    break
+                if best and data[cand + best - 1] != data[pos + best - 1]:
+                    continue
+                n = MATCH_MIN
+                while n < max_len and data[cand + n] == data[pos + n]:
+                    n += 1
+                if n > best:
+                    best, offset = n, pos - cand
+                    if best == max_len:
+                        break
+        if best * 9 > 1 + window_bits + lookahead_bits:
+            writer.put(0, 1)
+            writer.put(offset - 1, window_bits)
+            writer.put(best - 1, lookahead_bits)
+            pos += best
+        else:
+            writer.put(1, 1)
+            writer.put(data[pos], 8)
+            pos += 1
+    return writer.flush()
+
+
+def decompress(stream, raw_size, window_bits, lookahead_bits):
+    out = bytearray()
+    acc, bits, index = 0, 0, 0
+
+    def get(count):
+        nonlocal acc, bits, index
+        while bits < count:
+            acc = (acc << 8) | stream[index]
+            index += 1
+            bits += 8
+        bits -= count
+        return (acc >> bits) & ((1 << count) - 1)
+
+    while len(out) < raw_size:
+        if get(1):
+            out.append(get(8))
+        else:
+            offset = get(window_bits) + 1
+            for _ in range(get(lookahead_bits) + 1):
+                out.append(out[-offset] if offset <= len(out) else 0)
+    return bytes(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("output")
+    parser.add_argument("--window-bits", type=int, default=11, choices=range(4, 13))
+    parser.add_argument("--lookahead-bits", type=int, default=4)
+    parser.add_argument("--align", type=int, default=1,
+                        help="pad the compressed image to a multiple of ALIGN bytes")
+    args = parser.parse_args()
+    if not 3 <= args.lookahead_bits < args.window_bits:
+        parser.error("lookahead bits must be 3..window_bits-1")
+
+    image = open(args.image, "rb").read()
+    stream = compress(image, args.window_bits, args.lookahead_bits)
+    if decompress(stream, len(image), args.window_bits, args.lookahead_bits) != image:
+        raise SystemExit("round trip failed")
+    header = struct.pack("<IIIBB2x", MAGIC, len(image), zlib.crc32(image),
+                         args.window_bits, args.lookahead_bits)
+    body = header + stream
+    body += bytes(-len(body) % args.align)
+    with open(args.output, "wb") as f:
+        f.write(body)
+    print("image %u, compressed %u (%.1f%%)"
+          % (len(image), len(body), 100.0 * len(body) / max(len(image), 1)))
+
+
+if __name__ == "__main__":
+    main()